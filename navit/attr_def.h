@@ -203,6 +203,22 @@ ATTR(nav_status)
 ATTR(virtual_dpi)
 ATTR(real_dpi)
 ATTR(underground_alpha)
+ATTR(route_graph_points)
+ATTR(route_graph_hash_size)
+ATTR(route_graph_lookups)
+ATTR(route_graph_probes)
+ATTR(route_graph_build_time)
+ATTR(route_graph_memory)
+ATTR(build_threads)
+ATTR(route_graph_cache_hits)
+ATTR(route_graph_cache_misses)
+ATTR(tile_cache_hits)
+ATTR(tile_cache_misses)
+ATTR(tile_prefetched)
+ATTR(tile_prefetch_hits)
+ATTR(prefetch_distance)
+ATTR(search_index_ref)
+ATTR(match_threads)
 ATTR2(0x00027500,type_rel_abs_begin)
 /* These attributes are int that can either hold relative or absolute values. See the
  * documentation of ATTR_REL_RELSHIFT for details.
@@ -264,6 +280,9 @@ ATTR(no_warning_if_map_file_missing)
 ATTR(duplicate)
 ATTR(has_menu_button)
 ATTR(oneway)
+ATTR(ch_routing)
+ATTR(graph_cache)
+ATTR(static_data) /* map data does not change while shown, the map may then also be read by worker threads */
 ATTR2(0x0002ffff,type_int_end)
 ATTR2(0x00030000,type_string_begin)
 ATTR(type)
@@ -4,12 +4,18 @@
 #endif
 #include <string.h>
 #include "debug.h"
+#include "thread.h"
 #include "cache.h"
 
+/** Maximum number of independently locked shards of a cache */
+#define CACHE_SHARDS 8
+/** A cache is only split into as many shards as leave each shard at least this many bytes */
+#define CACHE_SHARD_MIN_SIZE (256*1024)
+
 struct cache_entry {
     int usage;
     unsigned int size;
-    struct cache_entry_list *where;
+    struct cache_entry_list *where; /**< List holding the entry, NULL if it was inserted while an entry with the same id existed */
     struct cache_entry *next;
     struct cache_entry *prev;
     int id[0];
@@ -20,15 +26,31 @@ struct cache_entry_list {
     int size;
 };
 
-struct cache {
+/**
+ * @brief One independently locked part of a cache.
+ *
+ * Each shard is an ARC cache of its own, holding the ids that hash to it.
+ */
+struct cache_shard {
+    struct cache *cache;
+    struct thread_lock *lock;
     struct cache_entry_list t1,b1,t2,b2,*insert;
-    int size,id_size,entry_size;
+    int size;
     int t1_target;
     unsigned int misses;
     unsigned int hits;
+    unsigned int lookup_hits;
+    unsigned int lookup_misses;
+    unsigned int evictions;
     GHashTable *hash;
 };
 
+struct cache {
+    int size,id_size,entry_size;
+    int shard_count;
+    struct cache_shard shards[CACHE_SHARDS];
+};
+
 static void cache_entry_dump(struct cache *cache, struct cache_entry *entry) {
     int i,size;
     dbg(lvl_debug,"Usage: %d size %d",entry->usage, entry->size);
@@ -50,14 +72,31 @@ static void cache_list_dump(char *str, struct cache *cache, struct cache_entry_l
     }
 }
 
+/**
+ * @brief Hashes an id of `count` ints.
+ *
+ * FNV-1a over the ints followed by a final avalanche, so that all bits of the id
+ * affect both the shard and the bucket the id ends up in.
+ */
+static guint cache_hash_ints(const int *id, int count) {
+    guint hash=2166136261u;
+    int i;
+    for (i = 0 ; i < count ; i++)
+        hash=(hash ^ (guint)id[i])*16777619u;
+    hash^=hash >> 16;
+    hash*=0x85ebca6bu;
+    hash^=hash >> 13;
+    hash*=0xc2b2ae35u;
+    hash^=hash >> 16;
+    return hash;
+}
+
 static guint cache_hash4(gconstpointer key) {
-    int *id=(int *)key;
-    return id[0];
+    return cache_hash_ints(key, 1);
 }
 
 static guint cache_hash20(gconstpointer key) {
-    int *id=(int *)key;
-    return id[0]^id[1]^id[2]^id[3]^id[4];
+    return cache_hash_ints(key, 5);
 }
 
 static gboolean cache_equal4(gconstpointer a, gconstpointer b) {
@@ -78,33 +117,76 @@ static gboolean cache_equal20(gconstpointer a, gconstpointer b) {
            ida[4] == idb[4]);
 }
 
+static struct cache_shard *cache_shard(struct cache *cache, void *id) {
+    return &cache->shards[(cache_hash_ints(id, cache->id_size) >> 24) % cache->shard_count];
+}
+
+static struct cache_entry *cache_entry_from_data(struct cache *cache, void *data) {
+    return (struct cache_entry *)((char *)data-cache->entry_size);
+}
+
+static void cache_shard_resize(struct cache *cache) {
+    int i;
+    for (i = 0 ; i < cache->shard_count ; i++)
+        cache->shards[i].size=cache->size/cache->shard_count;
+}
+
+/**
+ * @brief Creates a new cache
+ *
+ * The cache is split into up to CACHE_SHARDS shards with their own lock and LRU lists, so it can
+ * be used from several threads. The byte budget `size` is split evenly between the shards.
+ *
+ * @param id_size Size of the ids in bytes, either 4 or 20
+ * @param size The byte budget of the cache
+ * @return The new cache, or NULL if `id_size` is not supported
+ */
 struct cache *
 cache_new(int id_size, int size) {
-    struct cache *cache=g_new0(struct cache, 1);
+    struct cache *cache;
+    GHashFunc hash_func;
+    GEqualFunc equal_func;
+    int i;
 
-    cache->id_size=id_size/4;
-    cache->entry_size=cache->id_size*sizeof(int)+sizeof(struct cache_entry);
-    cache->size=size;
     switch (id_size) {
     case 4:
-        cache->hash=g_hash_table_new(cache_hash4, cache_equal4);
+        hash_func=cache_hash4;
+        equal_func=cache_equal4;
         break;
     case 20:
-        cache->hash=g_hash_table_new(cache_hash20, cache_equal20);
+        hash_func=cache_hash20;
+        equal_func=cache_equal20;
         break;
     default:
         dbg(lvl_error,"cache with id_size of %d not supported", id_size);
-        g_free(cache);
-        cache=NULL;
+        return NULL;
+    }
+    cache=g_new0(struct cache, 1);
+    cache->id_size=id_size/4;
+    cache->entry_size=cache->id_size*sizeof(int)+sizeof(struct cache_entry);
+    cache->size=size;
+    cache->shard_count=MAX(1,MIN(CACHE_SHARDS,size/CACHE_SHARD_MIN_SIZE));
+    for (i = 0 ; i < cache->shard_count ; i++) {
+        cache->shards[i].cache=cache;
+        cache->shards[i].lock=thread_lock_new();
+        cache->shards[i].insert=&cache->shards[i].t1;
+        cache->shards[i].hash=g_hash_table_new(hash_func, equal_func);
     }
+    cache_shard_resize(cache);
     return cache;
 }
 
 void cache_resize(struct cache *cache, int size) {
+    int i;
+    for (i = 0 ; i < cache->shard_count ; i++)
+        thread_lock_acquire(cache->shards[i].lock);
     cache->size=size;
+    cache_shard_resize(cache);
+    for (i = 0 ; i < cache->shard_count ; i++)
+        thread_lock_release(cache->shards[i].lock);
 }
 
-static void cache_insert_mru(struct cache *cache, struct cache_entry_list *list, struct cache_entry *entry) {
+static void cache_insert_mru(struct cache_shard *shard, struct cache_entry_list *list, struct cache_entry *entry) {
     entry->prev=NULL;
     entry->next=list->first;
     entry->where=list;
@@ -114,8 +196,8 @@ static void cache_insert_mru(struct cache *cache, struct cache_entry_list *list,
     if (! list->last)
         list->last=entry;
     list->size+=entry->size;
-    if (cache)
-        g_hash_table_insert(cache->hash, (gpointer)entry->id, entry);
+    if (shard)
+        g_hash_table_insert(shard->hash, (gpointer)entry->id, entry);
 }
 
 static void cache_remove_from_list(struct cache_entry_list *list, struct cache_entry *entry) {
@@ -130,9 +212,9 @@ static void cache_remove_from_list(struct cache_entry_list *list, struct cache_e
     list->size-=entry->size;
 }
 
-static void cache_remove(struct cache *cache, struct cache_entry *entry) {
+static void cache_remove(struct cache_shard *shard, struct cache_entry *entry) {
     dbg(lvl_debug,"remove 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
-    g_hash_table_remove(cache->hash, (gpointer)(entry->id));
+    g_hash_table_remove(shard->hash, (gpointer)(entry->id));
     g_slice_free1(entry->size, entry);
 }
 
@@ -149,7 +231,7 @@ static struct cache_entry *cache_remove_lru_helper(struct cache_entry_list *list
     return last;
 }
 
-static struct cache_entry *cache_remove_lru(struct cache *cache, struct cache_entry_list *list) {
+static struct cache_entry *cache_remove_lru(struct cache_shard *shard, struct cache_entry_list *list) {
     struct cache_entry *last;
     int seen=0;
     while (list->last && list->last->usage && seen < list->size) {
@@ -162,8 +244,10 @@ static struct cache_entry *cache_remove_lru(struct cache *cache, struct cache_en
         return NULL;
     dbg(lvl_debug,"removing %d", last->id[0]);
     cache_remove_lru_helper(list);
-    if (cache) {
-        cache_remove(cache, last);
+    if (shard) {
+        if (list == &shard->t1 || list == &shard->t2)
+            shard->evictions++;
+        cache_remove(shard, last);
         return NULL;
     }
     return last;
@@ -172,7 +256,6 @@ static struct cache_entry *cache_remove_lru(struct cache *cache, struct cache_en
 void *cache_entry_new(struct cache *cache, void *id, int size) {
     struct cache_entry *ret;
     size+=cache->entry_size;
-    cache->misses+=size;
     ret=(struct cache_entry *)g_slice_alloc0(size);
     ret->size=size;
     ret->usage=1;
@@ -181,24 +264,30 @@ void *cache_entry_new(struct cache *cache, void *id, int size) {
 }
 
 void cache_entry_destroy(struct cache *cache, void *data) {
-    struct cache_entry *entry=(struct cache_entry *)((char *)data-cache->entry_size);
+    struct cache_entry *entry=cache_entry_from_data(cache, data);
+    struct cache_shard *shard=cache_shard(cache, entry->id);
     dbg(lvl_debug,"destroy 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
-    entry->usage--;
+    thread_lock_acquire(shard->lock);
+    if (!--entry->usage && !entry->where)
+        g_slice_free1(entry->size, entry);
+    thread_lock_release(shard->lock);
 }
 
-static struct cache_entry *cache_trim(struct cache *cache, struct cache_entry *entry) {
+static struct cache_entry *cache_trim(struct cache_shard *shard, struct cache_entry *entry) {
     struct cache_entry *new_entry;
+    int entry_size=shard->cache->entry_size;
     dbg(lvl_debug,"trim 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
-    dbg(lvl_debug,"Trim %x from %d -> %d", entry->id[0], entry->size, cache->size);
-    if ( cache->entry_size < entry->size ) {
-        g_hash_table_remove(cache->hash, (gpointer)(entry->id));
+    dbg(lvl_debug,"Trim %x from %d -> %d", entry->id[0], entry->size, shard->size);
+    shard->evictions++;
+    if ( entry_size < entry->size ) {
+        g_hash_table_remove(shard->hash, (gpointer)(entry->id));
 
-        new_entry = g_slice_alloc0(cache->entry_size);
-        memcpy(new_entry, entry, cache->entry_size);
+        new_entry = g_slice_alloc0(entry_size);
+        memcpy(new_entry, entry, entry_size);
         g_slice_free1( entry->size, entry);
-        new_entry->size = cache->entry_size;
+        new_entry->size = entry_size;
 
-        g_hash_table_insert(cache->hash, (gpointer)new_entry->id, new_entry);
+        g_hash_table_insert(shard->hash, (gpointer)new_entry->id, new_entry);
     } else {
         new_entry = entry;
     }
@@ -206,124 +295,154 @@ static struct cache_entry *cache_trim(struct cache *cache, struct cache_entry *e
     return new_entry;
 }
 
-static struct cache_entry *cache_move(struct cache *cache, struct cache_entry_list *old, struct cache_entry_list *new) {
+static struct cache_entry *cache_move(struct cache_shard *shard, struct cache_entry_list *old,
+                                      struct cache_entry_list *new) {
     struct cache_entry *entry;
     entry=cache_remove_lru(NULL, old);
     if (! entry)
         return NULL;
-    entry=cache_trim(cache, entry);
+    entry=cache_trim(shard, entry);
     cache_insert_mru(NULL, new, entry);
     return entry;
 }
 
-static int cache_replace(struct cache *cache) {
-    if (cache->t1.size >= MAX(1,cache->t1_target)) {
+static int cache_replace(struct cache_shard *shard) {
+    if (shard->t1.size >= MAX(1,shard->t1_target)) {
         dbg(lvl_debug,"replace 12");
-        if (!cache_move(cache, &cache->t1, &cache->b1))
-            cache_move(cache, &cache->t2, &cache->b2);
+        if (!cache_move(shard, &shard->t1, &shard->b1))
+            cache_move(shard, &shard->t2, &shard->b2);
     } else {
         dbg(lvl_debug,"replace t2");
-        if (!cache_move(cache, &cache->t2, &cache->b2))
-            cache_move(cache, &cache->t1, &cache->b1);
+        if (!cache_move(shard, &shard->t2, &shard->b2))
+            cache_move(shard, &shard->t1, &shard->b1);
     }
-#if 0
-    if (! entry) {
-        cache_dump(cache);
-        exit(0);
-    }
-#endif
     return 1;
 }
 
-void cache_flush(struct cache *cache, void *id) {
-    struct cache_entry *entry=g_hash_table_lookup(cache->hash, id);
-    if (entry) {
+static void cache_flush_entry(struct cache_shard *shard, struct cache_entry *entry) {
+    if (entry->where) {
         cache_remove_from_list(entry->where, entry);
-        cache_remove(cache, entry);
-    }
+        cache_remove(shard, entry);
+    } else
+        g_slice_free1(entry->size, entry);
+}
+
+void cache_flush(struct cache *cache, void *id) {
+    struct cache_shard *shard=cache_shard(cache, id);
+    struct cache_entry *entry;
+    thread_lock_acquire(shard->lock);
+    entry=g_hash_table_lookup(shard->hash, id);
+    if (entry)
+        cache_flush_entry(shard, entry);
+    thread_lock_release(shard->lock);
 }
 
 void cache_flush_data(struct cache *cache, void *data) {
-    struct cache_entry *entry=(struct cache_entry *)((char *)data-cache->entry_size);
-    if (entry) {
-        cache_remove_from_list(entry->where, entry);
-        cache_remove(cache, entry);
-    }
+    struct cache_entry *entry=cache_entry_from_data(cache, data);
+    struct cache_shard *shard=cache_shard(cache, entry->id);
+    thread_lock_acquire(shard->lock);
+    cache_flush_entry(shard, entry);
+    thread_lock_release(shard->lock);
 }
 
 
 void *cache_lookup(struct cache *cache, void *id) {
+    struct cache_shard *shard=cache_shard(cache, id);
     struct cache_entry *entry;
+    void *ret=NULL;
 
     dbg(lvl_debug,"get %d", ((int *)id)[0]);
-    entry=g_hash_table_lookup(cache->hash, id);
+    thread_lock_acquire(shard->lock);
+    entry=g_hash_table_lookup(shard->hash, id);
     if (entry == NULL) {
-        cache->insert=&cache->t1;
+        shard->insert=&shard->t1;
+        shard->lookup_misses++;
 #ifdef DEBUG_CACHE
         fprintf(stderr,"-");
 #endif
         dbg(lvl_debug,"not in cache");
-        return NULL;
-    }
-    dbg(lvl_debug,"found 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
-    if (entry->where == &cache->t1 || entry->where == &cache->t2) {
-        cache->hits+=entry->size;
+    } else if (entry->where == &shard->t1 || entry->where == &shard->t2) {
+        dbg(lvl_debug,"found 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
+        shard->hits+=entry->size;
+        shard->lookup_hits++;
 #ifdef DEBUG_CACHE
-        if (entry->where == &cache->t1)
+        if (entry->where == &shard->t1)
             fprintf(stderr,"h");
         else
             fprintf(stderr,"H");
 #endif
-        dbg(lvl_debug,"in cache %s", entry->where == &cache->t1 ? "T1" : "T2");
+        dbg(lvl_debug,"in cache %s", entry->where == &shard->t1 ? "T1" : "T2");
         cache_remove_from_list(entry->where, entry);
-        cache_insert_mru(NULL, &cache->t2, entry);
+        cache_insert_mru(NULL, &shard->t2, entry);
         entry->usage++;
-        return &entry->id[cache->id_size];
+        ret=&entry->id[cache->id_size];
     } else {
-        if (entry->where == &cache->b1) {
+        shard->lookup_misses++;
+        if (entry->where == &shard->b1) {
 #ifdef DEBUG_CACHE
             fprintf(stderr,"m");
 #endif
             dbg(lvl_debug,"in phantom cache B1");
-            cache->t1_target=MIN(cache->t1_target+MAX(cache->b2.size/cache->b1.size, 1),cache->size);
-            cache_remove_from_list(&cache->b1, entry);
-        } else if (entry->where == &cache->b2) {
+            shard->t1_target=MIN(shard->t1_target+MAX(shard->b2.size/shard->b1.size, 1),shard->size);
+            cache_remove_from_list(&shard->b1, entry);
+        } else if (entry->where == &shard->b2) {
 #ifdef DEBUG_CACHE
             fprintf(stderr,"M");
 #endif
             dbg(lvl_debug,"in phantom cache B2");
-            cache->t1_target=MAX(cache->t1_target-MAX(cache->b1.size/cache->b2.size, 1),0);
-            cache_remove_from_list(&cache->b2, entry);
+            shard->t1_target=MAX(shard->t1_target-MAX(shard->b1.size/shard->b2.size, 1),0);
+            cache_remove_from_list(&shard->b2, entry);
         } else {
             dbg(lvl_error,"**ERROR** invalid where");
         }
-        cache_replace(cache);
-        cache_remove(cache, entry);
-        cache->insert=&cache->t2;
-        return NULL;
+        cache_replace(shard);
+        cache_remove(shard, entry);
+        shard->insert=&shard->t2;
     }
+    thread_lock_release(shard->lock);
+    return ret;
 }
 
+/**
+ * @brief Inserts an entry created by cache_entry_new() into the cache
+ *
+ * If another thread inserted an entry with the same id since the preceding cache_lookup(), the
+ * entry is not added to the cache. It stays valid for the caller and is freed by cache_entry_destroy().
+ *
+ * @param cache The cache
+ * @param data The data of the entry, as returned by cache_entry_new()
+ */
 void cache_insert(struct cache *cache, void *data) {
-    struct cache_entry *entry=(struct cache_entry *)((char *)data-cache->entry_size);
+    struct cache_entry *entry=cache_entry_from_data(cache, data);
+    struct cache_shard *shard=cache_shard(cache, entry->id);
     dbg(lvl_debug,"insert 0x%x 0x%x 0x%x 0x%x 0x%x", entry->id[0], entry->id[1], entry->id[2], entry->id[3], entry->id[4]);
-    if (cache->insert == &cache->t1) {
-        if (cache->t1.size + cache->b1.size >= cache->size) {
-            if (cache->t1.size < cache->size) {
-                cache_remove_lru(cache, &cache->b1);
-                cache_replace(cache);
+    thread_lock_acquire(shard->lock);
+    shard->misses+=entry->size;
+    if (g_hash_table_lookup(shard->hash, entry->id)) {
+        entry->where=NULL;
+        thread_lock_release(shard->lock);
+        return;
+    }
+    if (shard->insert == &shard->t1) {
+        if (shard->t1.size + shard->b1.size >= shard->size) {
+            if (shard->t1.size < shard->size) {
+                cache_remove_lru(shard, &shard->b1);
+                cache_replace(shard);
             } else {
-                cache_remove_lru(cache, &cache->t1);
+                cache_remove_lru(shard, &shard->t1);
             }
         } else {
-            if (cache->t1.size + cache->t2.size + cache->b1.size + cache->b2.size >= cache->size) {
-                if (cache->t1.size + cache->t2.size + cache->b1.size + cache->b2.size >= 2*cache->size)
-                    cache_remove_lru(cache, &cache->b2);
-                cache_replace(cache);
+            if (shard->t1.size + shard->t2.size + shard->b1.size + shard->b2.size >= shard->size) {
+                if (shard->t1.size + shard->t2.size + shard->b1.size + shard->b2.size >= 2*shard->size)
+                    cache_remove_lru(shard, &shard->b2);
+                cache_replace(shard);
             }
         }
     }
-    cache_insert_mru(cache, cache->insert, entry);
+    cache_insert_mru(shard, shard->insert, entry);
+    /* The hint set by cache_lookup() applies to one insertion only */
+    shard->insert=&shard->t1;
+    thread_lock_release(shard->lock);
 }
 
 void *cache_insert_new(struct cache *cache, void *id, int size) {
@@ -332,20 +451,49 @@ void *cache_insert_new(struct cache *cache, void *id, int size) {
     return data;
 }
 
-static void cache_stats(struct cache *cache) {
-    dbg(lvl_debug,"hits %d misses %d hitratio %d size %d entry_size %d id_size %d T1 target %d", cache->hits, cache->misses,
-        cache->hits*100/(cache->hits+cache->misses), cache->size, cache->entry_size, cache->id_size, cache->t1_target);
-    dbg(lvl_debug,"T1:%d B1:%d T2:%d B2:%d", cache->t1.size, cache->b1.size, cache->t2.size, cache->b2.size);
-    cache->hits=0;
-    cache->misses=0;
+/**
+ * @brief Returns the statistics of a cache, summed over all shards
+ *
+ * @param cache The cache
+ * @param hits Returns the number of lookups that found their data in the cache
+ * @param misses Returns the number of lookups that did not
+ * @param evictions Returns the number of entries whose data was dropped to stay within the byte budget
+ */
+void cache_get_stats(struct cache *cache, unsigned int *hits, unsigned int *misses, unsigned int *evictions) {
+    int i;
+    *hits=*misses=*evictions=0;
+    for (i = 0 ; i < cache->shard_count ; i++) {
+        struct cache_shard *shard=&cache->shards[i];
+        thread_lock_acquire(shard->lock);
+        *hits+=shard->lookup_hits;
+        *misses+=shard->lookup_misses;
+        *evictions+=shard->evictions;
+        thread_lock_release(shard->lock);
+    }
+}
+
+static void cache_stats(struct cache_shard *shard) {
+    struct cache *cache=shard->cache;
+    dbg(lvl_debug,"hits %d misses %d hitratio %d size %d entry_size %d id_size %d T1 target %d", shard->hits, shard->misses,
+        shard->hits+shard->misses ? shard->hits*100/(shard->hits+shard->misses) : 0, shard->size, cache->entry_size,
+        cache->id_size, shard->t1_target);
+    dbg(lvl_debug,"T1:%d B1:%d T2:%d B2:%d", shard->t1.size, shard->b1.size, shard->t2.size, shard->b2.size);
+    shard->hits=0;
+    shard->misses=0;
 }
 
 void cache_dump(struct cache *cache) {
-    cache_stats(cache);
-    cache_list_dump("T1", cache, &cache->t1);
-    cache_list_dump("B1", cache, &cache->b1);
-    cache_list_dump("T2", cache, &cache->t2);
-    cache_list_dump("B2", cache, &cache->b2);
+    int i;
+    for (i = 0 ; i < cache->shard_count ; i++) {
+        struct cache_shard *shard=&cache->shards[i];
+        thread_lock_acquire(shard->lock);
+        dbg(lvl_debug,"shard %d",i);
+        cache_stats(shard);
+        cache_list_dump("T1", cache, &shard->t1);
+        cache_list_dump("B1", cache, &shard->b1);
+        cache_list_dump("T2", cache, &shard->t2);
+        cache_list_dump("B2", cache, &shard->b2);
+        thread_lock_release(shard->lock);
+    }
     dbg(lvl_debug,"dump end");
 }
-
@@ -11,4 +11,5 @@ void *cache_insert_new(struct cache *cache, void *id, int size);
 void cache_flush(struct cache *cache, void *id);
 void cache_dump(struct cache *cache);
 void cache_flush_data(struct cache *cache, void *data);
+void cache_get_stats(struct cache *cache, unsigned int *hits, unsigned int *misses, unsigned int *evictions);
 /* end of prototypes */
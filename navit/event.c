@@ -106,6 +106,15 @@ void event_call_callback(struct callback_list *cb) {
     event_methods.call_callback(cb);
 }
 
+/**
+ * @brief Whether the event system can call a callback list on the main loop on behalf of another thread
+ *
+ * @return True if `event_call_callback()` is implemented by the current event system
+ */
+int event_call_callback_supported(void) {
+    return event_methods.call_callback != NULL;
+}
+
 char const *event_system(void) {
     return e_system;
 }
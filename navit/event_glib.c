@@ -136,14 +136,20 @@ static void event_glib_remove_idle(struct event_idle *ev) {
     g_free(ev);
 }
 
+static gboolean event_glib_call_callback_idle(gpointer data) {
+    callback_list_call_0(data);
+    return FALSE;
+}
+
+/**
+ * @brief Calls a callback list on the main loop
+ *
+ * This may be called from any thread, as adding a source to the default main context is thread-safe in GLib.
+ *
+ * @param cb The callback list
+ */
 static void event_glib_call_callback(struct callback_list *cb) {
-    /*
-     Idea for implementation:
-     Create a pipe then use add_watch
-     add callback to a queue
-     from here write to the pipe to wakeup the pool
-     then from the gui thread process the callback queue
-    */
+    g_idle_add(event_glib_call_callback_idle, cb);
 }
 
 static struct event_methods event_glib_methods = {
@@ -31,6 +31,7 @@
 #include <wordexp.h>
 #include <glib.h>
 #include <zlib.h>
+#include <errno.h>
 #include "debug.h"
 #include "cache.h"
 #include "file.h"
@@ -38,6 +39,7 @@
 #include "item.h"
 #include "util.h"
 #include "types.h"
+#include "thread.h"
 #include "zipfile.h"
 #ifdef HAVE_SOCKET
 #include <sys/socket.h>
@@ -50,6 +52,24 @@ static GHashTable *file_name_hash;
 
 static struct cache *file_cache;
 
+/** Serializes file positions on systems without pread(), so that maps can be read from several threads */
+static struct thread_lock *file_lock;
+
+/**
+ * @brief Per-thread state for reading compressed data
+ *
+ * Holds the compressed input of file_data_read_compressed() and an inflate stream, so that
+ * reading a tile does not allocate anything besides the uncompressed result.
+ */
+struct file_scratch {
+    z_stream stream;        /**< Raw inflate stream, reset for every use */
+    int stream_valid;       /**< Whether `stream` has been initialized */
+    int size;               /**< Size of `buffer` */
+    unsigned char *buffer;  /**< Compressed input */
+};
+
+static struct thread_local *file_scratch;
+
 #ifdef HAVE_PRAGMA_PACK
 #pragma pack(push)
 #pragma pack(1)
@@ -316,6 +336,36 @@ int file_mmap(struct file *file) {
     return 1;
 }
 
+/**
+ * @brief Reads `size` bytes at `offset` without moving the shared file position
+ *
+ * @return 1 if all bytes were read, 0 otherwise
+ */
+static int file_read_at(struct file *file, void *buffer, long long offset, int size) {
+#ifdef HAVE_PREAD
+    unsigned char *pos=buffer;
+    ssize_t rd;
+    while (size > 0) {
+        rd=pread(file->fd, pos, size, offset);
+        if (rd < 0 && errno == EINTR)
+            continue;
+        if (rd <= 0)
+            return 0;
+        pos+=rd;
+        offset+=rd;
+        size-=rd;
+    }
+    return 1;
+#else
+    int ret;
+    thread_lock_acquire(file_lock);
+    lseek(file->fd, offset, SEEK_SET);
+    ret=(read(file->fd, buffer, size) == size);
+    thread_lock_release(file_lock);
+    return ret;
+#endif
+}
+
 unsigned char *file_data_read(struct file *file, long long offset, int size) {
     void *ret;
     if (file->special)
@@ -327,16 +377,50 @@ unsigned char *file_data_read(struct file *file, long long offset, int size) {
         ret=cache_lookup(file_cache,&id);
         if (ret)
             return ret;
-        ret=cache_insert_new(file_cache,&id,size);
-    } else
-        ret=g_malloc(size);
-    lseek(file->fd, offset, SEEK_SET);
-    if (read(file->fd, ret, size) != size) {
-        file_data_free(file, ret);
+        ret=cache_entry_new(file_cache,&id,size);
+        if (!file_read_at(file, ret, offset, size)) {
+            cache_entry_destroy(file_cache, ret);
+            return NULL;
+        }
+        /* Only insert filled entries, so that other threads never see partial data */
+        cache_insert(file_cache, ret);
+        return ret;
+    }
+    ret=g_malloc(size);
+    if (!file_read_at(file, ret, offset, size)) {
+        g_free(ret);
         ret=NULL;
     }
     return ret;
+}
 
+/**
+ * @brief Hints the operating system that a range of the file will be read soon
+ *
+ * Uses madvise() for memory mapped files and posix_fadvise() otherwise, so the data can be read
+ * ahead while the caller is busy with other data. Does nothing where neither is available.
+ *
+ * @param file The file
+ * @param offset Start of the range
+ * @param size Size of the range in bytes
+ */
+void file_data_prefetch(struct file *file, long long offset, int size) {
+    if (file->special || size <= 0)
+        return;
+    if (file->begin) {
+#ifdef HAVE_MADVISE
+        long page_size=sysconf(_SC_PAGESIZE);
+        long long start=offset & ~((long long)page_size-1);
+        if (offset+size > file->size)
+            size=file->size-offset;
+        if (size > 0)
+            madvise(file->begin+start, offset+size-start, MADV_WILLNEED);
+#endif
+    } else {
+#ifdef HAVE_POSIX_FADVISE
+        posix_fadvise(file->fd, offset, size, POSIX_FADV_WILLNEED);
+#endif
+    }
 }
 
 static void file_process_headers(struct file *file, unsigned char *headers) {
@@ -459,62 +543,89 @@ int file_get_contents(char *name, unsigned char **buffer, int *size) {
 }
 
 
-static int uncompress_int(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLen) {
-    z_stream stream;
-    int err;
+static void file_scratch_destroy(void *data) {
+    struct file_scratch *scratch=data;
+    if (scratch->stream_valid)
+        inflateEnd(&scratch->stream);
+    g_free(scratch->buffer);
+    g_free(scratch);
+}
 
-    stream.next_in = (Bytef*)source;
-    stream.avail_in = (uInt)sourceLen;
-    stream.next_out = dest;
-    stream.avail_out = (uInt)*destLen;
+/**
+ * @brief Returns the scratch state of the calling thread, with room for `size` bytes of input
+ */
+static struct file_scratch *file_scratch_get(int size) {
+    struct file_scratch *scratch=thread_local_get(file_scratch);
+    if (!scratch) {
+        scratch=g_new0(struct file_scratch, 1);
+        thread_local_set(file_scratch, scratch);
+    }
+    if (scratch->size < size) {
+        g_free(scratch->buffer);
+        /* Round up, so that a few large tiles don't cause a reallocation each */
+        scratch->size=(size+0xffff) & ~0xffff;
+        scratch->buffer=g_malloc(scratch->size);
+    }
+    return scratch;
+}
 
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
+static int uncompress_int(struct file_scratch *scratch, Bytef *dest, uLongf *destLen, const Bytef *source,
+                          uLong sourceLen) {
+    z_stream *stream=&scratch->stream;
+    int err;
 
-    err = inflateInit2(&stream, -MAX_WBITS);
+    if (scratch->stream_valid) {
+        err = inflateReset(stream);
+    } else {
+        stream->zalloc = (alloc_func)0;
+        stream->zfree = (free_func)0;
+        stream->next_in = Z_NULL;
+        stream->avail_in = 0;
+        err = inflateInit2(stream, -MAX_WBITS);
+        scratch->stream_valid = (err == Z_OK);
+    }
     if (err != Z_OK) return err;
 
-    err = inflate(&stream, Z_FINISH);
+    stream->next_in = (Bytef*)source;
+    stream->avail_in = (uInt)sourceLen;
+    stream->next_out = dest;
+    stream->avail_out = (uInt)*destLen;
+
+    err = inflate(stream, Z_FINISH);
     if (err != Z_STREAM_END) {
-        inflateEnd(&stream);
-        if (err == Z_NEED_DICT || (err == Z_BUF_ERROR && stream.avail_in == 0))
+        if (err == Z_NEED_DICT || (err == Z_BUF_ERROR && stream->avail_in == 0))
             return Z_DATA_ERROR;
         return err;
     }
-    *destLen = stream.total_out;
-
-    err = inflateEnd(&stream);
-    return err;
+    *destLen = stream->total_out;
+    return Z_OK;
 }
 
 unsigned char *file_data_read_compressed(struct file *file, long long offset, int size, int size_uncomp) {
     void *ret;
-    char *buffer = 0;
+    struct file_scratch *scratch;
+    struct file_cache_id id= {offset,size,file->name_id,1};
     uLongf destLen=size_uncomp;
 
     if (file->cache) {
-        struct file_cache_id id= {offset,size,file->name_id,1};
         ret=cache_lookup(file_cache,&id);
         if (ret)
             return ret;
-        ret=cache_insert_new(file_cache,&id,size_uncomp);
+        ret=cache_entry_new(file_cache,&id,size_uncomp);
     } else
         ret=g_malloc(size_uncomp);
-    lseek(file->fd, offset, SEEK_SET);
-
-    buffer = (char *)g_malloc(size);
-    if (read(file->fd, buffer, size) != size) {
-        g_free(ret);
-        ret=NULL;
-    } else {
-        if (uncompress_int(ret, &destLen, (Bytef *)buffer, size) != Z_OK) {
-            dbg(lvl_error,"uncompress failed");
-            g_free(ret);
-            ret=NULL;
-        }
+    scratch=file_scratch_get(size);
+    if (!file_read_at(file, scratch->buffer, offset, size)) {
+        file_data_free(file, ret);
+        return NULL;
     }
-    g_free(buffer);
-
+    if (uncompress_int(scratch, ret, &destLen, scratch->buffer, size) != Z_OK) {
+        dbg(lvl_error,"uncompress failed");
+        file_data_free(file, ret);
+        return NULL;
+    }
+    if (file->cache)
+        cache_insert(file_cache, ret);
     return ret;
 }
 
@@ -759,7 +870,26 @@ int file_set_cache_size(int cache_size) {
 #endif
 }
 
+/**
+ * @brief Returns the statistics of the cache for data read from files
+ *
+ * @param hits Returns the number of reads served from the cache
+ * @param misses Returns the number of reads that had to go to the file
+ * @param evictions Returns the number of cached blocks dropped to stay within the cache size
+ * @return 1 if the statistics are available, 0 if navit was built without cache
+ */
+int file_get_cache_stats(unsigned int *hits, unsigned int *misses, unsigned int *evictions) {
+#ifdef CACHE_SIZE
+    cache_get_stats(file_cache, hits, misses, evictions);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 void file_init(void) {
+    file_lock=thread_lock_new();
+    file_scratch=thread_local_new(file_scratch_destroy);
 #ifdef CACHE_SIZE
     file_name_hash=g_hash_table_new(g_str_hash, g_str_equal);
     file_cache=cache_new(sizeof(struct file_cache_id), CACHE_SIZE);
@@ -71,6 +71,7 @@ long long file_size(struct file *file);
 int file_mkdir(char *name, int pflag);
 int file_mmap(struct file *file);
 unsigned char *file_data_read(struct file *file, long long offset, int size);
+void file_data_prefetch(struct file *file, long long offset, int size);
 unsigned char *file_data_read_special(struct file *file, int size, int *size_ret);
 unsigned char *file_data_read_all(struct file *file);
 void file_data_flush(struct file *file, long long offset, int size);
@@ -95,6 +96,7 @@ int file_get_param(struct file *file, struct param_list *param, int count);
 int file_version(struct file *file, int byname);
 void *file_get_os_handle(struct file *file);
 int file_set_cache_size(int cache_size);
+int file_get_cache_stats(unsigned int *hits, unsigned int *misses, unsigned int *evictions);
 void file_init(void);
 void file_data_remove(struct file *file, unsigned char *data);
 /* end of prototypes */
@@ -52,6 +52,7 @@
 #include "file.h"
 #include "event.h"
 #include "navit.h"
+#include "thread.h"
 
 /**
  * @brief maximum amount of coordinates to allocate on stack using g_alloca
@@ -134,8 +135,40 @@ struct displaylist {
     struct event_idle *idle_ev;
     unsigned int seq;
     struct hash_entry hash_entries[HASH_SIZE];
+    int map_static;                         /**< Whether the current map `m` has static data */
+    GHashTable *static_items;               /**< Displayitems from maps with static data, keyed by map and item id */
+    struct map_selection *sel_loaded;       /**< The area for which the items of maps with static data are loaded,
+                                                 in the projection `pro_loaded`, NULL if not known */
+    struct map_selection *sel_pending;      /**< The area being loaded, becomes `sel_loaded` once done */
+    struct map_selection *sel_exposed;      /**< The part of `sel_pending` not in `sel_loaded`, if `incremental` */
+    int incremental;                        /**< Whether only `sel_exposed` is loaded from maps with static data */
+    struct mapset *ms_loaded;               /**< The mapset used for `sel_loaded` */
+    struct layout *layout_loaded;           /**< The layout used for `sel_loaded` */
+    int order_loaded;                       /**< The order used for `sel_loaded` */
+    enum projection pro_loaded;             /**< The projection of `sel_loaded` */
+    int maps_done;                          /**< Whether all maps of the mapset have been processed */
+    struct thread *worker;                  /**< Thread loading the maps with static data, NULL if none */
+    struct thread_lock *worker_lock;        /**< Protects `worker_items`, `worker_cancel` and `worker_done` */
+    GList *worker_jobs;                     /**< The maps for `worker` to load, as struct displaylist_job */
+    enum projection worker_pro;             /**< The projection to convert the items of `worker` to */
+    int worker_cancel;                      /**< Set to stop `worker` early */
+    int worker_done;                        /**< Set by `worker` when it has finished */
+    struct displayitem *worker_items;       /**< Items loaded by `worker` not yet added to the displaylist */
+    struct displayitem *worker_items_last;  /**< The last item of `worker_items` */
+    struct event_timeout *worker_ev;        /**< Polls `worker` once there is nothing left to do on the main thread */
 };
 
+/**
+ * @brief A map to be loaded by the worker thread of a displaylist
+ */
+struct displaylist_job {
+    struct map *m;                          /**< The map, referenced while the job exists */
+    struct map_selection *sel;              /**< The selection to load, in the projection of the map */
+};
+
+/** Number of items the worker thread of a displaylist hands over at once */
+#define DISPLAYLIST_BATCH 256
+
 
 struct displaylist_icon_cache {
     unsigned int seq;
@@ -145,6 +178,7 @@ struct displaylist_icon_cache {
 static void circle_to_points(const struct point *center, int diameter, int scale, int start, int len, struct point *res,
                              int *pos, int dir);
 static void graphics_process_selection(struct graphics *gra, struct displaylist *dl);
+static void displaylist_worker_stop(struct displaylist *dl, int cancel);
 static void graphics_gc_init(struct graphics *this_);
 
 
@@ -1453,6 +1487,9 @@ struct displayitem {
 */
 static void xdisplay_free(struct displaylist *dl) {
     int i;
+    g_hash_table_remove_all(dl->static_items);
+    map_selection_destroy(dl->sel_loaded);
+    dl->sel_loaded=NULL;
     for (i = 0 ; i < HASH_SIZE ; i++) {
         struct displayitem *di=dl->hash_entries[i].di;
         while (di) {
@@ -1493,14 +1530,37 @@ static inline struct displayitem_poly_holes *  display_add_holes(struct item *it
     return holes;
 }
 
+static guint displayitem_hash(gconstpointer key) {
+    const struct displayitem *di=key;
+    return GPOINTER_TO_UINT(di->item.map) ^ (di->item.id_hi*2654435761U) ^ di->item.id_lo;
+}
+
+static gboolean displayitem_equal(gconstpointer a, gconstpointer b) {
+    const struct displayitem *dia=a;
+    const struct displayitem *dib=b;
+    return dia->item.map == dib->item.map && dia->item.id_hi == dib->item.id_hi && dia->item.id_lo == dib->item.id_lo
+           && dia->item.type == dib->item.type;
+}
+
+/**
+ * @brief Checks if a displayitem is kept in the displaylist for an incremental update
+ *
+ * @param dl The displaylist
+ * @param di The displayitem
+ * @returns True if the displayitem belongs to a map with static data
+ */
+static int displayitem_is_static(struct displaylist *dl, struct displayitem *di) {
+    return g_hash_table_lookup(dl->static_items, di) == di;
+}
+
 /**
  * FIXME
  * @param <>
  * @returns <>
  * @author Martin Schaller (04/2008)
 */
-static void display_add(struct hash_entry *entry, struct item *item, int count, struct coord *c, char **label,
-                        int label_count) {
+static struct displayitem *displayitem_new(struct item *item, int count, struct coord *c, char **label,
+        int label_count) {
     struct displayitem *di;
     int len,i;
     char *p;
@@ -1563,6 +1623,55 @@ static void display_add(struct hash_entry *entry, struct item *item, int count,
         di->label=NULL;
     di->count=count;
     memcpy(di->c, c, count*sizeof(*c));
+    di->next=NULL;
+    return di;
+}
+
+/**
+ * @brief Creates a displayitem for an item, with its label and icon
+ *
+ * @param m The map of the item
+ * @param conv Whether the strings of the map need to be converted
+ * @param item The item
+ * @param count The number of coordinates
+ * @param c The coordinates, already converted to the projection of the displaylist
+ * @returns The new displayitem
+ */
+static struct displayitem *displayitem_new_from_item(struct map *m, int conv, struct item *item, int count,
+        struct coord *c) {
+    struct displayitem *di;
+    struct attr attr,attr2;
+    int label_count=0;
+    char *labels[2];
+
+    if (item_is_custom_poi(*item)) {
+        if (item_attr_get(item, attr_icon_src, &attr2))
+            labels[1]=map_convert_string(m, attr2.u.str);
+        else
+            labels[1]=NULL;
+        label_count=2;
+    } else {
+        labels[1]=NULL;
+        label_count=0;
+    }
+    if (item_attr_get(item, attr_label, &attr)) {
+        labels[0]=attr.u.str;
+        if (!label_count)
+            label_count=2;
+    } else
+        labels[0]=NULL;
+    if (conv && label_count) {
+        labels[0]=map_convert_string(m, labels[0]);
+        di=displayitem_new(item, count, c, labels, label_count);
+        map_convert_free(labels[0]);
+    } else
+        di=displayitem_new(item, count, c, labels, label_count);
+    if (labels[1])
+        map_convert_free(labels[1]);
+    return di;
+}
+
+static void display_add(struct hash_entry *entry, struct displayitem *di) {
     di->next=entry->di;
     entry->di=di;
 }
@@ -3193,14 +3302,409 @@ GList *displaylist_get_clicked_list(struct displaylist *displaylist, struct poin
 
 
 
+/**
+ * @brief Appends a rectangle to a list of selections
+ *
+ * @param sel The list to append to
+ * @param tmpl The selection to take the order and item range from
+ * @returns The new list
+ */
+static struct map_selection *displaylist_selection_add(struct map_selection *sel, struct map_selection *tmpl,
+        int lux, int luy, int rlx, int rly) {
+    struct map_selection *ret=g_new(struct map_selection, 1);
+    *ret=*tmpl;
+    ret->u.c_rect.lu.x=lux;
+    ret->u.c_rect.lu.y=luy;
+    ret->u.c_rect.rl.x=rlx;
+    ret->u.c_rect.rl.y=rly;
+    ret->next=sel;
+    return ret;
+}
+
+/**
+ * @brief Returns the part of a selection which is not covered by another one
+ *
+ * Each rectangle of `sel` is split into up to four rectangles around each rectangle of `covered` it overlaps.
+ * The results may share their edges with `covered`.
+ *
+ * @param sel The selection
+ * @param covered The area to remove from `sel`
+ * @returns The remaining selection, NULL if `covered` covers all of `sel`
+ */
+static struct map_selection *displaylist_selection_subtract(struct map_selection *sel, struct map_selection *covered) {
+    struct map_selection *ret=map_selection_dup(sel),*curr,*next;
+
+    for ( ; covered ; covered=covered->next) {
+        struct coord_rect *cr=&covered->u.c_rect;
+        curr=ret;
+        ret=NULL;
+        for ( ; curr ; curr=next) {
+            struct coord_rect *r=&curr->u.c_rect;
+            int top,bottom;
+            next=curr->next;
+            if (r->lu.x > cr->rl.x || r->rl.x < cr->lu.x || r->lu.y < cr->rl.y || r->rl.y > cr->lu.y) {
+                curr->next=ret;
+                ret=curr;
+                continue;
+            }
+            top=MIN(r->lu.y, cr->lu.y);
+            bottom=MAX(r->rl.y, cr->rl.y);
+            if (r->lu.y > cr->lu.y)
+                ret=displaylist_selection_add(ret, curr, r->lu.x, r->lu.y, r->rl.x, cr->lu.y);
+            if (r->rl.y < cr->rl.y)
+                ret=displaylist_selection_add(ret, curr, r->lu.x, cr->rl.y, r->rl.x, r->rl.y);
+            if (r->lu.x < cr->lu.x)
+                ret=displaylist_selection_add(ret, curr, r->lu.x, top, cr->lu.x, bottom);
+            if (r->rl.x > cr->rl.x)
+                ret=displaylist_selection_add(ret, curr, cr->rl.x, top, r->rl.x, bottom);
+            g_free(curr);
+        }
+    }
+    return ret;
+}
+
+static int displayitem_in_selection(struct displayitem *di, struct map_selection *sel) {
+    struct coord_rect r;
+    int i;
+
+    r.lu=r.rl=di->c[0];
+    for (i = 1 ; i < di->count ; i++)
+        coord_rect_extend(&r, &di->c[i]);
+    return map_selection_contains_rect(sel, &r);
+}
+
+/**
+ * @brief Removes all displayitems which cannot be reused for an incremental update
+ *
+ * These are the items of maps without static data, items of maps which are no longer active and items
+ * outside of the new selection.
+ *
+ * @param dl The displaylist
+ * @param sel The new selection
+ */
+static void displaylist_prune(struct displaylist *dl, struct map_selection *sel) {
+    GHashTable *maps=g_hash_table_new(g_direct_hash, g_direct_equal);
+    struct mapset_handle *msh=mapset_open(dl->ms);
+    struct displayitem *di,**prev;
+    struct map *m;
+    int i,removed=0,kept=0;
+
+    while ((m=mapset_next(msh, 1)))
+        g_hash_table_insert(maps, m, m);
+    mapset_close(msh);
+    for (i = 0 ; i < HASH_SIZE ; i++) {
+        prev=&dl->hash_entries[i].di;
+        while ((di=*prev)) {
+            int is_static=displayitem_is_static(dl, di);
+            if (is_static && g_hash_table_lookup(maps, di->item.map) && displayitem_in_selection(di, sel)) {
+                prev=&di->next;
+                kept++;
+                continue;
+            }
+            *prev=di->next;
+            if (is_static)
+                g_hash_table_remove(dl->static_items, di);
+            g_free(di);
+            removed++;
+        }
+    }
+    g_hash_table_destroy(maps);
+    dbg(lvl_debug,"kept %d items, removed %d", kept, removed);
+}
+
+/**
+ * @brief Prepares the displaylist for loading the items shown by a transformation
+ *
+ * If only the visible area changed since the last complete load, the displaylist is updated incrementally:
+ * items of maps with static data which are still visible are kept, and only the newly exposed area is loaded
+ * from these maps. As the displayitems hold map coordinates, which are only transformed to the screen when
+ * drawing, they stay valid if just the center, yaw or pitch change. Otherwise all items are dropped.
+ *
+ * @param dl The displaylist, with the new mapset, layout and order set
+ * @param trans The transformation
+ */
+static void displaylist_load_prepare(struct displaylist *dl, struct transformation *trans) {
+    enum projection pro=transform_get_projection(trans);
+    struct map_selection *sel=transform_get_selection(trans, pro, dl->order);
+
+    map_selection_destroy(dl->sel_exposed);
+    dl->sel_exposed=NULL;
+    map_selection_destroy(dl->sel_pending);
+    dl->sel_pending=sel;
+    dl->incremental=0;
+    if (dl->sel_loaded && !route_selection && dl->ms == dl->ms_loaded && dl->layout == dl->layout_loaded
+            && dl->order == dl->order_loaded && pro == dl->pro_loaded) {
+        displaylist_prune(dl, sel);
+        dl->sel_exposed=displaylist_selection_subtract(sel, dl->sel_loaded);
+        dl->incremental=1;
+        map_selection_destroy(dl->sel_loaded);
+        dl->sel_loaded=NULL;
+    } else
+        xdisplay_free(dl);
+    dl->ms_loaded=dl->ms;
+    dl->layout_loaded=dl->layout;
+    dl->order_loaded=dl->order;
+    dl->pro_loaded=pro;
+}
+
+/**
+ * @brief Remembers the area loaded after all maps have been processed
+ *
+ * @param dl The displaylist
+ * @param cancel Whether the load was cancelled, in which case the next load starts from scratch
+ */
+static void displaylist_load_done(struct displaylist *dl, int cancel) {
+    map_selection_destroy(dl->sel_loaded);
+    dl->sel_loaded=cancel ? NULL : dl->sel_pending;
+    if (cancel)
+        map_selection_destroy(dl->sel_pending);
+    dl->sel_pending=NULL;
+    map_selection_destroy(dl->sel_exposed);
+    dl->sel_exposed=NULL;
+    dl->incremental=0;
+}
+
+static void displaylist_check_hash(struct displaylist *displaylist) {
+    if (displaylist->order != displaylist->order_hashed || displaylist->layout != displaylist->layout_hashed) {
+        displaylist_update_hash(displaylist);
+        displaylist->order_hashed=displaylist->order;
+        displaylist->layout_hashed=displaylist->layout;
+    }
+}
+
+static void displaylist_worker_push(struct displaylist *dl, struct displayitem *first, struct displayitem *last) {
+    thread_lock_acquire(dl->worker_lock);
+    if (dl->worker_items_last)
+        dl->worker_items_last->next=first;
+    else
+        dl->worker_items=first;
+    dl->worker_items_last=last;
+    thread_lock_release(dl->worker_lock);
+}
+
+static int displaylist_worker_cancelled(struct displaylist *dl) {
+    int ret;
+    thread_lock_acquire(dl->worker_lock);
+    ret=dl->worker_cancel;
+    thread_lock_release(dl->worker_lock);
+    return ret;
+}
+
+/**
+ * @brief Main function of the worker thread of a displaylist
+ *
+ * Loads the items of the maps in `worker_jobs`, converts their coordinates and hands them over to the main
+ * thread in batches through `worker_items`. Only maps with static data are loaded here, as `attr_static_data`
+ * also promises that the map driver can be used from other threads. The layout hash of the displaylist is
+ * only read.
+ *
+ * @param data The displaylist
+ * @returns 0
+ */
+static int displaylist_worker_main(void *data) {
+    struct displaylist *dl=data;
+    int max=ALLOCA_COORD_LIMIT,count,batch=0;
+    struct coord *ca=g_new(struct coord, max);
+    struct displayitem *first=NULL,*last=NULL,*di;
+    GList *l;
+
+    for (l = dl->worker_jobs ; l && !displaylist_worker_cancelled(dl) ; l=g_list_next(l)) {
+        struct displaylist_job *job=l->data;
+        enum projection pro=map_projection(job->m);
+        int conv=map_requires_conversion(job->m);
+        struct map_rect *mr=map_rect_new(job->m, job->sel);
+        struct item *item;
+
+        if (!mr)
+            continue;
+        while (!displaylist_worker_cancelled(dl) && (item=map_rect_get_item(mr))) {
+            if (item == &busy_item || !get_hash_entry(dl, item->type))
+                continue;
+            count=item_coord_get_within_selection(item, ca, item->type < type_line ? 1: max, job->sel);
+            if (!count)
+                continue;
+            if (count == max) {
+                int coords_left;
+                item_coord_rewind(item);
+                coords_left=item_coords_left(item);
+                max=coords_left > 0 ? coords_left+2 : max*2;
+                g_free(ca);
+                ca=g_new(struct coord, max);
+                item_coord_rewind(item);
+                count=item_coord_get_within_selection(item, ca, item->type < type_line ? 1: max, job->sel);
+                if (count <= 0)
+                    continue;
+            }
+            if (pro != dl->worker_pro)
+                transform_from_to_count(ca, pro, ca, dl->worker_pro, count);
+            di=displayitem_new_from_item(job->m, conv, item, count, ca);
+            if (last)
+                last->next=di;
+            else
+                first=di;
+            last=di;
+            if (++batch == DISPLAYLIST_BATCH) {
+                displaylist_worker_push(dl, first, last);
+                first=last=NULL;
+                batch=0;
+            }
+        }
+        map_rect_destroy(mr);
+    }
+    if (first)
+        displaylist_worker_push(dl, first, last);
+    g_free(ca);
+    thread_lock_acquire(dl->worker_lock);
+    dl->worker_done=1;
+    thread_lock_release(dl->worker_lock);
+    return 0;
+}
+
+/**
+ * @brief Starts loading the maps with static data in a worker thread
+ *
+ * Called on the main thread after displaylist_load_prepare(). The selections are computed here, so the
+ * worker does not need the transformation, which the main thread may replace while it runs.
+ *
+ * @param dl The displaylist
+ * @param trans The transformation
+ */
+static void displaylist_worker_start(struct displaylist *dl, struct transformation *trans) {
+    struct mapset_handle *msh;
+    struct map *m;
+    struct attr attr;
+    enum projection pro=transform_get_projection(trans);
+
+    if (!thread_supported() || route_selection)
+        return;
+    displaylist_check_hash(dl);
+    msh=mapset_open(dl->ms);
+    while ((m=mapset_next(msh, 1))) {
+        struct displaylist_job *job;
+        struct map_selection *sel;
+        if (!map_get_attr(m, attr_static_data, &attr, NULL) || !attr.u.num)
+            continue;
+        if (dl->incremental && map_projection(m) == pro) {
+            sel=map_selection_dup(dl->sel_exposed);
+            if (!sel)
+                continue;
+        } else
+            sel=transform_get_selection(trans, map_projection(m), dl->order);
+        job=g_new(struct displaylist_job, 1);
+        /* keep the map alive if it is removed from the mapset while the worker reads it */
+        job->m=(struct map *)navit_object_ref((struct navit_object *)m);
+        job->sel=sel;
+        dl->worker_jobs=g_list_append(dl->worker_jobs, job);
+    }
+    mapset_close(msh);
+    if (!dl->worker_jobs)
+        return;
+    if (!dl->worker_lock)
+        dl->worker_lock=thread_lock_new();
+    dl->worker_pro=pro;
+    dl->worker_cancel=0;
+    dl->worker_done=0;
+    dl->worker=thread_new(displaylist_worker_main, dl, "displaylist");
+    if (!dl->worker)
+        displaylist_worker_stop(dl, 1);
+}
+
+static int displaylist_worker_finished(struct displaylist *dl) {
+    int ret;
+    thread_lock_acquire(dl->worker_lock);
+    ret=dl->worker_done;
+    thread_lock_release(dl->worker_lock);
+    return ret;
+}
+
+/**
+ * @brief Adds the items loaded by the worker thread so far to the displaylist
+ *
+ * @param dl The displaylist
+ * @returns The number of items taken from the worker, including duplicates which were dropped
+ */
+static int displaylist_worker_merge(struct displaylist *dl) {
+    struct displayitem *di,*next;
+    int count=0;
+
+    thread_lock_acquire(dl->worker_lock);
+    di=dl->worker_items;
+    dl->worker_items=dl->worker_items_last=NULL;
+    thread_lock_release(dl->worker_lock);
+    for ( ; di ; di=next) {
+        next=di->next;
+        count++;
+        if (g_hash_table_lookup(dl->static_items, di)) {
+            g_free(di);
+            continue;
+        }
+        display_add(get_hash_entry(dl, di->item.type), di);
+        g_hash_table_insert(dl->static_items, di, di);
+    }
+    return count;
+}
+
+/**
+ * @brief Switches from the idle callback to polling while only the worker thread has work left
+ *
+ * @param dl The displaylist
+ */
+static void displaylist_worker_wait(struct displaylist *dl) {
+    if (dl->worker_ev)
+        return;
+    if (dl->idle_ev)
+        event_remove_idle(dl->idle_ev);
+    dl->idle_ev=NULL;
+    dl->worker_ev=event_add_timeout(10, 1, dl->idle_cb);
+}
+
+/**
+ * @brief Waits for the worker thread to finish and cleans up after it
+ *
+ * @param dl The displaylist
+ * @param cancel If set, the worker is stopped early and its items are dropped, otherwise they are added
+ */
+static void displaylist_worker_stop(struct displaylist *dl, int cancel) {
+    struct displayitem *di,*next;
+
+    if (cancel && dl->worker) {
+        thread_lock_acquire(dl->worker_lock);
+        dl->worker_cancel=1;
+        thread_lock_release(dl->worker_lock);
+    }
+    if (dl->worker) {
+        thread_join(dl->worker);
+        dl->worker=NULL;
+    }
+    if (cancel) {
+        for (di = dl->worker_items ; di ; di=next) {
+            next=di->next;
+            g_free(di);
+        }
+        dl->worker_items=dl->worker_items_last=NULL;
+    } else
+        displaylist_worker_merge(dl);
+    while (dl->worker_jobs) {
+        struct displaylist_job *job=dl->worker_jobs->data;
+        map_selection_destroy(job->sel);
+        navit_object_unref((struct navit_object *)job->m);
+        g_free(job);
+        dl->worker_jobs=g_list_remove(dl->worker_jobs, job);
+    }
+    if (dl->worker_ev)
+        event_remove_timeout(dl->worker_ev);
+    dl->worker_ev=NULL;
+}
+
 static void do_draw(struct displaylist *displaylist, int cancel, int flags) {
     struct item *item;
     int count,max=displaylist->dc.maxlen,workload=0;
     int used=0;
     struct coord *ca;
-    struct attr attr,attr2;
+    struct attr attr;
     enum projection pro;
     int need_free=0;
+    struct displayitem *di,key;
 
     if (max < ALLOCA_COORD_LIMIT) {
         ca=g_alloca(sizeof(struct coord)*max);
@@ -3210,14 +3714,10 @@ static void do_draw(struct displaylist *displaylist, int cancel, int flags) {
         need_free=1;
     }
 
-    if (displaylist->order != displaylist->order_hashed || displaylist->layout != displaylist->layout_hashed) {
-        displaylist_update_hash(displaylist);
-        displaylist->order_hashed=displaylist->order;
-        displaylist->layout_hashed=displaylist->layout;
-    }
+    displaylist_check_hash(displaylist);
     profile(0,NULL);
     pro=transform_get_projection(displaylist->dc.trans);
-    while (!cancel) {
+    while (!cancel && !displaylist->maps_done) {
         if (!displaylist->msh)
             displaylist->msh=mapset_open(displaylist->ms);
         if (!displaylist->m) {
@@ -3225,20 +3725,28 @@ static void do_draw(struct displaylist *displaylist, int cancel, int flags) {
             if (!displaylist->m) {
                 mapset_close(displaylist->msh);
                 displaylist->msh=NULL;
+                displaylist->maps_done=1;
                 break;
             }
             displaylist->dc.pro=map_projection(displaylist->m);
             displaylist->conv=map_requires_conversion(displaylist->m);
+            displaylist->map_static=map_get_attr(displaylist->m, attr_static_data, &attr, NULL) && attr.u.num;
             if (route_selection)
                 displaylist->sel=route_selection;
-            else
+            else if (displaylist->map_static && displaylist->worker) {
+                /* Loaded by the worker thread */
+                continue;
+            } else if (displaylist->map_static && displaylist->incremental && displaylist->dc.pro == pro) {
+                displaylist->sel=map_selection_dup(displaylist->sel_exposed);
+                /* Nothing new to load from this map if the area shown was already loaded */
+                if (!displaylist->sel)
+                    continue;
+            } else
                 displaylist->sel=displaylist_get_selection(displaylist);
             displaylist->mr=map_rect_new(displaylist->m, displaylist->sel);
         }
         if (displaylist->mr) {
             while ((item=map_rect_get_item(displaylist->mr))) {
-                int label_count=0;
-                char *labels[2];
                 struct hash_entry *entry;
                 int coords_left;
                 if (item == &busy_item) {
@@ -3253,6 +3761,11 @@ static void do_draw(struct displaylist *displaylist, int cancel, int flags) {
                 entry=get_hash_entry(displaylist, item->type);
                 if (!entry)
                     continue;
+                if (displaylist->map_static) {
+                    key.item=*item;
+                    if (g_hash_table_lookup(displaylist->static_items, &key))
+                        continue;
+                }
                 count=item_coord_get_within_selection(item, ca, item->type < type_line ? 1: max, displaylist->sel);
                 /* abort if no coordinates within selection at all */
                 if (! count)
@@ -3293,30 +3806,10 @@ static void do_draw(struct displaylist *displaylist, int cancel, int flags) {
                 if(used < count)
                     used=count;
 
-                if (item_is_custom_poi(*item)) {
-                    if (item_attr_get(item, attr_icon_src, &attr2))
-                        labels[1]=map_convert_string(displaylist->m, attr2.u.str);
-                    else
-                        labels[1]=NULL;
-                    label_count=2;
-                } else {
-                    labels[1]=NULL;
-                    label_count=0;
-                }
-                if (item_attr_get(item, attr_label, &attr)) {
-                    labels[0]=attr.u.str;
-                    if (!label_count)
-                        label_count=2;
-                } else
-                    labels[0]=NULL;
-                if (displaylist->conv && label_count) {
-                    labels[0]=map_convert_string(displaylist->m, labels[0]);
-                    display_add(entry, item, count, ca, labels, label_count);
-                    map_convert_free(labels[0]);
-                } else
-                    display_add(entry, item, count, ca, labels, label_count);
-                if (labels[1])
-                    map_convert_free(labels[1]);
+                di=displayitem_new_from_item(displaylist->m, displaylist->conv, item, count, ca);
+                display_add(entry, di);
+                if (displaylist->map_static)
+                    g_hash_table_insert(displaylist->static_items, di, di);
                 workload++;
                 if (workload == displaylist->workload) {
                     if (need_free) {
@@ -3333,6 +3826,19 @@ static void do_draw(struct displaylist *displaylist, int cancel, int flags) {
         displaylist->sel=NULL;
         displaylist->m=NULL;
     }
+    if (displaylist->worker) {
+        if (!cancel && !displaylist_worker_finished(displaylist)) {
+            /* Add what the worker has loaded so far and check again later */
+            if (!displaylist_worker_merge(displaylist))
+                displaylist_worker_wait(displaylist);
+            if (need_free)
+                g_free(ca);
+            return;
+        }
+        displaylist_worker_stop(displaylist, cancel);
+    }
+    displaylist->maps_done=0;
+    displaylist_load_done(displaylist, cancel);
     profile(1,"process_selection\n");
     if (displaylist->idle_ev)
         event_remove_idle(displaylist->idle_ev);
@@ -3414,7 +3920,6 @@ static void graphics_load_mapset(struct graphics *gra, struct displaylist *displ
             return;
         do_draw(displaylist, 1, flags);
     }
-    xdisplay_free(displaylist);
     dbg(lvl_debug,"order=%d", order);
 
     displaylist->dc.gra=gra;
@@ -3431,9 +3936,11 @@ static void graphics_load_mapset(struct graphics *gra, struct displaylist *displ
     displaylist->order=order>0?order:0;
     displaylist->busy=1;
     displaylist->layout=l;
+    displaylist_load_prepare(displaylist, displaylist->dc.trans);
     if (async) {
         if (! displaylist->idle_cb)
             displaylist->idle_cb=callback_new_3(callback_cast(do_draw), displaylist, 0, flags);
+        displaylist_worker_start(displaylist, displaylist->dc.trans);
         displaylist->idle_ev=event_add_idle(50, displaylist->idle_cb);
     } else
         do_draw(displaylist, 0, flags);
@@ -3530,6 +4037,7 @@ struct displaylist * graphics_displaylist_new(void) {
     struct displaylist *ret=g_new0(struct displaylist, 1);
 
     ret->dc.maxlen=ALLOCA_COORD_LIMIT;
+    ret->static_items=g_hash_table_new(displayitem_hash, displayitem_equal);
 
     return ret;
 }
@@ -3537,6 +4045,13 @@ struct displaylist * graphics_displaylist_new(void) {
 void graphics_displaylist_destroy(struct displaylist *displaylist) {
     if(displaylist->dc.trans)
         transform_destroy(displaylist->dc.trans);
+    displaylist_worker_stop(displaylist, 1);
+    if (displaylist->worker_lock)
+        thread_lock_destroy(displaylist->worker_lock);
+    xdisplay_free(displaylist);
+    g_hash_table_destroy(displaylist->static_items);
+    map_selection_destroy(displaylist->sel_pending);
+    map_selection_destroy(displaylist->sel_exposed);
     g_free(displaylist);
 
 }
@@ -1129,10 +1129,6 @@ static void event_android_remove_idle(struct event_idle *ev) {
     event_android_remove_timeout((struct event_timeout *)ev);
 }
 
-static void event_android_call_callback(struct callback_list *cb) {
-    dbg(lvl_debug,"enter");
-}
-
 static struct event_methods event_android_methods = {
     event_android_main_loop_run,
     event_android_main_loop_quit,
@@ -1142,7 +1138,7 @@ static struct event_methods event_android_methods = {
     event_android_remove_timeout,
     event_android_add_idle,
     event_android_remove_idle,
-    event_android_call_callback,
+    NULL, /* call_callback is not supported */
 };
 
 static struct event_priv *event_android_new(struct event_methods *meth) {
@@ -267,10 +267,6 @@ static void event_null_remove_idle(struct event_idle *ev) {
     dbg(lvl_debug,"enter");
 }
 
-static void event_null_call_callback(struct callback_list *cb) {
-    dbg(lvl_debug,"enter");
-}
-
 static struct event_methods event_null_methods = {
     event_null_main_loop_run,
     event_null_main_loop_quit,
@@ -280,7 +276,7 @@ static struct event_methods event_null_methods = {
     event_null_remove_timeout,
     event_null_add_idle,
     event_null_remove_idle,
-    event_null_call_callback,
+    NULL, /* call_callback is not supported */
 };
 
 static struct event_priv *event_null_new(struct event_methods *meth) {
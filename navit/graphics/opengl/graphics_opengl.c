@@ -1609,10 +1609,6 @@ static void event_opengl_remove_idle(struct event_idle *ev) {
     dbg(lvl_debug, "enter");
 }
 
-static void event_opengl_call_callback(struct callback_list *cb) {
-    dbg(lvl_debug, "enter");
-}
-
 static struct event_methods event_opengl_methods = {
     event_opengl_main_loop_run,
     event_opengl_main_loop_quit,
@@ -1622,7 +1618,7 @@ static struct event_methods event_opengl_methods = {
     event_opengl_remove_timeout,
     event_opengl_add_idle,
     event_opengl_remove_idle,
-    event_opengl_call_callback,
+    NULL, /* call_callback is not supported */
 };
 
 static struct event_priv *event_opengl_new(struct event_methods *meth) {
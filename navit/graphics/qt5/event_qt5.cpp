@@ -147,10 +147,6 @@ static void event_qt5_remove_idle(struct event_idle* ev) {
     event_qt5_remove_timeout((struct event_timeout*)ev);
 }
 
-static void event_qt5_call_callback(struct callback_list* cb) {
-    dbg(lvl_debug, "enter");
-}
-
 static struct event_methods event_qt5_methods = {
     event_qt5_main_loop_run,
     event_qt5_main_loop_quit,
@@ -160,7 +156,7 @@ static struct event_methods event_qt5_methods = {
     event_qt5_remove_timeout,
     event_qt5_add_idle,
     event_qt5_remove_idle,
-    event_qt5_call_callback,
+    NULL, /* call_callback is not supported */
 };
 
 static struct event_priv* event_qt5_new(struct event_methods* meth) {
@@ -754,10 +754,6 @@ static void event_qt_remove_idle(struct event_idle *ev) {
     event_qt_remove_timeout((struct event_timeout *) ev);
 }
 
-static void event_qt_call_callback(struct callback_list *cb) {
-    dbg(lvl_debug,"enter");
-}
-
 static struct event_methods event_qt_methods = {
     event_qt_main_loop_run,
     event_qt_main_loop_quit,
@@ -767,7 +763,7 @@ static struct event_methods event_qt_methods = {
     event_qt_remove_timeout,
     event_qt_add_idle,
     event_qt_remove_idle,
-    event_qt_call_callback,
+    NULL, /* call_callback is not supported */
 };
 
 struct event_priv {
@@ -346,11 +346,9 @@ int item_coord_get_within_range(struct item *i, struct coord *c, int max,
  */
 int item_coord_get_pro(struct item *it, struct coord *c, int count, enum projection to) {
     int ret=item_coord_get(it, c, count);
-    int i;
     enum projection from=map_projection(it->map);
     if (from != to)
-        for (i = 0 ; i < count ; i++)
-            transform_from_to(c+i, from, c+i, to);
+        transform_from_to_count(c, from, c, to, ret);
     return ret;
 }
 
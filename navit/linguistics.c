@@ -279,6 +279,46 @@ static const char *upperlower[]= {
 
 static GHashTable *casefold_hash, *special_hash;
 
+/** Maximum size of the replacement of a single character, including the terminating NUL */
+#define LINGUISTICS_CHAR_MAX 8
+
+/**
+ * @brief Precomputed casefolding and expansions of a non-ASCII character.
+ *
+ * Built by linguistics_init() for every character which linguistics_casefold() or linguistics_expand_special()
+ * change, so linguistics_compare() can fold and expand on the fly without lookups by string.
+ */
+struct linguistics_char {
+    char str[3][LINGUISTICS_CHAR_MAX]; /**< The casefolded character, followed by its expansions for
+                                            linguistics_expand_special() mode 1 and 2 (the casefolded character if none) */
+    int expand; /**< Bit n is set if linguistics_expand_special() mode n replaces the casefolded character */
+};
+
+/* Characters encoded with two bytes in UTF-8, indexed by code point, which covers all characters of the tables above */
+static struct linguistics_char *linguistics_chars[0x800];
+/* Any longer characters, indexed by their UTF-8 encoding */
+static GHashTable *linguistics_char_hash;
+/* Casefolding of ASCII characters */
+static unsigned char linguistics_ascii_fold[128];
+
+/**
+ * @brief Get the precomputed casefolding and expansions of a character.
+ *
+ * @param s Start of the UTF-8 encoded character
+ * @param len Length of the character in bytes
+ * @returns The precomputed data, or NULL if the character is left as is
+ */
+static struct linguistics_char *linguistics_char_get(const char *s, int len) {
+    char buf[10];
+    if (len == 2 && (s[0] & 0xe0) == 0xc0)
+        return linguistics_chars[((s[0] & 0x1f) << 6) | (s[1] & 0x3f)];
+    if (len < 2 || len >= sizeof(buf) || !linguistics_char_hash)
+        return NULL;
+    memcpy(buf, s, len);
+    buf[len]='\0';
+    return g_hash_table_lookup(linguistics_char_hash, buf);
+}
+
 
 /*
  * @brief Prepare an utf-8 string for case insensitive comparison.
@@ -290,19 +330,18 @@ char* linguistics_casefold(const char *in) {
     const char *src=in;
     char *ret=g_new(char,len+1);
     char *dest=ret;
-    char buf[10];
     while(*src && dest-ret<len) {
         if(*src>='A' && *src<='Z') {
             *dest++=*src++ - 'A' + 'a';
         } else if (!(*src&128)) {
             *dest++=*src++;
         } else {
-            int charlen;
-            char *tmp, *folded;
+            char *tmp, *folded=NULL;
+            struct linguistics_char *c;
             tmp=g_utf8_find_next_char(src,NULL);
-            charlen=tmp-src+1;
-            g_strlcpy(buf,src,charlen>10?10:charlen);
-            folded=g_hash_table_lookup(casefold_hash,buf);
+            c=linguistics_char_get(src, tmp-src);
+            if(c)
+                folded=c->str[0];
             if(folded) {
                 while(*folded && dest-ret<len)
                     *dest++=*folded++;
@@ -330,9 +369,80 @@ static char** linguistics_get_special(const char *str, const char *end) {
     return g_hash_table_lookup(special_hash,buf);
 }
 
+/**
+ * @brief Get the linguistics_expand_special() modes which would replace any character of a string after casefolding.
+ *
+ * @param str The string to check
+ * @returns Bit n is set if mode n would replace a character
+ */
+static int linguistics_expand_modes(const char *str) {
+    const unsigned char *in=(const unsigned char *)str;
+    int ret=0;
+    while (*in) {
+        const char *next;
+        struct linguistics_char *c;
+        if (*in < 128) {
+            in++;
+            continue;
+        }
+        next=g_utf8_find_next_char((const char *)in, NULL);
+        c=linguistics_char_get((const char *)in, next-(const char *)in);
+        if (c)
+            ret|=c->expand;
+        in=(const unsigned char *)next;
+    }
+    return ret;
+}
+
+/**
+ * @brief Compare a string, casefolded and expanded on the fly, with another string.
+ *
+ * This gives the same result as comparing linguistics_expand_special(linguistics_casefold(s1),mode) with s2,
+ * but does not allocate anything. ASCII characters are folded with a table, other characters use the
+ * precomputed replacements from linguistics_char_get().
+ *
+ * @param s1 The string to casefold and expand
+ * @param s2 The string to compare with, should be linguistics_casefold()ed
+ * @param mode The linguistics_expand_special() mode
+ * @param partial If set, s2 only needs to match the beginning of s1
+ * @returns 0 when strings are equal, less or greater than 0 like strcmp() otherwise
+ */
+static int linguistics_compare_folded(const char *s1, const char *s2, int mode, int partial) {
+    const unsigned char *in=(const unsigned char *)s1;
+    const unsigned char *str=(const unsigned char *)s2;
+    const unsigned char *replace=(const unsigned char *)"";
+    unsigned char c;
+
+    for (;;) {
+        if (*replace) {
+            c=*replace++;
+        } else if (*in < 128) {
+            c=linguistics_ascii_fold[*in];
+            if (c)
+                in++;
+        } else {
+            const char *next=g_utf8_find_next_char((const char *)in, NULL);
+            struct linguistics_char *lc=linguistics_char_get((const char *)in, next-(const char *)in);
+            if (lc) {
+                replace=(const unsigned char *)lc->str[mode];
+                in=(const unsigned char *)next;
+                continue;
+            }
+            c=*in++;
+        }
+        if (!*str)
+            return partial ? 0 : c;
+        if (c != *str)
+            return c - *str;
+        str++;
+    }
+}
+
 /**
  * @brief Compare two strings, trying to replace special characters (e.g. umlauts) in first string with plain letters.
  *
+ * The first string is casefolded and expanded while comparing, so nothing is allocated.
+ *
  * @param s1 First string to process, for example, an item name from the map. Will be linguistics_casefold()ed before comparison.
  * @param s2 Second string to process, usually user supplied search string. Should be linguistics_casefold()ed before calling this function.
  * @param mode set to composition of linguistics_cmp_mode flags to have s1 linguistics_expand_special()ed, allow matches shorter than whole s1, or
@@ -342,33 +452,26 @@ static char** linguistics_get_special(const char *str, const char *end) {
 int linguistics_compare(const char *s1, const char *s2, enum linguistics_cmp_mode mode) {
     int ret=0;
     int i;
-    int s2len=strlen(s2);
-    char *s1f;
-    /* Calling linguistics_casefold() before linguistics_expand_special() requires that result is independent of calling order. This seems
-       to be true at the time of writing this comment. */
-    s1f=linguistics_casefold(s1);
+    int partial=(mode & linguistics_cmp_partial) != 0;
+    int expand=0;
+
+    /* Word separators are ASCII and thus not changed by casefolding or expansion, so the words can be found in s1 directly.
+       Like with linguistics_expand_special(), expansion modes which do not replace anything are skipped. */
+    if (mode & linguistics_cmp_expand)
+        expand=linguistics_expand_modes(s1);
     for(i=0; i<3; i++) {
-        char *s, *word;
-        if(i>0)
-            s=linguistics_expand_special(s1f,i);
-        else
-            s=s1f;
-        word=s;
+        const char *word=s1;
+        if (i > 0 && !(expand & (1 << i)))
+            continue;
         while(word) {
-            if(mode & linguistics_cmp_partial)
-                ret=strncmp(word,s2,s2len);
-            else
-                ret=strcmp(word,s2);
+            ret=linguistics_compare_folded(word, s2, i, partial);
             if(!ret || !(mode & linguistics_cmp_words))
                 break;
-            word=linguistics_next_word(word);
+            word=linguistics_next_word((char *)word);
         }
-        if(i>0)
-            g_free(s);
         if(!ret || !(mode & linguistics_cmp_expand))
             break;
     }
-    g_free(s1f);
     return ret;
 }
 
@@ -473,6 +576,51 @@ static char
     return ret;
 }
 
+/**
+ * @brief Precompute the casefolding and expansions of a character for linguistics_char_get().
+ *
+ * Must be called after casefold_hash and special_hash are set up. Characters which are left as is are skipped.
+ *
+ * @param s pointer to the beginning of the UTF-8 encoded character
+ */
+static void linguistics_char_add(const char *s) {
+    char *key=linguistics_dup_utf8_char(s);
+    int len=strlen(key);
+    const char *folded;
+    const char **spc;
+    struct linguistics_char *c;
+    int i;
+
+    if (linguistics_char_get(key, len)) {
+        g_free(key);
+        return;
+    }
+    folded=g_hash_table_lookup(casefold_hash, key);
+    if (!folded)
+        folded=key;
+    spc=g_hash_table_lookup(special_hash, folded);
+    if (folded == key && !spc) {
+        g_free(key);
+        return;
+    }
+    c=g_new0(struct linguistics_char, 1);
+    for (i = 0 ; i < 3 ; i++) {
+        const char *str=folded;
+        if (i > 0 && spc && spc[i]) {
+            str=spc[i];
+            c->expand|=1 << i;
+        }
+        if (strlen(str) >= LINGUISTICS_CHAR_MAX)
+            dbg(lvl_error,"Replacement '%s' of '%s' is too long", str, key);
+        g_strlcpy(c->str[i], str, LINGUISTICS_CHAR_MAX);
+    }
+    if (len == 2 && (key[0] & 0xe0) == 0xc0) {
+        linguistics_chars[((key[0] & 0x1f) << 6) | (key[1] & 0x3f)]=c;
+        g_free(key);
+    } else
+        g_hash_table_insert(linguistics_char_hash, key, c);
+}
+
 void linguistics_init(void) {
     int i;
 
@@ -493,12 +641,29 @@ void linguistics_init(void) {
     for (i = 0 ; i < sizeof(special)/sizeof(special[0]); i++)
         g_hash_table_insert(special_hash,(gpointer)special[i][0],special[i]);
 
+    for (i = 0 ; i < 128 ; i++)
+        linguistics_ascii_fold[i]=(i >= 'A' && i <= 'Z') ? i - 'A' + 'a' : i;
+    linguistics_char_hash=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    for (i = 0 ; upperlower[i]; i++) {
+        const char *s;
+        for (s = upperlower[i] ; *s ; s=g_utf8_find_next_char(s, NULL))
+            linguistics_char_add(s);
+    }
+    for (i = 0 ; i < sizeof(special)/sizeof(special[0]); i++)
+        linguistics_char_add(special[i][0]);
 }
 
 void linguistics_free(void) {
+    int i;
     g_hash_table_destroy(casefold_hash);
     g_hash_table_destroy(special_hash);
+    g_hash_table_destroy(linguistics_char_hash);
     casefold_hash=NULL;
     special_hash=NULL;
+    linguistics_char_hash=NULL;
+    for (i = 0 ; i < sizeof(linguistics_chars)/sizeof(linguistics_chars[0]) ; i++) {
+        g_free(linguistics_chars[i]);
+        linguistics_chars[i]=NULL;
+    }
 }
 
@@ -375,6 +375,22 @@ void map_rect_destroy(struct map_rect *mr) {
     }
 }
 
+/**
+ * @brief Loads the data of a map selection ahead of use
+ *
+ * This lets the map driver read and decode the data covered by `sel`, so that later map rects
+ * over the same area are served from memory. It is meant to be called from a background thread.
+ *
+ * @param m The map
+ * @param sel The selection to load, in the projection of the map
+ * @return True if the map driver supports prefetching, false otherwise
+ */
+int map_prefetch(struct map *m, struct map_selection *sel) {
+    if (!m->meth.map_prefetch)
+        return 0;
+    return m->meth.map_prefetch(m->priv, sel);
+}
+
 /**
  * @brief Holds information about a search on a map
  *
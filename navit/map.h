@@ -90,6 +90,7 @@ struct map_methods {
 	struct item *		(*map_rect_create_item)(struct map_rect_priv *mr, enum item_type type); /**< Function to create a new item in the map */
 	int			(*map_get_attr)(struct map_priv *priv, enum attr_type type, struct attr *attr); /**< Function to get a map attribute, can be NULL */
     int			(*map_set_attr)(struct map_priv *priv, struct attr *attr); /**< Function to set a map attribute, can be NULL */
+	int			(*map_prefetch)(struct map_priv *priv, struct map_selection *sel); /**< Function to load the data of a selection ahead of use, can be NULL. Called from a background thread. */
 };
 
 /**
@@ -262,6 +263,7 @@ struct item *map_rect_get_item(struct map_rect *mr);
 struct item *map_rect_get_item_byid(struct map_rect *mr, int id_hi, int id_lo);
 struct item *map_rect_create_item(struct map_rect *mr, enum item_type type_);
 void map_rect_destroy(struct map_rect *mr);
+int map_prefetch(struct map *m, struct map_selection *sel);
 struct map_search *map_search_new(struct map *m, struct item *item, struct attr *search_attr, int partial);
 struct item *map_search_get_item(struct map_search *this_);
 void map_search_destroy(struct map_search *this_);
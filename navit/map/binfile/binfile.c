@@ -39,6 +39,10 @@
 #include "callback.h"
 #include "types.h"
 #include "geom.h"
+#include "thread.h"
+
+/** Upper bound in bytes for unreferenced decoded tiles kept per map. */
+#define BINFILE_TILE_CACHE_SIZE (8*1024*1024)
 
 static int map_id;
 
@@ -81,7 +85,29 @@ struct tile {
     int *pos_next;          //!< Pointer to the next item (the item which follows the "current item" as indicated by *pos).
     struct file *fi;        //!< The file from which this tile was loaded.
     int zipfile_num;
-    int mode;
+    int mode;               //!< 0/1: buffer read from the file, 2: owned by the changes hash, 3: held in the tile cache.
+    struct binfile_tile_cache_entry *cache_entry; //!< Tile cache entry holding the buffer if mode is 3.
+    int submaps_hinted;     //!< Whether read ahead hints for the submaps of this tile have been issued.
+};
+
+/**
+ * @brief A decoded tile in the per-map tile cache.
+ *
+ * Entries are shared by all map_rects of a map and refcounted. Entries that are
+ * no longer referenced stay in the cache on a LRU list until the cache grows
+ * beyond BINFILE_TILE_CACHE_SIZE.
+ */
+struct binfile_tile_cache_entry {
+    int zipdsk;             //!< Disk number of the zip member.
+    long long offset;       //!< Offset of the local file header of the zip member.
+    int *start;             //!< Uncompressed tile data.
+    int *end;               //!< First memory address not belonging to the tile data.
+    struct file *fi;        //!< The file the tile data was read from.
+    int size;               //!< Size of the tile data in bytes.
+    int refcount;           //!< Number of tiles currently using this entry.
+    int prefetched;         //!< Whether the tile was loaded by a prefetch and has not been used since.
+    int orphaned;           //!< Whether the map files were closed while the entry was in use, see binfile_tile_cache_flush.
+    struct binfile_tile_cache_entry *prev,*next; //!< Position in the LRU list while unreferenced.
 };
 
 
@@ -132,6 +158,17 @@ struct map_priv {
     long download_enabled;
     int last_searched_town_id_hi;
     int last_searched_town_id_lo;
+    GHashTable *tile_cache;      //!< Decoded tiles shared by all map_rects, keyed by zip member.
+    struct binfile_tile_cache_entry *tile_cache_first; //!< Least recently used unreferenced tile.
+    struct binfile_tile_cache_entry *tile_cache_last;  //!< Most recently used unreferenced tile.
+    int tile_cache_size;         //!< Bytes of tile data held by the tile cache.
+    int tile_cache_hits;
+    int tile_cache_misses;
+    int tile_cache_orphans;      //!< Number of orphaned entries still in use.
+    GList *tile_cache_files;     //!< Closed map files to be destroyed once no orphaned entry uses them.
+    int tile_prefetched;         //!< Number of tiles loaded into the tile cache by map_prefetch.
+    int tile_prefetch_hits;      //!< Number of prefetched tiles used by a map_rect later on.
+    struct thread_lock *tile_cache_lock;
 };
 
 struct map_rect_priv {
@@ -151,6 +188,7 @@ struct map_rect_priv {
     struct attr attrs[8];
     int status;
     struct map_search_priv *msp;
+    int prefetch;               //!< Whether this map_rect only loads tiles for binmap_prefetch.
 #ifdef DEBUG_SIZE
     int size;
 #endif
@@ -174,6 +212,11 @@ struct map_search_priv {
     struct coord_rect rect_new;
     char *parent_name;
     GHashTable *search_results;
+    struct map_rect_priv *index_mr; /**< Map rect holding the search index of the country, NULL if not used */
+    char *index_keys; /**< The string table of the search index */
+    int index_keys_size; /**< The size of `index_keys` in bytes, its last byte is always 0 */
+    int index_pos; /**< The next entry of the search index to return */
+    int index_end; /**< The end of the entries of the search index which match */
 };
 
 
@@ -846,6 +889,7 @@ static void push_tile(struct map_rect_priv *mr, struct tile *t, int offset, int
     dbg_assert(mr->tile_depth < 8);
     mr->t=&mr->tiles[mr->tile_depth++];
     *(mr->t)=*t;
+    mr->t->submaps_hinted=0;
     mr->t->pos=mr->t->pos_next=mr->t->start+offset;
     if (length == -1)
         length=le32_to_cpu(mr->t->pos[0])+1;
@@ -853,11 +897,221 @@ static void push_tile(struct map_rect_priv *mr, struct tile *t, int offset, int
         mr->t->end=mr->t->pos+length;
 }
 
+static guint binfile_tile_cache_hash(gconstpointer key) {
+    const struct binfile_tile_cache_entry *entry=key;
+    return (guint)(entry->offset ^ (entry->offset >> 32) ^ entry->zipdsk);
+}
+
+static gboolean binfile_tile_cache_equal(gconstpointer a, gconstpointer b) {
+    const struct binfile_tile_cache_entry *entry1=a,*entry2=b;
+    return (entry1->offset == entry2->offset && entry1->zipdsk == entry2->zipdsk);
+}
+
+static void binfile_tile_cache_unlink(struct map_priv *m, struct binfile_tile_cache_entry *entry) {
+    if (entry->prev)
+        entry->prev->next=entry->next;
+    else
+        m->tile_cache_first=entry->next;
+    if (entry->next)
+        entry->next->prev=entry->prev;
+    else
+        m->tile_cache_last=entry->prev;
+    entry->prev=entry->next=NULL;
+}
+
+static void binfile_tile_cache_entry_destroy(struct map_priv *m, struct binfile_tile_cache_entry *entry) {
+    m->tile_cache_size-=entry->size;
+    file_data_free(entry->fi, (unsigned char *)entry->start);
+    g_free(entry);
+}
+
+/**
+ * @brief Evicts unreferenced tiles until the cache fits into BINFILE_TILE_CACHE_SIZE.
+ *
+ * Must be called with the tile cache lock held.
+ */
+static void binfile_tile_cache_trim(struct map_priv *m) {
+    struct binfile_tile_cache_entry *entry;
+    while (m->tile_cache_size > BINFILE_TILE_CACHE_SIZE && m->tile_cache_first) {
+        entry=m->tile_cache_first;
+        binfile_tile_cache_unlink(m, entry);
+        g_hash_table_remove(m->tile_cache, entry);
+        binfile_tile_cache_entry_destroy(m, entry);
+    }
+}
+
+/**
+ * @brief Looks up the decoded tile of a zip member in the tile cache.
+ *
+ * Lookups done for a prefetch are not counted as hits or misses.
+ *
+ * @param m The map
+ * @param zipdsk Disk number of the zip member
+ * @param offset Offset of the zip member
+ * @param prefetch Whether the lookup is done for a prefetch
+ * @return The referenced cache entry, or NULL if the tile is not cached
+ */
+static struct binfile_tile_cache_entry *binfile_tile_cache_get(struct map_priv *m, int zipdsk, long long offset,
+        int prefetch) {
+    struct binfile_tile_cache_entry key,*entry;
+    if (!m->tile_cache)
+        return NULL;
+    key.zipdsk=zipdsk;
+    key.offset=offset;
+    thread_lock_acquire(m->tile_cache_lock);
+    entry=g_hash_table_lookup(m->tile_cache, &key);
+    if (entry) {
+        if (!entry->refcount++)
+            binfile_tile_cache_unlink(m, entry);
+        if (!prefetch) {
+            m->tile_cache_hits++;
+            if (entry->prefetched) {
+                entry->prefetched=0;
+                m->tile_prefetch_hits++;
+            }
+        }
+    } else if (!prefetch)
+        m->tile_cache_misses++;
+    thread_lock_release(m->tile_cache_lock);
+    return entry;
+}
+
+/**
+ * @brief Hands a freshly decoded tile over to the tile cache.
+ *
+ * On success the tile is switched to mode 3 and holds a reference to the new entry.
+ * If another map_rect has cached the same zip member meanwhile, the tile keeps its own buffer.
+ *
+ * @param m The map
+ * @param zipdsk Disk number of the zip member
+ * @param offset Offset of the zip member
+ * @param t The tile holding the decoded data
+ * @param prefetch Whether the tile was loaded by a prefetch
+ */
+static void binfile_tile_cache_put(struct map_priv *m, int zipdsk, long long offset, struct tile *t, int prefetch) {
+    struct binfile_tile_cache_entry *entry;
+    if (!m->tile_cache)
+        return;
+    entry=g_new0(struct binfile_tile_cache_entry, 1);
+    entry->zipdsk=zipdsk;
+    entry->offset=offset;
+    entry->start=t->start;
+    entry->end=t->end;
+    entry->fi=t->fi;
+    entry->size=(t->end-t->start)*sizeof(int);
+    entry->refcount=1;
+    entry->prefetched=prefetch;
+    thread_lock_acquire(m->tile_cache_lock);
+    if (g_hash_table_lookup(m->tile_cache, entry)) {
+        thread_lock_release(m->tile_cache_lock);
+        g_free(entry);
+        return;
+    }
+    g_hash_table_insert(m->tile_cache, entry, entry);
+    m->tile_cache_size+=entry->size;
+    if (prefetch)
+        m->tile_prefetched++;
+    binfile_tile_cache_trim(m);
+    thread_lock_release(m->tile_cache_lock);
+    t->mode=3;
+    t->cache_entry=entry;
+}
+
+/**
+ * @brief Destroys the closed map files once no orphaned entry uses them any more.
+ *
+ * Must be called with the tile cache lock held.
+ */
+static void binfile_tile_cache_destroy_files(struct map_priv *m) {
+    GList *l;
+    if (m->tile_cache_orphans)
+        return;
+    for (l = m->tile_cache_files ; l ; l=g_list_next(l))
+        file_destroy(l->data);
+    g_list_free(m->tile_cache_files);
+    m->tile_cache_files=NULL;
+}
+
+static void binfile_tile_cache_release(struct map_priv *m, struct binfile_tile_cache_entry *entry) {
+    thread_lock_acquire(m->tile_cache_lock);
+    if (!--entry->refcount && entry->orphaned) {
+        binfile_tile_cache_entry_destroy(m, entry);
+        m->tile_cache_orphans--;
+        binfile_tile_cache_destroy_files(m);
+    } else if (!entry->refcount) {
+        entry->prev=m->tile_cache_last;
+        entry->next=NULL;
+        if (m->tile_cache_last)
+            m->tile_cache_last->next=entry;
+        else
+            m->tile_cache_first=entry;
+        m->tile_cache_last=entry;
+        binfile_tile_cache_trim(m);
+    }
+    thread_lock_release(m->tile_cache_lock);
+}
+
+static gboolean binfile_tile_cache_orphan(gpointer key, gpointer value, gpointer user_data) {
+    struct binfile_tile_cache_entry *entry=value;
+    struct map_priv *m=user_data;
+    entry->orphaned=1;
+    m->tile_cache_orphans++;
+    return TRUE;
+}
+
+/**
+ * @brief Empties the tile cache and destroys the map files.
+ *
+ * Called when the map files are closed. Unreferenced tiles are dropped. Tiles which are still in use are
+ * removed from the cache and marked as orphaned, they are freed when their last user releases them. The
+ * files are only destroyed after that, as the data of orphaned tiles has to be freed against the file it
+ * was read from.
+ *
+ * @param m The map
+ * @param files The map files, as struct file, the list is taken over
+ */
+static void binfile_tile_cache_flush(struct map_priv *m, GList *files) {
+    struct binfile_tile_cache_entry *entry;
+    thread_lock_acquire(m->tile_cache_lock);
+    while ((entry=m->tile_cache_first)) {
+        binfile_tile_cache_unlink(m, entry);
+        g_hash_table_remove(m->tile_cache, entry);
+        binfile_tile_cache_entry_destroy(m, entry);
+    }
+    g_hash_table_foreach_remove(m->tile_cache, binfile_tile_cache_orphan, m);
+    if (m->tile_cache_orphans)
+        dbg(lvl_debug,"map file %s: %d tiles still in use", m->filename, m->tile_cache_orphans);
+    m->tile_cache_files=g_list_concat(m->tile_cache_files, files);
+    binfile_tile_cache_destroy_files(m);
+    thread_lock_release(m->tile_cache_lock);
+}
+
+/**
+ * @brief Reads a statistics counter of the tile cache.
+ *
+ * @param m The map
+ * @param counter The counter, a member of `m`
+ * @return The value of the counter
+ */
+static int binfile_tile_cache_stat(struct map_priv *m, int *counter) {
+    int ret;
+    thread_lock_acquire(m->tile_cache_lock);
+    ret=*counter;
+    thread_lock_release(m->tile_cache_lock);
+    return ret;
+}
+
+static void binfile_tile_free(struct map_priv *m, struct tile *t) {
+    if (t->mode == 3)
+        binfile_tile_cache_release(m, t->cache_entry);
+    else if (t->mode < 2)
+        file_data_free(t->fi, (unsigned char *)(t->start));
+}
+
 static int pop_tile(struct map_rect_priv *mr) {
     if (mr->tile_depth <= 1)
         return 0;
-    if (mr->t->mode < 2)
-        file_data_free(mr->m->fi, (unsigned char *)(mr->t->start));
+    binfile_tile_free(mr->m, mr->t);
 #ifdef DEBUG_SIZE
 #if DEBUG_SIZE > 0
     dbg(lvl_debug,"leave %d",mr->t->zipfile_num);
@@ -868,15 +1122,26 @@ static int pop_tile(struct map_rect_priv *mr) {
 }
 
 
-static int zipfile_to_tile(struct map_priv *m, struct zip_cd *cd, struct tile *t) {
+static int zipfile_to_tile(struct map_priv *m, struct zip_cd *cd, struct tile *t, int prefetch) {
     char buffer[1024];
     struct zip_lfh *lfh;
     char *zipfn;
     struct file *fi;
+    struct binfile_tile_cache_entry *entry;
     dbg(lvl_debug,"enter %p %p %p", m, cd, t);
     dbg(lvl_debug,"cd->zipofst=0x"LONGLONG_HEX_FMT "", binfile_cd_offset(cd));
     t->start=NULL;
     t->mode=1;
+    t->cache_entry=NULL;
+    entry=binfile_tile_cache_get(m, cd->zipdsk, binfile_cd_offset(cd), prefetch);
+    if (entry) {
+        t->start=entry->start;
+        t->end=entry->end;
+        t->fi=entry->fi;
+        t->mode=3;
+        t->cache_entry=entry;
+        return 1;
+    }
     if (m->fis)
         fi=m->fis[cd->zipdsk];
     else
@@ -890,6 +1155,8 @@ static int zipfile_to_tile(struct map_priv *m, struct zip_cd *cd, struct tile *t
     t->fi=fi;
     file_data_free(fi, (unsigned char *)zipfn);
     file_data_free(fi, (unsigned char *)lfh);
+    if (t->start)
+        binfile_tile_cache_put(m, cd->zipdsk, binfile_cd_offset(cd), t, prefetch);
     return t->start != NULL;
 }
 
@@ -1227,7 +1494,7 @@ static void push_zipfile_tile_do(struct map_rect_priv *mr, struct zip_cd *cd, in
     mr->size+=cd->zipcunc;
 #endif
     t.zipfile_num=zipfile;
-    if (zipfile_to_tile(m, cd, &t))
+    if (zipfile_to_tile(m, cd, &t, mr->prefetch))
         push_tile(mr, &t, offset, length);
     file_data_free(f, (unsigned char *)cd);
 }
@@ -1469,10 +1736,21 @@ static void map_download_selection(struct map_priv *m, struct map_rect_priv *mr,
     }
 }
 
-static struct map_rect_priv *map_rect_new_binfile(struct map_priv *map, struct map_selection *sel) {
+/**
+ * @brief Opens a map_rect for reading items or for prefetching tiles.
+ *
+ * @param map The map
+ * @param sel The selection
+ * @param prefetch Whether the map_rect only loads tiles for binmap_prefetch, set before the first tile is loaded
+ * @return The map_rect
+ */
+static struct map_rect_priv *map_rect_new_binfile_mode(struct map_priv *map, struct map_selection *sel, int prefetch) {
     struct map_rect_priv *mr=map_rect_new_binfile_int(map, sel);
     struct tile t;
     dbg(lvl_debug,"zip_members=%d", map->zip_members);
+    if (!mr)
+        return NULL;
+    mr->prefetch=prefetch;
     if (map->url && map->fi && sel && sel->order == 255) {
         map_download_selection(map, mr, sel);
     }
@@ -1496,6 +1774,10 @@ static struct map_rect_priv *map_rect_new_binfile(struct map_priv *map, struct m
     return mr;
 }
 
+static struct map_rect_priv *map_rect_new_binfile(struct map_priv *map, struct map_selection *sel) {
+    return map_rect_new_binfile_mode(map, sel, 0);
+}
+
 static void write_changes_do(gpointer key, gpointer value, gpointer user_data) {
     struct binfile_hash_entry *entry=key;
     FILE *out=user_data;
@@ -1552,7 +1834,7 @@ static void map_rect_destroy_binfile(struct map_rect_priv *mr) {
     dbg(lvl_debug,"size=%d kb",mr->size/1024);
 #endif
     if (mr->tiles[0].fi && mr->tiles[0].start)
-        file_data_free(mr->tiles[0].fi, (unsigned char *)(mr->tiles[0].start));
+        binfile_tile_free(mr->m, &mr->tiles[0]);
     g_free(mr->url);
     map_binfile_http_close(mr->m);
     g_free(mr);
@@ -1628,11 +1910,83 @@ static void map_parse_country_binfile(struct map_rect_priv *mr) {
     push_zipfile_tile(mr, at.u.num, 0, 0, 0);
 }
 
+static int binfile_tile_cache_contains(struct map_priv *m, int zipdsk, long long offset) {
+    struct binfile_tile_cache_entry key;
+    int ret;
+    key.zipdsk=zipdsk;
+    key.offset=offset;
+    thread_lock_acquire(m->tile_cache_lock);
+    ret=g_hash_table_lookup(m->tile_cache, &key) != NULL;
+    thread_lock_release(m->tile_cache_lock);
+    return ret;
+}
+
+/**
+ * @brief Issues read ahead hints for the zip members of the submaps of the current tile.
+ *
+ * Called when the first submap of a tile is reached. All remaining submaps of the tile that
+ * match the selection are hinted at once, so the operating system can read their data while
+ * the earlier ones are being decoded.
+ *
+ * @param mr The map rect
+ */
+static void binfile_hint_submaps(struct map_rect_priv *mr) {
+    struct map_priv *m=mr->m;
+    struct tile *t=mr->t;
+    long long cdoffset=m->eoc64?m->eoc64->zip64eofst:m->eoc->zipeofst;
+    int *pos,*attr,*end;
+    struct coord_rect r;
+    struct range mima;
+    struct zip_cd *cd;
+    int zipfile;
+
+    t->submaps_hinted=1;
+    for (pos=t->pos ; pos < t->end ; pos+=le32_to_cpu(pos[0])+1) {
+        if (le32_to_cpu(pos[0]) < 2 || le32_to_cpu(pos[1]) != type_submap || le32_to_cpu(pos[2]) < 4)
+            continue;
+        r.lu.x=le32_to_cpu(pos[3]);
+        r.rl.y=le32_to_cpu(pos[4]);
+        r.rl.x=le32_to_cpu(pos[5]);
+        r.lu.y=le32_to_cpu(pos[6]);
+        mima.min=mima.max=0;
+        zipfile=-1;
+        end=pos+le32_to_cpu(pos[0])+1;
+        for (attr=pos+3+le32_to_cpu(pos[2]) ; attr < end ; attr+=le32_to_cpu(attr[0])+1) {
+            if (le32_to_cpu(attr[1]) == attr_order) {
+                struct attr at;
+                at.type=attr_order;
+                attr_data_set_le(&at, attr+2);
+#if __BYTE_ORDER == __BIG_ENDIAN
+                mima.min=le16_to_cpu(at.u.range.max);
+                mima.max=le16_to_cpu(at.u.range.min);
+#else
+                mima=at.u.range;
+#endif
+            } else if (le32_to_cpu(attr[1]) == attr_zipfile_ref)
+                zipfile=le32_to_cpu(attr[2]);
+        }
+        if (zipfile < 0 || zipfile >= m->zip_members || !selection_contains(mr->sel, &r, &mima))
+            continue;
+        cd=(struct zip_cd *)file_data_read(m->fi, cdoffset + zipfile*m->cde_size, m->cde_size);
+        if (!cd)
+            continue;
+        cd_to_cpu(cd);
+        if (cd->zipcunc && !binfile_tile_cache_contains(m, cd->zipdsk, binfile_cd_offset(cd))) {
+            /* The local header may carry a different extra field than the cd, allow for some slack */
+            file_data_prefetch(m->fis ? m->fis[cd->zipdsk] : m->fi, binfile_cd_offset(cd),
+                               sizeof(struct zip_lfh)+cd->zipcfnl+cd->zipcxtl+cd->zipcsiz+64);
+        }
+        file_data_free(m->fi, (unsigned char *)cd);
+    }
+}
+
 static int map_parse_submap(struct map_rect_priv *mr, int async) {
     struct coord_rect r;
     struct coord c[2];
     struct attr at;
     struct range mima;
+    if (mr->m->eoc && !mr->t->submaps_hinted)
+        binfile_hint_submaps(mr);
     if (binfile_coord_get(mr->item.priv_data, c, 2) != 2)
         return 0;
     r.lu.x=c[0].x;
@@ -1915,6 +2269,126 @@ static int binmap_get_estimated_boundaries (struct item *town, GList **boundarie
     return 0;
 }
 
+/**
+ * @brief Finds the search index which maptool wrote for a country.
+ *
+ * @param map The map
+ * @param country_id The id of the country
+ * @return The zip member of the search index, or -1 if the map has none
+ */
+static int binmap_search_index_ref(struct map_priv *map, int country_id) {
+    struct map_rect_priv *mr=map_rect_new_binfile_int(map, NULL);
+    struct attr at;
+    int ret=-1;
+
+    if (!mr)
+        return -1;
+    if (!push_zipfile_tile(mr, map->zip_members-1, 0, 0, 0)) {
+        struct tile *t=mr->t;
+        while (ret == -1 && t->pos_next < t->end) {
+            t->pos=t->pos_next;
+            setup_pos(mr);
+            binfile_attr_rewind(mr);
+            if (mr->item.type == type_countryindex && binfile_attr_get(mr, attr_country_id, &at) && at.u.num == country_id
+                    && binfile_attr_get(mr, attr_search_index_ref, &at))
+                ret=at.u.num;
+        }
+    }
+    map_rect_destroy_binfile(mr);
+    return ret;
+}
+
+/**
+ * @brief Returns the key of a search index entry.
+ *
+ * @param msp The search
+ * @param entry The entry
+ * @return The key, or NULL if its offset lies outside of the string table
+ */
+static char *binmap_search_index_key(struct map_search_priv *msp, int *entry) {
+    unsigned int offset=le32_to_cpu(entry[2]);
+    if (offset >= (unsigned int)msp->index_keys_size)
+        return NULL;
+    return msp->index_keys+offset;
+}
+
+static int binmap_search_index_compare(struct map_search_priv *msp, int *entry) {
+    char *key=binmap_search_index_key(msp, entry);
+    /* Corrupt entries are skipped by binmap_search_index_get_item(), any order will do for them */
+    if (!key)
+        return -1;
+    if (msp->partial)
+        return strncmp(key, msp->search.u.str, strlen(msp->search.u.str));
+    return strcmp(key, msp->search.u.str);
+}
+
+/**
+ * @brief Looks up a town or district search in the search index of the country.
+ *
+ * The entries of the index are sorted by their casefolded key, so the range of entries matching the
+ * search string is found with two binary searches. The items are then fetched by id while iterating
+ * over this range in binmap_search_index_get_item(). The index holds the same keys the scan in
+ * binmap_search_get_item() compares, so both find the same towns and districts. Streets are not
+ * indexed and are always searched by scanning the street tiles of the town.
+ *
+ * @param msp The search, with the casefolded search string
+ * @param map The map
+ * @param country_id The id of the country
+ * @return True if the index is used, false if the map has no index and the country parts need to be scanned
+ */
+static int binmap_search_index_new(struct map_search_priv *msp, struct map_priv *map, int country_id) {
+    int ref=binmap_search_index_ref(map, country_id);
+    int *entries,count,lo,hi,mid;
+    struct tile *t;
+
+    if (ref == -1)
+        return 0;
+    msp->index_mr=map_rect_new_binfile_int(map, NULL);
+    if (push_zipfile_tile(msp->index_mr, ref, 0, 0, 0)) {
+        map_rect_destroy_binfile(msp->index_mr);
+        msp->index_mr=NULL;
+        return 0;
+    }
+    t=msp->index_mr->t;
+    count=t->end > t->start ? le32_to_cpu(t->start[0]) : -1;
+    if (count < 0 || count > (t->end-t->start-1)/3) {
+        dbg(lvl_error,"invalid search index %d in %s", ref, map->filename);
+        map_rect_destroy_binfile(msp->index_mr);
+        msp->index_mr=NULL;
+        return 0;
+    }
+    entries=t->start+1;
+    msp->index_keys=(char *)(entries+count*3);
+    msp->index_keys_size=(char *)t->end-msp->index_keys;
+    if (msp->index_keys_size <= 0 || msp->index_keys[msp->index_keys_size-1]) {
+        dbg(lvl_error,"invalid search index %d in %s", ref, map->filename);
+        map_rect_destroy_binfile(msp->index_mr);
+        msp->index_mr=NULL;
+        return 0;
+    }
+    lo=0;
+    hi=count;
+    while (lo < hi) {
+        mid=lo+(hi-lo)/2;
+        if (binmap_search_index_compare(msp, entries+mid*3) < 0)
+            lo=mid+1;
+        else
+            hi=mid;
+    }
+    msp->index_pos=lo;
+    hi=count;
+    while (lo < hi) {
+        mid=lo+(hi-lo)/2;
+        if (binmap_search_index_compare(msp, entries+mid*3) <= 0)
+            lo=mid+1;
+        else
+            hi=mid;
+    }
+    msp->index_end=lo;
+    dbg(lvl_debug,"search index %d: %d of %d entries match", ref, msp->index_end-msp->index_pos, count);
+    return 1;
+}
+
 static struct map_search_priv *binmap_search_new(struct map_priv *map, struct item *item, struct attr *search,
         int partial) {
     struct map_rect_priv *map_rec;
@@ -1937,6 +2411,10 @@ static struct map_search_priv *binmap_search_new(struct map_priv *map, struct it
     case attr_town_name:
     case attr_town_or_district_name:
     case attr_town_postal:
+        if (search->type != attr_town_postal && binmap_search_index_new(msp, map, item->id_lo)) {
+            msp->mr=map_rect_new_binfile_int(map, NULL);
+            return msp;
+        }
         map_rec = map_rect_new_binfile(map, NULL);
         if (!map_rec)
             break;
@@ -2153,11 +2631,30 @@ static int item_inside_poly_list(struct item *it, GList *l) {
     return 0;
 }
 
+static struct item *binmap_search_index_get_item(struct map_search_priv *msp) {
+    struct item *it;
+    int *entry;
+
+    while (msp->index_pos < msp->index_end) {
+        entry=msp->index_mr->t->start+1+msp->index_pos++*3;
+        if (!binmap_search_index_key(msp, entry))
+            continue;
+        it=map_rect_get_item_byid_binfile(msp->mr, le32_to_cpu(entry[0]), le32_to_cpu(entry[1]));
+        if (item_is_town(*it) && msp->search.type != attr_district_name && !duplicate(msp, it, attr_town_name,0))
+            return it;
+        if (item_is_district(*it) && msp->search.type != attr_town_name && !duplicate(msp, it, attr_town_name,0))
+            return it;
+    }
+    return NULL;
+}
+
 static struct item *binmap_search_get_item(struct map_search_priv *map_search) {
     struct item* it;
     struct attr at;
     enum linguistics_cmp_mode mode=(map_search->partial?linguistics_cmp_partial:0);
 
+    if (map_search->index_mr)
+        return binmap_search_index_get_item(map_search);
     for (;;) {
         while ((it  = map_rect_get_item_binfile(map_search->mr))) {
             int has_house_number=0;
@@ -2325,6 +2822,8 @@ static void binmap_search_destroy(struct map_search_priv *ms) {
         map_rect_destroy_binfile(ms->mr_item);
     if (ms->mr)
         map_rect_destroy_binfile(ms->mr);
+    if (ms->index_mr)
+        map_rect_destroy_binfile(ms->index_mr);
     while(ms->boundaries) {
         geom_poly_segment_destroy(ms->boundaries->data, NULL);
         ms->boundaries=g_list_delete_link(ms->boundaries,ms->boundaries);
@@ -2346,6 +2845,23 @@ static int binmap_get_attr(struct map_priv *m, enum attr_type type, struct attr
             attr->u.str=m->progress;
             return 1;
         }
+        break;
+    case attr_tile_cache_hits:
+        attr->u.num=binfile_tile_cache_stat(m, &m->tile_cache_hits);
+        return 1;
+    case attr_tile_cache_misses:
+        attr->u.num=binfile_tile_cache_stat(m, &m->tile_cache_misses);
+        return 1;
+    case attr_tile_prefetched:
+        attr->u.num=binfile_tile_cache_stat(m, &m->tile_prefetched);
+        return 1;
+    case attr_tile_prefetch_hits:
+        attr->u.num=binfile_tile_cache_stat(m, &m->tile_prefetch_hits);
+        return 1;
+    case attr_static_data:
+        /* Maps downloaded on demand, with local changes or reloaded when the file changes can change while they are shown */
+        attr->u.num=!m->url && !m->changes && !m->check_version;
+        return 1;
     default:
         break;
     }
@@ -2363,6 +2879,36 @@ static int binmap_set_attr(struct map_priv *map, struct attr *attr) {
 
 }
 
+/**
+ * @brief Loads all tiles of a selection into the tile cache.
+ *
+ * Walks the selection like a map_rect would, so the tiles stay in the tile cache for the
+ * map_rects opened later on. Maps which are downloaded on demand are not prefetched.
+ *
+ * @param m The map
+ * @param sel The selection to load
+ * @return True if the selection was loaded
+ */
+static int binmap_prefetch(struct map_priv *m, struct map_selection *sel) {
+    struct map_rect_priv *mr;
+    struct item *item;
+    int prefetched;
+
+    /* The same maps as for attr_static_data, opening a map_rect of any other map may reopen the file */
+    if (m->url || m->changes || m->check_version || !m->eoc)
+        return 0;
+    mr=map_rect_new_binfile_mode(m, sel, 1);
+    if (!mr)
+        return 0;
+    prefetched=binfile_tile_cache_stat(m, &m->tile_prefetched);
+    while ((item=map_rect_get_item_binfile(mr)) && item != &busy_item);
+    map_rect_destroy_binfile(mr);
+    dbg(lvl_debug,"%s: prefetched %d tiles, %d of %d prefetched tiles used", m->filename,
+        binfile_tile_cache_stat(m, &m->tile_prefetched)-prefetched, binfile_tile_cache_stat(m, &m->tile_prefetch_hits),
+        binfile_tile_cache_stat(m, &m->tile_prefetched));
+    return 1;
+}
+
 static struct map_methods map_methods_binfile = {
     projection_mg,
     "utf-8",
@@ -2377,6 +2923,7 @@ static struct map_methods map_methods_binfile = {
     NULL,
     binmap_get_attr,
     binmap_set_attr,
+    binmap_prefetch,
 };
 
 static int binfile_get_index(struct map_priv *m) {
@@ -2610,20 +3157,26 @@ static int map_binfile_open(struct map_priv *m) {
 
 static void map_binfile_close(struct map_priv *m) {
     int i;
+    GList *files=NULL;
+    if (m->fis) {
+        for (i = 0 ; i < m->eoc->zipedsk ; i++) {
+            files=g_list_append(files, m->fis[i]);
+        }
+    } else
+        files=g_list_append(files, m->fi);
     file_data_free(m->fi, (unsigned char *)m->index_cd);
     file_data_free(m->fi, (unsigned char *)m->eoc);
     file_data_free(m->fi, (unsigned char *)m->eoc64);
     g_free(m->cachedir);
     g_free(m->map_release);
-    if (m->fis) {
-        for (i = 0 ; i < m->eoc->zipedsk ; i++) {
-            file_destroy(m->fis[i]);
-        }
-    } else
-        file_destroy(m->fi);
+    binfile_tile_cache_flush(m, files);
 }
 
 static void map_binfile_destroy(struct map_priv *m) {
+    if (m->tile_cache) {
+        g_hash_table_destroy(m->tile_cache);
+        thread_lock_destroy(m->tile_cache_lock);
+    }
     g_free(m->filename);
     g_free(m->url);
     g_free(m->progress);
@@ -2662,6 +3215,8 @@ static struct map_priv *map_new_binfile(struct map_methods *meth, struct attr **
     m=g_new0(struct map_priv, 1);
     m->cbl=cbl;
     m->id=++map_id;
+    m->tile_cache=g_hash_table_new(binfile_tile_cache_hash, binfile_tile_cache_equal);
+    m->tile_cache_lock=thread_lock_new();
     m->filename=g_strdup(wexp_data[0]);
     file_wordexp_destroy(wexp);
     check_version=attr_search(attrs, NULL, attr_check_version);
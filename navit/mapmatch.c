@@ -0,0 +1,457 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ * @brief Matches recorded GPS tracks to the streets of the map.
+ *
+ * Unlike the tracking, which has to decide on every fix as it comes in, this matcher looks at the whole
+ * track with a hidden Markov model: the streets near each fix are the states, a fix is more likely
+ * the closer it is to the street (emission), and a step between two fixes is more likely the closer the
+ * distance along the streets is to the distance between the fixes (transition). The Viterbi algorithm
+ * then finds the most likely sequence of streets.
+ *
+ * The matcher works on a stream of fixes with bounded memory: a fix is decided as soon as all paths
+ * through the newer fixes share it, and at the latest after `MAPMATCH_WINDOW` fixes. The streets are
+ * looked up through the tracking lines and segment index of a private tracking object, and the distances
+ * along the streets are searched on its tracking lines.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <glib.h>
+#ifdef _POSIX_C_SOURCE
+#include <sys/types.h>
+#endif
+#include <sys/time.h>
+#include "config.h"
+#include "debug.h"
+#include "coord.h"
+#include "item.h"
+#include "attr.h"
+#include "map.h"
+#include "mapset.h"
+#include "projection.h"
+#include "transform.h"
+#include "callback.h"
+#include "util.h"
+#include "track.h"
+#include "mapmatch.h"
+
+/** Maximum number of streets considered for a fix */
+#define MAPMATCH_CANDIDATES 8
+/** Maximum number of undecided fixes */
+#define MAPMATCH_WINDOW 64
+/** Radius around a fix in which streets are considered, in meters */
+#define MAPMATCH_RADIUS 50
+/** Standard deviation of the GPS position, in meters */
+#define MAPMATCH_SIGMA 5.0
+/** Scale of the difference between the distance along the streets and between the fixes, in meters */
+#define MAPMATCH_BETA 5.0
+/** Distance between two fixes in meters above which the track is treated as interrupted */
+#define MAPMATCH_GAP 2000
+/** Detour in meters, in addition to twice the distance between two fixes, up to which streets are searched */
+#define MAPMATCH_DETOUR 200
+
+struct mapmatch_state {
+    struct tracking_candidate cand;
+    double cost;                        /**< Cost of the best path ending in this state */
+    int prev;                           /**< Index of the previous state on that path, -1 if none */
+};
+
+struct mapmatch_step {
+    int time;
+    struct coord in;
+    int count;                          /**< Number of states */
+    int chosen;                         /**< The state chosen when the step is decided */
+    struct mapmatch_state states[MAPMATCH_CANDIDATES];
+};
+
+struct mapmatch {
+    struct tracking *tracking;
+    enum projection pro;
+    struct callback *cb;
+    struct mapmatch_step steps[MAPMATCH_WINDOW];    /**< Ring buffer of the undecided fixes */
+    int first;                          /**< Index of the oldest undecided fix in `steps` */
+    int count;                          /**< Number of undecided fixes */
+};
+
+/**
+ * @brief Creates a new map matcher
+ *
+ * @param ms The mapset to match against
+ * @param pro The projection of the streets of the mapset
+ * @param cb Called with a `struct mapmatch_point *` for every fix, in order, once it has been decided
+ * @return The new map matcher
+ */
+struct mapmatch *mapmatch_new(struct mapset *ms, enum projection pro, struct callback *cb) {
+    struct mapmatch *this_=g_new0(struct mapmatch, 1);
+    this_->tracking=tracking_new(NULL, NULL);
+    tracking_set_mapset(this_->tracking, ms);
+    this_->pro=pro;
+    this_->cb=cb;
+    return this_;
+}
+
+static struct mapmatch_step *mapmatch_step(struct mapmatch *this_, int i) {
+    return &this_->steps[(this_->first+i) % MAPMATCH_WINDOW];
+}
+
+static double mapmatch_distance(struct coord *c1, struct coord *c2) {
+    double dx=c1->x-c2->x, dy=c1->y-c2->y;
+    return navit_sqrt(dx*dx+dy*dy);
+}
+
+static void mapmatch_emit(struct mapmatch *this_, struct mapmatch_step *step) {
+    struct mapmatch_point p;
+
+    p.time=step->time;
+    p.in=step->in;
+    if (step->count) {
+        struct mapmatch_state *state=&step->states[step->chosen];
+        p.out=state->cand.lpnt;
+        p.item=&state->cand.item;
+        p.pos=state->cand.pos;
+    } else {
+        p.out=step->in;
+        p.item=NULL;
+        p.pos=0;
+    }
+    callback_call_1(this_->cb, &p);
+}
+
+/**
+ * @brief Decides the oldest `count` fixes along the path ending in state `chosen` of the last of them
+ *
+ * `chosen` is an index into the states of fix `count-1`, the earlier fixes follow its `prev` links.
+ */
+static void mapmatch_decide(struct mapmatch *this_, int count, int chosen) {
+    int i;
+
+    for (i = count-1 ; i >= 0 ; i--) {
+        struct mapmatch_step *step=mapmatch_step(this_, i);
+        step->chosen=chosen;
+        chosen=step->count ? step->states[chosen].prev : -1;
+        if (chosen < 0 && i)
+            chosen=0;
+    }
+    for (i = 0 ; i < count ; i++)
+        mapmatch_emit(this_, mapmatch_step(this_, i));
+    this_->first=(this_->first+count) % MAPMATCH_WINDOW;
+    this_->count-=count;
+}
+
+/**
+ * @brief Decides the fixes which all remaining paths agree on
+ */
+static void mapmatch_converge(struct mapmatch *this_) {
+    struct mapmatch_step *step=mapmatch_step(this_, this_->count-1);
+    unsigned int mask=(1 << step->count)-1, prev_mask;
+    int i,j,single;
+
+    for (i = this_->count-1 ; i > 0 ; i--) {
+        step=mapmatch_step(this_, i);
+        prev_mask=0;
+        for (j = 0 ; j < step->count ; j++)
+            if ((mask & (1 << j)) && step->states[j].prev >= 0)
+                prev_mask|=1 << step->states[j].prev;
+        mask=prev_mask;
+        if (mask && !(mask & (mask-1))) {
+            for (single = 0 ; !(mask & (1 << single)) ; single++);
+            mapmatch_decide(this_, i, single);
+            return;
+        }
+    }
+}
+
+static int mapmatch_best(struct mapmatch_step *step) {
+    int i,best=0;
+    for (i = 1 ; i < step->count ; i++)
+        if (step->states[i].cost < step->states[best].cost)
+            best=i;
+    return best;
+}
+
+/**
+ * @brief Decides all pending fixes along the best path
+ *
+ * @param this_ The map matcher
+ */
+void mapmatch_flush(struct mapmatch *this_) {
+    if (this_->count)
+        mapmatch_decide(this_, this_->count, mapmatch_best(mapmatch_step(this_, this_->count-1)));
+}
+
+/**
+ * @brief Adds the next fix of the track
+ *
+ * @param this_ The map matcher
+ * @param g The position of the fix
+ * @param time The time of the fix, in seconds since the epoch
+ */
+void mapmatch_add(struct mapmatch *this_, struct coord_geo *g, int time) {
+    struct tracking_candidate cand[MAPMATCH_CANDIDATES],prev_cand[MAPMATCH_CANDIDATES];
+    struct mapmatch_step *step,*prev=NULL;
+    struct coord c;
+    double scale,min,gc=0;
+    double route[MAPMATCH_CANDIDATES*MAPMATCH_CANDIDATES];
+    int count,i,j;
+
+    transform_from_geo(this_->pro, g, &c);
+    scale=transform_scale(c.y);
+    count=tracking_get_candidates(this_->tracking, &c, this_->pro, MAPMATCH_RADIUS*scale, cand, MAPMATCH_CANDIDATES);
+    if (this_->count) {
+        prev=mapmatch_step(this_, this_->count-1);
+        if (!count || mapmatch_distance(&prev->in, &c) > MAPMATCH_GAP*scale) {
+            mapmatch_flush(this_);
+            prev=NULL;
+        }
+    }
+    if (this_->count == MAPMATCH_WINDOW) {
+        int chosen=mapmatch_best(prev);
+        for (i = this_->count-1 ; i > 0 ; i--) {
+            chosen=mapmatch_step(this_, i)->states[chosen].prev;
+            if (chosen < 0)
+                chosen=0;
+        }
+        mapmatch_decide(this_, 1, chosen);
+    }
+    step=mapmatch_step(this_, this_->count++);
+    step->time=time;
+    step->in=c;
+    step->count=count;
+    if (!count) {
+        mapmatch_decide(this_, 1, 0);
+        return;
+    }
+    if (prev) {
+        gc=mapmatch_distance(&prev->in, &c);
+        for (i = 0 ; i < prev->count ; i++)
+            prev_cand[i]=prev->states[i].cand;
+        tracking_get_candidate_distances(this_->tracking, prev_cand, prev->count, cand, count,
+                                         2*gc+MAPMATCH_DETOUR*scale, route);
+    }
+    min=-1;
+    for (j = 0 ; j < count ; j++) {
+        struct mapmatch_state *state=&step->states[j];
+        double d=navit_sqrt(cand[j].dist_sq)/scale;
+        state->cand=cand[j];
+        state->cost=d*d/(2*MAPMATCH_SIGMA*MAPMATCH_SIGMA);
+        state->prev=-1;
+        if (prev) {
+            double best=-1;
+            for (i = 0 ; i < prev->count ; i++) {
+                double cost=prev->states[i].cost+fabs(route[i*count+j]-gc)/(MAPMATCH_BETA*scale);
+                if (best < 0 || cost < best) {
+                    best=cost;
+                    state->prev=i;
+                }
+            }
+            state->cost+=best;
+        }
+        if (min < 0 || state->cost < min)
+            min=state->cost;
+    }
+    for (j = 0 ; j < count ; j++)
+        step->states[j].cost-=min;
+    mapmatch_converge(this_);
+}
+
+/**
+ * @brief Destroys a map matcher, pending fixes are dropped
+ *
+ * @param this_ The map matcher
+ */
+void mapmatch_destroy(struct mapmatch *this_) {
+    tracking_destroy(this_->tracking);
+    g_free(this_);
+}
+
+struct mapmatch_file {
+    FILE *out;
+    enum projection pro;
+    int points, matched;
+    struct item street;                 /**< The street of the current run of fixes, type_none if unmatched */
+    int street_start, street_end;       /**< Time of the first and last fix on `street` */
+    int street_points;                  /**< Number of fixes on `street` */
+};
+
+static void mapmatch_file_street(struct mapmatch_file *f) {
+    struct map_rect *mr;
+    struct item *item;
+    struct attr label;
+    char *str=NULL;
+
+    if (f->street.type == type_none)
+        return;
+    mr=map_rect_new(f->street.map, NULL);
+    if (mr) {
+        item=map_rect_get_item_byid(mr, f->street.id_hi, f->street.id_lo);
+        if (item && item_attr_get(item, attr_label, &label))
+            str=g_strdup(label.u.str);
+        map_rect_destroy(mr);
+    }
+    fprintf(f->out, "street\t0x%x\t0x%x\t%d\t%d\t%d\t%s\n", f->street.id_hi, f->street.id_lo, f->street_start,
+            f->street_end, f->street_points, str ? str : "");
+    g_free(str);
+    f->street.type=type_none;
+}
+
+static void mapmatch_file_point(struct mapmatch_file *f, struct mapmatch_point *p) {
+    struct coord_geo in,out;
+
+    transform_to_geo(f->pro, &p->in, &in);
+    transform_to_geo(f->pro, &p->out, &out);
+    f->points++;
+    if (p->item)
+        f->matched++;
+    if (!p->item || !item_is_equal(*p->item, f->street)) {
+        mapmatch_file_street(f);
+        if (p->item) {
+            f->street=*p->item;
+            f->street_start=p->time;
+            f->street_points=0;
+        }
+    }
+    if (p->item) {
+        f->street_end=p->time;
+        f->street_points++;
+        fprintf(f->out, "point\t%d\t%.6f\t%.6f\t%.6f\t%.6f\t0x%x\t0x%x\t%d\n", p->time, in.lat, in.lng, out.lat,
+                out.lng, p->item->id_hi, p->item->id_lo, p->pos);
+    } else
+        fprintf(f->out, "point\t%d\t%.6f\t%.6f\n", p->time, in.lat, in.lng);
+}
+
+static double mapmatch_file_nmea_coord(char *str, char *dir) {
+    double val=g_ascii_strtod(str, NULL);
+    double deg=floor(val/100);
+    deg+=(val-deg*100)/60;
+    if (*dir == 'S' || *dir == 'W')
+        deg=-deg;
+    return deg;
+}
+
+/**
+ * @brief Parses a $GPRMC sentence
+ *
+ * @return True if the sentence contains a valid fix
+ */
+static int mapmatch_file_nmea(char *line, struct coord_geo *g, int *time) {
+    char *item[10],*p=line;
+    char iso8601[32];
+    int i;
+
+    for (i = 0 ; i < 10 ; i++) {
+        item[i]=p;
+        p=strchr(p, ',');
+        if (!p && i < 9)
+            return 0;
+        if (p)
+            *p++='\0';
+    }
+    if (strcmp(item[2], "A") || strlen(item[1]) < 6 || strlen(item[9]) < 6)
+        return 0;
+    g->lat=mapmatch_file_nmea_coord(item[3], item[4]);
+    g->lng=mapmatch_file_nmea_coord(item[5], item[6]);
+    g_snprintf(iso8601, sizeof(iso8601), "20%.2s-%.2s-%.2sT%.2s:%.2s:%.2sZ", item[9]+4, item[9]+2, item[9], item[1],
+               item[1]+2, item[1]+4);
+    *time=iso8601_to_secs(iso8601);
+    return 1;
+}
+
+/**
+ * @brief Matches a recorded track to the streets of a mapset
+ *
+ * The track may be an NMEA log, of which the $GPRMC (or $GNRMC) sentences are used, or a GPX file as
+ * written by the GPX log. For every fix, a `point` line with its time, position and, if it could be
+ * matched, the matched position, street item and segment is written to `out`. Every run of fixes on the
+ * same street is followed by a `street` line with the item, the time of the first and the last fix,
+ * the number of fixes and the name of the street. The file ends with a comment giving the throughput.
+ *
+ * @param ms The mapset to match against
+ * @param in The track file
+ * @param out The result file
+ * @return The number of fixes, -1 if a file could not be opened
+ */
+int mapmatch_file(struct mapset *ms, const char *in, const char *out) {
+    struct mapmatch_file f;
+    struct mapmatch *mm;
+    struct callback *cb;
+    struct coord_geo g;
+    struct timeval start,end;
+    char line[4096],*p;
+    int time=0,trkpt=0;
+    double secs;
+    FILE *fin;
+
+    memset(&f, 0, sizeof(f));
+    fin=fopen(in, "r");
+    if (!fin) {
+        dbg(lvl_error,"failed to open %s", in);
+        return -1;
+    }
+    f.out=fopen(out, "w");
+    if (!f.out) {
+        dbg(lvl_error,"failed to open %s", out);
+        fclose(fin);
+        return -1;
+    }
+    f.pro=projection_mg;
+    f.street.type=type_none;
+    cb=callback_new_1(callback_cast(mapmatch_file_point), &f);
+    mm=mapmatch_new(ms, f.pro, cb);
+    gettimeofday(&start, NULL);
+    while (fgets(line, sizeof(line), fin)) {
+        if (line[0] == '$' && !strncmp(line+3, "RMC,", 4)) {
+            if (mapmatch_file_nmea(line, &g, &time))
+                mapmatch_add(mm, &g, time);
+        } else if ((p=strstr(line, "<trkpt "))) {
+            char *lat=strstr(p, "lat=\""), *lon=strstr(p, "lon=\"");
+            if (lat && lon) {
+                g.lat=g_ascii_strtod(lat+5, NULL);
+                g.lng=g_ascii_strtod(lon+5, NULL);
+                trkpt=1;
+            }
+        }
+        if (trkpt && (p=strstr(line, "<time>"))) {
+            char *e=strstr(p, "</time>");
+            char *str=e ? g_strndup(p+6, e-p-6) : g_strdup(p+6);
+            time=iso8601_to_secs(str);
+            g_free(str);
+        }
+        if (trkpt && strstr(line, "</trkpt>")) {
+            mapmatch_add(mm, &g, time);
+            trkpt=0;
+        }
+    }
+    mapmatch_flush(mm);
+    mapmatch_file_street(&f);
+    gettimeofday(&end, NULL);
+    secs=end.tv_sec-start.tv_sec+(end.tv_usec-start.tv_usec)/1000000.0;
+    fprintf(f.out, "# %d points, %d matched, %.3f s, %.0f points/s\n", f.points, f.matched, secs,
+            secs > 0 ? f.points/secs : 0);
+    dbg(lvl_info,"%d points, %d matched, %.3f s, %.0f points/s", f.points, f.matched, secs,
+        secs > 0 ? f.points/secs : 0);
+    mapmatch_destroy(mm);
+    callback_destroy(cb);
+    fclose(f.out);
+    fclose(fin);
+    return f.points;
+}
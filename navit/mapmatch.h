@@ -0,0 +1,54 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef NAVIT_MAPMATCH_H
+#define NAVIT_MAPMATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief A matched position, as passed to the callback of the map matcher
+ */
+struct mapmatch_point {
+    int time;                   /**< Time of the fix, in seconds since the epoch */
+    struct coord in;            /**< The position of the fix */
+    struct coord out;           /**< The matched position, `in` if the fix could not be matched */
+    struct item *item;          /**< The matched street, NULL if the fix could not be matched */
+    int pos;                    /**< Index of the first coordinate of the matched segment */
+};
+
+/* prototypes */
+enum projection;
+struct callback;
+struct coord_geo;
+struct mapmatch;
+struct mapset;
+struct mapmatch *mapmatch_new(struct mapset *ms, enum projection pro, struct callback *cb);
+void mapmatch_add(struct mapmatch *this_, struct coord_geo *g, int time);
+void mapmatch_flush(struct mapmatch *this_);
+void mapmatch_destroy(struct mapmatch *this_);
+int mapmatch_file(struct mapset *ms, const char *in, const char *out);
+/* end of prototypes */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -417,6 +417,7 @@ void ch_generate_tiles(char *map_suffix, char *suffix, FILE *tilesdir_out, struc
     info.suffix=suffix;
     info.tiles_list=NULL;
     info.tilesdir_out=tilesdir_out;
+    info.spill=NULL;
     graphfiles=g_alloca(sizeof(FILE*)*(ch_levels+1));
 
     ch_create_tempfiles(suffix, graphfiles, ch_levels, 1);
@@ -454,6 +455,7 @@ void ch_assemble_map(char *map_suffix, char *suffix, struct zip_info *zip_info)
     info.suffix=suffix;
     info.tiles_list=NULL;
     info.tilesdir_out=NULL;
+    info.spill=NULL;
     ref=tempfile(suffix,"sgr_ref",1);
 
     create_tile_hash();
@@ -500,11 +502,13 @@ void ch_assemble_map(char *map_suffix, char *suffix, struct zip_info *zip_info)
                 fprintf(stderr,"Size error '%s': %d vs %d\n", th->name, th->total_size, th->total_size_used);
                 exit(1);
             }
-            write_zipmember(zip_info, th->name, zip_get_maxnamelen(zip_info), th->zip_data, th->total_size);
+            zip_queue_member(zip_info, th->name, zip_get_maxnamelen(zip_info), th->zip_data, th->total_size);
         } else {
             fwrite(th->zip_data, th->total_size, 1, zip_get_index(zip_info));
         }
-        g_free(th->zip_data);
         th=th->next;
     }
+    zip_flush_members(zip_info);
+    for (th=tile_head_root ; th ; th=th->next)
+        g_free(th->zip_data);
 }
@@ -63,6 +63,8 @@ char* experimental_feature_description =
     "Move coastline data to order 6 tiles. Makes map look more smooth, but may affect drawing/searching performance."; /* add description here */
 /** Indicates if experimental features (if available) were enabled. */
 int experimental;
+/** Assemble the tiles with a single pass over the input, using spill files for the slices. */
+int spill_tiles;
 
 struct buffer node_buffer = {
     64*1024*1024,
@@ -293,6 +295,8 @@ static void usage(void) {
             experimental_feature_description ? experimental_feature_description : "-not available in this version-");
     fprintf(f,"-i (--input-file) <file>          : specify the input file name (OSM), overrules default stdin\n");
     fprintf(f,"-k (--keep-tmpfiles)              : do not delete tmp files after processing. useful to reuse them\n");
+    fprintf(f,
+            "-l (--spill-tiles)                : read the input only once when assembling tiles larger than the slice size, using spill files\n");
     fprintf(f,"-M (--o5m)                        : input data is in o5m format\n");
     fprintf(f,"-n (--ignore-unknown)             : do not output ways and nodes with unknown type\n");
     fprintf(f,"-N (--nodes-only)                 : process only nodes\n");
@@ -374,6 +378,7 @@ static int parse_option(struct maptool_params *p, char **argv, int argc, int *op
         {"experimental", 0, 0, 'E'},
         {"help", 0, 0, 'h'},
         {"keep-tmpfiles", 0, 0, 'k'},
+        {"spill-tiles", 0, 0, 'l'},
         {"nodes-only", 0, 0, 'N'},
         {"map", 1, 0, 'm'},
         {"o5m", 0, 0, 'M'},
@@ -396,7 +401,7 @@ static int parse_option(struct maptool_params *p, char **argv, int argc, int *op
 #ifdef HAVE_POSTGRESQL
                      "d:"
 #endif
-                     "e:hi:knm:p:r:s:t:T:wu:z:Ux:", long_options, option_index);
+                     "e:hi:klnm:p:r:s:t:T:wu:z:Ux:", long_options, option_index);
     if (c == -1)
         return 1;
     switch (c) {
@@ -492,6 +497,9 @@ static int parse_option(struct maptool_params *p, char **argv, int argc, int *op
         fprintf(stderr,"I will KEEP tmp files\n");
         p->keep_tmpfiles=1;
         break;
+    case 'l':
+        spill_tiles=1;
+        break;
     case 'p':
         add_plugin(optarg);
         break;
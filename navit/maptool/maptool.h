@@ -54,6 +54,7 @@ struct tile_info {
     char *suffix;
     GList **tiles_list;
     FILE *tilesdir_out;
+    struct buffer *spill; /* if set, items of tiles without zip_data are collected per slice, see spill_append() */
 };
 
 extern struct tile_head {
@@ -64,6 +65,8 @@ extern struct tile_head {
     int total_size_used;
     int zipnum;
     int process;
+    int slice;
+    long long slice_offset;
     struct tile_head *next;
     // char subtiles[0];
 } *tile_head_root;
@@ -252,6 +255,7 @@ extern int bytes_read;
 extern int overlap;
 extern int unknown_country;
 extern int experimental;
+extern int spill_tiles;
 void sig_alrm(int sig);
 void sig_alrm_end(void);
 
@@ -269,6 +273,7 @@ void phase1_map(GList *maps, FILE *out_ways, FILE *out_nodes);
 void dump(FILE *in);
 int phase4(FILE **in, int in_count, int with_range, char *suffix, FILE *tilesdir_out, struct zip_info *zip_info);
 int phase5(FILE **in, FILE **references, int in_count, int with_range, char *suffix, struct zip_info *zip_info);
+void spill_append(struct tile_info *info, int slice, void *data, int len);
 void process_binfile(FILE *in, FILE *out);
 void add_aux_tiles(char *name, struct zip_info *info);
 void cat(FILE *in, FILE *out);
@@ -412,6 +417,8 @@ void index_submap_add(struct tile_info *info, struct tile_head *th);
 
 /* zip.c */
 void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size);
+void zip_flush_members(struct zip_info *zip_info);
+void zip_queue_member(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size);
 int zip_write_index(struct zip_info *info);
 int zip_write_directory(struct zip_info *info);
 struct zip_info *zip_new(void);
@@ -25,6 +25,7 @@
 #include <glib.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <math.h>
@@ -301,14 +302,37 @@ int phase4(FILE **in, int in_count, int with_range, char *suffix, FILE *tilesdir
     info.suffix=suffix;
     info.tiles_list=NULL;
     info.tilesdir_out=tilesdir_out;
+    info.spill=NULL;
     return phase34(&info, zip_info, in, NULL, in_count, with_range);
 }
 
+static int write_slice(struct zip_info *zip_info) {
+    struct tile_head *th;
+    int zipfiles=0;
+
+    for (th=tile_head_root; th; th=th->next) {
+        if (!th->process)
+            continue;
+        if (th->name[0]) {
+            if (th->total_size != th->total_size_used) {
+                fprintf(stderr,"Size error '%s': %d vs %d\n", th->name, th->total_size, th->total_size_used);
+                exit(1);
+            }
+            zip_queue_member(zip_info, th->name, zip_get_maxnamelen(zip_info), th->zip_data, th->total_size);
+            zipfiles++;
+        } else {
+            dbg_assert(fwrite(th->zip_data, th->total_size, 1, zip_get_index(zip_info))==1);
+        }
+    }
+    zip_flush_members(zip_info);
+    return zipfiles;
+}
+
 static int process_slice(FILE **in, FILE **reference, int in_count, int with_range, long long size, char *suffix,
                          struct zip_info *zip_info) {
     struct tile_head *th;
     char *slice_data,*zip_data;
-    int zipfiles=0;
+    int zipfiles;
     struct tile_info info;
     int i;
 
@@ -334,24 +358,145 @@ static int process_slice(FILE **in, FILE **reference, int in_count, int with_ran
     info.suffix=suffix;
     info.tiles_list=NULL;
     info.tilesdir_out=NULL;
+    info.spill=NULL;
     phase34(&info, zip_info, in, reference, in_count, with_range);
 
+    zipfiles=write_slice(zip_info);
+    g_free(slice_data);
+
+    return zipfiles;
+}
+
+/* Bytes collected per slice before they are appended to its spill file */
+#define SPILL_BUFFER_SIZE (256*1024)
+
+static char *spill_name(int slice) {
+    return g_strdup_printf("spill%d", slice);
+}
+
+static void spill_flush(char *suffix, int slice, struct buffer *b) {
+    char *name;
+    FILE *f;
+
+    if (!b->size)
+        return;
+    name=spill_name(slice);
+    f=tempfile(suffix, name, 2);
+    g_free(name);
+    if (!f) {
+        fprintf(stderr,"Failed to open spill file %d: %s\n", slice, strerror(errno));
+        exit(1);
+    }
+    dbg_assert(fwrite(b->base, b->size, 1, f)==1);
+    fclose(f);
+    b->size=0;
+}
+
+/*
+ * Appends data to the spill file of a slice. The data is collected in memory and the spill file is only opened
+ * while a full buffer is appended to it, so the number of open files does not depend on the number of slices.
+ */
+void spill_append(struct tile_info *info, int slice, void *data, int len) {
+    struct buffer *b=&info->spill[slice];
+
+    if (b->size+len > b->malloced) {
+        spill_flush(info->suffix, slice, b);
+        if (len > b->malloced) {
+            b->malloced=len > SPILL_BUFFER_SIZE ? len : SPILL_BUFFER_SIZE;
+            b->base=g_realloc(b->base, b->malloced);
+        }
+    }
+    memcpy(b->base+b->size, data, len);
+    b->size+=len;
+}
+
+/*
+ * Assembles all tiles with a single pass over the input files. The tiles are split into slices of at most
+ * slice_size bytes as in process_slice(), but instead of reading the input once per slice, every item is
+ * appended to the spill file of its slice along with its offset within the slice. Each spill file is then
+ * read back into memory and its tiles are written to the zip file, so the tile data is read and written
+ * only once more.
+ */
+static int process_slices_spill(FILE **in, FILE **reference, int in_count, int with_range, char *suffix,
+                                struct zip_info *zip_info) {
+    struct tile_head *th;
+    struct tile_info info;
+    struct buffer *spill;
+    FILE *f;
+    char *slice_data,*name;
+    long long size,*slice_sizes,offset;
+    int i,len,count,zipnum,zipfiles=0;
+
+    count=0;
+    size=0;
     for (th=tile_head_root; th; th=th->next) {
-        if (!th->process)
-            continue;
-        if (th->name[0]) {
-            if (th->total_size != th->total_size_used) {
-                fprintf(stderr,"Size error '%s': %d vs %d\n", th->name, th->total_size, th->total_size_used);
-                exit(1);
+        if (size && size+th->total_size > slice_size) {
+            count++;
+            size=0;
+        }
+        th->slice=count;
+        th->slice_offset=size;
+        th->process=1;
+        th->zip_data=NULL;
+        size+=th->total_size;
+    }
+    count++;
+    slice_sizes=g_new0(long long, count);
+    for (th=tile_head_root; th; th=th->next)
+        slice_sizes[th->slice]=th->slice_offset+th->total_size;
+    spill=g_new0(struct buffer, count);
+    for (i = 0 ; i < count ; i++) {
+        name=spill_name(i);
+        tempfile_unlink(suffix, name);
+        g_free(name);
+    }
+    for (i = 0 ; i < in_count ; i++) {
+        if (in[i])
+            fseek(in[i], 0, SEEK_SET);
+        if (reference && reference[i])
+            fseek(reference[i], 0, SEEK_SET);
+    }
+    fprintf(stderr,"PROGRESS: Writing %d slices to spill files\n", count);
+    info.write=1;
+    info.maxlen=zip_get_maxnamelen(zip_info);
+    info.suffix=suffix;
+    info.tiles_list=NULL;
+    info.tilesdir_out=NULL;
+    info.spill=spill;
+    zipnum=zip_get_zipnum(zip_info);
+    phase34(&info, zip_info, in, reference, in_count, with_range);
+    zip_set_zipnum(zip_info, zipnum);
+    for (i = 0 ; i < count ; i++) {
+        spill_flush(suffix, i, &spill[i]);
+        g_free(spill[i].base);
+    }
+    g_free(spill);
+
+    for (i = 0 ; i < count ; i++) {
+        fprintf(stderr,"PROGRESS: Assembling slice %d of size "LONGLONG_FMT"\n", i, slice_sizes[i]);
+        slice_data=g_malloc(slice_sizes[i]);
+        for (th=tile_head_root; th; th=th->next) {
+            th->process=(th->slice == i);
+            if (th->process)
+                th->zip_data=slice_data+th->slice_offset;
+        }
+        name=spill_name(i);
+        f=tempfile(suffix, name, 0);
+        if (f) {
+            while (fread(&offset, sizeof(offset), 1, f) == 1) {
+                dbg_assert(fread(&len, sizeof(len), 1, f) == 1);
+                dbg_assert(offset >= 0 && offset+len <= slice_sizes[i]);
+                dbg_assert(fread(slice_data+offset, len, 1, f) == 1);
             }
-            write_zipmember(zip_info, th->name, zip_get_maxnamelen(zip_info), th->zip_data, th->total_size);
-            zipfiles++;
-        } else {
-            dbg_assert(fwrite(th->zip_data, th->total_size, 1, zip_get_index(zip_info))==1);
+            fclose(f);
         }
+        tempfile_unlink(suffix, name);
+        g_free(name);
+        zipfiles+=write_slice(zip_info);
+        zip_set_zipnum(zip_info, zipnum+zipfiles);
+        g_free(slice_data);
     }
-    g_free(slice_data);
-
+    g_free(slice_sizes);
     return zipfiles;
 }
 
@@ -377,6 +522,10 @@ int phase5(FILE **in, FILE **references, int in_count, int with_range, char *suf
     }
     if (size)
         fprintf(stderr,"Slice %d is of size "LONGLONG_FMT"\n", slices, size);
+    if (spill_tiles && slices) {
+        process_slices_spill(in, references, in_count, with_range, suffix, zip_info);
+        return 0;
+    }
     th=tile_head_root;
     size=0;
     slices=0;
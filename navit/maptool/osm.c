@@ -1375,18 +1375,111 @@ static void extend_buffer(struct buffer *b) {
 static struct node_item *current_node;
 /** ID of the last node processed. */
 osmid id_last_node;
-GHashTable *node_hash,*way_hash;
+GHashTable *way_hash;
 
-static void node_buffer_to_hash(void) {
-    int i,count=node_buffer.size/sizeof(struct node_item);
+/**
+ * Index of the nodes in node_buffer, used to detect duplicate nodes once nodes arrive out of sequence.
+ * This is an open-addressing hashtable whose slots hold the position of a node in node_buffer plus one
+ * (0 marks an empty slot). The id is taken from the node itself, so each node costs only a few bytes.
+ * Lookups of way nodes do not use the index: node_buffer is sorted by id when it is flushed, so they
+ * can use a binary search.
+ */
+static struct node_index {
+    unsigned int *slots;
+    long long size;     /* always a power of two */
+    long long count;
+} *node_index;
+
+/** Maximum load of the node index in percent, beyond which it is grown */
+#define NODE_INDEX_LOAD 70
+
+static inline unsigned long long node_index_hash(osmid id) {
+    unsigned long long h=id;
+    h^=h>>33;
+    h*=0xff51afd7ed558ccdULL;
+    h^=h>>33;
+    return h;
+}
+
+/**
+ * @brief Looks up a node in the node index
+ *
+ * @param id the id of the node
+ * @return the position of the node in node_buffer, or -1 if it is not there
+ */
+static long long node_index_lookup(osmid id) {
     struct node_item *ni=(struct node_item *)node_buffer.base;
+    long long mask=node_index->size-1,i=node_index_hash(id)&mask;
 
-    for (i = 0 ; i < count ; i++)
-        g_hash_table_insert(node_hash, (gpointer)(long long)(ni[i].nd_id), (gpointer)(long long)i);
+    if (!node_index->size)
+        return -1;
+    while (node_index->slots[i]) {
+        if (ni[node_index->slots[i]-1].nd_id == id)
+            return node_index->slots[i]-1;
+        i=(i+1)&mask;
+    }
+    return -1;
+}
+
+static void node_index_insert_slot(unsigned int *slots, long long size, osmid id, unsigned int value) {
+    long long mask=size-1,i=node_index_hash(id)&mask;
+
+    while (slots[i])
+        i=(i+1)&mask;
+    slots[i]=value;
+}
+
+/**
+ * @brief Adds a node to the node index, which must not contain it yet
+ *
+ * @param pos the position of the node in node_buffer
+ */
+static void node_index_insert(long long pos) {
+    struct node_item *ni=(struct node_item *)node_buffer.base;
+    unsigned int *slots;
+    long long i,size;
+
+    dbg_assert(pos < 0xffffffffLL);
+    if ((node_index->count+1)*100 > node_index->size*NODE_INDEX_LOAD) {
+        size=node_index->size ? node_index->size*2 : 1024*1024;
+        slots=g_new0(unsigned int, size);
+        for (i = 0 ; i < node_index->size ; i++)
+            if (node_index->slots[i])
+                node_index_insert_slot(slots, size, ni[node_index->slots[i]-1].nd_id, node_index->slots[i]);
+        g_free(node_index->slots);
+        node_index->slots=slots;
+        node_index->size=size;
+    }
+    node_index_insert_slot(node_index->slots, node_index->size, ni[pos].nd_id, pos+1);
+    node_index->count++;
+}
+
+/**
+ * @brief Empties the node index
+ */
+static void node_index_clear(void) {
+    g_free(node_index->slots);
+    node_index->slots=NULL;
+    node_index->size=0;
+    node_index->count=0;
+}
+
+static int node_item_cmp(const void *a, const void *b) {
+    const struct node_item *na=a,*nb=b;
+    if (na->nd_id < nb->nd_id)
+        return -1;
+    if (na->nd_id > nb->nd_id)
+        return 1;
+    return 0;
 }
 
 void flush_nodes(int final) {
     fprintf(stderr,"flush_nodes %d\n",final);
+    if (node_index) {
+        /* Nodes arrived out of sequence, sort them so they can be found by binary search */
+        qsort(node_buffer.base, node_buffer.size/sizeof(struct node_item), sizeof(struct node_item), node_item_cmp);
+        node_index_clear();
+    }
     save_buffer("coords.tmp",&node_buffer,slices*slice_size);
     if (!final) {
         node_buffer.size=0;
@@ -1411,6 +1504,8 @@ static void remove_last_node_item_from_buffer(void) {
 }
 
 void osm_add_node(osmid id, double lat, double lon) {
+    long long pos;
+
     in_node=1;
     attr_strings_clear();
     node_is_tagged=0;
@@ -1429,18 +1524,23 @@ void osm_add_node(osmid id, double lat, double lon) {
     current_node->ref_way=0;
     current_node->c.x=lon*6371000.0*M_PI/180;
     current_node->c.y=log(tan(M_PI_4+lat*M_PI/360))*6371000.0;
-    if (! node_hash) {
+    pos=current_node-(struct node_item *)node_buffer.base;
+    if (! node_index) {
         if (current_node->nd_id > id_last_node) {
             id_last_node=current_node->nd_id;
-        } else {
-            fprintf(stderr,"INFO: Nodes out of sequence (new " OSMID_FMT " vs old " OSMID_FMT "), adding hash\n",
-                    (osmid)current_node->nd_id, id_last_node);
-            node_hash=g_hash_table_new(NULL, NULL);
-            node_buffer_to_hash();
+            return;
         }
-    } else if (!g_hash_table_lookup(node_hash, (gpointer)(long long)(current_node->nd_id)))
-        g_hash_table_insert(node_hash, (gpointer)(long long)(current_node->nd_id),
-                            (gpointer)(long long)(current_node-(struct node_item *)node_buffer.base));
+        fprintf(stderr,"INFO: Nodes out of sequence (new " OSMID_FMT " vs old " OSMID_FMT "), adding index\n",
+                (osmid)current_node->nd_id, id_last_node);
+        node_index=g_new0(struct node_index, 1);
+    }
+    if (!node_index->count) {
+        long long i;
+        for (i = 0 ; i < pos ; i++)
+            node_index_insert(i);
+    }
+    if (node_index_lookup(id) == -1)
+        node_index_insert(pos);
     else {
         remove_last_node_item_from_buffer();
         nodeid=0;
@@ -1458,56 +1558,23 @@ void clear_node_item_buffer(void) {
 
 static long long node_item_find_index_in_ordered_list(osmid id) {
     struct node_item *node_buffer_base=(struct node_item *)(node_buffer.base);
-    long long node_count=node_buffer.size/sizeof(struct node_item);
-    long long search_step=node_count>4 ? node_count/4 : 1;
-    long long search_index=node_count/2;
-    if (node_buffer_base[0].nd_id > id)
-        return -1;
-    if (node_buffer_base[node_count-1].nd_id < id)
-        return -1;
-    while (node_buffer_base[search_index].nd_id != id) {
-        if (node_buffer_base[search_index].nd_id < id) {
-            search_index+=search_step;
-            if (search_step == 1) {
-                if (search_index >= node_count)
-                    return -1;
-                if (node_buffer_base[search_index].nd_id > id)
-                    return -1;
-            } else {
-                if (search_index >= node_count)
-                    search_index=node_count-1;
-            }
-        } else {
-            search_index-=search_step;
-            if (search_step == 1) {
-                if (search_index < 0)
-                    return -1;
-                if (node_buffer_base[search_index].nd_id < id)
-                    return -1;
-            } else {
-                if (search_index < 0)
-                    search_index=0;
-            }
-        }
-        if (search_step > 1)
-            search_step/=2;
+    long long low=0,high=node_buffer.size/sizeof(struct node_item),mid;
+
+    while (low < high) {
+        mid=low+(high-low)/2;
+        if (node_buffer_base[mid].nd_id < id)
+            low=mid+1;
+        else
+            high=mid;
     }
-    return search_index;
+    if (low < node_buffer.size/sizeof(struct node_item) && node_buffer_base[low].nd_id == id)
+        return low;
+    return -1;
 }
 
 static struct node_item *node_item_get(osmid id) {
     struct node_item *node_buffer_base=(struct node_item *)(node_buffer.base);
-    long long result_index;
-    if (node_hash) {
-        // Use g_hash_table_lookup_extended instead of g_hash_table_lookup
-        // to distinguish a key with a value 0 from a missing key.
-        if (!g_hash_table_lookup_extended (node_hash, (gpointer)(id), NULL,
-                                           (gpointer)&result_index)) {
-            result_index=-1;
-        }
-    } else {
-        result_index=node_item_find_index_in_ordered_list(id);
-    }
+    long long result_index=node_item_find_index_in_ordered_list(id);
     return result_index!=-1 ? node_buffer_base+result_index : NULL;
 }
 
@@ -1527,15 +1594,6 @@ static int node_item_get_from_file(FILE *coords, osmid id, struct node_item *ret
     int count;
     int interval;
     int p;
-    if (node_hash) {
-        int i;
-        i=(int)(long)(g_hash_table_lookup(node_hash, (gpointer)(long)id));
-        fseek(coords, i*sizeof(*ret), SEEK_SET);
-        if (fread(ret, sizeof(*ret), 1, coords) == 1)
-            return 1;
-        else
-            return 0;
-    }
 
     fseek(coords, 0, SEEK_END);
     count=ftello(coords)/sizeof(struct node_item);
@@ -4047,18 +4105,25 @@ int map_resolve_coords_and_split_at_intersections(FILE *in, FILE *out, FILE *out
     return 0;
 }
 
-static void index_country_add(struct zip_info *info, int country_id, char*first_key, char *last_key, char *tile,
-                              char *filename,
-                              int size, FILE *out) {
-    struct item_bin *item_bin=init_item(type_countryindex);
+static int country_aux_tile_add(struct zip_info *info, char *tile, char *suffix, char *filename, int size) {
     int num=0, zip_num;
     char tilename[32];
 
     do {
-        snprintf(tilename,sizeof(tilename),"%ss%d", tile, num);
+        snprintf(tilename,sizeof(tilename),"%s%s%d", tile, suffix, num);
         num++;
         zip_num=add_aux_tile(info, tilename, filename, size);
     } while (zip_num == -1);
+    return zip_num;
+}
+
+static int index_country_add(struct zip_info *info, int country_id, char*first_key, char *last_key, char *tile,
+                             char *filename,
+                             int size, int search_index, FILE *out) {
+    struct item_bin *item_bin=init_item(type_countryindex);
+    int zip_num;
+
+    zip_num=country_aux_tile_add(info, tile, "s", filename, size);
 
     item_bin_add_attr_int(item_bin, attr_country_id, country_id);
 
@@ -4069,7 +4134,82 @@ static void index_country_add(struct zip_info *info, int country_id, char*first_
         item_bin_add_attr_string(item_bin, attr_last_key, last_key);
 
     item_bin_add_attr_int(item_bin, attr_zipfile_ref, zip_num);
+
+    if(search_index != -1)
+        item_bin_add_attr_int(item_bin, attr_search_index_ref, search_index);
     item_bin_write(item_bin, out);
+    return zip_num;
+}
+
+/**
+ * @brief An entry of the search index of a country, see country_search_write()
+ */
+struct country_search_entry {
+    char *key;          /**< The casefolded search key */
+    int zipfile;        /**< The zip member of the country index part holding the item */
+    int offset;         /**< The offset of the item within the part, in ints */
+};
+
+static int country_search_compare(const void *p1, const void *p2) {
+    const struct country_search_entry *e1=p1, *e2=p2;
+    int ret=strcmp(e1->key, e2->key);
+    if (ret)
+        return ret;
+    if (e1->zipfile != e2->zipfile)
+        return e1->zipfile < e2->zipfile ? -1 : 1;
+    if (e1->offset != e2->offset)
+        return e1->offset < e2->offset ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Writes the search index of a country as an aux tile
+ *
+ * The index lets the binfile driver look up towns and districts by a prefix of their casefolded name
+ * with a binary search, instead of comparing the names of all items of the country index parts.
+ * Streets are not indexed, they are searched in the street tiles of a town as before.
+ *
+ * item_bin_write_match() writes one copy of a town or district for every name variant, with that
+ * variant as its last attribute, and the scan in binfile compares exactly this attribute of each copy.
+ * The index holds one entry per copy with the same key, so it matches the same variants as the scan.
+ *
+ * It consists of the number of entries, followed by the entries sorted by key, each made of the
+ * zip member and the offset of the item and the offset of the key within the string table, followed
+ * by the string table holding the NUL terminated keys, padded to a multiple of 4 bytes. All numbers are 32 bit integers.
+ *
+ * @param info The zip info
+ * @param tile The tile name used for the aux tile
+ * @param name The base name of the temporary file
+ * @param entries The entries of the index, sorted in place
+ * @param count The number of entries
+ * @return The zip member of the index
+ */
+static int country_search_write(struct zip_info *info, char *tile, char *name, struct country_search_entry *entries,
+                                int count) {
+    FILE *out=tempfile("search", name, 1);
+    char *filename=tempfile_name("search", name);
+    int i, key_offset=0, size, zip_num;
+
+    qsort(entries, count, sizeof(*entries), country_search_compare);
+    fwrite(&count, sizeof(count), 1, out);
+    for (i = 0 ; i < count ; i++) {
+        int entry[3];
+        entry[0]=entries[i].zipfile;
+        entry[1]=entries[i].offset;
+        entry[2]=key_offset;
+        fwrite(entry, sizeof(entry), 1, out);
+        key_offset+=strlen(entries[i].key)+1;
+    }
+    for (i = 0 ; i < count ; i++)
+        fwrite(entries[i].key, strlen(entries[i].key)+1, 1, out);
+    /* Pad to whole ints, the map driver sees tiles as int arrays */
+    while (key_offset++ % 4)
+        fputc(0, out);
+    size=ftello(out);
+    fclose(out);
+    zip_num=country_aux_tile_add(info, tile, "i", filename, size);
+    g_free(filename);
+    return zip_num;
 }
 
 void write_countrydir(struct zip_info *zip_info, int max_index_size) {
@@ -4095,6 +4235,9 @@ void write_countrydir(struct zip_info *zip_info, int max_index_size) {
             char *countryindexname;
             FILE *countryindex;
             char key[1024]="",first_key[1024]="",last_key[1024]="";
+            enum attr_type key_type=attr_none;
+            struct country_search_entry *search=NULL;
+            int search_count=0, search_size=0, search_part=0, search_index=-1, zip_num;
 
             tile(&co->r, "", tileco, max, overlap, NULL);
 
@@ -4122,8 +4265,11 @@ void write_countrydir(struct zip_info *zip_info, int max_index_size) {
                         tilecur[0]=0;
 
                     a=item_bin_get_attr_bin_last(ib);
-                    if(a && ATTR_IS_STRING(a->type))
+                    if(a && ATTR_IS_STRING(a->type)) {
                         g_strlcpy(key,(char *)(a+1),sizeof(key));
+                        key_type=a->type;
+                    } else
+                        key_type=attr_none;
                 }
 
                 /* If output file is already opened, and:
@@ -4135,8 +4281,10 @@ void write_countrydir(struct zip_info *zip_info, int max_index_size) {
                     partsize=ftello(out);
                     fclose(out);
                     out=NULL;
-                    index_country_add(zip_info,co->countryid,first_key,last_key,strlen(tileco)>strlen(tileprev)?tileco:tileprev,outname,
-                                      partsize,countryindex);
+                    zip_num=index_country_add(zip_info,co->countryid,first_key,last_key,strlen(tileco)>strlen(tileprev)?tileco:tileprev,
+                                              outname,partsize,-1,countryindex);
+                    while (search_part < search_count)
+                        search[search_part++].zipfile=zip_num;
                     g_free(outname);
                     outname=NULL;
                     g_strlcpy(first_key,key,sizeof(first_key));
@@ -4155,14 +4303,35 @@ void write_countrydir(struct zip_info *zip_info, int max_index_size) {
                     partsize=0;
                 }
 
+                /* Towns and districts are also added to the search index, with the key binfile compares against:
+                   the last attribute of the copy, which is its only name_match attribute, or the name if it has none. */
+                if(key_type == attr_town_name || key_type == attr_town_name_match || key_type == attr_district_name
+                        || key_type == attr_district_name_match) {
+                    if(search_count == search_size) {
+                        search_size=search_size ? search_size*2 : 1024;
+                        search=g_renew(struct country_search_entry, search, search_size);
+                    }
+                    search[search_count].key=linguistics_casefold(key);
+                    search[search_count].zipfile=-1;
+                    search[search_count].offset=partsize/4;
+                    search_count++;
+                }
+
                 item_bin_write(ib,out);
                 partsize+=ibsize;
                 g_strlcpy(last_key,key,sizeof(last_key));
             }
 
+            if(search_count)
+                search_index=country_search_write(zip_info, tileco, countrypart, search, search_count);
+            while (search_count)
+                g_free(search[--search_count].key);
+            g_free(search);
+
             partsize=ftello(countryindex);
             if(partsize)
-                index_country_add(zip_info,co->countryid,NULL,NULL,tileco,countryindexname, partsize, zip_get_index(zip_info));
+                index_country_add(zip_info,co->countryid,NULL,NULL,tileco,countryindexname, partsize, search_index,
+                                  zip_get_index(zip_info));
             fclose(countryindex);
             g_free(countryindexname);
             fclose(in);
@@ -61,14 +61,6 @@ static OSMPBF__BlobHeader *read_header(FILE *f) {
 }
 
 
-static OSMPBF__Blob *read_blob(OSMPBF__BlobHeader *header, FILE *f, unsigned char *buffer) {
-    int len=header->datasize;
-    SANITY_CHECK_LENGTH(len, MAX_BLOB_LENGTH)
-    if (fread(buffer, len, 1, f) != 1)
-        return NULL;
-    return osmpbf__blob__unpack(NULL, len, buffer);
-}
-
 static unsigned char *uncompress_blob(OSMPBF__Blob *blob) {
     unsigned char *ret=g_malloc(blob->raw_size);
     int zerr;
@@ -242,10 +234,8 @@ static void process_relation(OSMPBF__PrimitiveBlock *primitive_block, OSMPBF__Re
     osm_end_relation(osm);
 }
 
-static void process_osmdata(OSMPBF__Blob *blob, unsigned char *data, struct maptool_osm *osm) {
+static void process_osmdata(OSMPBF__PrimitiveBlock *primitive_block, struct maptool_osm *osm) {
     int i,j;
-    OSMPBF__PrimitiveBlock *primitive_block;
-    primitive_block=osmpbf__primitive_block__unpack(NULL, blob->raw_size, data);
     for (i = 0 ; i < primitive_block->n_primitivegroup ; i++) {
         OSMPBF__PrimitiveGroup *primitive_group=primitive_block->primitivegroup[i];
         process_dense(primitive_block, primitive_group->dense, osm);
@@ -254,32 +244,210 @@ static void process_osmdata(OSMPBF__Blob *blob, unsigned char *data, struct mapt
         for (j = 0 ; j < primitive_group->n_relations ; j++)
             process_relation(primitive_block, primitive_group->relations[j], osm);
     }
-    osmpbf__primitive_block__free_unpacked(primitive_block, NULL);
 }
 
+/**
+ * @brief A file block on its way through the decoding pipeline
+ */
+struct pbf_block {
+    int seq;                                  /**< Position of the block in the file */
+    OSMPBF__BlobHeader *header;               /**< The header of the block */
+    unsigned char *raw;                       /**< The undecoded blob, freed once decoded */
+    int raw_len;                              /**< Length of `raw` */
+    OSMPBF__PrimitiveBlock *primitive_block;  /**< The decoded data, for blocks of type OSMData */
+    int error;                                /**< The block could not be decoded */
+};
 
-int map_collect_data_osm_protobuf(FILE *in, struct maptool_osm *osm) {
+/** Maximum number of blocks read ahead per decoding thread */
+#define PBF_BLOCKS_PER_THREAD 4
+
+/**
+ * @brief Dummy block to make the decoding threads exit, as NULL cannot be passed through a queue.
+ */
+static struct pbf_block pbf_block_end;
+
+/**
+ * @brief Reads the next block from the file, without decoding it
+ *
+ * @param in the file
+ * @param seq the position of the block in the file
+ * @return the block, or NULL at the end of the file
+ */
+static struct pbf_block *pbf_block_read(FILE *in, int seq) {
+    struct pbf_block *block;
     OSMPBF__BlobHeader *header;
+    int len;
+
+    header=read_header(in);
+    if (!header)
+        return NULL;
+    block=g_new0(struct pbf_block, 1);
+    block->seq=seq;
+    block->header=header;
+    len=header->datasize;
+    if (len < 0 || len > MAX_BLOB_LENGTH) {
+        fprintf(stderr,"Not a valid protobuf file. Invalid block size in input: %d, max is %d. \n", len, MAX_BLOB_LENGTH);
+        block->error=1;
+        return block;
+    }
+    block->raw=g_malloc(len);
+    block->raw_len=len;
+    if (fread(block->raw, len, 1, in) != 1)
+        block->error=1;
+    return block;
+}
+
+/**
+ * @brief Inflates and unpacks a block
+ *
+ * This does not touch any global state, so several blocks can be decoded at the same time.
+ *
+ * @param block the block
+ */
+static void pbf_block_decode(struct pbf_block *block) {
     OSMPBF__Blob *blob;
     unsigned char *data;
-    unsigned char *buffer=g_malloc(MAX_BLOB_LENGTH);
-
-    while ((header=read_header(in))) {
-        blob=read_blob(header, in, buffer);
-        data=uncompress_blob(blob);
-        if (!g_strcmp0(header->type,"OSMHeader")) {
-            process_osmheader(blob, data);
-        } else if (!g_strcmp0(header->type,"OSMData")) {
-            process_osmdata(blob, data, osm);
-        } else {
-            printf("skipping fileblock of unknown type '%s'\n", header->type);
-            g_free(buffer);
-            return 0;
-        }
-        g_free(data);
+
+    if (block->error)
+        return;
+    blob=osmpbf__blob__unpack(NULL, block->raw_len, block->raw);
+    g_free(block->raw);
+    block->raw=NULL;
+    data=blob ? uncompress_blob(blob) : NULL;
+    if (!data)
+        block->error=1;
+    else if (!g_strcmp0(block->header->type,"OSMHeader"))
+        process_osmheader(blob, data);
+    else if (!g_strcmp0(block->header->type,"OSMData")) {
+        block->primitive_block=osmpbf__primitive_block__unpack(NULL, blob->raw_size, data);
+        if (!block->primitive_block)
+            block->error=1;
+    }
+    g_free(data);
+    if (blob)
         osmpbf__blob__free_unpacked(blob, NULL);
-        osmpbf__blob_header__free_unpacked(header, NULL);
+}
+
+/**
+ * @brief Frees a block
+ *
+ * @param block the block
+ */
+static void pbf_block_free(struct pbf_block *block) {
+    if (block->primitive_block)
+        osmpbf__primitive_block__free_unpacked(block->primitive_block, NULL);
+    osmpbf__blob_header__free_unpacked(block->header, NULL);
+    g_free(block->raw);
+    g_free(block);
+}
+
+/**
+ * @brief Passes the contents of a decoded block to the osm_* functions and frees the block
+ *
+ * @param block the block
+ * @param osm the osm processing state
+ * @return 1 on success, 0 if processing has to stop
+ */
+static int pbf_block_process(struct pbf_block *block, struct maptool_osm *osm) {
+    int ret=1;
+
+    if (block->error) {
+        fprintf(stderr,"failed to decode fileblock %d\n", block->seq);
+        ret=0;
+    } else if (!g_strcmp0(block->header->type,"OSMData")) {
+        process_osmdata(block->primitive_block, osm);
+    } else if (g_strcmp0(block->header->type,"OSMHeader")) {
+        printf("skipping fileblock of unknown type '%s'\n", block->header->type);
+        ret=0;
     }
-    g_free(buffer);
-    return 1;
+    pbf_block_free(block);
+    return ret;
+}
+
+/**
+ * @brief Decoding thread, decodes blocks from one queue and passes them on to another
+ *
+ * @param data the queues, input first
+ */
+static gpointer pbf_decode_worker(gpointer data) {
+    GAsyncQueue **queues=data;
+    struct pbf_block *block;
+
+    while ((block=g_async_queue_pop(queues[0])) != &pbf_block_end) {
+        pbf_block_decode(block);
+        g_async_queue_push(queues[1], block);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads OSM data from a PBF file
+ *
+ * The file is read on the calling thread, while the blocks are inflated and unpacked on up to thread_count
+ * threads. The decoded blocks are passed to the osm_* functions on the calling thread in file order, so the
+ * result is the same as when decoding on a single thread. At most PBF_BLOCKS_PER_THREAD blocks per thread are
+ * kept in memory.
+ *
+ * @param in the file
+ * @param osm the osm processing state
+ * @return 1 on success, 0 on error
+ */
+int map_collect_data_osm_protobuf(FILE *in, struct maptool_osm *osm) {
+    GAsyncQueue *queues[2];
+    GThread **threads;
+    struct pbf_block *block,**pending;
+    int i,max,count=0,read_seq=0,next_seq=0,eof=0,ret=1;
+
+    if (thread_count <= 1) {
+        while (ret && (block=pbf_block_read(in, read_seq++))) {
+            pbf_block_decode(block);
+            ret=pbf_block_process(block, osm);
+        }
+        return ret;
+    }
+
+    max=thread_count*PBF_BLOCKS_PER_THREAD;
+    pending=g_new0(struct pbf_block *, max);
+    queues[0]=g_async_queue_new();
+    queues[1]=g_async_queue_new();
+    threads=g_new(GThread *, thread_count);
+    for (i = 0 ; i < thread_count ; i++)
+        threads[i]=g_thread_new("pbf_decode_worker", pbf_decode_worker, queues);
+
+    for (;;) {
+        while (ret && !eof && count < max) {
+            block=pbf_block_read(in, read_seq);
+            if (!block) {
+                eof=1;
+                break;
+            }
+            read_seq++;
+            count++;
+            g_async_queue_push(queues[0], block);
+        }
+        if (!count)
+            break;
+        while (!pending[next_seq % max]) {
+            block=g_async_queue_pop(queues[1]);
+            pending[block->seq % max]=block;
+        }
+        block=pending[next_seq % max];
+        pending[next_seq % max]=NULL;
+        next_seq++;
+        count--;
+        if (ret)
+            ret=pbf_block_process(block, osm);
+        else
+            pbf_block_free(block);
+    }
+
+    for (i = 0 ; i < thread_count ; i++)
+        g_async_queue_push(queues[0], &pbf_block_end);
+    for (i = 0 ; i < thread_count ; i++)
+        g_thread_join(threads[i]);
+    g_free(threads);
+    g_async_queue_unref(queues[0]);
+    g_async_queue_unref(queues[1]);
+    g_free(pending);
+    return ret;
 }
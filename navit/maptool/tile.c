@@ -279,7 +279,7 @@ static void write_tile(char *key, struct tile_head *th, gpointer dummy) {
 }
 #endif
 
-static void write_item(char *tile, struct item_bin *ib, FILE *reference) {
+static void write_item(struct tile_info *info, char *tile, struct item_bin *ib, FILE *reference) {
     struct tile_head *th;
     int size;
 
@@ -319,6 +319,12 @@ static void write_item(char *tile, struct item_bin *ib, FILE *reference) {
         }
         if (th->zip_data)
             memcpy(th->zip_data+th->total_size_used, ib, size);
+        else if (info->spill) {
+            long long offset=th->slice_offset+th->total_size_used;
+            spill_append(info, th->slice, &offset, sizeof(offset));
+            spill_append(info, th->slice, &size, sizeof(size));
+            spill_append(info, th->slice, ib, size);
+        }
         th->total_size_used+=size;
     } else {
         fprintf(stderr,"no tile hash found for %s\n", tile);
@@ -328,7 +334,7 @@ static void write_item(char *tile, struct item_bin *ib, FILE *reference) {
 
 void tile_write_item_to_tile(struct tile_info *info, struct item_bin *ib, FILE *reference, char *name) {
     if (info->write)
-        write_item(name, ib, reference);
+        write_item(info, name, ib, reference);
     else
         tile_extend(name, ib, info->tiles_list);
 }
@@ -25,6 +25,20 @@
 #include "config.h"
 #include "zipfile.h"
 
+/**
+ * @brief A member waiting to be compressed and written
+ */
+struct zip_member {
+    char *name;
+    int filelen;
+    char *data;        /* the data, or the compressed data once compressed */
+    int data_size;
+    char *compbuffer;
+    int comp_size;
+    int crc;
+    int method;
+};
+
 struct zip_info {
     int zipnum;
     int dir_size;
@@ -37,6 +51,11 @@ struct zip_info {
     FILE *res2;
     FILE *index;
     FILE *dir;
+    struct zip_member *pending;
+    int pending_count;
+    int pending_size;
+    long long pending_data_size;
+    volatile gint pending_next;
 };
 
 static int zip_write(struct zip_info *info, void *data, int len) {
@@ -75,7 +94,53 @@ static int compress2_int(Byte *dest, uLongf *destLen, const Bytef *source, uLong
 }
 #endif
 
-void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size) {
+/** Maximum number of members queued before they are compressed and written */
+#define ZIP_PENDING_MAX 1024
+
+/** Maximum uncompressed size of all queued members before they are compressed and written */
+#define ZIP_PENDING_MAX_SIZE (256*1024*1024)
+
+/**
+ * @brief Compresses a member and computes its checksum
+ *
+ * This only touches the member, so members can be compressed concurrently.
+ *
+ * @param zip_info the zip file
+ * @param m the member
+ */
+static void zip_member_compress(struct zip_info *zip_info, struct zip_member *m) {
+    uLongf destlen=m->data_size+m->data_size/500+12;
+
+    m->crc=crc32(0, NULL, 0);
+    m->crc=crc32(m->crc, (unsigned char *)m->data, m->data_size);
+    m->comp_size=m->data_size;
+    m->method=zip_info->compression_level ? 8:0;
+    m->compbuffer=NULL;
+#ifdef HAVE_ZLIB
+    if (zip_info->compression_level) {
+        int error;
+        m->compbuffer=g_malloc(destlen);
+        error=compress2_int((Byte *)m->compbuffer, &destlen, (Bytef *)m->data, m->data_size, zip_info->compression_level);
+        if (error == Z_OK) {
+            if (destlen < m->data_size) {
+                m->data=m->compbuffer;
+                m->comp_size=destlen;
+            } else
+                m->method=0;
+        } else {
+            fprintf(stderr,"compress2 returned %d\n", error);
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Writes a compressed member and its central directory entry
+ *
+ * @param zip_info the zip file
+ * @param m the member, compressed by zip_member_compress()
+ */
+static void zip_member_write(struct zip_info *zip_info, struct zip_member *m) {
     struct zip_lfh lfh = {
         0x04034b50,
         0x0a,
@@ -86,7 +151,7 @@ void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *d
         0x0,
         0x0,
         0x0,
-        filelen,
+        m->filelen,
         0x0,
     };
     struct zip_cd cd = {
@@ -102,7 +167,7 @@ void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *d
         0x0,
         0x0,
         0x0,
-        filelen,
+        m->filelen,
         0x0000,
         0x0000,
         0x0000,
@@ -116,41 +181,22 @@ void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *d
         zip_info->offset,
     };
     char *filename;
-    int crc=0,len,comp_size=data_size;
-    uLongf destlen=data_size+data_size/500+12;
-    char *compbuffer;
+    int len,filelen=m->filelen;
 
-    compbuffer = g_malloc(destlen);
-    crc=crc32(0, NULL, 0);
-    crc=crc32(crc, (unsigned char *)data, data_size);
-    lfh.zipmthd=zip_info->compression_level ? 8:0;
-#ifdef HAVE_ZLIB
-    if (zip_info->compression_level) {
-        int error=compress2_int((Byte *)compbuffer, &destlen, (Bytef *)data, data_size, zip_info->compression_level);
-        if (error == Z_OK) {
-            if (destlen < data_size) {
-                data=compbuffer;
-                comp_size=destlen;
-            } else
-                lfh.zipmthd=0;
-        } else {
-            fprintf(stderr,"compress2 returned %d\n", error);
-        }
-    }
-#endif
-    lfh.zipcrc=crc;
-    lfh.zipsize=comp_size;
-    lfh.zipuncmp=data_size;
-    cd.zipccrc=crc;
+    lfh.zipmthd=m->method;
+    lfh.zipcrc=m->crc;
+    lfh.zipsize=m->comp_size;
+    lfh.zipuncmp=m->data_size;
+    cd.zipccrc=m->crc;
     cd.zipcsiz=lfh.zipsize;
-    cd.zipcunc=data_size;
+    cd.zipcunc=m->data_size;
     cd.zipcmthd=lfh.zipmthd;
     if (zip_info->zip64) {
         cd.zipofst=0xffffffff;
         cd.zipcxtl+=sizeof(cd_ext);
     }
     filename=g_alloca(filelen+1);
-    strcpy(filename, name);
+    strcpy(filename, m->name);
     len=strlen(filename);
     while (len < filelen) {
         filename[len++]='_';
@@ -159,8 +205,8 @@ void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *d
     zip_write(zip_info, &lfh, sizeof(lfh));
     zip_write(zip_info, filename, filelen);
     zip_info->offset+=sizeof(lfh)+filelen;
-    zip_write(zip_info, data, comp_size);
-    zip_info->offset+=comp_size;
+    zip_write(zip_info, m->data, m->comp_size);
+    zip_info->offset+=m->comp_size;
     dbg_assert(fwrite(&cd, sizeof(cd), 1, zip_info->dir)==1);
     dbg_assert(fwrite(filename, filelen, 1, zip_info->dir)==1);
     zip_info->dir_size+=sizeof(cd)+filelen;
@@ -169,7 +215,96 @@ void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *d
         zip_info->dir_size+=sizeof(cd_ext);
     }
 
-    g_free(compbuffer);
+    g_free(m->compbuffer);
+    m->compbuffer=NULL;
+}
+
+/**
+ * @brief Compression worker thread, compresses queued members until none are left
+ *
+ * @param data the zip file
+ */
+static gpointer zip_compress_worker(gpointer data) {
+    struct zip_info *zip_info=data;
+    int i;
+
+    while ((i=g_atomic_int_add(&zip_info->pending_next, 1)) < zip_info->pending_count)
+        zip_member_compress(zip_info, &zip_info->pending[i]);
+    return NULL;
+}
+
+/**
+ * @brief Compresses and writes all members queued by zip_queue_member()
+ *
+ * The members are compressed on up to thread_count threads and then written in the order they were queued,
+ * so the result does not depend on the number of threads.
+ *
+ * @param zip_info the zip file
+ */
+void zip_flush_members(struct zip_info *zip_info) {
+    GThread **threads;
+    int i,count;
+
+    if (!zip_info->pending_count)
+        return;
+    count=MIN(thread_count, zip_info->pending_count);
+    zip_info->pending_next=0;
+    if (count > 1) {
+        threads=g_new(GThread *, count);
+        for (i = 0 ; i < count ; i++)
+            threads[i]=g_thread_new("zip_compress_worker", zip_compress_worker, zip_info);
+        for (i = 0 ; i < count ; i++)
+            g_thread_join(threads[i]);
+        g_free(threads);
+    } else
+        zip_compress_worker(zip_info);
+    for (i = 0 ; i < zip_info->pending_count ; i++) {
+        zip_member_write(zip_info, &zip_info->pending[i]);
+        g_free(zip_info->pending[i].name);
+    }
+    zip_info->pending_count=0;
+    zip_info->pending_data_size=0;
+}
+
+/**
+ * @brief Queues a member to be compressed and written by zip_flush_members()
+ *
+ * The data must stay valid until the members have been flushed, which happens automatically when too many
+ * members are queued, and whenever write_zipmember() is called.
+ *
+ * @param zip_info the zip file
+ * @param name the name of the member
+ * @param filelen the length of the name in the zip file, the name is padded with '_'
+ * @param data the data of the member
+ * @param data_size the size of the data
+ */
+void zip_queue_member(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size) {
+    struct zip_member *m;
+
+    if (zip_info->pending_count == zip_info->pending_size) {
+        zip_info->pending_size=zip_info->pending_size ? zip_info->pending_size*2 : 64;
+        zip_info->pending=g_renew(struct zip_member, zip_info->pending, zip_info->pending_size);
+    }
+    m=&zip_info->pending[zip_info->pending_count++];
+    m->name=g_strdup(name);
+    m->filelen=filelen;
+    m->data=data;
+    m->data_size=data_size;
+    zip_info->pending_data_size+=data_size;
+    if (zip_info->pending_count >= ZIP_PENDING_MAX || zip_info->pending_data_size >= ZIP_PENDING_MAX_SIZE)
+        zip_flush_members(zip_info);
+}
+
+void write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size) {
+    struct zip_member m;
+
+    zip_flush_members(zip_info);
+    m.name=name;
+    m.filelen=filelen;
+    m.data=data;
+    m.data_size=data_size;
+    zip_member_compress(zip_info, &m);
+    zip_member_write(zip_info, &m);
 }
 
 int zip_write_index(struct zip_info *info) {
@@ -226,6 +361,7 @@ int zip_write_directory(struct zip_info *info) {
         0x0,
     };
 
+    zip_flush_members(info);
     fseek(info->dir, 0, SEEK_SET);
     zip_write_file_data(info, info->dir);
     if (info->zip64) {
@@ -335,5 +471,6 @@ void zip_close(struct zip_info *info) {
 }
 
 void zip_destroy(struct zip_info *info) {
+    g_free(info->pending);
     g_free(info);
 }
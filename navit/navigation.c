@@ -154,7 +154,8 @@ enum nav_status_int {
     status_none = 0,
     status_busy = 1,
     status_has_ritem = 2,
-    status_has_sitem = 4
+    status_has_sitem = 4,
+    status_patching = 8
 };
 
 
@@ -189,6 +190,10 @@ struct navigation {
     struct callback *idle_cb;			/**< Idle callback to process the route map */
     struct event_idle *idle_ev;			/**< The pointer to the idle event */
     int nav_status;						/**< Status of the navigation engine */
+    int unchanged;						/**< Number of route items still to be compared with the existing
+										 *   navigation items while patching the maneuver list */
+    struct navigation_itm *patch_itm;	/**< Last navigation item found unchanged while patching */
+    struct navigation_itm *patch_from;	/**< First navigation item whose maneuver has to be regenerated */
 };
 
 /** @brief Set of simplified distance values that are easy to be pronounced.
@@ -1356,6 +1361,21 @@ static void navigation_itm_ways_update(struct navigation_itm *itm, struct map *g
     itm->way.next = w;
 }
 
+/**
+ * @brief Frees a navigation item and the data associated with it
+ *
+ * @param itm The navigation item, which must already have been unlinked
+ */
+static void navigation_itm_destroy(struct navigation_itm *itm) {
+    map_convert_free(itm->way.name);
+    map_convert_free(itm->way.name_systematic);
+    map_convert_free(itm->way.exit_ref);
+    map_convert_free(itm->way.exit_label);
+    free_list(itm->way.destination);
+    navigation_itm_ways_clear(itm);
+    g_free(itm);
+}
+
 /**
  * @brief Destroys navigation items associated with a navigation object.
  *
@@ -1391,13 +1411,7 @@ static void navigation_destroy_itms_cmds(struct navigation *this_, struct naviga
             g_free(cmd);
         }
 
-        map_convert_free(itm->way.name);
-        map_convert_free(itm->way.name_systematic);
-        map_convert_free(itm->way.exit_ref);
-        map_convert_free(itm->way.exit_label);
-        free_list(itm->way.destination);
-        navigation_itm_ways_clear(itm);
-        g_free(itm);
+        navigation_itm_destroy(itm);
     }
     if (! this_->first)
         this_->last=NULL;
@@ -1406,6 +1420,56 @@ static void navigation_destroy_itms_cmds(struct navigation *this_, struct naviga
     dbg(lvl_info,"ret this_->first=%p this_->cmd_first=%p",this_->first, this_->cmd_first);
 }
 
+/**
+ * @brief Destroys the navigation items following a given item, along with the commands which depend on them.
+ *
+ * This is used to patch the list of navigation items when only the part of the route following `keep` has
+ * changed. Maneuvers look ahead across ramps, one-way roads and roundabouts, therefore commands are destroyed
+ * back to the last item from which this lookahead cannot reach the destroyed items. This item is stored in
+ * the `patch_from` member of `this_`, and maneuvers must be regenerated starting with it.
+ *
+ * @param this_ The navigation object
+ * @param keep The last navigation item to keep
+ */
+static void navigation_destroy_itms_cmds_after(struct navigation *this_, struct navigation_itm *keep) {
+    struct navigation_itm *itm, *from;
+    struct navigation_command *cmd, *next;
+
+    from=keep;
+    while (from->prev && ((from->way.flags & (AF_ONEWAYMASK | AF_ROUNDABOUT)) || (from->way.item.type == type_ramp)))
+        from=from->prev;
+
+    /* commands are in the same order as the items they refer to */
+    cmd=this_->cmd_first;
+    for (itm = this_->first; itm && itm != from; itm = itm->next)
+        while (cmd && cmd->itm == itm)
+            cmd=cmd->next;
+    if (cmd) {
+        this_->cmd_last=cmd->prev;
+        if (this_->cmd_last)
+            this_->cmd_last->next=NULL;
+        else
+            this_->cmd_first=NULL;
+    }
+    while (cmd) {
+        next=cmd->next;
+        g_free(cmd->maneuver);
+        g_free(cmd);
+        cmd=next;
+    }
+
+    while (keep->next) {
+        itm=keep->next;
+        keep->next=itm->next;
+        item_hash_remove(this_->hash, &itm->way.item);
+        navigation_itm_destroy(itm);
+    }
+    this_->last=keep;
+    this_->patch_from=from;
+    this_->status_int |= status_patching;
+    dbg(lvl_debug,"kept items up to %p, regenerating maneuvers from %p", keep, from);
+}
+
 static void navigation_itm_update(struct navigation_itm *itm, struct item *ritem) {
     struct attr length, time, speed;
 
@@ -2778,14 +2842,20 @@ static struct navigation_command *command_new(struct navigation *this_, struct n
  * @brief Creates turn instructions where needed
  *
  * @param this_ The navigation object for which to create turn instructions
- * @param route Not used
+ * @param from The first navigation item for which to create turn instructions, commands for the items before it
+ * are kept. If NULL, turn instructions are created for all items.
  */
-static void make_maneuvers(struct navigation *this_, struct route *route) {
+static void make_maneuvers(struct navigation *this_, struct navigation_itm *from) {
     struct navigation_itm *itm, *last=NULL, *last_itm=NULL;
     struct navigation_maneuver *maneuver;
-    itm=this_->first;
-    this_->cmd_last=NULL;
-    this_->cmd_first=NULL;
+    if (from && from->prev) {
+        itm=from;
+        last=last_itm=from->prev;
+    } else {
+        itm=this_->first;
+        this_->cmd_last=NULL;
+        this_->cmd_first=NULL;
+    }
     while (itm) {
         if (last) {
             if (maneuver_required2(this_, last_itm, itm, &maneuver)) {
@@ -3612,14 +3682,20 @@ static void navigation_update_done(struct navigation *this_, int cancel) {
         else {
             if (!(this_->status_int & status_has_ritem)) {
                 navigation_itm_new(this_, NULL);
-                make_maneuvers(this_,this_->route);
+                make_maneuvers(this_, (this_->status_int & status_patching) ? this_->patch_from : NULL);
             }
             calculate_dest_distance(this_, incr);
             profile(0,"end");
             navigation_call_callbacks(this_, FALSE);
         }
         navigation_set_attr(this_, &nav_status);
+    } else if (this_->status_int & status_patching) {
+        /* the maneuvers of the patched part of the list have not been regenerated yet */
+        navigation_flush(this_);
     }
+    this_->unchanged=0;
+    this_->patch_itm=NULL;
+    this_->patch_from=NULL;
     /*
      * In order to ensure that route_mr holds either NULL or a valid pointer at any given time,
      * always pass a copy of it to map_rect_destroy() and set route_mr to NULL prior to calling
@@ -3683,13 +3759,42 @@ static void navigation_update_idle(struct navigation *this_) {
             navigation_destroy_itms_cmds(this_, itm);
             if (itm) {
                 navigation_itm_update(itm, ritem);
-                break;
+                if (!this_->unchanged)
+                    break;
+                /* the route has changed further ahead, compare the following items */
+                this_->unchanged--;
+                this_->patch_itm=itm;
+                if (!this_->unchanged)
+                    navigation_destroy_itms_cmds_after(this_, itm);
+                count--;
+                continue;
             }
             dbg(lvl_debug,"not on track");
+            this_->unchanged=0;
+        } else if (this_->unchanged && item_attr_get(ritem, attr_street_item, &street_item)) {
+            if (!item_attr_get(ritem, attr_direction, &street_direction))
+                street_direction.u.num = 0;
+            itm=this_->patch_itm->next;
+            if (itm && item_is_equal(itm->way.item, *street_item.u.item) && itm->way.dir == street_direction.u.num) {
+                navigation_itm_update(itm, ritem);
+                this_->patch_itm=itm;
+                this_->unchanged--;
+                if (!this_->unchanged)
+                    navigation_destroy_itms_cmds_after(this_, itm);
+                count--;
+                continue;
+            }
+            this_->unchanged=0;
+            navigation_destroy_itms_cmds_after(this_, this_->patch_itm);
         }
         navigation_itm_new(this_, ritem);
         count--;
     }
+    if (!ritem && this_->unchanged) {
+        /* the route ends within the part which has not changed */
+        this_->unchanged=0;
+        navigation_destroy_itms_cmds_after(this_, this_->patch_itm);
+    }
     if (count > 0) {
         /* if count > 0, one of the break conditions in the loop was true and we're done */
         navigation_update_done(this_, 0);
@@ -3702,7 +3807,8 @@ static void navigation_update_idle(struct navigation *this_) {
  *
  * This function is added to the callback list of the current route. It is called whenever the
  * status of the route changes and will either discard the current list of maneuvers or build a new
- * list.
+ * list. After a partial recalculation of the route, the items for the unchanged part of the route are
+ * kept and only the rest of the list is rebuilt.
  *
  * @param this_ The navigation object
  * @param route The route
@@ -3737,8 +3843,14 @@ static void navigation_update(struct navigation *this_, struct route *route, str
     }
     navigation_set_attr(this_, &nav_status);
 
-    if (attr->u.num == route_status_no_destination || attr->u.num == route_status_not_found
-            || attr->u.num == route_status_path_done_new)
+    this_->unchanged=0;
+    if (attr->u.num == route_status_path_done_new) {
+        /* after a partial recalculation of the route, only the part following the unchanged segments
+         * needs to be processed again */
+        this_->unchanged=route_get_path_unchanged(route);
+        if (!this_->unchanged || !this_->first)
+            navigation_flush(this_);
+    } else if (attr->u.num == route_status_no_destination || attr->u.num == route_status_not_found)
         navigation_flush(this_);
     if (attr->u.num != route_status_path_done_new && attr->u.num != route_status_path_done_incremental) {
         if (this_->status_int & status_busy) {
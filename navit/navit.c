@@ -51,9 +51,11 @@
 #include "popup.h"
 #include "data_window.h"
 #include "route.h"
+#include "prefetch.h"
 #include "navigation.h"
 #include "speech.h"
 #include "track.h"
+#include "mapmatch.h"
 #include "vehicle.h"
 #include "layout.h"
 #include "log.h"
@@ -171,6 +173,8 @@ struct navit {
     int graphics_flags;
     int zoom_min, zoom_max;
     int radius;
+    int prefetch_distance;      /**< How far ahead of the vehicle map data is prefetched, in meters, 0 to disable */
+    struct prefetch *prefetch;
     struct bookmarks *bookmarks;
     int flags;
     /* 1=No graphics ok */
@@ -847,6 +851,29 @@ static int navit_cmd_say(struct navit *this, char *function, struct attr **in, s
     return 0;
 }
 
+/**
+ * Matches a recorded track to the streets of the active mapset
+ *
+ * @param navit The navit instance
+ * @param function unused (needed to match command function signature)
+ * @param in input attributes in[0] is the NMEA or GPX track file, in[1] the file to write the result to
+ * @param out output attributes, unused
+ * @returns 0
+ */
+static int navit_cmd_match_track(struct navit *this, char *function, struct attr **in, struct attr ***out) {
+    if (!in || !in[0] || !ATTR_IS_STRING(in[0]->type) || !in[0]->u.str || !in[1] || !ATTR_IS_STRING(in[1]->type)
+            || !in[1]->u.str) {
+        dbg(lvl_error, "Command function match_track(): expected a track file and a result file");
+        return 0;
+    }
+    if (!this->mapsets) {
+        dbg(lvl_error, "Command function match_track(): there is no active mapset");
+        return 0;
+    }
+    mapmatch_file(this->mapsets->data, in[0]->u.str, in[1]->u.str);
+    return 0;
+}
+
 static GHashTable *cmd_int_var_hash = NULL;
 static GHashTable *cmd_attr_var_hash = NULL;
 
@@ -1441,6 +1468,7 @@ static struct command_table commands[] = {
     {"set_attr_var",command_cast(navit_cmd_set_attr_var)},
     {"get_attr_var",command_cast(navit_cmd_get_attr_var)},
     {"switch_layout_day_night",command_cast(navit_cmd_switch_layout_day_night)},
+    {"match_track",command_cast(navit_cmd_match_track)},
 };
 
 void navit_command_add_table(struct navit*this_, struct command_table *commands, int count) {
@@ -2627,6 +2655,10 @@ static int navit_set_attr_do(struct navit *this_, struct attr *attr, int init) {
         attr_updated=(this_->radius != attr->u.num);
         this_->radius=attr->u.num;
         break;
+    case attr_prefetch_distance:
+        attr_updated=(this_->prefetch_distance != attr->u.num);
+        this_->prefetch_distance=attr->u.num;
+        break;
     case attr_recent_dest:
         attr_updated=(this_->recentdest_count != attr->u.num);
         this_->recentdest_count=attr->u.num;
@@ -2919,6 +2951,9 @@ int navit_get_attr(struct navit *this_, enum attr_type type, struct attr *attr,
     case attr_autozoom_active:
         attr->u.num=this_->autozoom_active;
         break;
+    case attr_prefetch_distance:
+        attr->u.num=this_->prefetch_distance;
+        break;
     case attr_follow_cursor:
         attr->u.num=this_->follow_cursor;
         break;
@@ -3229,6 +3264,12 @@ static void navit_vehicle_update_position(struct navit *this_, struct navit_vehi
         else
             route_set_position(this_->route, &cursor_pc);
     }
+    if (this_->prefetch_distance > 0) {
+        if (!this_->prefetch)
+            this_->prefetch=prefetch_new();
+        prefetch_update(this_->prefetch, navit_get_mapset(this_), this_->route, pro, &nv->coord, nv->dir,
+                        this_->prefetch_distance);
+    }
     callback_list_call_attr_0(this_->attr_cbl, attr_position);
     navit_textfile_debug_log(this_, "type=trackpoint_tracked");
     if (this_->ready == 3) {
@@ -3728,6 +3769,8 @@ void navit_destroy(struct navit *this_) {
     callback_destroy(this_->predraw_callback);
 
     callback_destroy(this_->route_cb);
+    if (this_->prefetch)
+        prefetch_destroy(this_->prefetch);
     if (this_->route)
         route_destroy(this_->route);
 
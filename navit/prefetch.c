@@ -0,0 +1,257 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ * @brief Loads the map data ahead of the vehicle in the background.
+ *
+ * Whenever the vehicle has moved far enough, a selection is built along the active route, or along the
+ * current heading if there is no route, up to the prefetch horizon. A background thread then hands this
+ * selection to `map_prefetch()` for every active map with static data, so the map drivers can decode the data
+ * before the renderer or the route graph builder reach it.
+ */
+
+#include <math.h>
+#include <glib.h>
+#include "config.h"
+#include "debug.h"
+#include "coord.h"
+#include "item.h"
+#include "map.h"
+#include "mapset.h"
+#include "projection.h"
+#include "transform.h"
+#include "route.h"
+#include "thread.h"
+#include "xmlconfig.h"
+#include "prefetch.h"
+
+/** Order of the selections handed to the maps, deep enough to include the streets */
+#define PREFETCH_ORDER 18
+/** Distance in meters between the sample points along the route or heading, also the half size of each rectangle */
+#define PREFETCH_STEP 500
+
+struct prefetch {
+    struct thread_lock *lock;
+    struct thread *thread;              /**< The worker thread, NULL if idle */
+    int running;                        /**< Whether the worker is still busy, protected by `lock` */
+    int cancel;                         /**< Set to stop the worker early, protected by `lock` */
+    GList *maps;                        /**< The maps left for the worker, protected by `lock` */
+    GList *refs;                        /**< The maps referenced for the worker, released on the main thread */
+    struct map_selection *sel;          /**< The selection being prefetched */
+    struct coord last;                  /**< The position of the last prefetch */
+    int last_valid;                     /**< Whether `last` is set */
+    int count;                          /**< Number of prefetches started */
+};
+
+/**
+ * @brief Creates a new prefetcher
+ *
+ * @return The new prefetcher
+ */
+struct prefetch *prefetch_new(void) {
+    struct prefetch *this_=g_new0(struct prefetch, 1);
+    this_->lock=thread_lock_new();
+    return this_;
+}
+
+static int prefetch_main(void *data) {
+    struct prefetch *this_=data;
+    struct map *m;
+
+    for (;;) {
+        thread_lock_acquire(this_->lock);
+        m=(this_->cancel || !this_->maps) ? NULL : this_->maps->data;
+        if (m)
+            this_->maps=g_list_delete_link(this_->maps, this_->maps);
+        else
+            this_->running=0;
+        thread_lock_release(this_->lock);
+        if (!m)
+            break;
+        map_prefetch(m, this_->sel);
+    }
+    return 0;
+}
+
+static void prefetch_unref_maps(struct prefetch *this_) {
+    GList *l;
+
+    for (l = this_->refs ; l ; l=g_list_next(l))
+        navit_object_unref(l->data);
+    g_list_free(this_->refs);
+    this_->refs=NULL;
+}
+
+/**
+ * @brief Cleans up after a worker which has finished
+ *
+ * @param this_ The prefetcher
+ * @param wait Whether to wait for a busy worker
+ * @return True if no worker is busy any more
+ */
+static int prefetch_reap(struct prefetch *this_, int wait) {
+    int running;
+
+    if (!this_->thread)
+        return 1;
+    thread_lock_acquire(this_->lock);
+    running=this_->running;
+    thread_lock_release(this_->lock);
+    if (running && !wait)
+        return 0;
+    thread_join(this_->thread);
+    this_->thread=NULL;
+    g_list_free(this_->maps);
+    this_->maps=NULL;
+    prefetch_unref_maps(this_);
+    map_selection_destroy(this_->sel);
+    this_->sel=NULL;
+    return 1;
+}
+
+static struct map_selection *prefetch_add_rect(struct map_selection *sel, enum projection pro, struct coord *c) {
+    struct pcoord pc;
+    struct map_selection *ret;
+
+    if (sel && sel->u.c_rect.lu.x <= c->x && sel->u.c_rect.rl.x >= c->x && sel->u.c_rect.rl.y <= c->y
+            && sel->u.c_rect.lu.y >= c->y)
+        return sel;
+    pc.pro=pro;
+    pc.x=c->x;
+    pc.y=c->y;
+    ret=map_selection_rect_new(&pc, PREFETCH_STEP*transform_scale(c->y), PREFETCH_ORDER);
+    ret->next=sel;
+    return ret;
+}
+
+/**
+ * @brief Builds the selection covering the next `distance` meters
+ *
+ * @param route The route, may be NULL
+ * @param pro The projection of `pos`
+ * @param pos The current position of the vehicle
+ * @param dir The current heading of the vehicle in degrees
+ * @param distance The prefetch horizon in meters
+ * @return The selection
+ */
+static struct map_selection *prefetch_selection(struct route *route, enum projection pro, struct coord *pos, double dir,
+        int distance) {
+    struct map_selection *sel=NULL;
+    struct coord c;
+    int d;
+
+    if (route && route_get_pos(route) && route_get_destination_count(route)) {
+        for (d = PREFETCH_STEP ; d <= distance ; d+=PREFETCH_STEP) {
+            c=route_get_coord_dist(route, d);
+            sel=prefetch_add_rect(sel, pro, &c);
+        }
+        /* Without a route path all points are at the current position, fall back to the heading */
+        if (sel && !sel->next) {
+            map_selection_destroy(sel);
+            sel=NULL;
+        }
+    }
+    if (!sel) {
+        double scale=transform_scale(pos->y);
+        double dx=sin(dir*M_PI/180)*scale,dy=cos(dir*M_PI/180)*scale;
+        for (d = PREFETCH_STEP ; d <= distance ; d+=PREFETCH_STEP) {
+            c.x=pos->x+dx*d;
+            c.y=pos->y+dy*d;
+            sel=prefetch_add_rect(sel, pro, &c);
+        }
+    }
+    return sel;
+}
+
+/**
+ * @brief Starts prefetching the map data ahead of the vehicle if needed
+ *
+ * Nothing is done while a previous prefetch is still running, or until the vehicle has moved a quarter
+ * of the horizon since the last prefetch.
+ *
+ * @param this_ The prefetcher
+ * @param ms The mapset to prefetch from
+ * @param route The route to follow, may be NULL
+ * @param pro The projection of `pos`, which must be the projection of the maps
+ * @param pos The current position of the vehicle
+ * @param dir The current heading of the vehicle in degrees
+ * @param distance The prefetch horizon in meters
+ */
+void prefetch_update(struct prefetch *this_, struct mapset *ms, struct route *route, enum projection pro,
+                     struct coord *pos, double dir, int distance) {
+    struct mapset_handle *msh;
+    struct map *m;
+    struct attr attr;
+    GList *maps=NULL,*l;
+
+    if (!ms || distance <= 0 || !thread_supported())
+        return;
+    if (!prefetch_reap(this_, 0))
+        return;
+    if (this_->last_valid && transform_distance(pro, &this_->last, pos) < distance/4)
+        return;
+    /* Only maps with static data may be read off the main loop */
+    msh=mapset_open(ms);
+    while ((m=mapset_next(msh, 1)))
+        if (map_get_attr(m, attr_static_data, &attr, NULL) && attr.u.num)
+            maps=g_list_append(maps, m);
+    mapset_close(msh);
+    if (!maps)
+        return;
+    this_->sel=prefetch_selection(route, pro, pos, dir, distance);
+    if (!this_->sel) {
+        g_list_free(maps);
+        return;
+    }
+    this_->last=*pos;
+    this_->last_valid=1;
+    /* keep the maps alive if they are removed from the mapset while the worker reads them */
+    for (l = maps ; l ; l=g_list_next(l))
+        navit_object_ref(l->data);
+    this_->refs=g_list_copy(maps);
+    this_->maps=maps;
+    this_->cancel=0;
+    this_->running=1;
+    this_->thread=thread_new(prefetch_main, this_, "prefetch");
+    if (!this_->thread) {
+        this_->running=0;
+        g_list_free(this_->maps);
+        this_->maps=NULL;
+        prefetch_unref_maps(this_);
+        map_selection_destroy(this_->sel);
+        this_->sel=NULL;
+        return;
+    }
+    this_->count++;
+    dbg(lvl_debug,"prefetch %d started, %d m ahead", this_->count, distance);
+}
+
+/**
+ * @brief Stops a running prefetch and destroys the prefetcher
+ *
+ * @param this_ The prefetcher
+ */
+void prefetch_destroy(struct prefetch *this_) {
+    thread_lock_acquire(this_->lock);
+    this_->cancel=1;
+    thread_lock_release(this_->lock);
+    prefetch_reap(this_, 1);
+    thread_lock_destroy(this_->lock);
+    g_free(this_);
+}
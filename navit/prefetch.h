@@ -0,0 +1,41 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef NAVIT_PREFETCH_H
+#define NAVIT_PREFETCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* prototypes */
+enum projection;
+struct coord;
+struct mapset;
+struct prefetch;
+struct route;
+struct prefetch *prefetch_new(void);
+void prefetch_update(struct prefetch *this_, struct mapset *ms, struct route *route, enum projection pro,
+                     struct coord *pos, double dir, int distance);
+void prefetch_destroy(struct prefetch *this_);
+/* end of prototypes */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
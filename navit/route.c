@@ -85,8 +85,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <sys/time.h>
+#include <glib.h>
 #include "navit_nls.h"
-#include "glib_slice.h"
 #include "config.h"
 #include "point.h"
 #include "graphics.h"
@@ -102,13 +103,14 @@
 #include "track.h"
 #include "transform.h"
 #include "plugin.h"
-#include "fib.h"
 #include "event.h"
 #include "callback.h"
 #include "vehicle.h"
 #include "vehicleprofile.h"
 #include "roadprofile.h"
 #include "debug.h"
+#include "util.h"
+#include "thread.h"
 
 struct map_priv {
     struct route *route;
@@ -183,6 +185,8 @@ struct route_path {
     int in_use;						/**< The path is in use and can not be updated */
     int update_required;					/**< The path needs to be updated after it is no longer in use */
     int updated;						/**< The path has only been updated */
+    int unchanged;						/**< Number of segments at the start of the path which were taken over
+												 *  from the previous path */
     int path_time;						/**< Time to pass the path */
     int path_len;						/**< Length of the path */
     struct route_path_segment *path;			/**< The first segment in the path, i.e. the segment one should
@@ -218,11 +222,31 @@ struct route {
     struct vehicleprofile *vehicleprofile; /**< Routing preferences */
     int route_status;		/**< Route Status */
     int link_path;			/**< Link paths over multiple waypoints together */
+    int ch_routing;			/**< Build the route graph along a contraction hierarchy corridor if the map has one */
+    int ch_failed;			/**< No route was found within the corridor, use the full selection until the
+							 *   destinations change */
+    int build_threads;		/**< Number of worker threads used to build the route graph, 0 to build it on the main
+							 *   loop */
+    int graph_cache;		/**< Keep the segments read from the maps in an on-disk cache */
     struct pcoord pc;
     struct vehicle *v;
 };
 
-#define HASHCOORD(c) ((((c)->x +(c)->y) * 2654435761UL) & (HASH_SIZE-1))
+/** Initial number of slots of the route graph point hashtable */
+#define ROUTE_GRAPH_HASH_MIN 1024
+
+/** Maximum load of the route graph point hashtable in percent, beyond which it is grown */
+#define ROUTE_GRAPH_HASH_LOAD 70
+
+/** Size of the chunks from which route graph points and segments are allocated */
+#define ROUTE_GRAPH_ARENA_CHUNK 65536
+
+/** Alignment of route graph points and segments within an arena chunk */
+#define ROUTE_GRAPH_ARENA_ALIGN 8
+
+struct route_graph_arena_chunk {
+    struct route_graph_arena_chunk *next;
+};
 
 /**
  * @brief Iterator to iterate through all route graph segments in a route graph point
@@ -242,17 +266,58 @@ struct attr_iter {
     } u;
 };
 
+/**
+ * @brief A worker thread reading items for a route graph
+ */
+struct route_graph_worker {
+    struct route_graph_builder *builder;  /**< The builder this worker belongs to */
+    struct thread *thread;                /**< The thread, NULL if it could not be started */
+    struct route_graph_batch batch;       /**< Segments read by this worker */
+};
+
+/**
+ * @brief State of a route graph which is being built on worker threads
+ *
+ * Each worker takes the next map from `maps`, reads all items within the selection into its own batch and
+ * continues with the next map until none are left. Only maps with static data are read by the workers, all
+ * others are read in the idle callback of the graph while the workers run. Once both are done, the batches of
+ * the workers are added to the graph on the main loop.
+ */
+struct route_graph_builder {
+    struct route_graph *graph;            /**< The graph being built */
+    struct vehicleprofile *profile;       /**< The vehicle profile */
+    struct thread_lock *lock;             /**< Protects `maps`, `running` and `cancel` */
+    GList *maps;                          /**< The maps left for the workers */
+    GList *refs;                          /**< The maps referenced for the workers, released on the main loop */
+    struct route_graph_worker *workers;   /**< The workers */
+    int worker_count;                     /**< Number of workers */
+    int running;                          /**< Number of workers which have not finished yet */
+    int cancel;                           /**< Set to make the workers stop early */
+    int finished;                         /**< Set on the main loop once all workers have finished */
+};
+
+/** Protects `route_graph_builders_done` */
+static struct thread_lock *route_graph_builders_lock;
+
+/** Builders whose workers have all finished */
+static GList *route_graph_builders_done;
+
+/** Called on the main loop when a builder has finished */
+static struct callback_list *route_graph_builders_cbl;
+
 static struct route_info * route_find_nearest_street(struct vehicleprofile *vehicleprofile, struct mapset *ms,
         struct pcoord *c);
 static void route_graph_update(struct route *this, struct callback *cb, int async);
 static struct route_path *route_path_new(struct route_graph *this, struct route_path *oldpath, struct route_info *pos,
         struct route_info *dst, struct vehicleprofile *profile);
-static void route_graph_add_street(struct route_graph *this, struct item *item, struct vehicleprofile *profile);
+static void route_graph_batch_add_street(struct route_graph_batch *batch, struct item *item,
+        struct vehicleprofile *profile);
+static void route_graph_builder_destroy(struct route_graph_builder *builder, int cancel);
 static void route_graph_destroy(struct route_graph *this);
 static void route_path_update(struct route *this, int cancel, int async);
 static int route_time_seg(struct vehicleprofile *profile, struct route_segment_data *over,
                           struct route_traffic_distortion *dist);
-static void route_graph_compute_shortest_path(struct route_graph * graph, struct vehicleprofile * profile,
+static int route_graph_compute_shortest_path(struct route_graph * graph, struct vehicleprofile * profile,
         struct callback *cb);
 static int route_graph_is_path_computed(struct route_graph *this_);
 static struct route_graph_segment *route_graph_get_segment(struct route_graph *graph, struct street_data *sd,
@@ -422,6 +487,12 @@ route_new(struct attr *parent, struct attr **attrs) {
     } else {
         this->destination_distance = 50; // Default value
     }
+    if (attr_generic_get_attr(attrs, NULL, attr_ch_routing, &dest_attr, NULL))
+        this->ch_routing = dest_attr.u.num;
+    if (attr_generic_get_attr(attrs, NULL, attr_build_threads, &dest_attr, NULL))
+        this->build_threads = dest_attr.u.num;
+    if (attr_generic_get_attr(attrs, NULL, attr_graph_cache, &dest_attr, NULL))
+        this->graph_cache = dest_attr.u.num;
     this->cbl2=callback_list_new();
 
     return this;
@@ -443,6 +514,9 @@ route_dup(struct route *orig) {
     this->ms=orig->ms;
     this->flags=orig->flags;
     this->vehicleprofile=orig->vehicleprofile;
+    this->ch_routing=orig->ch_routing;
+    this->build_threads=orig->build_threads;
+    this->graph_cache=orig->graph_cache;
 
     return this;
 }
@@ -755,8 +829,13 @@ static void route_path_update_done(struct route *this, int new_graph) {
             route_status.u.num=route_status_path_done_incremental;
         else
             route_status.u.num=route_status_path_done_new;
-    } else
+    } else {
+        if (this->graph && this->graph->ch) {
+            dbg(lvl_debug,"no route within contraction hierarchy corridor, falling back to full selection");
+            this->ch_failed=1;
+        }
         route_status.u.num=route_status_not_found;
+    }
     this->link_path=0;
     route_set_attr(this, &route_status);
 }
@@ -1003,8 +1082,11 @@ static struct map_selection *route_rect_add(struct map_selection *sel, int order
  * @param c Array containing route points, including start, intermediate and destination ones.
  * @param count number of route points
  * @param proifle vehicleprofile
+ * @param rel If false, selections relative to the enclosing rectangle of all route points are omitted and only
+ * those around each individual route point are returned
  */
-static struct map_selection *route_calc_selection(struct coord *c, int count, struct vehicleprofile *profile) {
+static struct map_selection *route_calc_selection(struct coord *c, int count, struct vehicleprofile *profile,
+        int rel) {
     struct map_selection *ret=NULL;
     int i;
     struct coord_rect r;
@@ -1025,9 +1107,10 @@ static struct map_selection *route_calc_selection(struct coord *c, int count, st
     while((tok=strtok(str,","))!=NULL) {
         int order=0, dist=0;
         sscanf(tok,"%d:%d",&order,&dist);
-        if(strchr(tok,'%'))
-            ret=route_rect_add(ret, order, &r.lu, &r.rl, dist, 0);
-        else
+        if(strchr(tok,'%')) {
+            if (rel)
+                ret=route_rect_add(ret, order, &r.lu, &r.rl, dist, 0);
+        } else
             for (i = 0 ; i < count ; i++) {
                 ret=route_rect_add(ret, order, &c[i], &c[i], 0, dist);
             }
@@ -1039,6 +1122,48 @@ static struct map_selection *route_calc_selection(struct coord *c, int count, st
     return ret;
 }
 
+/**
+ * @brief Snaps a coordinate down to a grid
+ *
+ * @param v The coordinate
+ * @param min The origin of the grid
+ * @param size The grid size
+ * @return The largest grid line which is not greater than `v`
+ */
+static int route_snap_down(int v, int min, long long size) {
+    long long o=(long long)v-min;
+
+    return (int)(min+(o >= 0 ? o/size : -((-o+size-1)/size))*size);
+}
+
+/**
+ * @brief Widens a list of map selections to the tile boundaries of their order
+ *
+ * Map tiles are selected if they overlap one of the rectangles, so widening each rectangle to the tiles of its
+ * order reads (almost) the same tiles, while the rectangles no longer change with every small move of the route
+ * points. This is what lets the route graph cache match the selection of a later route to the same area.
+ *
+ * @param sel The selections to widen, modified in place
+ */
+static void route_selection_snap(struct map_selection *sel) {
+    long long size;
+    int order;
+
+    while (sel) {
+        order=sel->order;
+        if (order < 0)
+            order=0;
+        if (order > 18)
+            order=18;
+        size=((long long)WORLD_BOUNDINGBOX_MAX_X-WORLD_BOUNDINGBOX_MIN_X) >> order;
+        sel->u.c_rect.lu.x=route_snap_down(sel->u.c_rect.lu.x, WORLD_BOUNDINGBOX_MIN_X, size);
+        sel->u.c_rect.rl.y=route_snap_down(sel->u.c_rect.rl.y, WORLD_BOUNDINGBOX_MIN_Y, size);
+        sel->u.c_rect.rl.x=-route_snap_down(-sel->u.c_rect.rl.x, -WORLD_BOUNDINGBOX_MAX_X, size);
+        sel->u.c_rect.lu.y=-route_snap_down(-sel->u.c_rect.lu.y, -WORLD_BOUNDINGBOX_MAX_Y, size);
+        sel=sel->next;
+    }
+}
+
 /**
  * @brief Retrieves the map selection for the route.
  */
@@ -1054,7 +1179,31 @@ struct map_selection * route_get_selection(struct route * this_) {
         c[i++] = dst->c;
         tmp = g_list_next(tmp);
     }
-    return route_calc_selection(c, i, this_->vehicleprofile);
+    return route_calc_selection(c, i, this_->vehicleprofile, 1);
+}
+
+/**
+ * @brief Returns a list of map selections covering a contraction hierarchy corridor
+ *
+ * The list consists of the corridor returned by `route_ch_corridor()`, plus the selections around each route
+ * point from the vehicle profile's `route_depth`, which connect the route points to the corridor.
+ *
+ * @param ms The mapset
+ * @param c Array containing route points, including start, intermediate and destination ones.
+ * @param count number of route points
+ * @param profile vehicleprofile
+ * @return The list of map selections, or NULL if no corridor could be determined
+ */
+static struct map_selection *route_calc_ch_selection(struct mapset *ms, struct coord *c, int count,
+        struct vehicleprofile *profile) {
+    struct map_selection *ret,*last;
+
+    ret=route_ch_corridor(ms, c, count);
+    if (!ret)
+        return NULL;
+    for (last=ret ; last->next ; last=last->next);
+    last->next=route_calc_selection(c, count, profile, 0);
+    return ret;
 }
 
 /**
@@ -1104,6 +1253,7 @@ void route_set_destinations(struct route *this, struct pcoord *dst, int count, i
 
     profile(0,NULL);
     route_clear_destinations(this);
+    this->ch_failed=0;
     if (dst && count) {
         for (i = 0 ; i < count ; i++) {
             dsti=route_find_nearest_street(this->vehicleprofile, this->ms, &dst[i]);
@@ -1289,6 +1439,122 @@ void route_remove_waypoint(struct route *this) {
     }
 }
 
+/**
+ * @brief Allocates zeroed memory from a route graph arena
+ *
+ * The memory cannot be freed individually, it is released along with all other memory of the arena by
+ * `route_graph_arena_free()`.
+ *
+ * @param arena The arena
+ * @param size Number of bytes to allocate
+ * @return The memory
+ */
+static void *route_graph_arena_alloc(struct route_graph_arena *arena, int size) {
+    struct route_graph_arena_chunk *chunk;
+    int header=(sizeof(*chunk)+ROUTE_GRAPH_ARENA_ALIGN-1) & ~(ROUTE_GRAPH_ARENA_ALIGN-1);
+    int chunk_size;
+    void *ret;
+
+    size=(size+ROUTE_GRAPH_ARENA_ALIGN-1) & ~(ROUTE_GRAPH_ARENA_ALIGN-1);
+    if (arena->end-arena->next < size) {
+        chunk_size=MAX(ROUTE_GRAPH_ARENA_CHUNK, header+size);
+        chunk=g_malloc0(chunk_size);
+        chunk->next=arena->chunks;
+        arena->chunks=chunk;
+        arena->next=(char *)chunk+header;
+        arena->end=(char *)chunk+chunk_size;
+        arena->size+=chunk_size;
+    }
+    ret=arena->next;
+    arena->next+=size;
+    return ret;
+}
+
+/**
+ * @brief Releases all memory of a route graph arena
+ *
+ * @param arena The arena
+ */
+static void route_graph_arena_free(struct route_graph_arena *arena) {
+    struct route_graph_arena_chunk *chunk,*next;
+
+    for (chunk = arena->chunks ; chunk ; chunk = next) {
+        next=chunk->next;
+        g_free(chunk);
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+/**
+ * @brief Hashes a coordinate pair for the route graph point hashtable
+ *
+ * Both coordinates are combined into one 64-bit value, which is then mixed so that nearby points (including points
+ * on a diagonal) end up in different slots.
+ *
+ * @param c The coordinates
+ * @return The hash value
+ */
+static inline unsigned int route_graph_hash_coord(struct coord *c) {
+    guint64 h=((guint64)(unsigned int)c->x << 32) | (unsigned int)c->y;
+    h ^= h >> 33;
+    h *= G_GUINT64_CONSTANT(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= G_GUINT64_CONSTANT(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return (unsigned int)h;
+}
+
+/**
+ * @brief Finds the hashtable slot for the specified coordinates
+ *
+ * @param this The route graph
+ * @param c Coordinates to search for
+ * @return The slot holding the points at `c`, or the empty slot where they would be inserted; NULL if the
+ * hashtable has not been allocated yet
+ */
+static struct route_graph_point **route_graph_hash_slot(struct route_graph *this, struct coord *c) {
+    unsigned int mask,i;
+    struct route_graph_point *p;
+
+    if (!this->hash)
+        return NULL;
+    this->hash_lookups++;
+    mask=this->hash_size-1;
+    i=route_graph_hash_coord(c) & mask;
+    for (;;) {
+        this->hash_probes++;
+        p=this->hash[i];
+        if (!p || (p->c.x == c->x && p->c.y == c->y))
+            return &this->hash[i];
+        i=(i+1) & mask;
+    }
+}
+
+/**
+ * @brief Resizes the route graph point hashtable
+ *
+ * @param this The route graph
+ * @param size The new number of slots, must be a power of two and larger than the number of slots in use
+ */
+static void route_graph_hash_resize(struct route_graph *this, int size) {
+    struct route_graph_point **old=this->hash;
+    unsigned int mask=size-1,j;
+    int i;
+
+    dbg(lvl_debug,"resizing point hashtable from %d to %d slots, %d in use", this->hash_size, size, this->hash_count);
+    this->hash=g_new0(struct route_graph_point *, size);
+    for (i = 0 ; i < this->hash_size ; i++) {
+        if (!old[i])
+            continue;
+        j=route_graph_hash_coord(&old[i]->c) & mask;
+        while (this->hash[j])
+            j=(j+1) & mask;
+        this->hash[j]=old[i];
+    }
+    this->hash_size=size;
+    g_free(old);
+}
+
 /**
  * @brief Gets the next route_graph_point with the specified coordinates
  *
@@ -1300,19 +1566,11 @@ void route_remove_waypoint(struct route *this) {
  */
 struct route_graph_point *route_graph_get_point_next(struct route_graph *this, struct coord *c,
         struct route_graph_point *last) {
-    struct route_graph_point *p;
-    int seen=0,hashval=HASHCOORD(c);
-    p=this->hash[hashval];
-    while (p) {
-        if (p->c.x == c->x && p->c.y == c->y) {
-            if (!last || seen)
-                return p;
-            if (p == last)
-                seen=1;
-        }
-        p=p->hash_next;
-    }
-    return NULL;
+    struct route_graph_point **slot;
+    if (last)
+        return last->hash_next;
+    slot=route_graph_hash_slot(this, c);
+    return slot ? *slot : NULL;
 }
 
 /**
@@ -1335,11 +1593,9 @@ struct route_graph_point * route_graph_get_point(struct route_graph *this, struc
  */
 static struct route_graph_point *route_graph_get_point_last(struct route_graph *this, struct coord *c) {
     struct route_graph_point *p,*ret=NULL;
-    int hashval=HASHCOORD(c);
-    p=this->hash[hashval];
+    p=route_graph_get_point(this, c);
     while (p) {
-        if (p->c.x == c->x && p->c.y == c->y)
-            ret=p;
+        ret=p;
         p=p->hash_next;
     }
     return ret;
@@ -1350,21 +1606,29 @@ static struct route_graph_point *route_graph_get_point_last(struct route_graph *
 /**
  * @brief Create a new point for the route graph with the specified coordinates
  *
+ * The point is created even if the route graph already contains a point at the same coordinates. The new point
+ * becomes the first of them to be returned by `route_graph_get_point()`.
+ *
  * @param this The route to insert the point into
  * @param f The coordinates at which the point should be created
  * @return The point created
  */
 
 static struct route_graph_point *route_graph_point_new(struct route_graph *this, struct coord *f) {
-    int hashval;
+    struct route_graph_point **slot;
     struct route_graph_point *p;
 
-    hashval=HASHCOORD(f);
+    if ((this->hash_count+1)*100 > this->hash_size*ROUTE_GRAPH_HASH_LOAD)
+        route_graph_hash_resize(this, this->hash_size ? this->hash_size*2 : ROUTE_GRAPH_HASH_MIN);
+    slot=route_graph_hash_slot(this, f);
     if (debug_route)
         printf("p (0x%x,0x%x)\n", f->x, f->y);
-    p=g_slice_new0(struct route_graph_point);
-    p->hash_next=this->hash[hashval];
-    this->hash[hashval]=p;
+    p=route_graph_arena_alloc(&this->points, sizeof(struct route_graph_point));
+    if (!*slot)
+        this->hash_count++;
+    p->hash_next=*slot;
+    *slot=p;
+    this->point_count++;
     p->value=INT_MAX;
     p->dst_val = INT_MAX;
     p->c=*f;
@@ -1399,17 +1663,12 @@ struct route_graph_point * route_graph_add_point(struct route_graph *this, struc
  * @param this The route graph to delete all points from
  */
 void route_graph_free_points(struct route_graph *this) {
-    struct route_graph_point *curr,*next;
-    int i;
-    for (i = 0 ; i < HASH_SIZE ; i++) {
-        curr=this->hash[i];
-        while (curr) {
-            next=curr->hash_next;
-            g_slice_free(struct route_graph_point, curr);
-            curr=next;
-        }
-        this->hash[i]=NULL;
-    }
+    route_graph_arena_free(&this->points);
+    g_free(this->hash);
+    this->hash=NULL;
+    this->hash_size=0;
+    this->hash_count=0;
+    this->point_count=0;
 }
 
 /**
@@ -1436,7 +1695,7 @@ static void route_graph_init(struct route_graph *this, struct route_info *dst, s
             s->end->dst_seg = s;
             s->end->rhs = val;
             s->end->dst_val = val;
-            s->end->el = fh_insertkey(this->heap, MIN(s->end->rhs, s->end->value), s->end);
+            route_heap_insert(this->heap, s->end, MIN(s->end->rhs, s->end->value));
         }
         val = route_value_seg(profile, NULL, s, 1);
         if (val != INT_MAX) {
@@ -1445,7 +1704,7 @@ static void route_graph_init(struct route_graph *this, struct route_info *dst, s
             s->start->dst_seg = s;
             s->start->rhs = val;
             s->start->dst_val = val;
-            s->start->el = fh_insertkey(this->heap, MIN(s->start->rhs, s->start->value), s->start);
+            route_heap_insert(this->heap, s->start, MIN(s->start->rhs, s->start->value));
         }
     }
 }
@@ -1456,11 +1715,9 @@ static void route_graph_init(struct route_graph *this, struct route_info *dst, s
  * This iterates through all the points in the route graph, resetting them to their initial state.
  * The `value` (cost to reach the destination via `seg`) and `dst_val` (cost to destination if this point is the last
  * in the route) members of each point are reset to`INT_MAX`, the `seg` member (cheapest way to destination) is reset
- * to `NULL` and the `el` member (pointer to element in Fibonacci heap) is also reset to `NULL`.
+ * to `NULL`.
  *
- * The Fibonacci heap is also cleared. Inconsistencies between `el` and Fibonacci heap membership are handled
- * gracefully, i.e. `el` is reset even if it is invalid, and points are removed from the heap regardless of their `el`
- * value.
+ * The heap is also cleared, which resets the heap position of every point which was on it.
  *
  * After this method returns, the caller should call
  * {@link route_graph_init(struct route_graph *, struct route_info *, struct vehicleprofile *)} to initialize potential
@@ -1475,7 +1732,7 @@ static void route_graph_reset(struct route_graph *this) {
     struct route_graph_point *curr;
     int i;
 
-    for (i = 0 ; i < HASH_SIZE ; i++) {
+    for (i = 0 ; i < this->hash_size ; i++) {
         curr=this->hash[i];
         while (curr) {
             curr->value=INT_MAX;
@@ -1483,14 +1740,11 @@ static void route_graph_reset(struct route_graph *this) {
             curr->rhs = INT_MAX;
             curr->seg=NULL;
             curr->dst_seg = NULL;
-            curr->el=NULL;
             curr=curr->hash_next;
         }
     }
 
-    while (fh_extractmin(this->heap)) {
-        // no operation, just remove all items (`el` has already been reset)
-    }
+    route_heap_clear(this->heap);
 }
 
 /**
@@ -1595,7 +1849,7 @@ void route_graph_add_segment(struct route_graph *this, struct route_graph_point
     int size;
 
     size = sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)+route_segment_data_size(data->flags);
-    s = g_slice_alloc0(size);
+    s = route_graph_arena_alloc(&this->segments, size);
     if (!s) {
         printf("%s:Out of memory\n", __FUNCTION__);
         return;
@@ -1843,15 +2097,7 @@ linkold:
  * @param this The graph to destroy all segments from
  */
 void route_graph_free_segments(struct route_graph *this) {
-    struct route_graph_segment *curr,*next;
-    int size;
-    curr=this->route_segments;
-    while (curr) {
-        next=curr->next;
-        size = sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)+route_segment_data_size(curr->data.flags);
-        g_slice_free1(size, curr);
-        curr=next;
-    }
+    route_graph_arena_free(&this->segments);
     this->route_segments=NULL;
 }
 
@@ -1865,7 +2111,7 @@ static void route_graph_destroy(struct route_graph *this) {
         route_graph_build_done(this, 1);
         route_graph_free_points(this);
         route_graph_free_segments(this);
-        fh_deleteheap(this->heap);
+        route_heap_destroy(this->heap);
         g_free(this);
     }
 }
@@ -2132,7 +2378,7 @@ static int route_value_add(int val1, int val2) {
  * @param heap The heap
  */
 static void route_graph_point_update(struct vehicleprofile *profile, struct route_graph_point * p,
-                                     struct fibheap * heap) {
+                                     struct route_heap * heap) {
     struct route_graph_segment *s = NULL;
     int new, val;
 
@@ -2173,17 +2419,11 @@ static void route_graph_point_update(struct vehicleprofile *profile, struct rout
         }
     }
 
-    if (p->el) {
-        /* Due to a limitation of the Fibonacci heap implementation, which causes fh_replacekey() to fail if the new
-         * key is greater than the current one, we always remove the point from the heap (and, if locally inconsistent,
-         * re-add it afterwards). */
-        fh_delete(heap, p->el);
-        p->el = NULL;
-    }
-
     if (p->rhs != p->value)
-        /* The point is locally inconsistent, add (or re-add) it to the heap */
-        p->el = fh_insertkey(heap, MIN(p->rhs, p->value), p);
+        /* The point is locally inconsistent, add it to the heap or change its key */
+        route_heap_insert(heap, p, MIN(p->rhs, p->value));
+    else
+        route_heap_remove(heap, p);
 }
 
 /**
@@ -2198,14 +2438,17 @@ static void route_graph_point_update(struct vehicleprofile *profile, struct rout
  * @param profile The vehicle profile to use for routing. This determines which ways are passable and how their costs
  * are calculated.
  * @param cb The callback function to call when flooding is complete (can be NULL)
+ *
+ * @return The number of points which were expanded
  */
-static void route_graph_compute_shortest_path(struct route_graph * graph, struct vehicleprofile * profile,
+static int route_graph_compute_shortest_path(struct route_graph * graph, struct vehicleprofile * profile,
         struct callback *cb) {
     struct route_graph_point *p_min;
     struct route_graph_segment *s = NULL;
+    int expanded = 0;
 
-    while (!route_graph_is_path_computed(graph) && (p_min = fh_extractmin(graph->heap))) {
-        p_min->el = NULL;
+    while (!route_graph_is_path_computed(graph) && (p_min = route_heap_extract_min(graph->heap))) {
+        expanded++;
         if (p_min->value > p_min->rhs)
             /* cost has decreased, update point value */
             p_min->value = p_min->rhs;
@@ -2229,6 +2472,7 @@ static void route_graph_compute_shortest_path(struct route_graph * graph, struct
     }
     if (cb)
         callback_call_0(cb);
+    return expanded;
 }
 
 /**
@@ -2272,54 +2516,185 @@ static void route_graph_set_traffic_distortion(struct route_graph *this, struct
 }
 
 /**
- * @brief Adds a traffic distortion item to the route graph
+ * @brief Appends a segment to a batch
  *
- * @param this The route graph to add to
- * @param profile The vehicle profile to use for cost calculations
- * @param item The item to add, must be of {@code type_traffic_distortion}
- * @param update Whether to update the point (true for LPA*, false for Dijkstra)
+ * @param batch The batch
+ * @param item The item the segment belongs to
+ * @param start Coordinates of the start point
+ * @param end Coordinates of the end point
+ * @return The new entry, with all other members set to zero
  */
-static void route_graph_add_traffic_distortion(struct route_graph *this, struct vehicleprofile *profile,
-        struct item *item, int update) {
+struct route_graph_batch_entry *route_graph_batch_append(struct route_graph_batch *batch, struct item *item,
+        struct coord *start, struct coord *end) {
+    struct route_graph_batch_entry *ret;
+
+    if (batch->count == batch->size) {
+        batch->size=batch->size ? batch->size*2 : 256;
+        batch->entries=g_renew(struct route_graph_batch_entry, batch->entries, batch->size);
+    }
+    ret=&batch->entries[batch->count++];
+    memset(ret, 0, sizeof(*ret));
+    ret->item=*item;
+    ret->start=*start;
+    ret->end=*end;
+    return ret;
+}
+
+/**
+ * @brief Adds a segment from a batch to the route graph, creating its points if needed
+ *
+ * @param this The route graph
+ * @param entry The segment
+ * @param s_ret If not NULL, receives the start point of the segment
+ * @param e_ret If not NULL, receives the end point of the segment
+ */
+void route_graph_batch_add_entry(struct route_graph *this, struct route_graph_batch_entry *entry,
+                                 struct route_graph_point **s_ret, struct route_graph_point **e_ret) {
     struct route_graph_point *s_pnt,*e_pnt;
-    struct coord c,l;
-    struct attr flags_attr, delay_attr, maxspeed_attr;
-    struct route_graph_segment_data data;
 
-    data.item=item;
-    data.len=0;
-    data.offset=1;
-    data.maxspeed = INT_MAX;
+    s_pnt=route_graph_add_point(this, &entry->start);
+    e_pnt=route_graph_add_point(this, &entry->end);
+    s_pnt->flags |= entry->start_flags;
+    e_pnt->flags |= entry->end_flags;
+    entry->data.item=&entry->item;
+    if (!entry->check_duplicate || !route_graph_segment_is_duplicate(s_pnt, &entry->data))
+        route_graph_add_segment(this, s_pnt, e_pnt, &entry->data);
+    if (s_ret)
+        *s_ret=s_pnt;
+    if (e_ret)
+        *e_ret=e_pnt;
+}
+
+/**
+ * @brief Adds all segments of a batch to the route graph and empties the batch
+ *
+ * @param this The route graph
+ * @param batch The batch
+ */
+static void route_graph_batch_add(struct route_graph *this, struct route_graph_batch *batch) {
+    int i;
+
+    if (this->cache)
+        route_cache_record(this->cache, batch);
+    for (i = 0 ; i < batch->count ; i++)
+        route_graph_batch_add_entry(this, &batch->entries[i], NULL, NULL);
+    batch->count=0;
+}
+
+/**
+ * @brief Frees the memory used by a batch
+ *
+ * @param batch The batch
+ */
+void route_graph_batch_free(struct route_graph_batch *batch) {
+    g_free(batch->entries);
+    memset(batch, 0, sizeof(*batch));
+}
+
+/**
+ * @brief Reads a traffic distortion item into a batch
+ *
+ * @param batch The batch
+ * @param item The item, must be of {@code type_traffic_distortion}
+ */
+static void route_graph_batch_add_traffic_distortion(struct route_graph_batch *batch, struct item *item) {
+    struct route_graph_batch_entry *entry;
+    struct coord c,l,s;
+    struct attr flags_attr, delay_attr, maxspeed_attr;
+    int flags=0;
 
     item_attr_rewind(item);
     if (item_attr_get(item, attr_flags, &flags_attr))
-        data.flags = flags_attr.u.num & AF_DISTORTIONMASK;
-    else
-        data.flags = 0;
+        flags = flags_attr.u.num & AF_DISTORTIONMASK;
 
     item_coord_rewind(item);
-    if (item_coord_get(item, &l, 1)) {
-        s_pnt=route_graph_add_point(this,&l);
+    if (item_coord_get(item, &s, 1)) {
+        l=s;
         while (item_coord_get(item, &c, 1)) {
             l=c;
         }
-        e_pnt=route_graph_add_point(this,&l);
-        s_pnt->flags |= RP_TRAFFIC_DISTORTION;
-        e_pnt->flags |= RP_TRAFFIC_DISTORTION;
+        entry=route_graph_batch_append(batch, item, &s, &l);
+        entry->start_flags=RP_TRAFFIC_DISTORTION;
+        entry->end_flags=RP_TRAFFIC_DISTORTION;
+        entry->data.flags=flags;
+        entry->data.offset=1;
+        entry->data.maxspeed=INT_MAX;
         if (item_attr_get(item, attr_maxspeed, &maxspeed_attr)) {
-            data.flags |= AF_SPEED_LIMIT;
-            data.maxspeed=maxspeed_attr.u.num;
+            entry->data.flags |= AF_SPEED_LIMIT;
+            entry->data.maxspeed=maxspeed_attr.u.num;
         }
         if (item_attr_get(item, attr_delay, &delay_attr))
-            data.len=delay_attr.u.num;
-        route_graph_add_segment(this, s_pnt, e_pnt, &data);
+            entry->data.len=delay_attr.u.num;
+    }
+}
+
+/**
+ * @brief Reads a turn restriction item into a batch
+ *
+ * @param batch The batch
+ * @param item The item, must be of `type_street_turn_restriction_no` or `type_street_turn_restriction_only`
+ */
+void route_graph_batch_add_turn_restriction(struct route_graph_batch *batch, struct item *item) {
+    struct coord c[5];
+    int count;
+
+    item_coord_rewind(item);
+    count=item_coord_get(item, c, 5);
+    if (count != 3 && count != 4) {
+        dbg(lvl_debug,"wrong count %d",count);
+        return;
+    }
+    if (count == 4)
+        return;
+    dbg(lvl_debug,"%s: (0x%x,0x%x)-(0x%x,0x%x)-(0x%x,0x%x)",item_to_name(item->type),c[0].x,c[0].y,c[1].x,c[1].y,
+        c[2].x,c[2].y);
+    route_graph_batch_append(batch, item, &c[0], &c[1])->end_flags=RP_TURN_RESTRICTION;
+    route_graph_batch_append(batch, item, &c[1], &c[2]);
+}
+
+/**
+ * @brief Reads an item of any type relevant for routing into a batch
+ *
+ * @param batch The batch
+ * @param item The item
+ * @param profile The vehicle profile currently in use
+ */
+static void route_graph_batch_add_item(struct route_graph_batch *batch, struct item *item,
+                                       struct vehicleprofile *profile) {
+    if (item->type == type_traffic_distortion)
+        route_graph_batch_add_traffic_distortion(batch, item);
+    else if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
+        route_graph_batch_add_turn_restriction(batch, item);
+    else
+        route_graph_batch_add_street(batch, item, profile);
+}
+
+/**
+ * @brief Adds a traffic distortion item to the route graph
+ *
+ * @param this The route graph to add to
+ * @param profile The vehicle profile to use for cost calculations
+ * @param item The item to add, must be of {@code type_traffic_distortion}
+ * @param update Whether to update the point (true for LPA*, false for Dijkstra)
+ */
+static void route_graph_add_traffic_distortion(struct route_graph *this, struct vehicleprofile *profile,
+        struct item *item, int update) {
+    struct route_graph_batch batch= {NULL, 0, 0};
+    struct route_graph_batch_entry *entry;
+    struct route_graph_point *s_pnt,*e_pnt;
+
+    route_graph_batch_add_traffic_distortion(&batch, item);
+    if (batch.count) {
+        entry=&batch.entries[0];
+        route_graph_batch_add_entry(this, entry, &s_pnt, &e_pnt);
         if (update) {
-            if (!(data.flags & AF_ONEWAYREV))
+            if (!(entry->data.flags & AF_ONEWAYREV))
                 route_graph_point_update(profile, s_pnt, this->heap);
-            if (!(data.flags & AF_ONEWAY))
+            if (!(entry->data.flags & AF_ONEWAY))
                 route_graph_point_update(profile, e_pnt, this->heap);
         }
     }
+    route_graph_batch_free(&batch);
 }
 
 /**
@@ -2361,7 +2736,7 @@ static void route_graph_remove_traffic_distortion(struct route_graph *this, stru
                 e_pnt->flags |= RP_TRAFFIC_DISTORTION;
 #else
         struct route_graph_segment *found = NULL, *prev;
-        /* this frees up memory but is slower */
+        /* this unlinks the segment from the graph but is slower */
         /* remove from global list */
         curr = this->route_segments;
         prev = NULL;
@@ -2417,9 +2792,7 @@ static void route_graph_remove_traffic_distortion(struct route_graph *this, stru
             curr = prev->end_next;
         }
 
-        size = sizeof(struct route_graph_segment) - sizeof(struct route_segment_data)
-               + route_segment_data_size(found->data.flags);
-        g_slice_free1(size, found);
+        /* the memory of `found` is released along with the graph's other segments */
 #endif
 
         /* TODO figure out if we need to update both points */
@@ -2439,9 +2812,43 @@ static void route_graph_remove_traffic_distortion(struct route_graph *this, stru
  */
 static void route_graph_change_traffic_distortion(struct route_graph *this, struct vehicleprofile *profile,
         struct item *item) {
-    /* TODO is there a more elegant way of doing this? */
-    route_graph_remove_traffic_distortion(this, profile, item);
-    route_graph_add_traffic_distortion(this, profile, item, 1);
+    struct route_graph_batch batch= {NULL, 0, 0};
+    struct route_graph_batch_entry *entry = NULL;
+    struct route_graph_point *s_pnt = NULL, *e_pnt = NULL;
+    struct route_graph_segment *curr = NULL;
+
+    route_graph_batch_add_traffic_distortion(&batch, item);
+    if (batch.count) {
+        entry = &batch.entries[0];
+        s_pnt = route_graph_get_point(this, &entry->start);
+        e_pnt = route_graph_get_point(this, &entry->end);
+        /* segments removed earlier are kept with type_none, they must not be brought back in place */
+        if (s_pnt && e_pnt)
+            for (curr = s_pnt->start; curr; curr = curr->start_next)
+                if ((curr->end == e_pnt) && (curr->data.item.type == type_traffic_distortion)
+                        && item_is_equal(curr->data.item, *item))
+                    break;
+    }
+    if (!curr || (route_segment_data_size(curr->data.flags) != route_segment_data_size(entry->data.flags))) {
+        /* not in the graph yet, or the segment data would not fit into the existing segment */
+        route_graph_batch_free(&batch);
+        route_graph_remove_traffic_distortion(this, profile, item);
+        route_graph_add_traffic_distortion(this, profile, item, 1);
+        return;
+    }
+
+    /* Update the segment in place. Only its end points need to be re-evaluated, and none at all if the cost of the
+     * segment has not changed. */
+    if ((curr->data.flags != entry->data.flags) || (curr->data.len != entry->data.len)
+            || ((curr->data.flags & AF_SPEED_LIMIT) && (RSD_MAXSPEED(&curr->data) != entry->data.maxspeed))) {
+        curr->data.flags = entry->data.flags;
+        curr->data.len = entry->data.len;
+        if (curr->data.flags & AF_SPEED_LIMIT)
+            RSD_MAXSPEED(&curr->data) = entry->data.maxspeed;
+        route_graph_point_update(profile, s_pnt, this->heap);
+        route_graph_point_update(profile, e_pnt, this->heap);
+    }
+    route_graph_batch_free(&batch);
 }
 
 /**
@@ -2451,50 +2858,25 @@ static void route_graph_change_traffic_distortion(struct route_graph *this, stru
  * @param item The item to add, must be of `type_street_turn_restriction_no` or `type_street_turn_restriction_only`
  */
 void route_graph_add_turn_restriction(struct route_graph *this, struct item *item) {
-    struct route_graph_point *pnt[4];
-    struct coord c[5];
-    int i,count;
-    struct route_graph_segment_data data;
+    struct route_graph_batch batch= {NULL, 0, 0};
 
-    item_coord_rewind(item);
-    count=item_coord_get(item, c, 5);
-    if (count != 3 && count != 4) {
-        dbg(lvl_debug,"wrong count %d",count);
-        return;
-    }
-    if (count == 4)
-        return;
-    for (i = 0 ; i < count ; i++)
-        pnt[i]=route_graph_add_point(this,&c[i]);
-    dbg(lvl_debug,"%s: (0x%x,0x%x)-(0x%x,0x%x)-(0x%x,0x%x) %p-%p-%p",item_to_name(item->type),c[0].x,c[0].y,c[1].x,c[1].y,
-        c[2].x,c[2].y,pnt[0],pnt[1],pnt[2]);
-    data.item=item;
-    data.flags=0;
-    data.len=0;
-    data.score = 0;
-    route_graph_add_segment(this, pnt[0], pnt[1], &data);
-    route_graph_add_segment(this, pnt[1], pnt[2], &data);
-#if 1
-    if (count == 4) {
-        pnt[1]->flags |= RP_TURN_RESTRICTION;
-        pnt[2]->flags |= RP_TURN_RESTRICTION;
-        route_graph_add_segment(this, pnt[2], pnt[3], &data);
-    } else
-        pnt[1]->flags |= RP_TURN_RESTRICTION;
-#endif
+    route_graph_batch_add_turn_restriction(&batch, item);
+    route_graph_batch_add(this, &batch);
+    route_graph_batch_free(&batch);
 }
 
 /**
- * @brief Adds an item to the route graph
+ * @brief Reads a street item into a batch
  *
- * This adds an item (e.g. a street) to the route graph, creating as many segments as needed for a
+ * This reads an item (e.g. a street) into a batch, creating as many segments as needed for a
  * segmented item.
  *
- * @param this The route graph to add to
+ * @param batch The batch to add to
  * @param item The item to add
  * @param profile		The vehicle profile currently in use
  */
-static void route_graph_add_street(struct route_graph *this, struct item *item, struct vehicleprofile *profile) {
+static void route_graph_batch_add_street(struct route_graph_batch *batch, struct item *item,
+        struct vehicleprofile *profile) {
 #ifdef AVOID_FLOAT
     int len=0;
 #else
@@ -2504,10 +2886,11 @@ static void route_graph_add_street(struct route_graph *this, struct item *item,
     struct roadprofile *roadp;
     int default_flags_value = AF_ALL;
     int *default_flags;
-    struct route_graph_point *s_pnt,*e_pnt; /* Start and end point */
-    struct coord c,l; /* Current and previous point */
+    struct route_graph_batch_entry *entry;
+    struct coord c,l,s; /* Current and previous point, start of the current segment */
     struct attr attr;
     struct route_graph_segment_data data;
+    memset(&data, 0, sizeof(data));
     data.flags=0;
     data.offset=1;
     data.maxspeed=-1;
@@ -2560,17 +2943,17 @@ static void route_graph_add_street(struct route_graph *this, struct item *item,
                 data.size_weight.axle_weight=-1;
         }
 
-        s_pnt=route_graph_add_point(this,&l);
+        s=l;
         if (!segmented) {
             while (item_coord_get(item, &c, 1)) {
                 len+=transform_distance(map_projection(item->map), &l, &c);
                 l=c;
             }
-            e_pnt=route_graph_add_point(this,&l);
             dbg_assert(len >= 0);
             data.len=len;
-            if (!route_graph_segment_is_duplicate(s_pnt, &data))
-                route_graph_add_segment(this, s_pnt, e_pnt, &data);
+            entry=route_graph_batch_append(batch, item, &s, &l);
+            entry->data=data;
+            entry->check_duplicate=1;
         } else {
             int isseg,rc;
             int sc = 0;
@@ -2581,22 +2964,22 @@ static void route_graph_add_street(struct route_graph *this, struct item *item,
                     len+=transform_distance(map_projection(item->map), &l, &c);
                     l=c;
                     if (isseg) {
-                        e_pnt=route_graph_add_point(this,&l);
                         data.len=len;
-                        if (!route_graph_segment_is_duplicate(s_pnt, &data))
-                            route_graph_add_segment(this, s_pnt, e_pnt, &data);
+                        entry=route_graph_batch_append(batch, item, &s, &l);
+                        entry->data=data;
+                        entry->check_duplicate=1;
                         data.offset++;
-                        s_pnt=route_graph_add_point(this,&l);
+                        s=l;
                         len = 0;
                     }
                 }
             } while(rc);
-            e_pnt=route_graph_add_point(this,&l);
             dbg_assert(len >= 0);
             sc++;
             data.len=len;
-            if (!route_graph_segment_is_duplicate(s_pnt, &data))
-                route_graph_add_segment(this, s_pnt, e_pnt, &data);
+            entry=route_graph_batch_append(batch, item, &s, &l);
+            entry->data=data;
+            entry->check_duplicate=1;
         }
     }
 }
@@ -2653,7 +3036,7 @@ static struct route_graph_segment *route_graph_get_segment(struct route_graph *g
  */
 static int route_graph_is_path_computed(struct route_graph *this_) {
     /* TODO refine exit criterion */
-    if (!fh_min(this_->heap))
+    if (!route_heap_min(this_->heap))
         return 1;
     else
         return 0;
@@ -2671,7 +3054,9 @@ static int route_graph_is_path_computed(struct route_graph *this_) {
  * If segment costs have changed (as is the case with traffic distortions), all affected segments must have been added
  * to, removed from or updated in the route graph before this method is called.
  *
- * After recalculation, the route path is updated.
+ * After recalculation, the route path is updated. Segments up to the first one which has changed are taken over from
+ * the previous route path, see `route_get_path_unchanged()`, so that users of the route map only need to process the
+ * rest of it. The number of points which had to be re-expanded is logged.
  *
  * The function uses a modified LPA* algorithm for recalculations. Most modifications were made for compatibility with
  * the algorithm used for the initial routing:
@@ -2689,6 +3074,7 @@ static int route_graph_is_path_computed(struct route_graph *this_) {
  * interruption until they finish, and are both on the main thread. If that changes, we need to revisit this. */
 void route_recalculate_partial(struct route *this_) {
     struct attr route_status;
+    int expanded;
 
     /* do nothing if we don’t have a route graph */
     if (!route_has_graph(this_))
@@ -2707,13 +3093,12 @@ void route_recalculate_partial(struct route *this_) {
     route_status.u.num = route_status_building_graph;
     route_set_attr(this_, &route_status);
 
-    printf("Expanding points which have changed\n");
-
-    route_graph_compute_shortest_path(this_->graph, this_->vehicleprofile, NULL);
-
-    printf("Point expansion complete, recalculating route path\n");
+    expanded = route_graph_compute_shortest_path(this_->graph, this_->vehicleprofile, NULL);
 
     route_path_update_done(this_, 0);
+
+    dbg(lvl_info, "%d points re-expanded, %d segments at the start of the route path unchanged", expanded,
+        route_get_path_unchanged(this_));
 }
 
 /**
@@ -2904,12 +3289,16 @@ static struct route_path *route_path_new(struct route_graph *this, struct route_
                 dstinfo=dst;
             if (!route_path_add_item_from_graph(ret, oldpath, s, 1, posinfo, dstinfo))
                 ret->updated=0;
+            else if (ret->updated)
+                ret->unchanged++;
             start=s->end;
         } else {
             if (item_is_equal(s->data.item, dst->street->item) && (s->start->seg == s || !posinfo))
                 dstinfo=dst;
             if (!route_path_add_item_from_graph(ret, oldpath, s, -1, posinfo, dstinfo))
                 ret->updated=0;
+            else if (ret->updated)
+                ret->unchanged++;
             start=s->start;
         }
         posinfo=NULL;
@@ -2921,13 +3310,40 @@ static struct route_path *route_path_new(struct route_graph *this, struct route_
     return ret;
 }
 
+/**
+ * @brief Whether a map may be read by a route graph worker thread
+ *
+ * Only the drivers of maps with static data can be used off the main loop. Other maps, such as the traffic map,
+ * change shared state while they are being read.
+ *
+ * @param m The map
+ * @return True if the map may be read on a worker thread
+ */
+static int route_graph_worker_can_read(struct map *m) {
+    struct attr attr;
+
+    if (map_get_attr(m, attr_traffic, &attr, NULL))
+        return 0;
+    return map_get_attr(m, attr_static_data, &attr, NULL) && attr.u.num;
+}
+
+/**
+ * @brief Opens the next map to be read on the main loop
+ *
+ * Maps covered by the route graph cache are skipped, as are the maps which the workers of the graph read.
+ *
+ * @param rg The route graph
+ * @return True if a map was opened, false if there are no maps left
+ */
 static int route_graph_build_next_map(struct route_graph *rg) {
     do {
         rg->m=mapset_next(rg->h, 2);
         if (! rg->m)
             return 0;
         map_rect_destroy(rg->mr);
-        rg->mr=map_rect_new(rg->m, rg->sel);
+        rg->mr=NULL;
+        if (!route_cache_covers_map(rg->cache, rg->m) && !(rg->builder && route_graph_worker_can_read(rg->m)))
+            rg->mr=map_rect_new(rg->m, rg->sel);
     } while (!rg->mr);
 
     return 1;
@@ -3081,7 +3497,7 @@ static void route_graph_process_restrictions(struct route_graph *this) {
     struct route_graph_point *curr;
     int i;
     dbg(lvl_debug,"enter");
-    for (i = 0 ; i < HASH_SIZE ; i++) {
+    for (i = 0 ; i < this->hash_size ; i++) {
         curr=this->hash[i];
         while (curr) {
             if (curr->flags & RP_TURN_RESTRICTION)
@@ -3091,6 +3507,15 @@ static void route_graph_process_restrictions(struct route_graph *this) {
     }
 }
 
+/**
+ * @brief Returns the current time in milliseconds, for measuring how long it takes to build a route graph
+ */
+static long long route_graph_time_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (long long)tv.tv_sec*1000+tv.tv_usec/1000;
+}
+
 /**
  * @brief Releases all resources needed to build the route graph.
  *
@@ -3106,6 +3531,8 @@ static void route_graph_process_restrictions(struct route_graph *this) {
  */
 void route_graph_build_done(struct route_graph *rg, int cancel) {
     dbg(lvl_debug,"cancel=%d",cancel);
+    if (rg->builder)
+        route_graph_builder_destroy(rg->builder, 1);
     if (rg->idle_ev)
         event_remove_idle(rg->idle_ev);
     if (rg->idle_cb)
@@ -3118,17 +3545,51 @@ void route_graph_build_done(struct route_graph *rg, int cancel) {
     rg->mr=NULL;
     rg->h=NULL;
     rg->sel=NULL;
+    if (rg->cache) {
+        if (!cancel)
+            route_cache_save(rg->cache);
+        route_cache_destroy(rg->cache);
+        rg->cache=NULL;
+    }
     if (! cancel) {
         route_graph_process_restrictions(rg);
+        if (rg->build_start)
+            rg->build_time=route_graph_time_ms()-rg->build_start;
+        dbg(lvl_debug,"%d points in %d of %d slots, %ld lookups, %ld probes, %d ms", rg->point_count, rg->hash_count,
+            rg->hash_size, rg->hash_lookups, rg->hash_probes, rg->build_time);
         if (rg->done_cb)
             callback_call_0(rg->done_cb);
     }
     rg->busy=0;
 }
 
+/**
+ * @brief Called when the idle callback of a route graph has read all of its maps
+ *
+ * If workers are reading maps as well and have not finished yet, the graph is completed by
+ * route_graph_builders_finish() once they have.
+ *
+ * @param rg The route graph
+ */
+static void route_graph_build_idle_done(struct route_graph *rg) {
+    if (rg->builder && !rg->builder->finished) {
+        event_remove_idle(rg->idle_ev);
+        callback_destroy(rg->idle_cb);
+        rg->idle_ev=NULL;
+        rg->idle_cb=NULL;
+        map_rect_destroy(rg->mr);
+        rg->mr=NULL;
+        return;
+    }
+    if (rg->builder)
+        route_graph_builder_destroy(rg->builder, 0);
+    route_graph_build_done(rg, 0);
+}
+
 static void route_graph_build_idle(struct route_graph *rg, struct vehicleprofile *profile) {
     int count=1000;
     struct item *item;
+    struct route_graph_batch batch= {NULL, 0, 0};
 
     while (count > 0) {
         for (;;) {
@@ -3136,18 +3597,204 @@ static void route_graph_build_idle(struct route_graph *rg, struct vehicleprofile
             if (item)
                 break;
             if (!route_graph_build_next_map(rg)) {
-                route_graph_build_done(rg, 0);
+                route_graph_batch_add(rg, &batch);
+                route_graph_batch_free(&batch);
+                route_graph_build_idle_done(rg);
                 return;
             }
         }
-        if (item->type == type_traffic_distortion)
-            route_graph_add_traffic_distortion(rg, profile, item, 0);
-        else if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
-            route_graph_add_turn_restriction(rg, item);
-        else
-            route_graph_add_street(rg, item, profile);
+        route_graph_batch_add_item(&batch, item, profile);
         count--;
     }
+    route_graph_batch_add(rg, &batch);
+    route_graph_batch_free(&batch);
+}
+
+static int route_graph_builder_cancelled(struct route_graph_builder *builder) {
+    int ret;
+    thread_lock_acquire(builder->lock);
+    ret=builder->cancel;
+    thread_lock_release(builder->lock);
+    return ret;
+}
+
+/**
+ * @brief Main function of a route graph worker thread
+ *
+ * @param data The worker
+ * @return Always 0
+ */
+static int route_graph_worker_main(void *data) {
+    struct route_graph_worker *worker=data;
+    struct route_graph_builder *builder=worker->builder;
+    struct map *m;
+    struct map_rect *mr;
+    struct item *item;
+    int last;
+
+    for (;;) {
+        thread_lock_acquire(builder->lock);
+        m=(builder->cancel || !builder->maps) ? NULL : builder->maps->data;
+        if (m)
+            builder->maps=g_list_delete_link(builder->maps, builder->maps);
+        thread_lock_release(builder->lock);
+        if (!m)
+            break;
+        mr=map_rect_new(m, builder->graph->sel);
+        if (!mr)
+            continue;
+        while (!route_graph_builder_cancelled(builder) && (item=map_rect_get_item(mr)))
+            route_graph_batch_add_item(&worker->batch, item, builder->profile);
+        map_rect_destroy(mr);
+    }
+
+    thread_lock_acquire(builder->lock);
+    last=!--builder->running;
+    thread_lock_release(builder->lock);
+    if (last) {
+        thread_lock_acquire(route_graph_builders_lock);
+        route_graph_builders_done=g_list_append(route_graph_builders_done, builder);
+        thread_lock_release(route_graph_builders_lock);
+        event_call_callback(route_graph_builders_cbl);
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits for the workers of a builder to finish and frees the builder
+ *
+ * If `cancel` is false, the segments read by the workers are added to the graph, in the order of the workers.
+ *
+ * @param builder The builder
+ * @param cancel Whether to stop the workers early and discard their results
+ */
+static void route_graph_builder_destroy(struct route_graph_builder *builder, int cancel) {
+    GList *l;
+    int i;
+
+    if (cancel) {
+        thread_lock_acquire(builder->lock);
+        builder->cancel=1;
+        thread_lock_release(builder->lock);
+    }
+    for (i = 0 ; i < builder->worker_count ; i++)
+        if (builder->workers[i].thread)
+            thread_join(builder->workers[i].thread);
+    thread_lock_acquire(route_graph_builders_lock);
+    route_graph_builders_done=g_list_remove(route_graph_builders_done, builder);
+    thread_lock_release(route_graph_builders_lock);
+    for (i = 0 ; i < builder->worker_count ; i++) {
+        if (!cancel)
+            route_graph_batch_add(builder->graph, &builder->workers[i].batch);
+        route_graph_batch_free(&builder->workers[i].batch);
+    }
+    builder->graph->builder=NULL;
+    g_list_free(builder->maps);
+    for (l = builder->refs ; l ; l=g_list_next(l))
+        navit_object_unref(l->data);
+    g_list_free(builder->refs);
+    thread_lock_destroy(builder->lock);
+    g_free(builder->workers);
+    g_free(builder);
+}
+
+/**
+ * @brief Completes all route graphs whose workers have finished
+ *
+ * This is called on the main loop, after a worker has requested it through `event_call_callback()`. Graphs which
+ * are still reading maps in their idle callback are completed by it instead.
+ */
+static void route_graph_builders_finish(void) {
+    struct route_graph_builder *builder;
+    struct route_graph *rg;
+
+    for (;;) {
+        thread_lock_acquire(route_graph_builders_lock);
+        builder=route_graph_builders_done ? route_graph_builders_done->data : NULL;
+        if (builder)
+            route_graph_builders_done=g_list_remove(route_graph_builders_done, builder);
+        thread_lock_release(route_graph_builders_lock);
+        if (!builder)
+            break;
+        rg=builder->graph;
+        builder->finished=1;
+        if (rg->idle_ev)
+            continue;
+        route_graph_builder_destroy(builder, 0);
+        route_graph_build_done(rg, 0);
+    }
+}
+
+/**
+ * @brief Starts building a route graph on worker threads
+ *
+ * The selection of the graph must have been set up. The maps with static data are handed to the workers, all other
+ * maps are left to the idle callback of the graph. When both are done, the graph is completed on the main loop and
+ * its `done_cb` is called.
+ *
+ * This requires an event system which implements `event_call_callback()`, as the workers use it to hand the graph
+ * back to the main loop.
+ *
+ * @param rg The route graph
+ * @param ms The mapset the graph is built from
+ * @param profile The vehicle profile
+ * @param threads The number of worker threads to use
+ * @return True if at least one worker was started, false if the graph must be built on the main loop instead
+ */
+static int route_graph_build_threaded(struct route_graph *rg, struct mapset *ms, struct vehicleprofile *profile,
+                                      int threads) {
+    struct route_graph_builder *builder;
+    struct mapset_handle *h;
+    struct map *m;
+    GList *maps=NULL,*l;
+    int i,running;
+
+    if (threads <= 0 || !thread_supported() || !event_call_callback_supported())
+        return 0;
+    h=mapset_open(ms);
+    while ((m=mapset_next(h, 2)))
+        if (!route_cache_covers_map(rg->cache, m) && route_graph_worker_can_read(m))
+            maps=g_list_append(maps, m);
+    mapset_close(h);
+    if (!maps)
+        return 0;
+    if (!route_graph_builders_cbl) {
+        route_graph_builders_lock=thread_lock_new();
+        route_graph_builders_cbl=callback_list_new();
+        callback_list_add(route_graph_builders_cbl, callback_new_0(callback_cast(route_graph_builders_finish)));
+    }
+    /* set up the default flags table before any worker needs it */
+    item_get_default_flags(type_street_0);
+
+    builder=g_new0(struct route_graph_builder, 1);
+    builder->graph=rg;
+    builder->profile=profile;
+    builder->lock=thread_lock_new();
+    /* keep the maps alive if they are removed from the mapset while the workers read them */
+    for (l = maps ; l ; l=g_list_next(l))
+        navit_object_ref(l->data);
+    builder->refs=g_list_copy(maps);
+    builder->maps=maps;
+    builder->worker_count=threads;
+    builder->workers=g_new0(struct route_graph_worker, threads);
+    rg->builder=builder;
+
+    /* workers block on the lock until all of them have been started */
+    thread_lock_acquire(builder->lock);
+    for (i = 0 ; i < threads ; i++) {
+        builder->workers[i].builder=builder;
+        builder->workers[i].thread=thread_new(route_graph_worker_main, &builder->workers[i], "route_graph_worker");
+        if (builder->workers[i].thread)
+            builder->running++;
+    }
+    running=builder->running;
+    thread_lock_release(builder->lock);
+    if (!running) {
+        route_graph_builder_destroy(builder, 1);
+        return 0;
+    }
+    dbg(lvl_debug,"building route graph on %d threads", running);
+    return 1;
 }
 
 /**
@@ -3165,27 +3812,46 @@ static void route_graph_build_idle(struct route_graph *rg, struct vehicleprofile
  * @param c1 Corner 1 of the rectangle to use from the map
  * @param c2 Corner 2 of the rectangle to use from the map
  * @param done_cb The callback which will be called when graph is complete
+ * @param ch Whether to restrict the graph to a contraction hierarchy corridor, if the map has one
+ * @param threads Number of worker threads to use in asynchronous mode, 0 to build the graph on the main loop
+ * @param cache Whether to use the on-disk cache of route graph segments
  * @return The new route graph.
  */
 // FIXME documentation does not match argument list
 static struct route_graph *route_graph_build(struct mapset *ms, struct coord *c, int count, struct callback *done_cb,
         int async,
-        struct vehicleprofile *profile) {
+        struct vehicleprofile *profile, int ch, int threads, int cache) {
     struct route_graph *ret=g_new0(struct route_graph, 1);
+    struct route_graph_batch batch= {NULL, 0, 0};
 
     dbg(lvl_debug,"enter");
 
-    ret->sel=route_calc_selection(c, count, profile);
+    if (ch)
+        ret->sel=route_calc_ch_selection(ms, c, count, profile);
+    ret->ch=(ret->sel != NULL);
+    if (!ret->sel)
+        ret->sel=route_calc_selection(c, count, profile, 1);
     ret->h=mapset_open(ms);
     ret->done_cb=done_cb;
     ret->busy=1;
-    ret->heap = fh_makekeyheap();
+    ret->build_start=route_graph_time_ms();
+    ret->heap = route_heap_new(route_heap_dary);
+    if (cache) {
+        route_selection_snap(ret->sel);
+        ret->cache=route_cache_new(ms, ret->sel, profile);
+    }
+    if (ret->cache && route_cache_load(ret->cache, &batch)) {
+        route_graph_batch_add(ret, &batch);
+        route_graph_batch_free(&batch);
+    }
+    if (async)
+        route_graph_build_threaded(ret, ms, profile, threads);
     if (route_graph_build_next_map(ret)) {
         if (async) {
             ret->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), ret, profile);
             ret->idle_ev=event_add_idle(50, ret->idle_cb);
         }
-    } else
+    } else if (!ret->builder)
         route_graph_build_done(ret, 0);
 
     return ret;
@@ -3226,7 +3892,8 @@ static void route_graph_update(struct route *this, struct callback *cb, int asyn
         c[i++]=dst->c;
         tmp=g_list_next(tmp);
     }
-    this->graph=route_graph_build(this->ms, c, i, this->route_graph_done_cb, async, this->vehicleprofile);
+    this->graph=route_graph_build(this->ms, c, i, this->route_graph_done_cb, async, this->vehicleprofile,
+                                  this->ch_routing && !this->ch_failed, this->build_threads, this->graph_cache);
     if (! async) {
         while (this->graph->busy)
             route_graph_build_idle(this->graph, this->vehicleprofile);
@@ -3879,13 +4546,12 @@ static struct item *rp_get_item(struct map_rect_priv *mr) {
             }
         } else {
             if (!p) {
-                mr->hash_bucket=0;
-                p = r->graph->hash[0];
+                mr->hash_bucket=-1;
             } else
                 p=p->hash_next;
             while (!p) {
                 mr->hash_bucket++;
-                if (mr->hash_bucket >= HASH_SIZE)
+                if (mr->hash_bucket >= r->graph->hash_size)
                     break;
                 p = r->graph->hash[mr->hash_bucket];
             }
@@ -4165,6 +4831,22 @@ int route_has_graph(struct route *this_) {
     return (this_->graph != NULL);
 }
 
+/**
+ * @brief Returns the number of segments at the start of the route path which were taken over from the previous path
+ *
+ * After a partial recalculation of the route, this is the part of the route path which is known to be unchanged.
+ * Users of the route map can keep any data they derived from the corresponding items and only need to process the
+ * items following them.
+ *
+ * @param this_ The route
+ * @return The number of unchanged segments, 0 if the route path was created from scratch or there is no route path
+ */
+int route_get_path_unchanged(struct route *this_) {
+    if (!this_->path2)
+        return 0;
+    return this_->path2->unchanged;
+}
+
 /**
  * @brief Removes a traffic distortion item from the route
  *
@@ -4312,6 +4994,43 @@ int route_get_attr(struct route *this_, enum attr_type type, struct attr *attr,
         } else
             ret=0;
         break;
+    case attr_route_graph_points:
+        ret=(this_->graph != NULL);
+        if (ret)
+            attr->u.num=this_->graph->point_count;
+        break;
+    case attr_route_graph_hash_size:
+        ret=(this_->graph != NULL);
+        if (ret)
+            attr->u.num=this_->graph->hash_size;
+        break;
+    case attr_route_graph_lookups:
+        ret=(this_->graph != NULL);
+        if (ret)
+            attr->u.num=MIN(this_->graph->hash_lookups, INT_MAX);
+        break;
+    case attr_route_graph_probes:
+        ret=(this_->graph != NULL);
+        if (ret)
+            attr->u.num=MIN(this_->graph->hash_probes, INT_MAX);
+        break;
+    case attr_route_graph_memory:
+        ret=(this_->graph != NULL);
+        if (ret)
+            attr->u.num=this_->graph->points.size+this_->graph->segments.size
+                        +this_->graph->hash_size*sizeof(struct route_graph_point *);
+        break;
+    case attr_route_graph_cache_hits:
+        attr->u.num=route_cache_get_hits();
+        break;
+    case attr_route_graph_cache_misses:
+        attr->u.num=route_cache_get_misses();
+        break;
+    case attr_route_graph_build_time:
+        ret=(this_->graph != NULL && !this_->graph->busy);
+        if (ret)
+            attr->u.num=this_->graph->build_time;
+        break;
     default:
         return 0;
     }
@@ -0,0 +1,511 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ * @brief Contains the on-disk cache of route graph segments.
+ *
+ * Building a route graph spends most of its time decoding map tiles and computing segment lengths. For a given set of
+ * map files, vehicle profile and map selection the result is always the same, so the segments read from the maps are
+ * written to a file in the user data directory after the graph has been built. When a graph with the same key is built
+ * again, the segments are read back from that file and the maps are not touched at all.
+ *
+ * The key consists of the path, size and modification time of each map, the road types the vehicle profile can use
+ * and the rectangles, orders and item ranges of the selection. The caller widens the rectangles to the tile boundaries
+ * of their order first, so routes whose points move within the same tiles share a key. Only binfile maps are cached;
+ * other maps (such as the traffic map) may change without their file changing and are always read from the map as
+ * usual.
+ *
+ * The file holds a header, the key and an array of fixed-size records in native byte order. It is mapped into memory
+ * when reading it. Files written by another build (with a different record size or byte order) are rejected and
+ * overwritten.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "config.h"
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "debug.h"
+#include "coord.h"
+#include "item.h"
+#include "attr.h"
+#include "map.h"
+#include "mapset.h"
+#include "file.h"
+#include "navit.h"
+#include "xmlconfig.h"
+#include "vehicleprofile.h"
+#include "route_protected.h"
+#include "route.h"
+
+/** Identifies a route graph cache file */
+#define ROUTE_CACHE_MAGIC 0x4347524e
+
+/** Format version of the cache file, increase when the record layout changes */
+#define ROUTE_CACHE_VERSION 1
+
+/** Maximum number of cache files kept in the cache directory, the oldest ones are removed beyond that */
+#define ROUTE_CACHE_MAX_FILES 16
+
+/**
+ * @brief Header of a cache file
+ *
+ * The header is followed by the key (zero-terminated, padded to a multiple of 8 bytes) and `count` records.
+ */
+struct route_cache_header {
+    int magic;                            /**< `ROUTE_CACHE_MAGIC`, also detects files of the other byte order */
+    int version;                          /**< `ROUTE_CACHE_VERSION` */
+    int record_size;                      /**< `sizeof(struct route_cache_record)` */
+    int key_size;                         /**< Size of the padded key in bytes */
+    int count;                            /**< Number of records */
+    int reserved;
+};
+
+/**
+ * @brief A segment as stored in a cache file
+ */
+struct route_cache_record {
+    int map;                              /**< Index of the map within the cached maps */
+    int type;                             /**< Type of the item */
+    int id_hi;                            /**< High part of the item id */
+    int id_lo;                            /**< Low part of the item id */
+    struct coord start;                   /**< Coordinates of the start point */
+    struct coord end;                     /**< Coordinates of the end point */
+    int start_flags;                      /**< Flags to set on the start point */
+    int end_flags;                        /**< Flags to set on the end point */
+    int check_duplicate;                  /**< Skip the segment if the graph already contains it */
+    int offset;                           /**< Position of the segment within the item */
+    int flags;                            /**< Flags of the segment */
+    int len;                              /**< Length of the segment */
+    int maxspeed;                         /**< Maximum speed on the segment */
+    int dangerous_goods;                  /**< Dangerous goods restrictions */
+    struct size_weight_limit size_weight; /**< Size and weight limits */
+};
+
+/**
+ * @brief Cache state of one route graph
+ */
+struct route_cache {
+    char *key;                            /**< Key describing the maps, profile and selection */
+    char *filename;                       /**< Name of the cache file */
+    struct map **maps;                    /**< The maps whose segments are cached, in mapset order */
+    int map_count;                        /**< Number of maps in `maps` */
+    int hit;                              /**< Segments of `maps` were loaded from the cache file */
+    struct route_cache_record *records;   /**< Records collected while the graph is built from the maps */
+    int count;                            /**< Number of records in `records` */
+    int size;                             /**< Number of records allocated */
+    int last_map;                         /**< Index of the map of the last recorded segment */
+};
+
+/** Number of route graphs built from the cache */
+static int route_cache_hits;
+
+/** Number of route graphs built from the maps with the cache enabled */
+static int route_cache_misses;
+
+/**
+ * @brief Returns the directory holding the cache files
+ *
+ * @return The directory name, to be freed with `g_free()`
+ */
+static char *route_cache_dir(void) {
+    return g_strjoin(NULL, navit_get_user_data_directory(TRUE), "/route_cache", NULL);
+}
+
+/**
+ * @brief Determines whether a map is cacheable and returns the name of its file
+ *
+ * @param m The map
+ * @param st Receives the status of the file
+ * @return The file name, to be freed with `g_free()`, or NULL if the map is not cacheable
+ */
+static char *route_cache_map_file(struct map *m, struct stat *st) {
+    struct attr type,data;
+    struct file_wordexp *wexp;
+    char *ret=NULL;
+
+    if (!map_get_attr(m, attr_type, &type, NULL) || strcmp(type.u.str, "binfile"))
+        return NULL;
+    if (!map_get_attr(m, attr_data, &data, NULL))
+        return NULL;
+    wexp=file_wordexp_new(data.u.str);
+    if (file_wordexp_get_count(wexp) > 0 && !stat(file_wordexp_get_array(wexp)[0], st))
+        ret=g_strdup(file_wordexp_get_array(wexp)[0]);
+    file_wordexp_destroy(wexp);
+    return ret;
+}
+
+/**
+ * @brief Computes the FNV-1a hash of the key, used as the name of the cache file
+ *
+ * @param key The key
+ * @return The hash
+ */
+static unsigned long long route_cache_hash(const char *key) {
+    unsigned long long h=0xcbf29ce484222325ULL;
+
+    while (*key) {
+        h ^= (unsigned char)*key++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Appends a formatted line to the key
+ *
+ * @param key The key, replaced by the new key
+ * @param fmt The format of the line
+ */
+static void route_cache_key_append(char **key, const char *fmt, ...) {
+    va_list ap;
+    char *line,*tmp;
+
+    va_start(ap, fmt);
+    line=g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+    tmp=g_strconcat(*key ? *key : "", line, NULL);
+    g_free(*key);
+    g_free(line);
+    *key=tmp;
+}
+
+/**
+ * @brief Creates the cache state for a route graph
+ *
+ * @param ms The mapset the graph is built from
+ * @param sel The selection of the graph
+ * @param profile The vehicle profile
+ * @return The cache state, or NULL if none of the maps can be cached
+ */
+struct route_cache *route_cache_new(struct mapset *ms, struct map_selection *sel, struct vehicleprofile *profile) {
+    struct route_cache *this_;
+    struct mapset_handle *h;
+    struct map *m;
+    struct attr name;
+    struct stat st;
+    char *key=NULL;
+    GList *maps=NULL;
+    char *file,*dir;
+    int i;
+
+    h=mapset_open(ms);
+    while ((m=mapset_next(h, 2))) {
+        file=route_cache_map_file(m, &st);
+        if (!file)
+            continue;
+        route_cache_key_append(&key, "map %s %lld %lld\n", file, (long long)st.st_size, (long long)st.st_mtime);
+        maps=g_list_append(maps, m);
+        g_free(file);
+    }
+    mapset_close(h);
+    if (!maps)
+        return NULL;
+    route_cache_key_append(&key, "profile %s",
+                           vehicleprofile_get_attr(profile, attr_name, &name, NULL) ? name.u.str : "");
+    for (i = route_item_first ; i <= route_item_last ; i++)
+        if (vehicleprofile_get_roadprofile(profile, i))
+            route_cache_key_append(&key, " 0x%x", i);
+    route_cache_key_append(&key, "\n");
+    while (sel) {
+        route_cache_key_append(&key, "sel %d %d %d %d %d 0x%x 0x%x\n", sel->u.c_rect.lu.x, sel->u.c_rect.lu.y,
+                               sel->u.c_rect.rl.x, sel->u.c_rect.rl.y, sel->order, sel->range.min, sel->range.max);
+        sel=sel->next;
+    }
+
+    this_=g_new0(struct route_cache, 1);
+    this_->key=key;
+    this_->map_count=g_list_length(maps);
+    this_->maps=g_new(struct map *, this_->map_count);
+    for (i = 0 ; i < this_->map_count ; i++)
+        this_->maps[i]=g_list_nth_data(maps, i);
+    g_list_free(maps);
+    dir=route_cache_dir();
+    this_->filename=g_strdup_printf("%s/%016llx.graph", dir, route_cache_hash(this_->key));
+    g_free(dir);
+    return this_;
+}
+
+/**
+ * @brief Reads the segments from the cache file
+ *
+ * On success, the segments of all cached maps are appended to `batch` and `route_cache_covers_map()` returns true for
+ * these maps. Otherwise the cache starts collecting segments, to be written by `route_cache_save()`.
+ *
+ * @param this_ The cache state
+ * @param batch The batch to fill
+ * @return True if the cache file was valid, false otherwise
+ */
+int route_cache_load(struct route_cache *this_, struct route_graph_batch *batch) {
+    struct file *f;
+    struct route_cache_header *header;
+    struct route_cache_record *r;
+    struct route_graph_batch_entry *entry;
+    unsigned char *data;
+    int i,ok=0;
+
+    f=file_create(this_->filename, NULL);
+    if (f && f->size >= sizeof(*header) && file_mmap(f)) {
+        data=file_data_read(f, 0, f->size);
+        header=(struct route_cache_header *)data;
+        if (header->magic == ROUTE_CACHE_MAGIC && header->version == ROUTE_CACHE_VERSION
+                && header->record_size == sizeof(*r) && header->key_size > 0 && header->count >= 0
+                && f->size == sizeof(*header)+header->key_size+(long long)header->count*sizeof(*r)
+                && data[sizeof(*header)+header->key_size-1] == '\0'
+                && !strcmp((char *)data+sizeof(*header), this_->key)) {
+            ok=1;
+            r=(struct route_cache_record *)(data+sizeof(*header)+header->key_size);
+            for (i = 0 ; i < header->count ; i++) {
+                if (r[i].map < 0 || r[i].map >= this_->map_count) {
+                    ok=0;
+                    break;
+                }
+            }
+        }
+        if (ok) {
+            if (batch->size < batch->count+header->count) {
+                batch->size=batch->count+header->count;
+                batch->entries=g_renew(struct route_graph_batch_entry, batch->entries, batch->size);
+            }
+            for (i = 0 ; i < header->count ; i++, r++) {
+                entry=&batch->entries[batch->count++];
+                memset(entry, 0, sizeof(*entry));
+                entry->item.type=r->type;
+                entry->item.id_hi=r->id_hi;
+                entry->item.id_lo=r->id_lo;
+                entry->item.map=this_->maps[r->map];
+                entry->start=r->start;
+                entry->end=r->end;
+                entry->start_flags=r->start_flags;
+                entry->end_flags=r->end_flags;
+                entry->check_duplicate=r->check_duplicate;
+                entry->data.offset=r->offset;
+                entry->data.flags=r->flags;
+                entry->data.len=r->len;
+                entry->data.maxspeed=r->maxspeed;
+                entry->data.dangerous_goods=r->dangerous_goods;
+                entry->data.size_weight=r->size_weight;
+            }
+        }
+        file_data_free(f, data);
+    }
+    if (f)
+        file_destroy(f);
+    this_->hit=ok;
+    if (ok) {
+        route_cache_hits++;
+        dbg(lvl_debug,"%s: %d segments", this_->filename, batch->count);
+    } else {
+        route_cache_misses++;
+        dbg(lvl_debug,"%s: miss", this_->filename);
+    }
+    dbg(lvl_info,"route graph cache: %d hits, %d misses", route_cache_hits, route_cache_misses);
+    return ok;
+}
+
+/**
+ * @brief Determines whether the segments of a map have been loaded from the cache
+ *
+ * @param this_ The cache state, may be NULL
+ * @param m The map
+ * @return True if the map need not be read
+ */
+int route_cache_covers_map(struct route_cache *this_, struct map *m) {
+    int i;
+
+    if (!this_ || !this_->hit)
+        return 0;
+    for (i = 0 ; i < this_->map_count ; i++)
+        if (this_->maps[i] == m)
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief Collects the segments of cached maps from a batch, before the batch is added to the graph
+ *
+ * @param this_ The cache state
+ * @param batch The batch
+ */
+void route_cache_record(struct route_cache *this_, struct route_graph_batch *batch) {
+    struct route_graph_batch_entry *entry;
+    struct route_cache_record *r;
+    int i,j;
+
+    if (this_->hit)
+        return;
+    for (i = 0 ; i < batch->count ; i++) {
+        entry=&batch->entries[i];
+        j=this_->last_map;
+        if (this_->maps[j] != entry->item.map) {
+            for (j = 0 ; j < this_->map_count ; j++)
+                if (this_->maps[j] == entry->item.map)
+                    break;
+            if (j == this_->map_count)
+                continue;
+            this_->last_map=j;
+        }
+        if (this_->count == this_->size) {
+            this_->size=this_->size ? this_->size*2 : 1024;
+            this_->records=g_renew(struct route_cache_record, this_->records, this_->size);
+        }
+        r=&this_->records[this_->count++];
+        memset(r, 0, sizeof(*r));
+        r->map=j;
+        r->type=entry->item.type;
+        r->id_hi=entry->item.id_hi;
+        r->id_lo=entry->item.id_lo;
+        r->start=entry->start;
+        r->end=entry->end;
+        r->start_flags=entry->start_flags;
+        r->end_flags=entry->end_flags;
+        r->check_duplicate=entry->check_duplicate;
+        r->offset=entry->data.offset;
+        r->flags=entry->data.flags;
+        r->len=entry->data.len;
+        r->maxspeed=entry->data.maxspeed;
+        r->dangerous_goods=entry->data.dangerous_goods;
+        r->size_weight=entry->data.size_weight;
+    }
+}
+
+/**
+ * @brief Removes the oldest cache files if there are more than `ROUTE_CACHE_MAX_FILES`
+ *
+ * @param dir The cache directory
+ */
+static void route_cache_prune(char *dir) {
+    void *hnd;
+    char *name,*path,*oldest=NULL;
+    time_t oldest_mtime=0;
+    struct stat st;
+    int count,len;
+
+    do {
+        count=0;
+        hnd=file_opendir(dir);
+        if (!hnd)
+            return;
+        while ((name=file_readdir(hnd))) {
+            len=strlen(name);
+            if (len < 6 || strcmp(name+len-6, ".graph"))
+                continue;
+            path=g_strjoin("/", dir, name, NULL);
+            if (!stat(path, &st)) {
+                count++;
+                if (!oldest || st.st_mtime < oldest_mtime) {
+                    g_free(oldest);
+                    oldest=path;
+                    oldest_mtime=st.st_mtime;
+                    continue;
+                }
+            }
+            g_free(path);
+        }
+        file_closedir(hnd);
+        if (count > ROUTE_CACHE_MAX_FILES && oldest) {
+            dbg(lvl_debug,"removing %s", oldest);
+            unlink(oldest);
+        }
+        g_free(oldest);
+        oldest=NULL;
+    } while (count-1 > ROUTE_CACHE_MAX_FILES);
+}
+
+/**
+ * @brief Writes the collected segments to the cache file
+ *
+ * This does nothing if the segments have been loaded from the cache.
+ *
+ * @param this_ The cache state
+ */
+void route_cache_save(struct route_cache *this_) {
+    struct route_cache_header header;
+    char *dir,*tmp,*key;
+    FILE *f;
+    int ok;
+
+    if (this_->hit)
+        return;
+    dir=route_cache_dir();
+    if (file_mkdir(dir, 1)) {
+        dbg(lvl_error,"failed to create %s", dir);
+        g_free(dir);
+        return;
+    }
+    memset(&header, 0, sizeof(header));
+    header.magic=ROUTE_CACHE_MAGIC;
+    header.version=ROUTE_CACHE_VERSION;
+    header.record_size=sizeof(struct route_cache_record);
+    header.key_size=(strlen(this_->key)+8) & ~7;
+    header.count=this_->count;
+    key=g_malloc0(header.key_size);
+    strcpy(key, this_->key);
+    tmp=g_strjoin(NULL, this_->filename, ".tmp", NULL);
+    f=fopen(tmp, "wb");
+    if (f) {
+        ok=fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(key, header.key_size, 1, f) == 1
+           && (!this_->count || fwrite(this_->records, sizeof(*this_->records), this_->count, f) == this_->count);
+        ok=!fclose(f) && ok;
+        unlink(this_->filename);
+        if (!ok || rename(tmp, this_->filename)) {
+            dbg(lvl_error,"failed to write %s", this_->filename);
+            unlink(tmp);
+        } else
+            dbg(lvl_debug,"wrote %d segments to %s", this_->count, this_->filename);
+    } else
+        dbg(lvl_error,"failed to create %s", tmp);
+    g_free(tmp);
+    g_free(key);
+    route_cache_prune(dir);
+    g_free(dir);
+}
+
+/**
+ * @brief Frees the cache state of a route graph
+ *
+ * @param this_ The cache state
+ */
+void route_cache_destroy(struct route_cache *this_) {
+    g_free(this_->key);
+    g_free(this_->filename);
+    g_free(this_->maps);
+    g_free(this_->records);
+    g_free(this_);
+}
+
+/**
+ * @brief Returns the number of route graphs built from the cache
+ */
+int route_cache_get_hits(void) {
+    return route_cache_hits;
+}
+
+/**
+ * @brief Returns the number of route graphs built from the maps with the cache enabled
+ */
+int route_cache_get_misses(void) {
+    return route_cache_misses;
+}
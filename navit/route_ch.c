@@ -0,0 +1,453 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ * @brief Contains the query engine for contraction hierarchies.
+ *
+ * Maps built by maptool with contraction hierarchy (CH) support carry an additional set of tiles (see
+ * `maptool/ch.c`), which hold one item of type `type_ch_node` for each node of the road network. Each node has one
+ * `attr_ch_edge` attribute per edge leading to a node of higher rank. An edge is either an original edge, in which
+ * case its `middle` member refers to the way item it represents, or a shortcut, in which case `middle` refers to the
+ * node which was contracted when the shortcut was added.
+ *
+ * Since every shortest path can be expressed as a sequence of edges which first go up and then down the hierarchy,
+ * a bidirectional Dijkstra search which only follows upward edges in both directions finds the shortest path while
+ * settling only a small number of nodes, regardless of the distance between start and destination.
+ *
+ * The hierarchy is built with a fixed per-road-type speed table and does not know about one-way streets, turn
+ * restrictions, traffic distortions or vehicle profiles. Therefore the path found here is not used as the route
+ * itself. Instead, it is unpacked into its nodes and turned into a narrow corridor of map selections, from which the
+ * route graph is then built and flooded with the regular LPA* algorithm. This keeps everything downstream of the
+ * route graph (path creation, traffic, turn restrictions) unchanged, while the graph covers only a fraction of the
+ * area which the bounding-box selection would cover on long routes.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "config.h"
+#include "debug.h"
+#include "coord.h"
+#include "item.h"
+#include "map.h"
+#include "mapset.h"
+#include "projection.h"
+#include "route_protected.h"
+#include "route.h"
+#include "transform.h"
+#include "endianess.h"
+#include "fib.h"
+
+/** Maximum distance between a route point and the CH node used to start or end the search */
+#define CH_NODE_DIST 2000
+
+/** Maximum number of nodes settled by a query before it is considered failed */
+#define CH_MAX_SETTLED 500000
+
+/** Number of unpacked path nodes covered by one corridor rectangle */
+#define CH_CORRIDOR_CHUNK 16
+
+/** Buffer zone around each corridor rectangle, absolute distance */
+#define CH_CORRIDOR_DIST 1500
+
+/** Order of the corridor rectangles */
+#define CH_CORRIDOR_ORDER 18
+
+/** Edge can be used by the forward search */
+#define CH_EDGE_FORWARD 1
+
+/** Edge can be used by the backward search */
+#define CH_EDGE_BACKWARD 2
+
+/** Edge is a shortcut, `middle` refers to the contracted node */
+#define CH_EDGE_SHORTCUT 4
+
+/**
+ * @brief An edge as stored in the `attr_ch_edge` attribute of a `type_ch_node` item
+ *
+ * This must match the layout written by maptool.
+ */
+struct ch_edge {
+    int flags;               /**< Combination of `CH_EDGE_*` flags */
+    int weight;              /**< Cost of the edge, in tenths of seconds */
+    struct item_id target;   /**< The node at the other end of this edge */
+    struct item_id middle;   /**< The way item (original edge) or contracted node (shortcut) */
+};
+
+/**
+ * @brief A node visited by a CH query
+ */
+struct ch_node {
+    struct item_id id;            /**< ID of the `type_ch_node` item */
+    struct coord c;               /**< Coordinates of the node, valid if `has_coord` is true */
+    int has_coord;                /**< Whether `c` has been read from the map */
+    int value[2];                 /**< Cost from the start (0) or to the destination (1), `INT_MAX` if not reached */
+    struct ch_node *pred[2];      /**< Previous node in the forward (0) or backward (1) search tree */
+    struct ch_edge pred_edge[2];  /**< The edge by which `pred` was left to reach this node */
+    struct fibheap_el *el[2];     /**< Heap elements of the forward (0) and backward (1) search */
+};
+
+/**
+ * @brief Coordinates of an unpacked CH path
+ */
+struct ch_path {
+    struct coord *c;              /**< The coordinates */
+    int count;                    /**< Number of coordinates in `c` */
+    int size;                     /**< Number of coordinates allocated for `c` */
+};
+
+/**
+ * @brief State of a CH query
+ */
+struct ch_query {
+    struct map *map;              /**< The map holding the hierarchy */
+    struct map_rect *mr;          /**< Map rect used to retrieve nodes by ID */
+    GHashTable *nodes;            /**< All nodes visited so far, keyed by `struct item_id` */
+    struct fibheap *heap[2];      /**< Priority queues of the forward (0) and backward (1) search */
+};
+
+static void route_ch_path_append(struct ch_path *path, struct coord *c) {
+    if (path->count == path->size) {
+        path->size=path->size ? path->size*2 : 256;
+        path->c=g_renew(struct coord, path->c, path->size);
+    }
+    path->c[path->count++]=*c;
+}
+
+static struct ch_node *route_ch_node_get(struct ch_query *q, struct item_id *id) {
+    struct ch_node *ret=g_hash_table_lookup(q->nodes, id);
+    if (!ret) {
+        ret=g_new0(struct ch_node, 1);
+        ret->id=*id;
+        ret->value[0]=INT_MAX;
+        ret->value[1]=INT_MAX;
+        g_hash_table_insert(q->nodes, &ret->id, ret);
+    }
+    return ret;
+}
+
+/**
+ * @brief Retrieves the map item for a CH node and reads its coordinates
+ *
+ * @return The item, or NULL if the node cannot be found in the map. The item is valid until the next call.
+ */
+static struct item *route_ch_node_item(struct ch_query *q, struct ch_node *node) {
+    struct item *item=map_rect_get_item_byid(q->mr, node->id.id_hi, node->id.id_lo);
+    if (!item || item->type != type_ch_node)
+        return NULL;
+    if (!node->has_coord) {
+        item_coord_rewind(item);
+        node->has_coord=item_coord_get(item, &node->c, 1);
+    }
+    item_attr_rewind(item);
+    return item;
+}
+
+/**
+ * @brief Reads the next CH edge from a node item
+ */
+static int route_ch_edge_get(struct item *item, struct ch_edge *edge) {
+    struct attr attr;
+    struct ch_edge *data;
+    if (!item_attr_get(item, attr_ch_edge, &attr))
+        return 0;
+    data=(struct ch_edge *)attr.u.data;
+    edge->flags=le32_to_cpu(data->flags);
+    edge->weight=le32_to_cpu(data->weight);
+    edge->target.id_hi=le32_to_cpu(data->target.id_hi);
+    edge->target.id_lo=le32_to_cpu(data->target.id_lo);
+    edge->middle.id_hi=le32_to_cpu(data->middle.id_hi);
+    edge->middle.id_lo=le32_to_cpu(data->middle.id_lo);
+    return 1;
+}
+
+/**
+ * @brief Finds the CH node nearest to a coordinate
+ *
+ * @param m The map to search
+ * @param c The coordinate
+ * @param id Receives the ID of the node
+ * @return True if a node was found within `CH_NODE_DIST`, false otherwise
+ */
+static int route_ch_find_node(struct map *m, struct coord *c, struct item_id *id) {
+    struct map_selection *sel=route_rect(18, c, c, 0, CH_NODE_DIST);
+    struct map_rect *mr;
+    struct item *item;
+    struct coord nc;
+    int dist,mindist=INT_MAX;
+
+    sel->range.min=type_ch_node;
+    sel->range.max=type_ch_node;
+    mr=map_rect_new(m, sel);
+    if (mr) {
+        while ((item=map_rect_get_item(mr))) {
+            if (item->type != type_ch_node || !item_coord_get(item, &nc, 1))
+                continue;
+            dist=transform_distance_sq(c, &nc);
+            if (dist < mindist) {
+                mindist=dist;
+                id->id_hi=item->id_hi;
+                id->id_lo=item->id_lo;
+            }
+        }
+        map_rect_destroy(mr);
+    }
+    map_selection_destroy(sel);
+    return mindist <= CH_NODE_DIST*CH_NODE_DIST;
+}
+
+/**
+ * @brief Relaxes all upward edges of a node in one search direction
+ */
+static void route_ch_expand(struct ch_query *q, struct ch_node *node, int dir) {
+    struct item *item=route_ch_node_item(q, node);
+    struct ch_edge edge;
+    struct ch_node *next;
+    int val;
+
+    if (!item)
+        return;
+    while (route_ch_edge_get(item, &edge)) {
+        if (!(edge.flags & (dir ? CH_EDGE_BACKWARD : CH_EDGE_FORWARD)))
+            continue;
+        next=route_ch_node_get(q, &edge.target);
+        val=node->value[dir]+edge.weight;
+        if (val >= next->value[dir])
+            continue;
+        next->value[dir]=val;
+        next->pred[dir]=node;
+        next->pred_edge[dir]=edge;
+        if (next->el[dir])
+            fh_replacekey(q->heap[dir], next->el[dir], val);
+        else
+            next->el[dir]=fh_insertkey(q->heap[dir], val, next);
+    }
+}
+
+/**
+ * @brief Runs a bidirectional upward search between two nodes
+ *
+ * @return The node at which both searches meet on the shortest path, or NULL if no path was found
+ */
+static struct ch_node *route_ch_search(struct ch_query *q, struct item_id *from, struct item_id *to) {
+    struct ch_node *node,*min[2],*meet=NULL;
+    int dir,best=INT_MAX,settled=0;
+
+    node=route_ch_node_get(q, from);
+    node->value[0]=0;
+    node->el[0]=fh_insertkey(q->heap[0], 0, node);
+    node=route_ch_node_get(q, to);
+    node->value[1]=0;
+    node->el[1]=fh_insertkey(q->heap[1], 0, node);
+
+    for (;;) {
+        min[0]=fh_min(q->heap[0]);
+        min[1]=fh_min(q->heap[1]);
+        if (min[0] && min[0]->value[0] >= best)
+            min[0]=NULL;
+        if (min[1] && min[1]->value[1] >= best)
+            min[1]=NULL;
+        if (!min[0] && !min[1])
+            break;
+        if (!min[1] || (min[0] && min[0]->value[0] <= min[1]->value[1]))
+            dir=0;
+        else
+            dir=1;
+        node=fh_extractmin(q->heap[dir]);
+        node->el[dir]=NULL;
+        if (node->value[!dir] != INT_MAX && node->value[0]+node->value[1] < best) {
+            best=node->value[0]+node->value[1];
+            meet=node;
+        }
+        route_ch_expand(q, node, dir);
+        if (++settled > CH_MAX_SETTLED) {
+            dbg(lvl_warning,"giving up after %d nodes", settled);
+            return NULL;
+        }
+    }
+    dbg(lvl_debug,"settled %d nodes, cost %d", settled, best);
+    return meet;
+}
+
+/**
+ * @brief Appends the coordinates of all nodes bypassed by an edge to a path
+ *
+ * Shortcuts are unpacked recursively: the contracted node of a shortcut from `a` to `b` has a lower rank than both,
+ * hence it holds the two edges leading to `a` and `b`.
+ */
+static void route_ch_unpack(struct ch_query *q, struct ch_node *a, struct ch_node *b, struct ch_edge *edge,
+                            struct ch_path *path, int depth) {
+    struct ch_node *m;
+    struct ch_edge e,ea,eb;
+    struct item *item;
+    int found=0;
+
+    if (!(edge->flags & CH_EDGE_SHORTCUT) || depth > 64)
+        return;
+    m=route_ch_node_get(q, &edge->middle);
+    if (!(item=route_ch_node_item(q, m)))
+        return;
+    while (found != 3 && route_ch_edge_get(item, &e)) {
+        if (!(found & 1) && item_id_equal(&e.target, &a->id)) {
+            ea=e;
+            found|=1;
+        } else if (!(found & 2) && item_id_equal(&e.target, &b->id)) {
+            eb=e;
+            found|=2;
+        }
+    }
+    if (found != 3) {
+        dbg(lvl_warning,"cannot unpack shortcut via (0x%x,0x%x)", m->id.id_hi, m->id.id_lo);
+        return;
+    }
+    route_ch_unpack(q, a, m, &ea, path, depth+1);
+    if (m->has_coord)
+        route_ch_path_append(path, &m->c);
+    route_ch_unpack(q, m, b, &eb, path, depth+1);
+}
+
+static void route_ch_path_add_node(struct ch_query *q, struct ch_node *node, struct ch_path *path) {
+    if (node->has_coord || route_ch_node_item(q, node))
+        route_ch_path_append(path, &node->c);
+}
+
+/**
+ * @brief Finds the shortest path between two nodes and appends its coordinates to `path`
+ *
+ * @return True on success, false if no path was found
+ */
+static int route_ch_path(struct ch_query *q, struct item_id *from, struct item_id *to, struct ch_path *path) {
+    struct ch_node *meet,*node;
+    GList *fwd=NULL,*l;
+
+    meet=route_ch_search(q, from, to);
+    if (!meet)
+        return 0;
+    for (node=meet ; node ; node=node->pred[0])
+        fwd=g_list_prepend(fwd, node);
+    for (l=fwd ; l ; l=g_list_next(l)) {
+        node=l->data;
+        if (node->pred[0])
+            route_ch_unpack(q, node->pred[0], node, &node->pred_edge[0], path, 0);
+        route_ch_path_add_node(q, node, path);
+    }
+    g_list_free(fwd);
+    for (node=meet ; node->pred[1] ; node=node->pred[1]) {
+        route_ch_unpack(q, node, node->pred[1], &node->pred_edge[1], path, 0);
+        route_ch_path_add_node(q, node->pred[1], path);
+    }
+    return 1;
+}
+
+static void route_ch_query_reset(struct ch_query *q) {
+    while (fh_extractmin(q->heap[0]));
+    while (fh_extractmin(q->heap[1]));
+    g_hash_table_remove_all(q->nodes);
+}
+
+/**
+ * @brief Turns a sequence of coordinates into a list of corridor rectangles
+ */
+static struct map_selection *route_ch_corridor_from_path(struct ch_path *path) {
+    struct map_selection *ret=NULL,*sel;
+    struct coord_rect r;
+    struct coord *c=path->c;
+    int i,j;
+
+    for (i = 0 ; i < path->count ; i+=CH_CORRIDOR_CHUNK) {
+        r.lu=c[i];
+        r.rl=c[i];
+        /* rectangles overlap by one node so that the corridor is contiguous */
+        for (j = i+1 ; j <= i+CH_CORRIDOR_CHUNK && j < path->count ; j++)
+            coord_rect_extend(&r, &c[j]);
+        sel=route_rect(CH_CORRIDOR_ORDER, &r.lu, &r.rl, 0, CH_CORRIDOR_DIST);
+        sel->next=ret;
+        ret=sel;
+    }
+    return ret;
+}
+
+/**
+ * @brief Calculates a corridor for the route graph using the contraction hierarchy of a map
+ *
+ * The first map in the mapset which holds CH data near the first route point is used. A shortest path is then
+ * calculated between each pair of consecutive route points.
+ *
+ * @param ms The mapset
+ * @param c Array containing route points, including start, intermediate and destination ones, in `projection_mg`
+ * @param count Number of route points
+ * @return A list of map selections covering the path, or NULL if no map has CH data for the route points or no
+ * path was found. The caller is responsible for freeing the list.
+ */
+struct map_selection *route_ch_corridor(struct mapset *ms, struct coord *c, int count) {
+    struct mapset_handle *h;
+    struct map *m;
+    struct item_id *ids;
+    struct ch_query q;
+    struct map_selection *ret=NULL;
+    struct ch_path path= {NULL, 0, 0};
+    int i;
+
+    if (count < 2)
+        return NULL;
+    ids=g_alloca(sizeof(struct item_id)*count);
+    h=mapset_open(ms);
+    while ((m=mapset_next(h, 2))) {
+        if (map_projection(m) == projection_mg && route_ch_find_node(m, &c[0], &ids[0]))
+            break;
+    }
+    mapset_close(h);
+    if (!m) {
+        dbg(lvl_debug,"no map with contraction hierarchy");
+        return NULL;
+    }
+    for (i = 1 ; i < count ; i++) {
+        if (!route_ch_find_node(m, &c[i], &ids[i])) {
+            dbg(lvl_debug,"no contraction hierarchy node near point %d", i);
+            return NULL;
+        }
+    }
+
+    q.map=m;
+    q.mr=map_rect_new(m, NULL);
+    if (!q.mr)
+        return NULL;
+    q.nodes=g_hash_table_new_full((GHashFunc)item_id_hash, (GEqualFunc)item_id_equal, NULL, g_free);
+    q.heap[0]=fh_makekeyheap();
+    q.heap[1]=fh_makekeyheap();
+
+    for (i = 1 ; i < count ; i++) {
+        if (!route_ch_path(&q, &ids[i-1], &ids[i], &path)) {
+            dbg(lvl_debug,"no contraction hierarchy path from point %d to %d", i-1, i);
+            break;
+        }
+        route_ch_query_reset(&q);
+    }
+    if (i == count && path.count) {
+        dbg(lvl_debug,"path has %d nodes", path.count);
+        ret=route_ch_corridor_from_path(&path);
+    }
+
+    g_free(path.c);
+    fh_deleteheap(q.heap[0]);
+    fh_deleteheap(q.heap[1]);
+    g_hash_table_destroy(q.nodes);
+    map_rect_destroy(q.mr);
+    return ret;
+}
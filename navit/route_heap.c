@@ -0,0 +1,400 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ * @brief Priority queues for flooding the route graph.
+ *
+ * Two implementations are provided behind a common interface:
+ *
+ * \li `route_heap_dary` is an array-backed 4-ary heap. It supports changing the key of a point in either direction,
+ * which is what the LPA* implementation in `route.c` needs when costs increase during a recalculation.
+ * \li `route_heap_radix` is a radix heap. It is the faster choice for plain Dijkstra floods, where every key inserted
+ * is at least as large as the last key extracted. Inserting a smaller key is still supported, but requires all
+ * elements to be redistributed.
+ *
+ * Both store their elements in flat arrays and keep the position of each point in the point itself (`heap_pos` and
+ * `heap_bucket` in `struct route_graph_point`), so no memory is allocated per element and no pointers need to be
+ * followed to compare keys.
+ */
+
+#include <glib.h>
+#include "config.h"
+#include "debug.h"
+#include "coord.h"
+#include "item.h"
+#include "route_protected.h"
+
+/** Number of children of each node of the d-ary heap */
+#define ROUTE_HEAP_ARITY 4
+
+/** Number of buckets of the radix heap, one for each bit of a (nonnegative) key plus one for keys equal to `last` */
+#define ROUTE_HEAP_BUCKETS 33
+
+/** Initial number of elements allocated for a heap array */
+#define ROUTE_HEAP_INITIAL_SIZE 256
+
+struct route_heap_entry {
+    int key;                      /**< The key of the point */
+    struct route_graph_point *p;  /**< The point */
+};
+
+struct route_heap_array {
+    struct route_heap_entry *e;   /**< The elements */
+    int count;                    /**< Number of elements in use */
+    int size;                     /**< Number of elements allocated */
+};
+
+struct route_heap_methods {
+    void (*insert)(struct route_heap *this_, struct route_graph_point *p, int key);
+    void (*remove)(struct route_heap *this_, struct route_graph_point *p);
+    struct route_graph_point *(*min)(struct route_heap *this_);
+};
+
+/**
+ * @brief A priority queue of route graph points
+ */
+struct route_heap {
+    struct route_heap_methods *meth;  /**< The implementation */
+    int count;                        /**< Number of points on the heap */
+    int last;                         /**< Radix heap only: the last key extracted, all keys are relative to it */
+    int array_count;                  /**< Number of entries in `array` */
+    struct route_heap_array *array;   /**< The heap (d-ary heap) or its buckets (radix heap) */
+};
+
+/**
+ * @brief Stores an entry at a given position of a heap array and records that position in the point.
+ */
+static inline void route_heap_array_set(struct route_heap_array *a, int bucket, int i, struct route_heap_entry e) {
+    a->e[i]=e;
+    e.p->heap_pos=i+1;
+    e.p->heap_bucket=bucket;
+}
+
+/**
+ * @brief Appends an entry to a heap array, growing it if needed.
+ *
+ * @return The position of the new entry
+ */
+static int route_heap_array_append(struct route_heap_array *a, int bucket, struct route_heap_entry e) {
+    if (a->count == a->size) {
+        a->size=a->size ? a->size*2 : ROUTE_HEAP_INITIAL_SIZE;
+        a->e=g_renew(struct route_heap_entry, a->e, a->size);
+    }
+    route_heap_array_set(a, bucket, a->count, e);
+    return a->count++;
+}
+
+static void route_heap_dary_sift_up(struct route_heap_array *a, int i) {
+    struct route_heap_entry e=a->e[i];
+    int parent;
+
+    while (i > 0) {
+        parent=(i-1)/ROUTE_HEAP_ARITY;
+        if (a->e[parent].key <= e.key)
+            break;
+        route_heap_array_set(a, 0, i, a->e[parent]);
+        i=parent;
+    }
+    route_heap_array_set(a, 0, i, e);
+}
+
+static void route_heap_dary_sift_down(struct route_heap_array *a, int i) {
+    struct route_heap_entry e=a->e[i];
+    int first,end,j,min;
+
+    for (;;) {
+        first=i*ROUTE_HEAP_ARITY+1;
+        if (first >= a->count)
+            break;
+        end=MIN(first+ROUTE_HEAP_ARITY, a->count);
+        min=first;
+        for (j = first+1 ; j < end ; j++)
+            if (a->e[j].key < a->e[min].key)
+                min=j;
+        if (a->e[min].key >= e.key)
+            break;
+        route_heap_array_set(a, 0, i, a->e[min]);
+        i=min;
+    }
+    route_heap_array_set(a, 0, i, e);
+}
+
+static void route_heap_dary_insert(struct route_heap *this_, struct route_graph_point *p, int key) {
+    struct route_heap_array *a=this_->array;
+    struct route_heap_entry e;
+    int i,old;
+
+    if (p->heap_pos) {
+        i=p->heap_pos-1;
+        old=a->e[i].key;
+        a->e[i].key=key;
+        if (key < old)
+            route_heap_dary_sift_up(a, i);
+        else if (key > old)
+            route_heap_dary_sift_down(a, i);
+        return;
+    }
+    e.key=key;
+    e.p=p;
+    route_heap_dary_sift_up(a, route_heap_array_append(a, 0, e));
+    this_->count++;
+}
+
+static void route_heap_dary_remove(struct route_heap *this_, struct route_graph_point *p) {
+    struct route_heap_array *a=this_->array;
+    int i=p->heap_pos-1;
+    int key=a->e[i].key;
+
+    p->heap_pos=0;
+    this_->count--;
+    if (i == --a->count)
+        return;
+    route_heap_array_set(a, 0, i, a->e[a->count]);
+    if (a->e[i].key < key)
+        route_heap_dary_sift_up(a, i);
+    else
+        route_heap_dary_sift_down(a, i);
+}
+
+static struct route_graph_point *route_heap_dary_min(struct route_heap *this_) {
+    if (!this_->count)
+        return NULL;
+    return this_->array->e[0].p;
+}
+
+static struct route_heap_methods route_heap_dary_meth = {
+    route_heap_dary_insert,
+    route_heap_dary_remove,
+    route_heap_dary_min,
+};
+
+/**
+ * @brief Returns the radix heap bucket for a key, i.e. the position of the highest bit in which it differs from `last`
+ */
+static int route_heap_radix_bucket(struct route_heap *this_, int key) {
+    unsigned int diff=(unsigned int)key ^ (unsigned int)this_->last;
+#ifdef __GNUC__
+    return diff ? 32-__builtin_clz(diff) : 0;
+#else
+    int ret=0;
+    while (diff) {
+        ret++;
+        diff >>= 1;
+    }
+    return ret;
+#endif
+}
+
+static void route_heap_radix_push(struct route_heap *this_, struct route_heap_entry e) {
+    int bucket=route_heap_radix_bucket(this_, e.key);
+    route_heap_array_append(&this_->array[bucket], bucket, e);
+}
+
+/**
+ * @brief Lowers the reference key of a radix heap and redistributes all elements accordingly.
+ *
+ * This is only needed if a key smaller than the last one extracted is inserted, which does not happen in a plain
+ * Dijkstra flood.
+ */
+static void route_heap_radix_rebase(struct route_heap *this_, int last) {
+    struct route_heap_array all= {NULL, 0, 0};
+    struct route_heap_array *a;
+    int b,i;
+
+    dbg(lvl_debug,"rebasing radix heap from %d to %d, %d elements", this_->last, last, this_->count);
+    for (b = 0 ; b < this_->array_count ; b++) {
+        a=&this_->array[b];
+        for (i = 0 ; i < a->count ; i++)
+            route_heap_array_append(&all, 0, a->e[i]);
+        a->count=0;
+    }
+    this_->last=last;
+    for (i = 0 ; i < all.count ; i++)
+        route_heap_radix_push(this_, all.e[i]);
+    g_free(all.e);
+}
+
+static void route_heap_radix_remove(struct route_heap *this_, struct route_graph_point *p) {
+    struct route_heap_array *a=&this_->array[p->heap_bucket];
+    int i=p->heap_pos-1;
+
+    p->heap_pos=0;
+    this_->count--;
+    if (i != --a->count)
+        route_heap_array_set(a, p->heap_bucket, i, a->e[a->count]);
+}
+
+static void route_heap_radix_insert(struct route_heap *this_, struct route_graph_point *p, int key) {
+    struct route_heap_entry e;
+
+    if (p->heap_pos)
+        route_heap_radix_remove(this_, p);
+    if (key < this_->last) {
+        if (this_->count)
+            route_heap_radix_rebase(this_, key);
+        else
+            this_->last=key;
+    }
+    e.key=key;
+    e.p=p;
+    route_heap_radix_push(this_, e);
+    this_->count++;
+}
+
+static struct route_graph_point *route_heap_radix_min(struct route_heap *this_) {
+    struct route_heap_array *a;
+    int b,i,n,min;
+
+    if (!this_->count)
+        return NULL;
+    if (!this_->array[0].count) {
+        /* Find the first non-empty bucket, make its smallest key the new reference and split it up. All of its
+         * elements end up in lower buckets, so the bucket can be iterated while being emptied. */
+        for (b = 1 ; !this_->array[b].count ; b++);
+        a=&this_->array[b];
+        min=a->e[0].key;
+        for (i = 1 ; i < a->count ; i++)
+            if (a->e[i].key < min)
+                min=a->e[i].key;
+        this_->last=min;
+        n=a->count;
+        a->count=0;
+        for (i = 0 ; i < n ; i++)
+            route_heap_radix_push(this_, a->e[i]);
+    }
+    return this_->array[0].e[0].p;
+}
+
+static struct route_heap_methods route_heap_radix_meth = {
+    route_heap_radix_insert,
+    route_heap_radix_remove,
+    route_heap_radix_min,
+};
+
+/**
+ * @brief Creates a new, empty heap
+ *
+ * @param type The implementation to use
+ *
+ * @return The new heap
+ */
+struct route_heap *route_heap_new(enum route_heap_type type) {
+    struct route_heap *this_=g_new0(struct route_heap, 1);
+
+    switch (type) {
+    case route_heap_radix:
+        this_->meth=&route_heap_radix_meth;
+        this_->array_count=ROUTE_HEAP_BUCKETS;
+        break;
+    default:
+        this_->meth=&route_heap_dary_meth;
+        this_->array_count=1;
+        break;
+    }
+    this_->array=g_new0(struct route_heap_array, this_->array_count);
+    return this_;
+}
+
+/**
+ * @brief Inserts a point into the heap, or changes its key if it is already on the heap
+ *
+ * @param this_ The heap
+ * @param p The point
+ * @param key The key, must not be negative
+ */
+void route_heap_insert(struct route_heap *this_, struct route_graph_point *p, int key) {
+    this_->meth->insert(this_, p, key);
+}
+
+/**
+ * @brief Removes a point from the heap
+ *
+ * It is safe to call this function for a point which is not on the heap.
+ *
+ * @param this_ The heap
+ * @param p The point
+ */
+void route_heap_remove(struct route_heap *this_, struct route_graph_point *p) {
+    if (p->heap_pos)
+        this_->meth->remove(this_, p);
+}
+
+/**
+ * @brief Returns the point with the lowest key without removing it
+ *
+ * @param this_ The heap
+ *
+ * @return The point, or NULL if the heap is empty
+ */
+struct route_graph_point *route_heap_min(struct route_heap *this_) {
+    return this_->meth->min(this_);
+}
+
+/**
+ * @brief Removes the point with the lowest key from the heap and returns it
+ *
+ * @param this_ The heap
+ *
+ * @return The point, or NULL if the heap is empty
+ */
+struct route_graph_point *route_heap_extract_min(struct route_heap *this_) {
+    struct route_graph_point *ret=this_->meth->min(this_);
+    if (ret)
+        this_->meth->remove(this_, ret);
+    return ret;
+}
+
+/**
+ * @brief Removes all points from the heap
+ *
+ * The heap keeps its memory, so it can be refilled without reallocating.
+ *
+ * @param this_ The heap
+ */
+void route_heap_clear(struct route_heap *this_) {
+    struct route_heap_array *a;
+    int b,i;
+
+    for (b = 0 ; b < this_->array_count ; b++) {
+        a=&this_->array[b];
+        for (i = 0 ; i < a->count ; i++)
+            a->e[i].p->heap_pos=0;
+        a->count=0;
+    }
+    this_->count=0;
+    this_->last=0;
+}
+
+/**
+ * @brief Destroys a heap
+ *
+ * Points still on the heap are not freed, but their heap position is left undefined.
+ *
+ * @param this_ The heap
+ */
+void route_heap_destroy(struct route_heap *this_) {
+    int b;
+
+    if (!this_)
+        return;
+    for (b = 0 ; b < this_->array_count ; b++)
+        g_free(this_->array[b].e);
+    g_free(this_->array);
+    g_free(this_);
+}
@@ -41,6 +41,18 @@ extern "C" {
 
 #define RSD_MAXSPEED(x) *((int *)route_segment_data_field_pos((x), attr_maxspeed))
 
+/**
+ * @brief A simple bump allocator holding the points or segments of a route graph
+ *
+ * Memory is taken from large chunks and only released all at once, when the route graph is freed.
+ */
+struct route_graph_arena {
+	struct route_graph_arena_chunk *chunks; /**< All chunks allocated so far, most recent first */
+	char *next;                          /**< Next free byte in the most recent chunk */
+	char *end;                           /**< End of the most recent chunk */
+	long size;                           /**< Total size of all chunks in bytes */
+};
+
 /**
  * @brief A point in the route graph
  *
@@ -48,15 +60,16 @@ extern "C" {
  * but there are also points which don't do that (e.g. at the end of a dead-end).
  */
 struct route_graph_point {
-	struct route_graph_point *hash_next; /**< Pointer to a chained hashlist of all route_graph_points with this hash */
+	struct route_graph_point *hash_next; /**< Pointer to the next route_graph_point with the same coordinates */
 	struct route_graph_segment *start;   /**< Pointer to a list of segments of which this point is the start. The links
 	                                      *  of this linked-list are in route_graph_segment->start_next.*/
 	struct route_graph_segment *end;     /**< Pointer to a list of segments of which this pointer is the end. The links
 	                                      *  of this linked-list are in route_graph_segment->end_next. */
 	struct route_graph_segment *seg;     /**< Pointer to the segment one should use to reach the destination at
 	                                      *  least costs */
-	struct fibheap_el *el;				 /**< When this point is put on a Fibonacci heap, this is a pointer
-	                                      *  to this point's heap element */
+	int heap_pos;                        /**< When this point is on the route graph's heap, this is its position
+	                                      *  in the heap array plus one; 0 if the point is not on the heap */
+	int heap_bucket;                     /**< The heap array holding this point (only used by the radix heap) */
 	int value;                           /**< The cost at which one can reach the destination from this point on.
 	                                      *  {@code INT_MAX} indicates that the destination is unreachable from this
 	                                      *  point, or that this point has not yet been examined. */
@@ -151,11 +164,58 @@ struct route_graph {
 	struct event_idle *idle_ev;                 /**< The pointer to the idle event */
 	struct route_graph_segment *route_segments; /**< Pointer to the first route_graph_segment in the linked list of all segments */
 	struct route_graph_segment *avoid_seg;
-	struct fibheap *heap;                       /**< Priority queue for points to be expanded */
-#define HASH_SIZE 8192
-	struct route_graph_point *hash[HASH_SIZE];  /**< A hashtable containing all route_graph_points in this graph */
+	struct route_heap *heap;                    /**< Priority queue for points to be expanded */
+	int ch;                                     /**< The graph covers only a contraction hierarchy corridor */
+	struct route_graph_builder *builder;        /**< Worker threads building the graph, NULL if it is built on the
+	                                             *   main loop */
+	long long build_start;                      /**< Time at which building the graph started, in milliseconds */
+	int build_time;                             /**< Time it took to build the graph, in milliseconds */
+	struct route_graph_point **hash;            /**< Open-addressing hashtable containing all route_graph_points in
+	                                             *   this graph, one slot per coordinate pair. Each slot holds a list
+	                                             *   of the points at these coordinates, linked via `hash_next`. */
+	int hash_size;                              /**< Number of slots in `hash`, always a power of two (or 0) */
+	int hash_count;                             /**< Number of slots in use */
+	int point_count;                            /**< Number of points in the graph */
+	long hash_lookups;                          /**< Number of point lookups in `hash` */
+	long hash_probes;                           /**< Number of slots examined during point lookups */
+	struct route_graph_arena points;            /**< Memory holding all points of the graph */
+	struct route_graph_arena segments;          /**< Memory holding all segments of the graph */
+	struct route_cache *cache;                  /**< On-disk cache of the segments, NULL if disabled */
+};
+
+
+/**
+ * @brief A segment read from the map, waiting to be added to the route graph
+ *
+ * Reading items from the map and adding them to the route graph are separate steps, so that items can be read on
+ * worker threads while only the main loop touches the graph.
+ */
+struct route_graph_batch_entry {
+	struct item item;                     /**< The item the segment belongs to */
+	struct coord start;                   /**< Coordinates of the start point */
+	struct coord end;                     /**< Coordinates of the end point */
+	int start_flags;                      /**< Flags to set on the start point */
+	int end_flags;                        /**< Flags to set on the end point */
+	int check_duplicate;                  /**< Skip the segment if the graph already contains it */
+	struct route_graph_segment_data data; /**< Segment data, `data.item` is set when the segment is added */
 };
 
+/**
+ * @brief A list of segments read from the map
+ */
+struct route_graph_batch {
+	struct route_graph_batch_entry *entries; /**< The segments */
+	int count;                               /**< Number of segments */
+	int size;                                /**< Number of segments allocated */
+};
+
+/**
+ * @brief Priority queue implementations for flooding the route graph, see `route_heap.c`
+ */
+enum route_heap_type {
+	route_heap_dary,                            /**< Array-backed 4-ary heap, supports increasing and decreasing keys */
+	route_heap_radix,                           /**< Radix heap, for floods which extract keys in ascending order */
+};
 
 /* prototypes */
 struct route_graph * route_get_graph(struct route *this_);
@@ -174,8 +234,30 @@ void route_graph_add_segment(struct route_graph *this, struct route_graph_point
 int route_graph_segment_is_duplicate(struct route_graph_point *start, struct route_graph_segment_data *data);
 void route_graph_free_segments(struct route_graph *this);
 void route_graph_build_done(struct route_graph *rg, int cancel);
+struct route_graph_batch_entry *route_graph_batch_append(struct route_graph_batch *batch, struct item *item,
+		struct coord *start, struct coord *end);
+void route_graph_batch_add_entry(struct route_graph *this, struct route_graph_batch_entry *entry,
+		struct route_graph_point **s_ret, struct route_graph_point **e_ret);
+void route_graph_batch_free(struct route_graph_batch *batch);
+void route_graph_batch_add_turn_restriction(struct route_graph_batch *batch, struct item *item);
 void route_recalculate_partial(struct route *this_);
 void * route_segment_data_field_pos(struct route_segment_data *seg, enum attr_type type);
+struct map_selection *route_ch_corridor(struct mapset *ms, struct coord *c, int count);
+struct route_heap *route_heap_new(enum route_heap_type type);
+void route_heap_insert(struct route_heap *this_, struct route_graph_point *p, int key);
+void route_heap_remove(struct route_heap *this_, struct route_graph_point *p);
+struct route_graph_point *route_heap_min(struct route_heap *this_);
+struct route_graph_point *route_heap_extract_min(struct route_heap *this_);
+void route_heap_clear(struct route_heap *this_);
+void route_heap_destroy(struct route_heap *this_);
+struct route_cache *route_cache_new(struct mapset *ms, struct map_selection *sel, struct vehicleprofile *profile);
+int route_cache_load(struct route_cache *this_, struct route_graph_batch *batch);
+int route_cache_covers_map(struct route_cache *this_, struct map *m);
+void route_cache_record(struct route_cache *this_, struct route_graph_batch *batch);
+void route_cache_save(struct route_cache *this_);
+void route_cache_destroy(struct route_cache *this_);
+int route_cache_get_hits(void);
+int route_cache_get_misses(void);
 /* end of prototypes */
 #ifdef __cplusplus
 }
@@ -0,0 +1,246 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ * @brief Minimal threading primitives for the Navit core.
+ *
+ * Navit does not depend on GThread, so this wraps POSIX threads where they are available. On all other platforms
+ * `thread_new()` fails and locks do nothing, so callers must always be prepared to do their work on the main loop
+ * instead.
+ */
+
+#include <glib.h>
+#include "config.h"
+#ifdef HAVE_POSIX_THREADS
+#include <pthread.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include "debug.h"
+#include "thread.h"
+
+struct thread {
+#ifdef HAVE_POSIX_THREADS
+    pthread_t id;
+#endif
+    int (*main)(void *);
+    void *data;
+    int ret;
+    char *name;
+};
+
+struct thread_lock {
+#ifdef HAVE_POSIX_THREADS
+    pthread_mutex_t mutex;
+#else
+    int dummy;
+#endif
+};
+
+struct thread_local {
+#ifdef HAVE_POSIX_THREADS
+    pthread_key_t key;
+#else
+    void *value;
+#endif
+};
+
+/**
+ * @brief Whether this build of Navit can run work on other threads
+ *
+ * @return True if `thread_new()` can succeed
+ */
+int thread_supported(void) {
+#ifdef HAVE_POSIX_THREADS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @brief Returns the number of processors available
+ *
+ * @return The number of processors, 1 if it cannot be determined
+ */
+int thread_get_cpu_count(void) {
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+    long ret=sysconf(_SC_NPROCESSORS_ONLN);
+    if (ret > 0)
+        return ret;
+#endif
+    return 1;
+}
+
+#ifdef HAVE_POSIX_THREADS
+static void *thread_main(void *data) {
+    struct thread *this_=data;
+    dbg(lvl_debug,"thread %s started", this_->name);
+    this_->ret=this_->main(this_->data);
+    dbg(lvl_debug,"thread %s finished with %d", this_->name, this_->ret);
+    return NULL;
+}
+#endif
+
+/**
+ * @brief Starts a new thread
+ *
+ * The thread must be waited for with `thread_join()`, which also frees it.
+ *
+ * @param main The function to run in the new thread, its return value is returned by `thread_join()`
+ * @param data The argument to pass to `main`
+ * @param name The name of the thread, for debugging
+ *
+ * @return The new thread, or NULL if threads are not supported or the thread could not be started
+ */
+struct thread *thread_new(int (*main)(void *), void *data, const char *name) {
+#ifdef HAVE_POSIX_THREADS
+    struct thread *this_=g_new0(struct thread, 1);
+    int err;
+
+    this_->main=main;
+    this_->data=data;
+    this_->name=g_strdup(name);
+    err=pthread_create(&this_->id, NULL, thread_main, this_);
+    if (err) {
+        dbg(lvl_error,"failed to start thread %s: error %d", name, err);
+        g_free(this_->name);
+        g_free(this_);
+        return NULL;
+    }
+    return this_;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * @brief Waits for a thread to finish and frees it
+ *
+ * @param this_ The thread
+ *
+ * @return The return value of the thread's main function
+ */
+int thread_join(struct thread *this_) {
+    int ret;
+
+#ifdef HAVE_POSIX_THREADS
+    pthread_join(this_->id, NULL);
+#endif
+    ret=this_->ret;
+    g_free(this_->name);
+    g_free(this_);
+    return ret;
+}
+
+/**
+ * @brief Creates a new lock
+ *
+ * @return The new lock
+ */
+struct thread_lock *thread_lock_new(void) {
+    struct thread_lock *this_=g_new0(struct thread_lock, 1);
+#ifdef HAVE_POSIX_THREADS
+    pthread_mutex_init(&this_->mutex, NULL);
+#endif
+    return this_;
+}
+
+/**
+ * @brief Acquires a lock, waiting for another thread to release it if needed
+ *
+ * @param this_ The lock, may be NULL in which case nothing is done
+ */
+void thread_lock_acquire(struct thread_lock *this_) {
+#ifdef HAVE_POSIX_THREADS
+    if (this_)
+        pthread_mutex_lock(&this_->mutex);
+#endif
+}
+
+/**
+ * @brief Releases a lock
+ *
+ * @param this_ The lock, may be NULL in which case nothing is done
+ */
+void thread_lock_release(struct thread_lock *this_) {
+#ifdef HAVE_POSIX_THREADS
+    if (this_)
+        pthread_mutex_unlock(&this_->mutex);
+#endif
+}
+
+/**
+ * @brief Destroys a lock
+ *
+ * @param this_ The lock, which must not be held
+ */
+void thread_lock_destroy(struct thread_lock *this_) {
+    if (!this_)
+        return;
+#ifdef HAVE_POSIX_THREADS
+    pthread_mutex_destroy(&this_->mutex);
+#endif
+    g_free(this_);
+}
+
+/**
+ * @brief Creates a new thread local variable
+ *
+ * Each thread sees its own value, which is NULL until the thread sets it.
+ *
+ * @param destroy Called with the value of a thread when the thread exits, may be NULL
+ * @return The new variable
+ */
+struct thread_local *thread_local_new(void (*destroy)(void *)) {
+    struct thread_local *this_=g_new0(struct thread_local, 1);
+#ifdef HAVE_POSIX_THREADS
+    pthread_key_create(&this_->key, destroy);
+#endif
+    return this_;
+}
+
+/**
+ * @brief Returns the value of a thread local variable for the calling thread
+ *
+ * @param this_ The variable
+ * @return The value, NULL if the calling thread did not set one
+ */
+void *thread_local_get(struct thread_local *this_) {
+#ifdef HAVE_POSIX_THREADS
+    return pthread_getspecific(this_->key);
+#else
+    return this_->value;
+#endif
+}
+
+/**
+ * @brief Sets the value of a thread local variable for the calling thread
+ *
+ * @param this_ The variable
+ * @param value The new value
+ */
+void thread_local_set(struct thread_local *this_, void *value) {
+#ifdef HAVE_POSIX_THREADS
+    pthread_setspecific(this_->key, value);
+#else
+    this_->value=value;
+#endif
+}
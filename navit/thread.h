@@ -0,0 +1,46 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2018 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef NAVIT_THREAD_H
+#define NAVIT_THREAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* prototypes */
+struct thread;
+struct thread_lock;
+struct thread_local;
+int thread_supported(void);
+int thread_get_cpu_count(void);
+struct thread *thread_new(int (*main)(void *), void *data, const char *name);
+int thread_join(struct thread *this_);
+struct thread_lock *thread_lock_new(void);
+void thread_lock_acquire(struct thread_lock *this_);
+void thread_lock_release(struct thread_lock *this_);
+void thread_lock_destroy(struct thread_lock *this_);
+struct thread_local *thread_local_new(void (*destroy)(void *));
+void *thread_local_get(struct thread_local *this_);
+void thread_local_set(struct thread_local *this_, void *value);
+/* end of prototypes */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
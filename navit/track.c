@@ -45,6 +45,8 @@ struct object_func tracking_func;
 struct tracking_line {
     struct street_data *street;
     struct tracking_line *next;
+    int generation;                     /**< The update of the lines in which this street was last within range */
+    double length;                      /**< Length of the street, in coordinate units */
     int angle[0];
 };
 
@@ -92,6 +94,11 @@ struct tracking {
     struct coord last_updated;
     struct tracking_line *lines;
     struct tracking_line *curr_line;
+    struct item_hash *line_hash;        /**< Maps the street items to their tracking lines */
+    GHashTable *cells;                  /**< The segment index, maps cells to `struct tracking_cell` */
+    int generation;                     /**< Number of updates of the lines */
+    struct coord index_center;          /**< The position of the last update of the lines */
+    int index_radius;                   /**< Half size of the area of the last update of the lines */
     int pos;
     struct coord curr[2], curr_in, curr_out;
     int curr_angle;
@@ -403,8 +410,12 @@ int *tracking_get_current_flags(struct tracking *_this) {
 static void tracking_get_angles(struct tracking_line *tl) {
     int i;
     struct street_data *sd=tl->street;
-    for (i = 0 ; i < sd->count-1 ; i++)
+    tl->length=0;
+    for (i = 0 ; i < sd->count-1 ; i++) {
+        double dx=sd->c[i+1].x-sd->c[i].x, dy=sd->c[i+1].y-sd->c[i].y;
         tl->angle[i]=transform_get_angle_delta(&sd->c[i], &sd->c[i+1], 0);
+        tl->length+=navit_sqrt(dx*dx+dy*dy);
+    }
 }
 
 static int street_data_within_selection(struct street_data *sd, struct map_selection *sel) {
@@ -438,6 +449,125 @@ static int street_data_within_selection(struct street_data *sd, struct map_selec
 }
 
 
+/** Size of the cells of the segment index, as a shift of the coordinates */
+#define TRACKING_CELL_SHIFT 7
+
+/**
+ * @brief The segments of the tracking lines passing through one cell of the segment index
+ */
+struct tracking_cell {
+    int count;                          /**< Number of segments */
+    int size;                           /**< Allocated size of `segments` */
+    struct tracking_segment {
+        struct tracking_line *line;
+        int offset;                     /**< Index of the first coordinate of the segment */
+    } *segments;
+};
+
+static gpointer tracking_cell_key(int x, int y) {
+    return GINT_TO_POINTER(((x & 0xffff) << 16) | (y & 0xffff));
+}
+
+static void tracking_cell_add(struct tracking *tr, int x, int y, struct tracking_line *tl, int offset) {
+    gpointer key=tracking_cell_key(x, y);
+    struct tracking_cell *cell=g_hash_table_lookup(tr->cells, key);
+
+    if (!cell) {
+        cell=g_new0(struct tracking_cell, 1);
+        g_hash_table_insert(tr->cells, key, cell);
+    }
+    if (cell->count == cell->size) {
+        cell->size=cell->size ? cell->size*2 : 4;
+        cell->segments=g_renew(struct tracking_segment, cell->segments, cell->size);
+    }
+    cell->segments[cell->count].line=tl;
+    cell->segments[cell->count].offset=offset;
+    cell->count++;
+}
+
+static void tracking_cell_remove(struct tracking *tr, int x, int y, struct tracking_line *tl, int offset) {
+    gpointer key=tracking_cell_key(x, y);
+    struct tracking_cell *cell=g_hash_table_lookup(tr->cells, key);
+    int i;
+
+    if (!cell)
+        return;
+    for (i = 0 ; i < cell->count ; i++) {
+        if (cell->segments[i].line == tl && cell->segments[i].offset == offset)
+            cell->segments[i--]=cell->segments[--cell->count];
+    }
+    if (!cell->count) {
+        g_hash_table_remove(tr->cells, key);
+        g_free(cell->segments);
+        g_free(cell);
+    }
+}
+
+/**
+ * @brief Adds a segment of a tracking line to the segment index or removes it
+ *
+ * The segment is sampled at steps shorter than a cell, so consecutive samples are in the same or in
+ * neighbouring cells. For a diagonal step both cells beside it are used as well, as the segment may
+ * pass through either of them.
+ *
+ * @param tr The tracking object
+ * @param tl The tracking line
+ * @param offset Index of the first coordinate of the segment
+ * @param add True to add the segment, false to remove it
+ */
+static void tracking_index_segment(struct tracking *tr, struct tracking_line *tl, int offset, int add) {
+    struct coord *c=tl->street->c+offset;
+    long long dx=c[1].x-c[0].x, dy=c[1].y-c[0].y;
+    int steps=(MAX(ABS(dx),ABS(dy)) >> TRACKING_CELL_SHIFT)+1;
+    int i,x,y,last_x=0,last_y=0;
+    void (*func)(struct tracking *tr, int x, int y, struct tracking_line *tl, int offset)=add ? tracking_cell_add :
+            tracking_cell_remove;
+
+    for (i = 0 ; i <= steps ; i++) {
+        x=(c[0].x+(int)(dx*i/steps)) >> TRACKING_CELL_SHIFT;
+        y=(c[0].y+(int)(dy*i/steps)) >> TRACKING_CELL_SHIFT;
+        if (i && x == last_x && y == last_y)
+            continue;
+        if (i && x != last_x && y != last_y) {
+            func(tr, x, last_y, tl, offset);
+            func(tr, last_x, y, tl, offset);
+        }
+        func(tr, x, y, tl, offset);
+        last_x=x;
+        last_y=y;
+    }
+}
+
+static void tracking_index_line(struct tracking *tr, struct tracking_line *tl, int add) {
+    int i;
+    for (i = 0 ; i < tl->street->count-1 ; i++)
+        tracking_index_segment(tr, tl, i, add);
+}
+
+static void tracking_cell_free(gpointer key, gpointer value, gpointer user_data) {
+    struct tracking_cell *cell=value;
+    g_free(cell->segments);
+    g_free(cell);
+}
+
+static void tracking_line_free(struct tracking *tr, struct tracking_line *tl) {
+    if (tr->cells)
+        tracking_index_line(tr, tl, 0);
+    item_hash_remove(tr->line_hash, &tl->street->item);
+    street_data_free(tl->street);
+    g_free(tl);
+}
+
+/**
+ * @brief Updates the tracking lines for the area around the given position
+ *
+ * Streets which are still within the area keep their tracking line and street data, only new streets
+ * are read and added to the segment index, and streets which have left the area are dropped.
+ *
+ * @param tr The tracking object
+ * @param pc The position
+ * @param pro The projection of `pc`
+ */
 static void tracking_doupdate_lines(struct tracking *tr, struct coord *pc, enum projection pro) {
     int max_dist=1000;
     struct map_selection *sel;
@@ -446,11 +576,17 @@ static void tracking_doupdate_lines(struct tracking *tr, struct coord *pc, enum
     struct map_rect *mr;
     struct item *item;
     struct street_data *street;
-    struct tracking_line *tl;
+    struct tracking_line *tl,**tlp;
     struct coord_geo g;
     struct coord cc;
+    int added=0,kept=0,removed=0;
 
     dbg(lvl_debug,"enter");
+    if (!tr->line_hash)
+        tr->line_hash=item_hash_new();
+    if (!tr->cells)
+        tr->cells=g_hash_table_new(g_direct_hash, g_direct_equal);
+    tr->generation++;
     h=mapset_open(tr->ms);
     while ((m=mapset_next(h,2))) {
         cc.x = pc->x;
@@ -465,13 +601,25 @@ static void tracking_doupdate_lines(struct tracking *tr, struct coord *pc, enum
             continue;
         while ((item=map_rect_get_item(mr))) {
             if (item_get_default_flags(item->type)) {
+                tl=item_hash_lookup(tr->line_hash, item);
+                if (tl) {
+                    if (tl->generation != tr->generation && street_data_within_selection(tl->street, sel)) {
+                        tl->generation=tr->generation;
+                        kept++;
+                    }
+                    continue;
+                }
                 street=street_get_data(item);
                 if (street_data_within_selection(street, sel)) {
                     tl=g_malloc(sizeof(struct tracking_line)+(street->count-1)*sizeof(int));
                     tl->street=street;
+                    tl->generation=tr->generation;
                     tracking_get_angles(tl);
                     tl->next=tr->lines;
                     tr->lines=tl;
+                    item_hash_insert(tr->line_hash, &street->item, tl);
+                    tracking_index_line(tr, tl, 1);
+                    added++;
                 } else
                     street_data_free(street);
             }
@@ -480,7 +628,20 @@ static void tracking_doupdate_lines(struct tracking *tr, struct coord *pc, enum
         map_rect_destroy(mr);
     }
     mapset_close(h);
-    dbg(lvl_debug, "exit");
+    tlp=&tr->lines;
+    while ((tl=*tlp)) {
+        if (tl->generation != tr->generation) {
+            *tlp=tl->next;
+            if (tr->curr_line == tl)
+                tr->curr_line=NULL;
+            tracking_line_free(tr, tl);
+            removed++;
+        } else
+            tlp=&tl->next;
+    }
+    tr->index_center=*pc;
+    tr->index_radius=max_dist;
+    dbg(lvl_debug, "exit, %d lines added, %d kept, %d removed", added, kept, removed);
 }
 
 
@@ -488,10 +649,14 @@ void tracking_flush(struct tracking *tr) {
     struct tracking_line *tl=tr->lines,*next;
     dbg(lvl_debug,"enter(tr=%p)", tr);
 
+    if (tr->cells) {
+        g_hash_table_foreach(tr->cells, tracking_cell_free, NULL);
+        g_hash_table_destroy(tr->cells);
+        tr->cells=NULL;
+    }
     while (tl) {
         next=tl->next;
-        street_data_free(tl->street);
-        g_free(tl);
+        tracking_line_free(tr, tl);
         tl=next;
     }
     tr->lines=NULL;
@@ -604,6 +769,300 @@ static int tracking_value(struct tracking *tr, struct tracking_line *t, int offs
 }
 
 
+/**
+ * @brief Rates a segment and makes it the current one if it is better than the best so far
+ *
+ * @param tr The tracking object
+ * @param t The tracking line
+ * @param i Index of the first coordinate of the segment
+ * @param min Points to the value of the best segment so far, updated if this one is better
+ */
+static void tracking_match_segment(struct tracking *tr, struct tracking_line *t, int i, int *min) {
+    struct street_data *sd=t->street;
+    struct coord lpnt;
+    int value=tracking_value(tr,t,i,&lpnt,*min,-1);
+    if (value < *min) {
+        struct coord lpnt_tmp;
+        int angle_delta=tracking_angle_abs_diff(tr->curr_angle, t->angle[i], 360);
+        tr->curr_line=t;
+        tr->pos=i;
+        tr->curr[0]=sd->c[i];
+        tr->curr[1]=sd->c[i+1];
+        tr->direction_matched=t->angle[i];
+        dbg(lvl_debug,"lpnt.x=0x%x,lpnt.y=0x%x pos=%d %d+%d+%d+%d=%d", lpnt.x, lpnt.y, i,
+            transform_distance_line_sq(&sd->c[i], &sd->c[i+1], &tr->curr_in, &lpnt_tmp),
+            tracking_angle_delta(tr, tr->curr_angle, t->angle[i], 0)*tr->angle_pref,
+            tracking_is_connected(tr, tr->last, &sd->c[i]) ? tr->connected_pref : 0,
+            lpnt.x == tr->last_out.x && lpnt.y == tr->last_out.y ? tr->nostop_pref : 0,
+            value
+           );
+        tr->curr_out.x=lpnt.x;
+        tr->curr_out.y=lpnt.y;
+        tr->coord_geo_valid=0;
+        if (angle_delta < 70)
+            tr->street_direction=1;
+        else if (angle_delta > 110)
+            tr->street_direction=-1;
+        else
+            tr->street_direction=0;
+        *min=value;
+    }
+}
+
+/**
+ * @brief Finds the segment matching the current position best
+ *
+ * The cells of the segment index are visited in square rings around the position. The distance is
+ * part of the value of a segment and the other parts are never negative, so the search can stop
+ * as soon as the next ring is further away than the best value found so far, or when the rings cover
+ * the whole area of the last update of the lines.
+ *
+ * @param tr The tracking object
+ * @return The value of the best segment, `INT_MAX/2` if there is none
+ */
+static int tracking_match(struct tracking *tr) {
+    int min=INT_MAX/2;
+    int cx=tr->curr_in.x >> TRACKING_CELL_SHIFT, cy=tr->curr_in.y >> TRACKING_CELL_SHIFT;
+    int k,kmax,x,y,i;
+
+    if (!tr->cells)
+        return min;
+    kmax=((tr->index_radius+MAX(ABS(tr->curr_in.x-tr->index_center.x),
+                                ABS(tr->curr_in.y-tr->index_center.y))) >> TRACKING_CELL_SHIFT)+1;
+    for (k = 0 ; k <= kmax ; k++) {
+        for (y = cy-k ; y <= cy+k ; y++) {
+            for (x = cx-k ; x <= cx+k ; x+=(y == cy-k || y == cy+k) ? 1 : 2*k) {
+                struct tracking_cell *cell=g_hash_table_lookup(tr->cells, tracking_cell_key(x, y));
+                if (!cell)
+                    continue;
+                for (i = 0 ; i < cell->count ; i++)
+                    tracking_match_segment(tr, cell->segments[i].line, cell->segments[i].offset, &min);
+            }
+        }
+        if ((long long)(k << TRACKING_CELL_SHIFT)*(k << TRACKING_CELL_SHIFT) >= min)
+            break;
+    }
+    return min;
+}
+
+/**
+ * @brief Fills a candidate for the projection of a position onto a segment of a street
+ */
+static void tracking_candidate_fill(struct tracking_candidate *cand, struct tracking_line *tl, int pos,
+                                    struct coord *lpnt, int dist_sq) {
+    struct street_data *sd=tl->street;
+    double offset=0,length=0;
+    int i;
+
+    for (i = 0 ; i < sd->count-1 ; i++) {
+        double dx=sd->c[i+1].x-sd->c[i].x, dy=sd->c[i+1].y-sd->c[i].y;
+        if (i == pos) {
+            double lx=lpnt->x-sd->c[i].x, ly=lpnt->y-sd->c[i].y;
+            offset=length+navit_sqrt(lx*lx+ly*ly);
+        }
+        length+=navit_sqrt(dx*dx+dy*dy);
+    }
+    cand->item=sd->item;
+    cand->flags=sd->flags;
+    cand->pos=pos;
+    cand->c[0]=sd->c[pos];
+    cand->c[1]=sd->c[pos+1];
+    cand->start=sd->c[0];
+    cand->end=sd->c[sd->count-1];
+    cand->lpnt=*lpnt;
+    cand->dist_sq=dist_sq;
+    cand->angle=tl->angle[pos];
+    cand->offset=offset;
+    cand->length=length;
+}
+
+static int tracking_candidate_compare(const void *a, const void *b) {
+    const struct tracking_candidate *ca=a, *cb=b;
+    return ca->dist_sq < cb->dist_sq ? -1 : ca->dist_sq > cb->dist_sq;
+}
+
+/**
+ * @brief Finds the streets near a position
+ *
+ * This uses the tracking lines and the segment index of the tracking object, which are updated for the
+ * position first if needed. For every street within `radius`, the segment closest to the position is
+ * returned, so the candidates are independent of the tracking lines and remain valid after the next
+ * call.
+ *
+ * @param tr The tracking object
+ * @param c The position
+ * @param pro The projection of `c`
+ * @param radius The search radius, in coordinate units
+ * @param cand Receives the candidates, ordered by distance
+ * @param max Size of `cand`, only the `max` closest streets are returned
+ * @return The number of candidates
+ */
+int tracking_get_candidates(struct tracking *tr, struct coord *c, enum projection pro, int radius,
+                            struct tracking_candidate *cand, int max) {
+    int cx=c->x >> TRACKING_CELL_SHIFT, cy=c->y >> TRACKING_CELL_SHIFT;
+    int r=(radius >> TRACKING_CELL_SHIFT)+1;
+    long long radius_sq=(long long)radius*radius;
+    int count=0,x,y,i,j,worst;
+    struct coord lpnt;
+
+    if (!tr->lines || transform_distance(pro, &tr->last_updated, c) > 500) {
+        tracking_doupdate_lines(tr, c, pro);
+        tr->last_updated=*c;
+    }
+    if (!tr->cells)
+        return 0;
+    for (y = cy-r ; y <= cy+r ; y++) {
+        for (x = cx-r ; x <= cx+r ; x++) {
+            struct tracking_cell *cell=g_hash_table_lookup(tr->cells, tracking_cell_key(x, y));
+            if (!cell)
+                continue;
+            for (i = 0 ; i < cell->count ; i++) {
+                struct tracking_line *tl=cell->segments[i].line;
+                int pos=cell->segments[i].offset;
+                int dist_sq=transform_distance_line_sq(&tl->street->c[pos], &tl->street->c[pos+1], c, &lpnt);
+                if (dist_sq > radius_sq)
+                    continue;
+                worst=0;
+                for (j = 0 ; j < count ; j++) {
+                    if (item_is_equal(cand[j].item, tl->street->item))
+                        break;
+                    if (cand[j].dist_sq > cand[worst].dist_sq)
+                        worst=j;
+                }
+                if (j < count) {
+                    if (dist_sq < cand[j].dist_sq)
+                        tracking_candidate_fill(&cand[j], tl, pos, &lpnt, dist_sq);
+                } else if (count < max) {
+                    tracking_candidate_fill(&cand[count++], tl, pos, &lpnt, dist_sq);
+                } else if (count && dist_sq < cand[worst].dist_sq) {
+                    tracking_candidate_fill(&cand[worst], tl, pos, &lpnt, dist_sq);
+                }
+            }
+        }
+    }
+    qsort(cand, count, sizeof(*cand), tracking_candidate_compare);
+    return count;
+}
+
+/**
+ * @brief An end point of a street in the search of tracking_get_candidate_distances()
+ */
+struct tracking_node {
+    struct coord c;
+    GList *lines;                       /**< The tracking lines starting or ending here */
+    int search;                         /**< The search which reached this node last */
+    int done;                           /**< True once `dist` is final in that search */
+    double dist;                        /**< Distance from the start of that search, in coordinate units */
+};
+
+static struct tracking_node *tracking_node_get(GHashTable *nodes, struct coord *c) {
+    struct tracking_node *n=g_hash_table_lookup(nodes, c);
+
+    if (!n) {
+        n=g_new0(struct tracking_node, 1);
+        n->c=*c;
+        g_hash_table_insert(nodes, &n->c, n);
+    }
+    return n;
+}
+
+static void tracking_node_free(gpointer key, gpointer value, gpointer user_data) {
+    struct tracking_node *n=value;
+    g_list_free(n->lines);
+    g_free(n);
+}
+
+static void tracking_node_reach(struct tracking_node **open, int *open_count, struct tracking_node *n, int search,
+                                double dist) {
+    if (!n)
+        return;
+    if (n->search != search) {
+        n->search=search;
+        n->done=0;
+        open[(*open_count)++]=n;
+    } else if (n->done || n->dist <= dist)
+        return;
+    n->dist=dist;
+}
+
+/**
+ * @brief Computes the distances along the streets between two sets of candidates
+ *
+ * The tracking lines form a graph with the first and last coordinates of the streets as nodes, as
+ * streets are split at junctions. For every candidate in `from`, a Dijkstra search starts at both ends of
+ * its street and stops at `max`. Candidates on the same street use the distance along that street. One-way
+ * streets are not taken into account.
+ *
+ * @param tr The tracking object, whose lines were updated by tracking_get_candidates()
+ * @param from The candidates to start from
+ * @param from_count Number of candidates in `from`
+ * @param to The candidates to reach
+ * @param to_count Number of candidates in `to`
+ * @param max The largest distance searched, in coordinate units
+ * @param dist Receives the distance from `from[i]` to `to[j]` in `dist[i*to_count+j]`, `max` if there is
+ * no shorter path within the tracking lines
+ */
+void tracking_get_candidate_distances(struct tracking *tr, struct tracking_candidate *from, int from_count,
+                                      struct tracking_candidate *to, int to_count, double max, double *dist) {
+    GHashTable *nodes=g_hash_table_new(coord_hash, coord_equal);
+    struct tracking_node **open,*n,*ends[2];
+    struct tracking_line *tl;
+    GList *l;
+    int i,j,k,best,open_count;
+
+    for (tl = tr->lines ; tl ; tl=tl->next) {
+        struct street_data *sd=tl->street;
+        if (sd->count < 2 || coord_equal(&sd->c[0], &sd->c[sd->count-1]))
+            continue;
+        n=tracking_node_get(nodes, &sd->c[0]);
+        n->lines=g_list_prepend(n->lines, tl);
+        n=tracking_node_get(nodes, &sd->c[sd->count-1]);
+        n->lines=g_list_prepend(n->lines, tl);
+    }
+    open=g_new(struct tracking_node *, g_hash_table_size(nodes)+1);
+    for (i = 0 ; i < from_count ; i++) {
+        open_count=0;
+        tracking_node_reach(open, &open_count, g_hash_table_lookup(nodes, &from[i].start), i+1, from[i].offset);
+        tracking_node_reach(open, &open_count, g_hash_table_lookup(nodes, &from[i].end), i+1,
+                            from[i].length-from[i].offset);
+        while (open_count) {
+            best=0;
+            for (k = 1 ; k < open_count ; k++)
+                if (open[k]->dist < open[best]->dist)
+                    best=k;
+            n=open[best];
+            if (n->dist > max)
+                break;
+            open[best]=open[--open_count];
+            n->done=1;
+            for (l = n->lines ; l ; l=g_list_next(l)) {
+                struct coord *c;
+                tl=l->data;
+                c=coord_equal(&tl->street->c[0], &n->c) ? &tl->street->c[tl->street->count-1] : &tl->street->c[0];
+                tracking_node_reach(open, &open_count, g_hash_table_lookup(nodes, c), i+1, n->dist+tl->length);
+            }
+        }
+        for (j = 0 ; j < to_count ; j++) {
+            double d=max;
+            if (item_is_equal(from[i].item, to[j].item)) {
+                d=fabs(to[j].offset-from[i].offset);
+            } else {
+                ends[0]=g_hash_table_lookup(nodes, &to[j].start);
+                ends[1]=g_hash_table_lookup(nodes, &to[j].end);
+                for (k = 0 ; k < 2 ; k++) {
+                    double rest=k ? to[j].length-to[j].offset : to[j].offset;
+                    if (ends[k] && ends[k]->search == i+1 && ends[k]->done && ends[k]->dist+rest < d)
+                        d=ends[k]->dist+rest;
+                }
+            }
+            dist[i*to_count+j]=d < max ? d : max;
+        }
+    }
+    g_free(open);
+    g_hash_table_foreach(nodes, tracking_node_free, NULL);
+    g_hash_table_destroy(nodes);
+}
+
 /**
  * @brief Processes a position update.
  *
@@ -614,10 +1073,7 @@ static int tracking_value(struct tracking *tr, struct tracking_line *t, int offs
  */
 void tracking_update(struct tracking *tr, struct vehicle *v, struct vehicleprofile *vehicleprofile,
                      enum projection pro) {
-    struct tracking_line *t;
-    int i,value,min,time;
-    struct coord lpnt;
-    struct coord cin;
+    int min,time;
     struct attr valid,speed_attr,direction_attr,coord_geo,lag,time_attr,static_speed,static_distance;
     double speed, direction;
     if (v)
@@ -709,49 +1165,14 @@ void tracking_update(struct tracking *tr, struct vehicle *v, struct vehicleprofi
     tr->last[1]=tr->curr[1];
     if (!tr->lines || transform_distance(pro, &tr->last_updated, &tr->curr_in) > 500) {
         dbg(lvl_debug, "update");
-        tracking_flush(tr);
         tracking_doupdate_lines(tr, &tr->curr_in, pro);
         tr->last_updated=tr->curr_in;
         dbg(lvl_debug,"update end");
     }
 
     tr->street_direction=0;
-    t=tr->lines;
     tr->curr_line=NULL;
-    min=INT_MAX/2;
-    while (t) {
-        struct street_data *sd=t->street;
-        for (i = 0; i < sd->count-1 ; i++) {
-            value=tracking_value(tr,t,i,&lpnt,min,-1);
-            if (value < min) {
-                struct coord lpnt_tmp;
-                int angle_delta=tracking_angle_abs_diff(tr->curr_angle, t->angle[i], 360);
-                tr->curr_line=t;
-                tr->pos=i;
-                tr->curr[0]=sd->c[i];
-                tr->curr[1]=sd->c[i+1];
-                tr->direction_matched=t->angle[i];
-                dbg(lvl_debug,"lpnt.x=0x%x,lpnt.y=0x%x pos=%d %d+%d+%d+%d=%d", lpnt.x, lpnt.y, i,
-                    transform_distance_line_sq(&sd->c[i], &sd->c[i+1], &cin, &lpnt_tmp),
-                    tracking_angle_delta(tr, tr->curr_angle, t->angle[i], 0)*tr->angle_pref,
-                    tracking_is_connected(tr, tr->last, &sd->c[i]) ? tr->connected_pref : 0,
-                    lpnt.x == tr->last_out.x && lpnt.y == tr->last_out.y ? tr->nostop_pref : 0,
-                    value
-                   );
-                tr->curr_out.x=lpnt.x;
-                tr->curr_out.y=lpnt.y;
-                tr->coord_geo_valid=0;
-                if (angle_delta < 70)
-                    tr->street_direction=1;
-                else if (angle_delta > 110)
-                    tr->street_direction=-1;
-                else
-                    tr->street_direction=0;
-                min=value;
-            }
-        }
-        t=t->next;
-    }
+    min=tracking_match(tr);
     dbg(lvl_debug,"tr->curr_line=%p min=%d", tr->curr_line, min);
     if (!tr->curr_line || min > tr->offroad_limit_pref) {
         tr->curr_out=tr->curr_in;
@@ -879,6 +1300,8 @@ void tracking_destroy(struct tracking *tr) {
     if (tr->attr)
         attr_free(tr->attr);
     tracking_flush(tr);
+    if (tr->line_hash)
+        item_hash_destroy(tr->line_hash);
     callback_list_destroy(tr->callback_list);
     g_free(tr);
 }
@@ -20,9 +20,28 @@
 #ifndef NAVIT_TRACK_H
 #define NAVIT_TRACK_H
 #include <time.h>
+#include "coord.h"
+#include "item.h"
 #ifdef __cplusplus
 extern "C" {
 #endif
+
+/**
+ * @brief A street near a position, as returned by tracking_get_candidates()
+ */
+struct tracking_candidate {
+    struct item item;           /**< The street item */
+    int flags;                  /**< The flags of the street */
+    int pos;                    /**< Index of the first coordinate of the closest segment */
+    struct coord c[2];          /**< The closest segment */
+    struct coord start, end;    /**< The first and the last coordinate of the street */
+    struct coord lpnt;          /**< The point of the segment closest to the position */
+    int dist_sq;                /**< Square of the distance between the position and `lpnt` */
+    int angle;                  /**< Direction of the segment in degrees */
+    double offset;              /**< Distance of `lpnt` from the start of the street, in coordinate units */
+    double length;              /**< Length of the street, in coordinate units */
+};
+
 /* prototypes */
 enum attr_type;
 enum projection;
@@ -35,6 +54,7 @@ struct mapset;
 struct route;
 struct street_data;
 struct tracking;
+struct tracking_candidate;
 struct vehicle;
 struct vehicleprofile;
 int tracking_get_angle(struct tracking *tr);
@@ -46,6 +66,10 @@ int tracking_get_attr(struct tracking *_this, enum attr_type type, struct attr *
 struct item *tracking_get_current_item(struct tracking *_this);
 int *tracking_get_current_flags(struct tracking *_this);
 void tracking_flush(struct tracking *tr);
+int tracking_get_candidates(struct tracking *tr, struct coord *c, enum projection pro, int radius,
+                            struct tracking_candidate *cand, int max);
+void tracking_get_candidate_distances(struct tracking *tr, struct tracking_candidate *from, int from_count,
+                                      struct tracking_candidate *to, int to_count, double max, double *dist);
 void tracking_update(struct tracking *tr, struct vehicle *v, struct vehicleprofile *vehicleprofile, enum projection pro);
 int tracking_set_attr(struct tracking *tr, struct attr *attr);
 struct tracking *tracking_new(struct attr *parent, struct attr **attrs);
@@ -47,11 +47,11 @@
 #include "xmlconfig.h"
 #include "traffic.h"
 #include "plugin.h"
-#include "fib.h"
 #include "event.h"
 #include "callback.h"
 #include "vehicleprofile.h"
 #include "debug.h"
+#include "thread.h"
 
 #undef TRAFFIC_DEBUG
 
@@ -105,6 +105,8 @@ struct traffic_shared_priv {
     struct mapset *ms;          /**< The mapset used for routing */
     struct route *rt;           /**< The route to notify of traffic changes */
     struct map *map;            /**< The traffic map, in which traffic distortions are stored */
+    struct traffic_graph_cache *graph_cache; /**< Route graph data for the messages in `message_queue` */
+    struct traffic_resolver *resolver; /**< Threads matching locations to the map, NULL to match them on the main loop */
 };
 
 /**
@@ -134,6 +136,7 @@ struct traffic_location_priv {
 
 struct traffic_message_priv {
     struct item **items;        /**< The items for this message in the traffic map */
+    struct traffic_resolver_job * job; /**< The resolver job matching the location, NULL if none */
 };
 
 /**
@@ -232,6 +235,134 @@ struct point_data {
     int score;                   /**< The attribute matching score */
 };
 
+/**
+ * @brief A segment to which a traffic location has been matched
+ */
+struct traffic_resolved_segment {
+    struct item item;            /**< The map item of the segment */
+    struct coord start;          /**< The start point of the segment, as in the route graph */
+    struct coord end;            /**< The end point of the segment, as in the route graph */
+    struct coord * c;            /**< Coordinates of the segment, NULL if they need to be read from the map */
+    int ccnt;                    /**< Number of coordinates in `c` */
+    int flags;                   /**< Flags for the traffic distortion */
+    int speed;                   /**< Speed for the traffic distortion */
+    int delay;                   /**< Delay for the traffic distortion */
+};
+
+/**
+ * @brief The result of matching a traffic location to the map
+ */
+struct traffic_resolution {
+    struct traffic_resolved_segment * segments; /**< The matched segments */
+    int count;                   /**< Number of elements in `segments` */
+    int size;                    /**< Number of elements allocated for `segments` */
+};
+
+/**
+ * @brief A routable item held in the traffic graph cache
+ */
+struct traffic_graph_item {
+    enum item_type type;         /**< The item type */
+    struct coord_rect r;         /**< Rectangle enclosing all coordinates of the item */
+    char * road_ref;             /**< The systematic street name, NULL if the item has none */
+    char * road_name;            /**< The street name, NULL if the item has none */
+    int first;                   /**< Index of the first segment of the item in the segment batch */
+    int count;                   /**< Number of segments of the item */
+    int coord_first;             /**< Index of the first coordinate of the item in `coords` of the cache */
+    int coord_count;             /**< Number of coordinates of the item, 0 for turn restrictions */
+};
+
+/**
+ * @brief A point item held in the traffic graph cache, used to match junctions
+ */
+struct traffic_graph_point {
+    struct coord c;              /**< The coordinates of the item */
+    char * ref;                  /**< The reference of the item, NULL if it has none */
+    char * label;                /**< The label of the item, NULL if it has none */
+};
+
+/**
+ * @brief Route graph data for a batch of traffic messages
+ *
+ * Matching a location to the map requires a route graph covering the location. Rather than reading the map
+ * for each location, the cache reads all routable items in the union of the rectangles of all locations in a
+ * batch at once. The route graph for each location is then built from the cached segments in its rectangle.
+ * Point items needed to match junctions are read in the same pass.
+ *
+ * The rectangles of the locations in a batch are registered with `traffic_graph_cache_add_location()` up
+ * front. They are read on the first cache miss, so nothing is read if all locations can be restored from
+ * persisted data.
+ */
+struct traffic_graph_cache {
+    struct mapset * ms;                 /**< The mapset to read from */
+    struct map_selection * pending;     /**< Rectangles still to be read */
+    struct map_selection * loaded;      /**< Rectangles which have been read */
+    struct item_hash * item_hash;       /**< Maps items to their index in `items` or `points`, plus one */
+    struct traffic_graph_item * items;  /**< The cached items */
+    int item_count;                     /**< Number of elements in `items` */
+    int item_size;                      /**< Number of elements allocated for `items` */
+    struct route_graph_batch segments;  /**< Segments of all cached items */
+    struct coord * coords;              /**< Coordinates of all cached streets */
+    int coord_count;                    /**< Number of elements in `coords` */
+    int coord_size;                     /**< Number of elements allocated for `coords` */
+    struct traffic_graph_point * points; /**< The cached point items which have a reference or label */
+    int point_count;                    /**< Number of elements in `points` */
+    int point_size;                     /**< Number of elements allocated for `points` */
+    int reads;                          /**< Number of passes over the map */
+    int locations;                      /**< Number of route graphs built for locations */
+    struct timeval start;               /**< Creation time of the cache */
+    double read_msec;                   /**< Time spent reading the map, in milliseconds */
+    double build_msec;                  /**< Time spent building route graphs, in milliseconds */
+    struct thread_lock * lock;          /**< Protects the statistics, which resolver threads update */
+    int jobs;                           /**< Number of resolver jobs using the cache, main thread only */
+    int retired;                        /**< Whether the cache is to be destroyed once `jobs` drops to zero */
+};
+
+/**
+ * @brief A traffic location to be matched to the map on a resolver thread
+ */
+struct traffic_resolver_job {
+    struct traffic_message * message;   /**< The message, which the thread only reads the location from */
+    struct seg_data * data;             /**< Data for the segments, owned by the job */
+    struct traffic_graph_cache * cache; /**< The cache to match the location against */
+    struct traffic_resolution res;      /**< The segments to which the location was matched */
+    int ret;                            /**< The return value of `traffic_location_resolve()` */
+    int discard;                        /**< Set if the message has been removed while the job was queued */
+};
+
+/**
+ * @brief A resolver thread
+ */
+struct traffic_resolver_thread {
+    struct traffic_resolver * resolver; /**< The resolver the thread belongs to */
+    struct thread * thread;             /**< The thread, NULL if it has never been started */
+    int running;                        /**< Whether the thread is still taking jobs, protected by the lock */
+};
+
+/**
+ * @brief Threads matching traffic locations to the map
+ *
+ * Matching a location is done on a resolver thread against the traffic graph cache, which holds all map data
+ * needed and is not modified while jobs are using it. Each thread takes jobs until none are left, then exits.
+ * Finished jobs are applied to the traffic map on the main loop, in batches bounded by `TIME_SLICE`.
+ *
+ * Messages with a job keep a pointer to it. The main loop does not touch their location or items until the
+ * job has been applied. A message which is removed in the meantime is destroyed when its job finishes.
+ */
+struct traffic_resolver {
+    struct navit * navit;               /**< The navit instance, for redraws */
+    struct thread_lock * lock;          /**< Protects `jobs`, `done`, `notified` and the `running` flags */
+    struct traffic_resolver_thread * threads; /**< The threads */
+    int thread_count;                   /**< Number of elements in `threads` */
+    GList * jobs;                       /**< Jobs waiting for a thread */
+    GList * done;                       /**< Jobs which have been matched, waiting to be applied */
+    int notified;                       /**< Whether the main loop has been asked to apply `done` */
+    int pending;                        /**< Number of jobs which have not been applied, main thread only */
+    int matched;                        /**< Number of jobs applied since the resolver was last idle */
+    struct timeval start;               /**< Time at which the resolver last became busy */
+    struct callback_list * cbl;         /**< Called on the main loop to apply `done` */
+};
+
 /**
  * @brief State for the XML parser.
  *
@@ -294,15 +425,21 @@ static int tm_attr_get(void *priv_data, enum attr_type attr_type, struct attr *a
 static int tm_type_set(void *priv_data, enum item_type type);
 static struct map_selection * traffic_location_get_rect(struct traffic_location * this_, enum projection projection);
 static struct route_graph * traffic_location_get_route_graph(struct traffic_location * this_,
-        struct mapset * ms);
-static int traffic_location_match_attributes(struct traffic_location * this_, struct item *item);
-static int traffic_message_add_segments(struct traffic_message * this_, struct mapset * ms, struct seg_data * data,
-                                        struct map *map, struct route * route);
+        struct traffic_graph_cache * cache);
+static int traffic_location_match_attributes(struct traffic_location * this_, struct traffic_graph_item *item);
+static int traffic_message_add_segments(struct traffic_message * this_, struct traffic_graph_cache * cache,
+                                        struct seg_data * data, struct map *map, struct route * route);
 static int traffic_message_restore_segments(struct traffic_message * this_, struct mapset * ms,
         struct map *map, struct route * route);
 static void traffic_location_populate_route_graph(struct traffic_location * this_, struct route_graph * rg,
-        struct mapset * ms);
+        struct traffic_graph_cache * cache);
 static void traffic_location_set_enclosing_rect(struct traffic_location * this_, struct coord_geo ** coords);
+static struct traffic_graph_cache * traffic_graph_cache_new(struct mapset * ms);
+static void traffic_graph_cache_add_messages(struct traffic_graph_cache * this_, GList * messages,
+        struct map_selection * sel);
+static void traffic_graph_cache_destroy(struct traffic_graph_cache * this_);
+static struct traffic_graph_item * traffic_graph_cache_get_item(struct traffic_graph_cache * this_,
+        struct item * item);
 static void traffic_dump_messages_to_xml(struct traffic_shared_priv * shared);
 static void traffic_loop(struct traffic * this_);
 static struct traffic * traffic_new(struct attr *parent, struct attr **attrs);
@@ -953,6 +1090,9 @@ static struct map_rect_priv * tm_rect_new(struct map_priv *priv, struct map_sele
     /* Whether new segments have been added */
     int dirty = 0;
 
+    /* Route graph data for all messages matched here */
+    struct traffic_graph_cache * cache = NULL;
+
     dbg(lvl_debug,"enter");
     mr=g_new0(struct map_rect_priv, 1);
     mr->mpriv = priv;
@@ -960,11 +1100,12 @@ static struct map_rect_priv * tm_rect_new(struct map_priv *priv, struct map_sele
     /* all other pointers are initially NULL */
 
     /* lazy location matching */
-    if (sel != NULL)
+    if (sel != NULL) {
         /* TODO experimental: if no selection is passed, do not resolve any locations */
         for (msgiter = priv->shared->messages; msgiter; msgiter = g_list_next(msgiter)) {
             message = (struct traffic_message *) msgiter->data;
-            if (message->priv->items == NULL) {
+            /* messages with a resolver job get their items when the job is applied */
+            if ((message->priv->items == NULL) && !message->priv->job) {
                 traffic_location_set_enclosing_rect(message->location, NULL);
                 msg_sel = traffic_location_get_rect(message->location, traffic_map_meth.pro);
                 for (rect_sel = sel; rect_sel; rect_sel = rect_sel->next)
@@ -980,8 +1121,14 @@ static struct map_rect_priv * tm_rect_new(struct map_priv *priv, struct map_sele
                         }
                         /* if cache restore yielded no items, expand from scratch */
                         if (message->priv->items == NULL) {
+                            /* on the first miss, register all locations which may need matching */
+                            if (!cache) {
+                                cache = traffic_graph_cache_new(priv->shared->ms);
+                                traffic_graph_cache_add_messages(cache, priv->shared->messages, sel);
+                            }
                             data = traffic_message_parse_events(message);
-                            traffic_message_add_segments(message, priv->shared->ms, data, priv->shared->map, priv->shared->rt);
+                            traffic_message_add_segments(message, cache, data, priv->shared->map,
+                                                         priv->shared->rt);
                             g_free(data);
                         }
                         dirty = 1;
@@ -990,6 +1137,9 @@ static struct map_rect_priv * tm_rect_new(struct map_priv *priv, struct map_sele
                 map_selection_destroy(msg_sel);
             }
         }
+        if (cache)
+            traffic_graph_cache_destroy(cache);
+    }
     if (dirty)
         /* dump message store if new messages have been received */
         traffic_dump_messages_to_xml(priv->shared);
@@ -1278,14 +1428,13 @@ static int traffic_event_is_valid(struct traffic_event * this_) {
  * for any item supplied.
  *
  * @param this_ The location
- * @param item The map item
+ * @param item The map item, as held in the traffic graph cache
  *
  * @return The score, as a percentage value
  */
-static int traffic_location_match_attributes(struct traffic_location * this_, struct item *item) {
+static int traffic_location_match_attributes(struct traffic_location * this_, struct traffic_graph_item *item) {
     int score = 0;
     int maxscore = 0;
-    struct attr attr;
 
     /* road type */
     if ((this_->road_type != type_line_unspecified)) {
@@ -1379,16 +1528,16 @@ static int traffic_location_match_attributes(struct traffic_location * this_, st
     /* road_ref */
     if (this_->road_ref) {
         maxscore += 400;
-        if (item_attr_get(item, attr_street_name_systematic, &attr))
-            score += (400 * (MAX_MISMATCH - compare_name_systematic(this_->road_ref, attr.u.str))) / MAX_MISMATCH;
+        if (item->road_ref)
+            score += (400 * (MAX_MISMATCH - compare_name_systematic(this_->road_ref, item->road_ref))) / MAX_MISMATCH;
     }
 
     /* road_name */
     if (this_->road_name) {
         maxscore += 200;
-        if (item_attr_get(item, attr_street_name, &attr)) {
+        if (item->road_name) {
             // TODO crude comparison in need of refinement
-            if (!strcmp(this_->road_name, attr.u.str))
+            if (!strcmp(this_->road_name, item->road_name))
                 score += 200;
         }
     }
@@ -1418,28 +1567,27 @@ static int traffic_location_match_attributes(struct traffic_location * this_, st
  * for any item supplied.
  *
  * @param this_ The traffic point
- * @param item The map item
+ * @param item The map item, as held in the traffic graph cache
  *
  * @return The score, as a percentage value
  */
-static int traffic_point_match_attributes(struct traffic_point * this_, struct item *item) {
+static int traffic_point_match_attributes(struct traffic_point * this_, struct traffic_graph_point *item) {
     int score = 0;
     int maxscore = 0;
-    struct attr attr;
 
     /* junction_ref */
     if (this_->junction_ref) {
         maxscore += 400;
-        if (item_attr_get(item, attr_ref, &attr))
-            score += (400 * (MAX_MISMATCH - compare_name_systematic(this_->junction_ref, attr.u.str))) / MAX_MISMATCH;
+        if (item->ref)
+            score += (400 * (MAX_MISMATCH - compare_name_systematic(this_->junction_ref, item->ref))) / MAX_MISMATCH;
     }
 
     /* junction_name */
     if (this_->junction_name) {
-        if (item_attr_get(item, attr_label, &attr)) {
+        if (item->label) {
             maxscore += 400;
             // TODO crude comparison in need of refinement
-            if (!strcmp(this_->junction_name, attr.u.str))
+            if (!strcmp(this_->junction_name, item->label))
                 score += 400;
         }
     }
@@ -1484,11 +1632,12 @@ static int traffic_point_match_attributes(struct traffic_point * this_, struct i
  * @param p The point shared by all segments to examine
  * @param start The first point of the path
  * @param match_start True to evaluate for the start point of a route, false for the end point
+ * @param cache The traffic graph cache from which the route graph was built
  *
  * @return The score, as a percentage value
  */
 static int traffic_point_match_segment_attributes(struct traffic_point * this_, struct route_graph_point *p,
-        struct route_graph_point * start, int match_start) {
+        struct route_graph_point * start, int match_start, struct traffic_graph_cache * cache) {
 
     /*
      * Whether we want a match for the route segment starting at p (leading away from it) or the route segment ending
@@ -1511,14 +1660,8 @@ static int traffic_point_match_segment_attributes(struct traffic_point * this_,
     /* The route segment being examined */
     struct route_graph_segment *s;
 
-    /* Map rect for retrieving item data */
-    struct map_rect *mr;
-
-    /* The item being examined */
-    struct item * item;
-
-    /* The attribute being examined */
-    struct attr attr;
+    /* The cached item being examined */
+    struct traffic_graph_item * gitem;
 
     /* Name and systematic name for route segments starting and ending at p */
     char *start_name = NULL, *start_ref = NULL, *end_name = NULL, *end_ref = NULL;
@@ -1551,35 +1694,21 @@ static int traffic_point_match_segment_attributes(struct traffic_point * this_,
         return 0;
     }
     /* check if we have a match for the start of a route segment */
-    if (p->seg) {
-        mr = map_rect_new(p->seg->data.item.map, NULL);
-        if ((item = map_rect_get_item_byid(mr, p->seg->data.item.id_hi, p->seg->data.item.id_lo))) {
-            if (item_attr_get(item, attr_street_name, &attr)) {
-                start_name = g_strdup(attr.u.str);
-                // TODO crude comparison in need of refinement
-                if (!strcmp(this_->junction_name, attr.u.str))
-                    has_start_match = 1;
-            }
-            if (item_attr_get(item, attr_street_name_systematic, &attr))
-                start_ref = g_strdup(attr.u.str);
-        }
-        map_rect_destroy(mr);
+    if (p->seg && (gitem = traffic_graph_cache_get_item(cache, &p->seg->data.item))) {
+        start_name = gitem->road_name;
+        start_ref = gitem->road_ref;
+        // TODO crude comparison in need of refinement
+        if (start_name && !strcmp(this_->junction_name, start_name))
+            has_start_match = 1;
     }
 
     /* check if we have a match for the end of a route segment */
-    if (p_prev && p_prev->seg) {
-        mr = map_rect_new(p_prev->seg->data.item.map, NULL);
-        if ((item = map_rect_get_item_byid(mr, p_prev->seg->data.item.id_hi, p_prev->seg->data.item.id_lo))) {
-            if (item_attr_get(item, attr_street_name, &attr)) {
-                end_name = g_strdup(attr.u.str);
-                // TODO crude comparison in need of refinement
-                if (!strcmp(this_->junction_name, attr.u.str))
-                    has_end_match = 1;
-            }
-            if (item_attr_get(item, attr_street_name_systematic, &attr))
-                end_ref = g_strdup(attr.u.str);
-        }
-        map_rect_destroy(mr);
+    if (p_prev && p_prev->seg && (gitem = traffic_graph_cache_get_item(cache, &p_prev->seg->data.item))) {
+        end_name = gitem->road_name;
+        end_ref = gitem->road_ref;
+        // TODO crude comparison in need of refinement
+        if (end_name && !strcmp(this_->junction_name, end_name))
+            has_end_match = 1;
     }
 
     /*
@@ -1589,10 +1718,6 @@ static int traffic_point_match_segment_attributes(struct traffic_point * this_,
      */
     if (has_start_match && has_end_match) {
         dbg(lvl_debug, "p=%p: both start and end match, score 0", p);
-        g_free(start_name);
-        g_free(start_ref);
-        g_free(end_name);
-        g_free(end_ref);
         return 0;
     }
 
@@ -1609,50 +1734,46 @@ static int traffic_point_match_segment_attributes(struct traffic_point * this_,
         if ((p->seg == s) || (p_prev && (p_prev->seg == s)))
             /* segments is on the route, skip */
             continue;
-        mr = map_rect_new(s->data.item.map, NULL);
-        if ((item = map_rect_get_item_byid(mr, s->data.item.id_hi, s->data.item.id_lo))) {
-            if (item_attr_get(item, attr_street_name, &attr)) {
-                // TODO crude comparison in need of refinement
-                if (!strcmp(this_->junction_name, attr.u.str))
-                    has_offroute_match = 1;
-                if (start_name)
-                    route_leaves_road |= !strcmp(start_name, attr.u.str);
-                if (end_name)
-                    route_leaves_road |= !strcmp(end_name, attr.u.str);
-            }
-            if (!route_leaves_road && item_attr_get(item, attr_street_name_systematic, &attr)) {
-                if (start_ref)
-                    route_leaves_road |= !compare_name_systematic(start_ref, attr.u.str);
-                if (end_ref)
-                    route_leaves_road |= !compare_name_systematic(end_ref, attr.u.str);
-            }
+        if (!(gitem = traffic_graph_cache_get_item(cache, &s->data.item)))
+            continue;
+        if (gitem->road_name) {
+            // TODO crude comparison in need of refinement
+            if (!strcmp(this_->junction_name, gitem->road_name))
+                has_offroute_match = 1;
+            if (start_name)
+                route_leaves_road |= !strcmp(start_name, gitem->road_name);
+            if (end_name)
+                route_leaves_road |= !strcmp(end_name, gitem->road_name);
+        }
+        if (!route_leaves_road && gitem->road_ref) {
+            if (start_ref)
+                route_leaves_road |= !compare_name_systematic(start_ref, gitem->road_ref);
+            if (end_ref)
+                route_leaves_road |= !compare_name_systematic(end_ref, gitem->road_ref);
         }
-        map_rect_destroy(mr);
     }
 
     for (s = p->end; s && !(has_offroute_match && route_leaves_road); s = s->end_next) {
         if ((p->seg == s) || (p_prev && (p_prev->seg == s)))
             /* segments is on the route, skip */
             continue;
-        mr = map_rect_new(s->data.item.map, NULL);
-        if ((item = map_rect_get_item_byid(mr, s->data.item.id_hi, s->data.item.id_lo))) {
-            if (item_attr_get(item, attr_street_name, &attr)) {
-                // TODO crude comparison in need of refinement
-                if (!strcmp(this_->junction_name, attr.u.str))
-                    has_offroute_match = 1;
-                if (start_name)
-                    route_leaves_road |= !strcmp(start_name, attr.u.str);
-                if (end_name)
-                    route_leaves_road |= !strcmp(end_name, attr.u.str);
-            }
-            if (!route_leaves_road && item_attr_get(item, attr_street_name_systematic, &attr)) {
-                if (start_ref)
-                    route_leaves_road |= !compare_name_systematic(start_ref, attr.u.str);
-                if (end_ref)
-                    route_leaves_road |= !compare_name_systematic(end_ref, attr.u.str);
-            }
+        if (!(gitem = traffic_graph_cache_get_item(cache, &s->data.item)))
+            continue;
+        if (gitem->road_name) {
+            // TODO crude comparison in need of refinement
+            if (!strcmp(this_->junction_name, gitem->road_name))
+                has_offroute_match = 1;
+            if (start_name)
+                route_leaves_road |= !strcmp(start_name, gitem->road_name);
+            if (end_name)
+                route_leaves_road |= !strcmp(end_name, gitem->road_name);
+        }
+        if (!route_leaves_road && gitem->road_ref) {
+            if (start_ref)
+                route_leaves_road |= !compare_name_systematic(start_ref, gitem->road_ref);
+            if (end_ref)
+                route_leaves_road |= !compare_name_systematic(end_ref, gitem->road_ref);
         }
-        map_rect_destroy(mr);
     }
 
     dbg(lvl_debug,
@@ -1660,11 +1781,6 @@ static int traffic_point_match_segment_attributes(struct traffic_point * this_,
         p, end_ref, end_name, start_ref, start_name,
         has_offroute_match, has_start_match, has_end_match, route_follows_road, route_leaves_road);
 
-    g_free(start_name);
-    g_free(start_ref);
-    g_free(end_name);
-    g_free(end_ref);
-
     if (route_leaves_road && !route_follows_road)
         want_start_match = !match_start;
     /* TODO decide how to handle ambiguous situations (both true or both false), currently we include the segment */
@@ -1867,58 +1983,92 @@ static struct map_selection * traffic_location_get_rect(struct traffic_location
 }
 
 /**
- * @brief Opens a map rectangle around the end points of the traffic location.
+ * @brief Creates a new traffic graph cache.
  *
- * Prior to calling this function, the caller must ensure `rg->m` points to the map to be used, and the enclosing
- * rectangle for the traffic location has been set (e.g. by calling `traffic_location_set_enclosing_rect()`).
+ * @param ms The mapset to read from
  *
- * @param this_ The traffic location
- * @param rg The route graph
+ * @return The cache, which is initially empty
+ */
+static struct traffic_graph_cache * traffic_graph_cache_new(struct mapset * ms) {
+    struct traffic_graph_cache * ret = g_new0(struct traffic_graph_cache, 1);
+
+    ret->ms = ms;
+    ret->item_hash = item_hash_new();
+    ret->lock = thread_lock_new();
+    gettimeofday(&ret->start, NULL);
+    return ret;
+}
+
+/**
+ * @brief Returns the time elapsed since `start`, in milliseconds.
+ */
+static double traffic_graph_cache_msec(struct timeval * start) {
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_usec - start->tv_usec) / ((double)1000) + (now.tv_sec - start->tv_sec) * 1000;
+}
+
+/**
+ * @brief Whether a list of rectangles contains a given rectangle.
+ *
+ * @param list The rectangles to search
+ * @param sel The rectangle to find
  *
- * @return NULL on failure, the map selection on success
+ * @return True if one rectangle in `list` contains `sel` and has at least the same order
  */
-static struct map_rect * traffic_location_open_map_rect(struct traffic_location * this_, struct route_graph * rg) {
-    /* Corners of the enclosing rectangle, in Mercator coordinates */
-    rg->sel = traffic_location_get_rect(this_, map_projection(rg->m));
-    if (!rg->sel)
-        return NULL;
-    rg->mr = map_rect_new(rg->m, rg->sel);
-    if (!rg->mr) {
-        map_selection_destroy(rg->sel);
-        rg->sel = NULL;
+static int traffic_graph_cache_covers(struct map_selection * list, struct map_selection * sel) {
+    for (; list; list = list->next)
+        if ((list->order >= sel->order)
+                && (list->u.c_rect.lu.x <= sel->u.c_rect.lu.x) && (list->u.c_rect.rl.x >= sel->u.c_rect.rl.x)
+                && (list->u.c_rect.lu.y >= sel->u.c_rect.lu.y) && (list->u.c_rect.rl.y <= sel->u.c_rect.rl.y))
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief Appends a coordinate to the coordinates held in the traffic graph cache.
+ *
+ * @param this_ The cache
+ * @param c The coordinate
+ */
+static void traffic_graph_cache_add_coord(struct traffic_graph_cache * this_, struct coord * c) {
+    if (this_->coord_count == this_->coord_size) {
+        this_->coord_size = this_->coord_size ? this_->coord_size * 2 : 1024;
+        this_->coords = g_renew(struct coord, this_->coords, this_->coord_size);
     }
-    return rg->mr;
+    this_->coords[this_->coord_count++] = *c;
 }
 
 /**
- * @brief Populates a route graph.
+ * @brief Reads a street into the traffic graph cache.
  *
- * This adds all routable segments in the enclosing rectangle of the location (plus a safety margin) to
- * the route graph.
+ * This creates as many segments as needed for a segmented item.
  *
- * @param rg The route graph
- * @param ms The mapset to read the ramps from
+ * @param this_ The cache
+ * @param gitem The cache entry for the item, its rectangle is set by this function
+ * @param item The item
  */
-static void traffic_location_populate_route_graph(struct traffic_location * this_, struct route_graph * rg,
-        struct mapset * ms) {
-    /* The item being processed */
-    struct item *item;
-
-    /* Mercator coordinates of current and previous point */
-    struct coord c, l;
+static void traffic_graph_cache_add_street(struct traffic_graph_cache * this_, struct traffic_graph_item * gitem,
+        struct item * item) {
+    /* Mercator coordinates of current and previous point, and start of the current segment */
+    struct coord c, l, s;
 
     /* Data for the route graph segment */
     struct route_graph_segment_data data;
 
+    /* The segment being added */
+    struct route_graph_batch_entry *entry;
+
     /* The length of the current segment */
 #ifdef AVOID_FLOAT
-    int len;
+    int len = 0;
 #else
-    double len;
+    double len = 0;
 #endif
 
     /* Whether the current item is segmented */
-    int segmented;
+    int segmented = 0;
 
     /* Default flags assumed for the current item type */
     int *default_flags;
@@ -1926,115 +2076,449 @@ static void traffic_location_populate_route_graph(struct traffic_location * this
     /* Holds an attribute retrieved from the current item */
     struct attr attr;
 
-    /* Start and end point of the current way or segment */
-    struct route_graph_point *s_pnt, *e_pnt;
+    item_coord_rewind(item);
+    if (!item_coord_get(item, &l, 1))
+        return;
+    s = l;
+    gitem->r.lu = l;
+    gitem->r.rl = l;
+    gitem->coord_first = this_->coord_count;
+    traffic_graph_cache_add_coord(this_, &l);
+
+    if (item_attr_get(item, attr_street_name_systematic, &attr))
+        gitem->road_ref = g_strdup(attr.u.str);
+    if (item_attr_get(item, attr_street_name, &attr))
+        gitem->road_name = g_strdup(attr.u.str);
+
+    memset(&data, 0, sizeof(data));
+    data.offset = 1;
+    data.maxspeed = -1;
+
+    if (!(default_flags = item_get_default_flags(item->type)))
+        default_flags = &item_default_flags_value;
+    if (item_attr_get(item, attr_flags, &attr)) {
+        data.flags = attr.u.num;
+        segmented = (data.flags & AF_SEGMENTED);
+    } else
+        data.flags = *default_flags;
 
-    traffic_location_set_enclosing_rect(this_, NULL);
+    if ((data.flags & AF_SPEED_LIMIT) && (item_attr_get(item, attr_maxspeed, &attr)))
+        data.maxspeed = attr.u.num;
 
-    rg->h = mapset_open(ms);
+    /* clear flags we're not copying here */
+    data.flags &= ~(AF_DANGEROUS_GOODS | AF_SIZE_OR_WEIGHT_LIMIT);
 
-    while ((rg->m = mapset_next(rg->h, 2))) {
+    for (;;) {
+        int isseg = segmented && item_coord_is_node(item);
+        int rc = item_coord_get(item, &c, 1);
+        if (rc) {
+            len += transform_distance(map_projection(item->map), &l, &c);
+            l = c;
+            coord_rect_extend(&gitem->r, &c);
+            traffic_graph_cache_add_coord(this_, &c);
+        }
+        if (!rc || isseg) {
+            dbg_assert(len >= 0);
+            data.len = len;
+            entry = route_graph_batch_append(&this_->segments, item, &s, &l);
+            entry->data = data;
+            entry->check_duplicate = 1;
+            data.offset++;
+            s = l;
+            len = 0;
+        }
+        if (!rc)
+            break;
+    }
+    gitem->coord_count = this_->coord_count - gitem->coord_first;
+}
+
+/**
+ * @brief Reads a point item into the traffic graph cache.
+ *
+ * Only items with a reference or label are kept, as others cannot match any junction.
+ *
+ * @param this_ The cache
+ * @param item The item
+ */
+static void traffic_graph_cache_add_point(struct traffic_graph_cache * this_, struct item * item) {
+    struct traffic_graph_point * gpoint;
+    struct coord c;
+    struct attr attr;
+
+    if (item_hash_lookup(this_->item_hash, item))
+        return;
+    if (!item_coord_get(item, &c, 1))
+        return;
+    if (this_->point_count == this_->point_size) {
+        this_->point_size = this_->point_size ? this_->point_size * 2 : 256;
+        this_->points = g_renew(struct traffic_graph_point, this_->points, this_->point_size);
+    }
+    gpoint = &this_->points[this_->point_count];
+    gpoint->c = c;
+    gpoint->ref = item_attr_get(item, attr_ref, &attr) ? g_strdup(attr.u.str) : NULL;
+    gpoint->label = item_attr_get(item, attr_label, &attr) ? g_strdup(attr.u.str) : NULL;
+    if (!gpoint->ref && !gpoint->label)
+        return;
+    this_->point_count++;
+    item_hash_insert(this_->item_hash, item, GINT_TO_POINTER(this_->point_count));
+}
+
+/**
+ * @brief Reads an item into the traffic graph cache.
+ *
+ * Items which are not relevant for routing, or which are already in the cache, are skipped.
+ *
+ * @param this_ The cache
+ * @param item The item
+ */
+static void traffic_graph_cache_add_item(struct traffic_graph_cache * this_, struct item * item) {
+    struct traffic_graph_item * gitem;
+    int i;
+
+    if ((item->type >= type_town_label) && (item->type < type_line)) {
+        traffic_graph_cache_add_point(this_, item);
+        return;
+    }
+    if ((item->type != type_street_turn_restriction_no) && (item->type != type_street_turn_restriction_only)
+            && ((item->type < route_item_first) || (item->type > route_item_last)
+                || !item_get_default_flags(item->type)))
+        return;
+    if (item_hash_lookup(this_->item_hash, item))
+        return;
+    if (this_->item_count == this_->item_size) {
+        this_->item_size = this_->item_size ? this_->item_size * 2 : 256;
+        this_->items = g_renew(struct traffic_graph_item, this_->items, this_->item_size);
+    }
+    gitem = &this_->items[this_->item_count];
+    memset(gitem, 0, sizeof(*gitem));
+    gitem->type = item->type;
+    gitem->first = this_->segments.count;
+    gitem->coord_first = this_->coord_count;
+    if ((item->type == type_street_turn_restriction_no) || (item->type == type_street_turn_restriction_only)) {
+        route_graph_batch_add_turn_restriction(&this_->segments, item);
+        for (i = gitem->first; i < this_->segments.count; i++) {
+            if (i == gitem->first) {
+                gitem->r.lu = this_->segments.entries[i].start;
+                gitem->r.rl = this_->segments.entries[i].start;
+            }
+            coord_rect_extend(&gitem->r, &this_->segments.entries[i].start);
+            coord_rect_extend(&gitem->r, &this_->segments.entries[i].end);
+        }
+    } else
+        traffic_graph_cache_add_street(this_, gitem, item);
+    gitem->count = this_->segments.count - gitem->first;
+    if (!gitem->count) {
+        g_free(gitem->road_ref);
+        g_free(gitem->road_name);
+        this_->coord_count = gitem->coord_first;
+        return;
+    }
+    this_->item_count++;
+    item_hash_insert(this_->item_hash, item, GINT_TO_POINTER(this_->item_count));
+}
+
+/**
+ * @brief Returns the cache entry for a routable item.
+ *
+ * @param this_ The cache
+ * @param item The item, usually the item of a route graph segment built from the cache
+ *
+ * @return The cache entry, or NULL if the item is not in the cache
+ */
+static struct traffic_graph_item * traffic_graph_cache_get_item(struct traffic_graph_cache * this_,
+        struct item * item) {
+    int i;
+
+    /* point items share the hash, with indices into `points` */
+    if ((item->type >= type_town_label) && (item->type < type_line))
+        return NULL;
+    i = GPOINTER_TO_INT(item_hash_lookup(this_->item_hash, item));
+    if ((i <= 0) || (i > this_->item_count))
+        return NULL;
+    return &this_->items[i - 1];
+}
+
+/**
+ * @brief Retrieves the coordinates of a cached street between two points.
+ *
+ * This is the equivalent of `item_coord_get_within_range()`, working on the coordinates held in the cache
+ * rather than reading the item from the map.
+ *
+ * @param this_ The cache
+ * @param item The item
+ * @param c Receives the coordinates
+ * @param max Maximum number of coordinates to return
+ * @param start The coordinates to start at
+ * @param end The coordinates to end at
+ *
+ * @return The number of coordinates stored in `c`, or -1 if the item is not in the cache
+ */
+static int traffic_graph_cache_get_coords(struct traffic_graph_cache * this_, struct item * item,
+        struct coord * c, int max, struct coord * start, struct coord * end) {
+    struct traffic_graph_item * gitem = traffic_graph_cache_get_item(this_, item);
+    struct coord * in, * last;
+    int ret = 0;
+
+    if (!gitem || !gitem->coord_count)
+        return -1;
+    in = this_->coords + gitem->coord_first;
+    last = in + gitem->coord_count;
+    while ((in < last) && (in->x != start->x || in->y != start->y))
+        in++;
+    while ((in < last) && (ret < max)) {
+        c[ret++] = *in;
+        if (in->x == end->x && in->y == end->y)
+            break;
+        in++;
+    }
+    return ret;
+}
+
+/**
+ * @brief Reads all rectangles registered with the traffic graph cache which have not been read yet.
+ *
+ * All rectangles are read in a single pass over the map, items in overlapping rectangles are stored only once.
+ *
+ * @param this_ The cache
+ */
+static void traffic_graph_cache_read(struct traffic_graph_cache * this_) {
+    struct mapset_handle * h;
+    struct map * m;
+    struct map_rect * mr;
+    struct item * item;
+    struct attr attr;
+    struct map_selection * last;
+    struct timeval start;
+
+    if (!this_->pending)
+        return;
+    gettimeofday(&start, NULL);
+    h = mapset_open(this_->ms);
+    while ((m = mapset_next(h, 2))) {
         /* Skip traffic map (identified by the `attr_traffic` attribute) */
-        if (map_get_attr(rg->m, attr_traffic, &attr, NULL))
+        if (map_get_attr(m, attr_traffic, &attr, NULL))
             continue;
-        if (!traffic_location_open_map_rect(this_, rg))
+        mr = map_rect_new(m, this_->pending);
+        if (!mr)
             continue;
-        while ((item = map_rect_get_item(rg->mr))) {
-            if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
-                route_graph_add_turn_restriction(rg, item);
-            else if ((item->type < route_item_first) || (item->type > route_item_last))
-                continue;
-            /* If road class is motorway, trunk or primary, ignore roads more than one level below */
-            if ((this_->road_type == type_highway_land) || (this_->road_type == type_highway_city)) {
-                if ((item->type != type_highway_land) && (item->type != type_highway_city) &&
-                        (item->type != type_street_n_lanes) && (item->type != type_ramp))
-                    continue;
-            } else if (this_->road_type == type_street_n_lanes) {
-                if ((item->type != type_highway_land) && (item->type != type_highway_city) &&
-                        (item->type != type_street_n_lanes) && (item->type != type_ramp) &&
-                        (item->type != type_street_4_land) && (item->type != type_street_4_city))
-                    continue;
-            } else if ((this_->road_type == type_street_4_land) || (this_->road_type == type_street_4_city)) {
-                if ((item->type != type_highway_land) && (item->type != type_highway_city) &&
-                        (item->type != type_street_n_lanes) && (item->type != type_ramp) &&
-                        (item->type != type_street_4_land) && (item->type != type_street_4_city) &&
-                        (item->type != type_street_3_land) && (item->type != type_street_3_city))
-                    continue;
-            }
-            if (item_get_default_flags(item->type)) {
-
-                item_coord_rewind(item);
-                if (item_coord_get(item, &l, 1)) {
-                    data.score = traffic_location_match_attributes(this_, item);
-                    data.flags=0;
-                    data.offset=1;
-                    data.maxspeed=-1;
-                    data.item=item;
-                    len = 0;
-                    segmented = 0;
-
-                    if (!(default_flags = item_get_default_flags(item->type)))
-                        default_flags = &item_default_flags_value;
-                    if (item_attr_get(item, attr_flags, &attr)) {
-                        data.flags = attr.u.num;
-                        segmented = (data.flags & AF_SEGMENTED);
-                    } else
-                        data.flags = *default_flags;
+        while ((item = map_rect_get_item(mr)))
+            traffic_graph_cache_add_item(this_, item);
+        map_rect_destroy(mr);
+    }
+    mapset_close(h);
+    for (last = this_->pending; last->next; last = last->next);
+    last->next = this_->loaded;
+    this_->loaded = this_->pending;
+    this_->pending = NULL;
+    this_->reads++;
+    this_->read_msec += traffic_graph_cache_msec(&start);
+}
 
-                    if ((data.flags & AF_SPEED_LIMIT) && (item_attr_get(item, attr_maxspeed, &attr)))
-                        data.maxspeed = attr.u.num;
+/**
+ * @brief Registers the rectangle of a location with the traffic graph cache.
+ *
+ * The rectangle is read, along with all others registered, when the route graph for a location is first
+ * requested from the cache. Registering all locations of a batch in advance thus allows the map to be read
+ * in a single pass.
+ *
+ * @param this_ The cache
+ * @param location The location
+ */
+static void traffic_graph_cache_add_location(struct traffic_graph_cache * this_, struct traffic_location * location) {
+    struct map_selection * sel;
 
-                    /* clear flags we're not copying here */
-                    data.flags &= ~(AF_DANGEROUS_GOODS | AF_SIZE_OR_WEIGHT_LIMIT);
+    traffic_location_set_enclosing_rect(location, NULL);
+    sel = traffic_location_get_rect(location, traffic_map_meth.pro);
+    if (!sel)
+        return;
+    if (traffic_graph_cache_covers(this_->loaded, sel) || traffic_graph_cache_covers(this_->pending, sel)) {
+        map_selection_destroy(sel);
+        return;
+    }
+    sel->next = this_->pending;
+    this_->pending = sel;
+}
 
-                    s_pnt = route_graph_add_point(rg, &l);
+/**
+ * @brief Ensures the traffic graph cache holds all items in the rectangle of a location.
+ *
+ * If the rectangle has not been read yet, it is read along with all other rectangles registered so far.
+ *
+ * @param this_ The cache
+ * @param location The location
+ *
+ * @return The rectangle of the location, which the caller must free
+ */
+static struct map_selection * traffic_graph_cache_get_location(struct traffic_graph_cache * this_,
+        struct traffic_location * location) {
+    struct map_selection * sel, * pending;
+
+    traffic_location_set_enclosing_rect(location, NULL);
+    sel = traffic_location_get_rect(location, traffic_map_meth.pro);
+    if (!traffic_graph_cache_covers(this_->loaded, sel)) {
+        if (!traffic_graph_cache_covers(this_->pending, sel)) {
+            pending = map_selection_dup(sel);
+            pending->next = this_->pending;
+            this_->pending = pending;
+        }
+        traffic_graph_cache_read(this_);
+    }
+    return sel;
+}
 
-                    if (!segmented) {
-                        while (item_coord_get(item, &c, 1)) {
-                            len += transform_distance(map_projection(item->map), &l, &c);
-                            l = c;
-                        }
-                        e_pnt = route_graph_add_point(rg, &l);
-                        dbg_assert(len >= 0);
-                        data.len = len;
-                        if (!route_graph_segment_is_duplicate(s_pnt, &data))
-                            route_graph_add_segment(rg, s_pnt, e_pnt, &data);
-                    } else {
-                        int isseg, rc;
-                        int sc = 0;
-                        do {
-                            isseg = item_coord_is_node(item);
-                            rc = item_coord_get(item, &c, 1);
-                            if (rc) {
-                                len += transform_distance(map_projection(item->map), &l, &c);
-                                l = c;
-                                if (isseg) {
-                                    e_pnt = route_graph_add_point(rg, &l);
-                                    data.len = len;
-                                    if (!route_graph_segment_is_duplicate(s_pnt, &data))
-                                        route_graph_add_segment(rg, s_pnt, e_pnt, &data);
-                                    data.offset++;
-                                    s_pnt = route_graph_add_point(rg, &l);
-                                    len = 0;
-                                }
-                            }
-                        } while(rc);
-                        e_pnt = route_graph_add_point(rg, &l);
-                        dbg_assert(len >= 0);
-                        sc++;
-                        data.len = len;
-                        if (!route_graph_segment_is_duplicate(s_pnt, &data))
-                            route_graph_add_segment(rg, s_pnt, e_pnt, &data);
-                    }
-                }
+/**
+ * @brief Registers the locations of all unmatched messages in a list with the traffic graph cache.
+ *
+ * @param this_ The cache
+ * @param messages The messages, as a `GList` of `struct traffic_message`
+ * @param sel If not NULL, only messages whose location overlaps with one of these rectangles are registered
+ */
+static void traffic_graph_cache_add_messages(struct traffic_graph_cache * this_, GList * messages,
+        struct map_selection * sel) {
+    struct traffic_message * message;
+    struct map_selection * msg_sel, * rect_sel;
+
+    for (; messages; messages = g_list_next(messages)) {
+        message = (struct traffic_message *) messages->data;
+        if (message->is_cancellation || !message->location || message->priv->items || message->priv->job)
+            continue;
+        if (!sel) {
+            traffic_graph_cache_add_location(this_, message->location);
+            continue;
+        }
+        traffic_location_set_enclosing_rect(message->location, NULL);
+        msg_sel = traffic_location_get_rect(message->location, traffic_map_meth.pro);
+        for (rect_sel = sel; rect_sel; rect_sel = rect_sel->next)
+            if (coord_rect_overlap(&(msg_sel->u.c_rect), &(rect_sel->u.c_rect))) {
+                traffic_graph_cache_add_location(this_, message->location);
+                break;
             }
+        map_selection_destroy(msg_sel);
+    }
+}
+
+/**
+ * @brief Destroys a traffic graph cache and logs its statistics.
+ *
+ * @param this_ The cache
+ */
+static void traffic_graph_cache_destroy(struct traffic_graph_cache * this_) {
+    int i;
+
+    if (this_->locations)
+        dbg(lvl_info, "%d location(s) matched in %.0f ms: %d item(s) (%d segments) read in %d pass(es), %.0f ms, "
+            "route graphs built in %.0f ms", this_->locations, traffic_graph_cache_msec(&this_->start),
+            this_->item_count, this_->segments.count, this_->reads, this_->read_msec, this_->build_msec);
+    for (i = 0; i < this_->item_count; i++) {
+        g_free(this_->items[i].road_ref);
+        g_free(this_->items[i].road_name);
+    }
+    g_free(this_->items);
+    for (i = 0; i < this_->point_count; i++) {
+        g_free(this_->points[i].ref);
+        g_free(this_->points[i].label);
+    }
+    g_free(this_->points);
+    g_free(this_->coords);
+    item_hash_destroy(this_->item_hash);
+    route_graph_batch_free(&this_->segments);
+    map_selection_destroy(this_->pending);
+    map_selection_destroy(this_->loaded);
+    thread_lock_destroy(this_->lock);
+    g_free(this_);
+}
+
+/**
+ * @brief Releases a traffic graph cache which is no longer needed for new locations.
+ *
+ * The cache is destroyed right away, unless resolver jobs still use it. In that case it is destroyed when the
+ * last of them has been applied.
+ *
+ * @param this_ The cache
+ */
+static void traffic_graph_cache_retire(struct traffic_graph_cache * this_) {
+    if (this_->jobs)
+        this_->retired = 1;
+    else
+        traffic_graph_cache_destroy(this_);
+}
+
+/**
+ * @brief Whether an item type is considered for a location, based on the road type of the location.
+ *
+ * If road class is motorway, trunk or primary, roads more than one level below are ignored.
+ *
+ * @param this_ The location
+ * @param type The item type
+ */
+static int traffic_location_match_road_type(struct traffic_location * this_, enum item_type type) {
+    if ((this_->road_type == type_highway_land) || (this_->road_type == type_highway_city))
+        return (type == type_highway_land) || (type == type_highway_city) || (type == type_street_n_lanes)
+               || (type == type_ramp);
+    if (this_->road_type == type_street_n_lanes)
+        return (type == type_highway_land) || (type == type_highway_city) || (type == type_street_n_lanes)
+               || (type == type_ramp) || (type == type_street_4_land) || (type == type_street_4_city);
+    if ((this_->road_type == type_street_4_land) || (this_->road_type == type_street_4_city))
+        return (type == type_highway_land) || (type == type_highway_city) || (type == type_street_n_lanes)
+               || (type == type_ramp) || (type == type_street_4_land) || (type == type_street_4_city)
+               || (type == type_street_3_land) || (type == type_street_3_city);
+    return 1;
+}
+
+/**
+ * @brief Populates a route graph.
+ *
+ * This adds all routable segments in the enclosing rectangle of the location (plus a safety margin) to
+ * the route graph. Segments are taken from the cache, which reads the rectangle from the map if it has
+ * not been read yet.
+ *
+ * @param rg The route graph
+ * @param cache The traffic graph cache to take the segments from
+ */
+static void traffic_location_populate_route_graph(struct traffic_location * this_, struct route_graph * rg,
+        struct traffic_graph_cache * cache) {
+    /* The rectangle of the location */
+    struct map_selection * sel;
+
+    /* The cached item being processed */
+    struct traffic_graph_item * gitem;
+
+    /* The segment being added, copied from the cache which may be shared with other threads */
+    struct route_graph_batch_entry entry;
+
+    /* Attribute matching score of the current item */
+    int score;
+
+    int i, j;
+
+    struct timeval start;
+
+    sel = traffic_graph_cache_get_location(cache, this_);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < cache->item_count; i++) {
+        gitem = &cache->items[i];
+        if (!coord_rect_overlap(&gitem->r, &sel->u.c_rect))
+            continue;
+        if ((gitem->type == type_street_turn_restriction_no) || (gitem->type == type_street_turn_restriction_only))
+            score = 0;
+        else if (traffic_location_match_road_type(this_, gitem->type))
+            score = traffic_location_match_attributes(this_, gitem);
+        else
+            continue;
+        for (j = 0; j < gitem->count; j++) {
+            entry = cache->segments.entries[gitem->first + j];
+            entry.data.score = score;
+            route_graph_batch_add_entry(rg, &entry, NULL, NULL);
         }
-        map_selection_destroy(rg->sel);
-        rg->sel = NULL;
-        map_rect_destroy(rg->mr);
-        rg->mr = NULL;
     }
+    map_selection_destroy(sel);
     route_graph_build_done(rg, 0);
+    thread_lock_acquire(cache->lock);
+    cache->locations++;
+    cache->build_msec += traffic_graph_cache_msec(&start);
+    thread_lock_release(cache->lock);
 }
 
 /**
@@ -2044,13 +2528,13 @@ static void traffic_location_populate_route_graph(struct traffic_location * this
  * affected by a traffic message.
  *
  * @param this_ The location to match to the map
- * @param ms The mapset to use for the route graph
+ * @param cache The traffic graph cache to build the route graph from
  *
  * @return A route graph. The caller is responsible for destroying the route graph and all related data
  * when it is no longer needed.
  */
 static struct route_graph * traffic_location_get_route_graph(struct traffic_location * this_,
-        struct mapset * ms) {
+        struct traffic_graph_cache * cache) {
     struct route_graph *rg;
 
     traffic_location_set_enclosing_rect(this_, NULL);
@@ -2061,7 +2545,7 @@ static struct route_graph * traffic_location_get_route_graph(struct traffic_loca
     rg->busy = 1;
 
     /* build the route graph */
-    traffic_location_populate_route_graph(this_, rg, ms);
+    traffic_location_populate_route_graph(this_, rg, cache);
 
     return rg;
 }
@@ -2179,8 +2663,9 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
 
     GList * existing = NULL;
 
-    /* This heap will hold all points with "temporarily" calculated costs */
-    struct fibheap *heap;
+    /* This heap will hold all points with "temporarily" calculated costs. Keys never drop below the last one
+     * extracted, which is what the radix heap is made for. */
+    struct route_heap *heap;
 
     /* Cost of the start position */
     int start_value;
@@ -2215,24 +2700,24 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
     }
 
     /* prime the route graph */
-    heap = fh_makekeyheap();
+    heap = route_heap_new(route_heap_radix);
 
     start_value = PENALTY_OFFROAD * transform_distance(projection_mg, c_start, c_dst);
     ret = NULL;
 
     dbg(lvl_debug, "start flooding route graph, start_value=%d", start_value);
 
-    for (i = 0; i < HASH_SIZE; i++) {
+    for (i = 0; i < rg->hash_size; i++) {
         p = rg->hash[i];
         while (p) {
             if (!g_list_find(existing, p)) {
                 if (!(p->flags & RP_TURN_RESTRICTION)) {
                     p->value = PENALTY_OFFROAD * transform_distance(projection_mg, &p->c, c_dst);
-                    p->el = fh_insertkey(heap, p->value, p);
+                    route_heap_insert(heap, p, p->value);
                 } else {
                     /* ignore points which are part of turn restrictions */
                     p->value = INT_MAX;
-                    p->el = NULL;
+                    p->heap_pos = 0;
                 }
                 p->seg = NULL;
             }
@@ -2242,14 +2727,14 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
 
     /* flood the route graph */
     for (;;) {
-        p = fh_extractmin(heap); /* Starting Dijkstra by selecting the point with the minimum costs on the heap */
+        p = route_heap_extract_min(heap); /* Starting Dijkstra by selecting the point with the minimum costs on the heap */
         if (!p) /* There are no more points with temporarily calculated costs, Dijkstra has finished */
             break;
 
         dbg(lvl_debug, "p=%p, value=%d", p, p->value);
 
         min = p->value;
-        p->el = NULL; /* This point is permanently calculated now, we've taken it out of the heap */
+        /* This point is permanently calculated now, we've taken it out of the heap */
         s = p->start;
         while (s) { /* Iterating all the segments leading away from our point to update the points at their ends */
             val = traffic_route_get_seg_cost(s, data, -1);
@@ -2261,11 +2746,7 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
                 if (new < s->end->value) { /* We've found a less costly way to reach the end of s, update it */
                     s->end->value = new;
                     s->end->seg = s;
-                    if (!s->end->el) {
-                        s->end->el = fh_insertkey(heap, new, s->end);
-                    } else {
-                        fh_replacekey(heap, s->end->el, new);
-                    }
+                    route_heap_insert(heap, s->end, new);
                     new += PENALTY_OFFROAD * transform_distance(projection_mg, &s->end->c, c_start);
                     if (new < start_value) { /* We've found a less costly way from the start point, update */
                         start_value = new;
@@ -2286,11 +2767,7 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
                 if (new < s->start->value) {
                     s->start->value = new;
                     s->start->seg = s;
-                    if (!s->start->el) {
-                        s->start->el = fh_insertkey(heap, new, s->start);
-                    } else {
-                        fh_replacekey(heap, s->start->el, new);
-                    }
+                    route_heap_insert(heap, s->start, new);
                     new += PENALTY_OFFROAD * transform_distance(projection_mg, &s->start->c, c_start);
                     if (new < start_value) {
                         start_value = new;
@@ -2302,7 +2779,7 @@ static struct route_graph_point * traffic_route_flood_graph(struct route_graph *
         }
     }
 
-    fh_deleteheap(heap);
+    route_heap_destroy(heap);
     g_list_free(existing);
     return ret;
 }
@@ -2563,12 +3040,12 @@ static struct traffic_point * traffic_location_get_point(struct traffic_location
  * @param rg The route graph
  * @param start The first point of the path
  * @param match_start True to evaluate for the start point of a route, false for the end point
- * @param ms The mapset to read the items from
+ * @param cache The traffic graph cache from which the route graph was built
  *
  * @return A score from 0 (worst) to 100 (best).
  */
 static int traffic_location_get_point_match(struct traffic_location * this_, struct route_graph_point * p, int point,
-        struct route_graph * rg, struct route_graph_point * start, int match_start, struct mapset * ms) {
+        struct route_graph * rg, struct route_graph_point * start, int match_start, struct traffic_graph_cache * cache) {
     int ret = 0;
 
     /* The point from the location to match */
@@ -2583,7 +3060,7 @@ static int traffic_location_get_point_match(struct traffic_location * this_, str
         return 0;
 
     /* First examine route graph points and connected segments */
-    score = traffic_point_match_segment_attributes(trpoint, p, start, match_start);
+    score = traffic_point_match_segment_attributes(trpoint, p, start, match_start, cache);
     if (ret < score)
         ret = score;
     return ret;
@@ -2592,7 +3069,7 @@ static int traffic_location_get_point_match(struct traffic_location * this_, str
 /**
  * @brief Returns points from the route graph which match a traffic location.
  *
- * This method obtains point items from the map_rect from which the route graph was built and compares
+ * This method obtains point items from the traffic graph cache from which the route graph was built and compares
  * their attributes to those supplied with the location. Each point is assigned a match score, from 0
  * (no matching attributes) to 100 (all supplied attributes match), and a list of all points with a
  * nonzero score is returned.
@@ -2605,25 +3082,22 @@ static int traffic_location_get_point_match(struct traffic_location * this_, str
  * @param rg The route graph
  * @param start The first point of the path
  * @param match_start True to evaluate for the start point of a route, false for the end point
- * @param ms The mapset to read the items from
+ * @param cache The traffic graph cache to read the items from
  *
  * @return The matched points as a `GList`. The `data` member of each item points to a `struct point_data` for the point.
  */
 static GList * traffic_location_get_matching_points(struct traffic_location * this_, int point,
-        struct route_graph * rg, struct route_graph_point * start, int match_start, struct mapset * ms) {
+        struct route_graph * rg, struct route_graph_point * start, int match_start, struct traffic_graph_cache * cache) {
     GList * ret = NULL;
 
     /* The point from the location to match */
     struct traffic_point * trpoint = NULL;
 
-    /* Map attribute (currently not evaluated) */
-    struct attr attr;
+    /* The rectangle of the location */
+    struct map_selection * sel;
 
-    /* The item being processed */
-    struct item *item;
-
-    /* Mercator coordinates of current and previous point */
-    struct coord c;
+    /* The cached item being processed */
+    struct traffic_graph_point * gpoint;
 
     /* The corresponding point in the route graph */
     struct route_graph_point * p;
@@ -2634,62 +3108,52 @@ static GList * traffic_location_get_matching_points(struct traffic_location * th
     /* Data for the current point */
     struct point_data * data;
 
+    int i;
+
     trpoint = traffic_location_get_point(this_, point);
 
     if (!trpoint)
         return NULL;
 
-    traffic_location_set_enclosing_rect(this_, NULL);
+    if (!trpoint->junction_ref && !trpoint->junction_name) {
+        /* nothing to compare, score is 0 for every item */
+        return NULL;
+    }
 
-    rg->h = mapset_open(ms);
+    sel = traffic_graph_cache_get_location(cache, this_);
 
-    while ((rg->m = mapset_next(rg->h, 2))) {
-        /* Skip traffic map (identified by the `attr_traffic` attribute) */
-        if (map_get_attr(rg->m, attr_traffic, &attr, NULL))
-            continue;
-        if (!traffic_location_open_map_rect(this_, rg))
+    for (i = 0; i < cache->point_count; i++) {
+        gpoint = &cache->points[i];
+        if (!coord_rect_contains(&sel->u.c_rect, &gpoint->c))
             continue;
-        while ((item = map_rect_get_item(rg->mr))) {
-            /* exclude non-point items */
-            if ((item->type < type_town_label) || (item->type >= type_line))
-                continue;
 
-            /* exclude items from which we can't obtain a coordinate pair */
-            if (!item_coord_get(item, &c, 1))
-                continue;
-
-            /* exclude items not in the route graph (points with turn restrictions are ignored) */
-            p = route_graph_get_point(rg, &c);
-            while (p && (p->flags & RP_TURN_RESTRICTION))
-                p = route_graph_get_point_next(rg, &c, p);
-            if (!p)
-                continue;
+        /* exclude items not in the route graph (points with turn restrictions are ignored) */
+        p = route_graph_get_point(rg, &gpoint->c);
+        while (p && (p->flags & RP_TURN_RESTRICTION))
+            p = route_graph_get_point_next(rg, &gpoint->c, p);
+        if (!p)
+            continue;
 
-            /* determine score */
-            score = traffic_point_match_attributes(trpoint, item);
+        /* determine score */
+        score = traffic_point_match_attributes(trpoint, gpoint);
 
-            /* exclude items with a zero score */
-            if (!score)
-                continue;
+        /* exclude items with a zero score */
+        if (!score)
+            continue;
 
-            dbg(lvl_debug, "adding item, score: %d", score);
+        dbg(lvl_debug, "adding item, score: %d", score);
 
-            do {
-                if (!(p->flags & RP_TURN_RESTRICTION)) {
-                    data = g_new0(struct point_data, 1);
-                    data->score = score;
-                    data->p = p;
+        do {
+            if (!(p->flags & RP_TURN_RESTRICTION)) {
+                data = g_new0(struct point_data, 1);
+                data->score = score;
+                data->p = p;
 
-                    ret = g_list_append(ret, data);
-                }
-            } while ((p = route_graph_get_point_next(rg, &c, p)));
-        }
-        map_selection_destroy(rg->sel);
-        rg->sel = NULL;
-        map_rect_destroy(rg->mr);
-        rg->mr = NULL;
+                ret = g_list_append(ret, data);
+            }
+        } while ((p = route_graph_get_point_next(rg, &gpoint->c, p)));
     }
-    route_graph_build_done(rg, 1);
+    map_selection_destroy(sel);
 
     return ret;
 }
@@ -2848,23 +3312,55 @@ static int traffic_get_item_delay(int delay, int item_len, int len) {
 }
 
 /**
- * @brief Generates segments affected by a traffic message.
+ * @brief Appends an empty segment to the result of matching a location.
+ *
+ * @param this_ The result
+ *
+ * @return The new segment
+ */
+static struct traffic_resolved_segment * traffic_resolution_add(struct traffic_resolution * this_) {
+    if (this_->count == this_->size) {
+        this_->size = this_->size ? this_->size * 2 : 16;
+        this_->segments = g_renew(struct traffic_resolved_segment, this_->segments, this_->size);
+    }
+    memset(&this_->segments[this_->count], 0, sizeof(struct traffic_resolved_segment));
+    return &this_->segments[this_->count++];
+}
+
+/**
+ * @brief Frees the data held by the result of matching a location.
+ *
+ * @param this_ The result, which is empty afterwards
+ */
+static void traffic_resolution_free(struct traffic_resolution * this_) {
+    int i;
+
+    for (i = 0; i < this_->count; i++)
+        g_free(this_->segments[i].c);
+    g_free(this_->segments);
+    memset(this_, 0, sizeof(*this_));
+}
+
+/**
+ * @brief Matches a traffic location to map segments.
  *
  * This translates the approximate coordinates in the `from`, `at`, `to`, `via` and `not_via` members of
  * the location to one or more map segments, using both the raw coordinates and the auxiliary information
- * contained in the location. Each segment is stored in the map, if not already present, and a link is
- * stored with the message.
+ * contained in the location.
  *
- * @param this_ The traffic message
- * @param ms The mapset to use for matching
+ * All map data is taken from `cache`, which must already hold the rectangle of the location. Neither the
+ * map nor the location is modified, thus this function can run on a resolver thread while other locations
+ * are matched against the same cache.
+ *
+ * @param this_ The traffic location, whose enclosing rectangle must have been set
+ * @param cache The traffic graph cache for the batch the location belongs to
  * @param data Data for the segments added to the map
- * @param map The traffic map
- * @param route The route affected by the changes
+ * @param res Receives the matched segments, in the order in which they are to be added to the message
  *
  * @return `true` if the locations were matched successfully, `false` if there was a failure.
  */
-static int traffic_message_add_segments(struct traffic_message * this_, struct mapset * ms, struct seg_data * data,
-                                        struct map *map, struct route * route) {
+static int traffic_location_resolve(struct traffic_location * this_, struct traffic_graph_cache * cache,
+                                    struct seg_data * data, struct traffic_resolution * res) {
     int i;
 
     struct coord_geo * coords[] = {NULL, NULL, NULL};
@@ -2895,35 +3391,14 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
     /* Coordinate count for matched segment */
     int ccnt;
 
-    /* Coordinates of matched segment and pointer into it, order as read from map */
-    struct coord *c, ca[2048];
-
-    /* Coordinates of matched segment, sorted */
-    struct coord *cd, *cs;
-
-    /* Speed for the current segment */
-    int speed;
-
-    /* Delay for the current segment */
-    int delay;
-
-    /* Number of new segments and existing segments */
-    int count = 0, prev_count;
+    /* Coordinates of matched segment, order as read from map */
+    struct coord ca[2048];
 
     /* Length of location */
     int len;
 
-    /* The message's previous list of items */
-    struct item ** prev_items;
-
-    /* The next item in the message's list of items */
-    struct item ** next_item;
-
-    /* Flags for the next item to add */
-    int flags;
-
-    /* The last item added */
-    struct item * item;
+    /* The segment being added to the result */
+    struct traffic_resolved_segment * rseg;
 
     /* Projected coordinates of start and end points of the actual location
      * (if at is set, both point to the same coordinates) */
@@ -2958,7 +3433,7 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
         return 0;
     }
 
-    if (this_->location->ramps != location_ramps_none)
+    if (this_->ramps != location_ramps_none)
         /* TODO Ramps, not supported yet */
         return 0;
 
@@ -2966,12 +3441,12 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
 
     dbg(lvl_debug, "*****checkpoint ADD-2");
     /* get point triple and enclosing rectangle */
-    endpoints = traffic_location_get_point_triple(this_->location, &coords[0]);
+    endpoints = traffic_location_get_point_triple(this_, &coords[0]);
     if (!endpoints) {
         dbg(lvl_error, "invalid location (mandatory points missing)");
         return 0;
     }
-    traffic_location_set_enclosing_rect(this_->location, &coords[0]);
+    traffic_location_set_enclosing_rect(this_, &coords[0]);
     for (i = 0; i < 3; i++)
         if (coords[i]) {
             pcoords[i] = g_new0(struct coord, 1);
@@ -2979,12 +3454,12 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
             point_pairs++;
         }
 
-    if (this_->location->at && !(this_->location->from || this_->location->to))
+    if (this_->at && !(this_->from || this_->to))
         /* TODO Point location with no auxiliary points, not supported yet */
         return 0;
 
     dbg(lvl_debug, "*****checkpoint ADD-3");
-    rg = traffic_location_get_route_graph(this_->location, ms);
+    rg = traffic_location_get_route_graph(this_, cache);
 
     /* transform coordinates */
     c_from = (endpoints & 4) ? pcoords[0] : pcoords[1];
@@ -3022,8 +3497,8 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
                 p_start = traffic_route_flood_graph(rg, data, pcoords[0], pcoords[1], NULL);
             else
                 p_start = traffic_route_flood_graph(rg, data, pcoords[2], pcoords[1], NULL);
-            if ((this_->location->fuzziness == location_fuzziness_low_res)
-                    || this_->location->at || this_->location->not_via) {
+            if ((this_->fuzziness == location_fuzziness_low_res)
+                    || this_->at || this_->not_via) {
                 /* extend start to next junction */
                 start_new = traffic_route_prepend(rg, p_start);
                 if (start_new)
@@ -3049,16 +3524,16 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
 
         dbg(lvl_debug, "*****checkpoint ADD-4.2");
         /* tweak ends (find the point where the ramp touches the main road) */
-        if ((this_->location->fuzziness == location_fuzziness_low_res)
-                || this_->location->at || this_->location->not_via) {
+        if ((this_->fuzziness == location_fuzziness_low_res)
+                || this_->at || this_->not_via) {
             dbg(lvl_debug, "*****checkpoint ADD-4.2.1");
             /* tweak end point */
-            if (this_->location->at)
-                points = traffic_location_get_matching_points(this_->location, 1, rg, p_start, 0, ms);
+            if (this_->at)
+                points = traffic_location_get_matching_points(this_, 1, rg, p_start, 0, cache);
             else if (dir > 0)
-                points = traffic_location_get_matching_points(this_->location, 2, rg, p_start, 0, ms);
+                points = traffic_location_get_matching_points(this_, 2, rg, p_start, 0, cache);
             else
-                points = traffic_location_get_matching_points(this_->location, 0, rg, p_start, 0, ms);
+                points = traffic_location_get_matching_points(this_, 0, rg, p_start, 0, cache);
             if (!p_start) {
                 dbg(lvl_error, "end point not found on map");
                 for (points_iter = points; points_iter; points_iter = g_list_next(points_iter))
@@ -3100,9 +3575,9 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
                 dbg(lvl_debug, "*****checkpoint ADD-4.2.3, p_iter=%p (value=%d)\nhttps://www.openstreetmap.org?mlat=%f&mlon=%f/#map=13",
                     p_iter, p_iter->value, wgs.lat, wgs.lng);
                 if (route_graph_point_is_endpoint_candidate(p_iter, s_prev)) {
-                    score = traffic_location_get_point_match(this_->location, p_iter,
-                            this_->location->at ? 1 : (dir > 0) ? 2 : 0,
-                            rg, p_start, 0, ms);
+                    score = traffic_location_get_point_match(this_, p_iter,
+                            this_->at ? 1 : (dir > 0) ? 2 : 0,
+                            rg, p_start, 0, cache);
                     pd = NULL;
                     for (points_iter = points; points_iter && (score < 100); points_iter = g_list_next(points_iter)) {
                         pd = (struct point_data *) points_iter->data;
@@ -3134,12 +3609,12 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
 
             dbg(lvl_debug, "*****checkpoint ADD-4.2.5");
             /* tweak start point */
-            if (this_->location->at)
-                points = traffic_location_get_matching_points(this_->location, 1, rg, p_start, 1, ms);
+            if (this_->at)
+                points = traffic_location_get_matching_points(this_, 1, rg, p_start, 1, cache);
             else if (dir > 0)
-                points = traffic_location_get_matching_points(this_->location, 0, rg, p_start, 1, ms);
+                points = traffic_location_get_matching_points(this_, 0, rg, p_start, 1, cache);
             else
-                points = traffic_location_get_matching_points(this_->location, 2, rg, p_start, 1, ms);
+                points = traffic_location_get_matching_points(this_, 2, rg, p_start, 1, cache);
             s_prev = NULL;
             minval = INT_MAX;
             p_from = NULL;
@@ -3162,9 +3637,9 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
                 dbg(lvl_debug, "*****checkpoint ADD-4.2.7, p_iter=%p (value=%d)\nhttps://www.openstreetmap.org?mlat=%f&mlon=%f/#map=13",
                     p_iter, p_iter->value, wgs.lat, wgs.lng);
                 if (route_graph_point_is_endpoint_candidate(p_iter, s_prev)) {
-                    score = traffic_location_get_point_match(this_->location, p_iter,
-                            this_->location->at ? 1 : (dir > 0) ? 0 : 2,
-                            rg, p_start, 1, ms);
+                    score = traffic_location_get_point_match(this_, p_iter,
+                            this_->at ? 1 : (dir > 0) ? 0 : 2,
+                            rg, p_start, 1, cache);
                     pd = NULL;
                     for (points_iter = points; points_iter && (score < 100); points_iter = g_list_next(points_iter)) {
                         pd = (struct point_data *) points_iter->data;
@@ -3264,14 +3739,13 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
             dbg(lvl_error, "no segments");
 
         /* count segments and calculate length */
-        prev_count = count;
-        count = 0;
+        i = 0;
         len = 0;
         dbg(lvl_debug, "*****checkpoint ADD-4.4");
         while (s) {
             dbg(lvl_debug, "*****checkpoint ADD-4.4.1 (#%d, p_iter=%p, s=%p, next %p)",
-                count, p_iter, s, (s->start == p_iter) ? s->end : s->start);
-            count++;
+                i, p_iter, s, (s->start == p_iter) ? s->end : s->start);
+            i++;
             len += s->data.len;
             if (s->start == p_iter)
                 p_iter = s->end;
@@ -3286,61 +3760,41 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
         s = p_start ? p_start->seg : NULL;
         p_iter = p_start;
 
-        if (this_->priv->items) {
-            prev_items = this_->priv->items;
-            this_->priv->items = g_new0(struct item *, count + prev_count + 1);
-            memcpy(this_->priv->items, prev_items, sizeof(struct item *) * prev_count);
-            next_item = this_->priv->items + prev_count;
-            g_free(prev_items);
-        } else {
-            this_->priv->items = g_new0(struct item *, count + 1);
-            next_item = this_->priv->items;
-        }
-
         dbg(lvl_debug, "*****checkpoint ADD-4.6 (loop start)");
         while (s) {
-            ccnt = item_coord_get_within_range(&s->data.item, ca, 2047, &s->start->c, &s->end->c);
-            c = ca;
-            cs = g_new0(struct coord, ccnt);
-            cd = cs;
-
-            speed = traffic_get_item_speed(&(s->data.item), data,
-                                           (s->data.flags & AF_SPEED_LIMIT) ? RSD_MAXSPEED(&s->data) : INT_MAX);
+            rseg = traffic_resolution_add(res);
+            rseg->item = s->data.item;
+            rseg->start = s->start->c;
+            rseg->end = s->end->c;
+            ccnt = traffic_graph_cache_get_coords(cache, &s->data.item, ca, 2047, &s->start->c, &s->end->c);
+            if (ccnt >= 0) {
+                rseg->c = g_new0(struct coord, ccnt);
+                memcpy(rseg->c, ca, ccnt * sizeof(struct coord));
+                rseg->ccnt = ccnt;
+            }
 
-            delay = traffic_get_item_delay(data->delay, s->data.len, len);
+            rseg->speed = traffic_get_item_speed(&(s->data.item), data,
+                                                 (s->data.flags & AF_SPEED_LIMIT) ? RSD_MAXSPEED(&s->data) : INT_MAX);
 
-            for (i = 0; i < ccnt; i++) {
-                *cd++ = *c++;
-            }
+            rseg->delay = traffic_get_item_delay(data->delay, s->data.len, len);
 
             if (s->start == p_iter) {
                 /* forward direction */
                 p_iter = s->end;
-                flags = data->flags | (s->data.flags & AF_ONEWAYMASK)
-                        | (data->dir == location_dir_one ? AF_ONEWAY : 0);
+                rseg->flags = data->flags | (s->data.flags & AF_ONEWAYMASK)
+                              | (data->dir == location_dir_one ? AF_ONEWAY : 0);
             } else {
                 /* backward direction */
                 p_iter = s->start;
-                flags = data->flags | (s->data.flags & AF_ONEWAYMASK)
-                        | (data->dir == location_dir_one ? AF_ONEWAYREV : 0);
+                rseg->flags = data->flags | (s->data.flags & AF_ONEWAYMASK)
+                              | (data->dir == location_dir_one ? AF_ONEWAYREV : 0);
             }
 
-
-            item = tm_add_item(map, type_traffic_distortion, s->data.item.id_hi, s->data.item.id_lo, flags, data->attrs, cs, ccnt,
-                               this_->id);
-
-            tm_item_add_message_data(item, this_->id, speed, delay, data->attrs, route);
-
-            g_free(cs);
-
-            *next_item = tm_item_ref(item);
-            next_item++;
-
             s = p_iter->seg;
         }
 
         dbg(lvl_debug, "*****checkpoint ADD-4.7");
-        if ((this_->location->directionality == location_dir_one) || (dir < 0))
+        if ((this_->directionality == location_dir_one) || (dir < 0))
             break;
 
         dir = -1;
@@ -3358,6 +3812,98 @@ static int traffic_message_add_segments(struct traffic_message * this_, struct m
     return 1;
 }
 
+/**
+ * @brief Adds the segments to which the location of a traffic message was matched to the traffic map.
+ *
+ * Each segment is stored in the map, if not already present, and a link is stored with the message.
+ * This must run on the main thread.
+ *
+ * @param this_ The traffic message
+ * @param res The segments, as returned by `traffic_location_resolve()`
+ * @param data Data for the segments added to the map
+ * @param map The traffic map
+ * @param route The route affected by the changes
+ */
+static void traffic_message_add_resolution(struct traffic_message * this_, struct traffic_resolution * res,
+        struct seg_data * data, struct map *map, struct route * route) {
+    /* Number of existing segments */
+    int prev_count = 0;
+
+    /* The message's previous list of items */
+    struct item ** prev_items;
+
+    /* The next item in the message's list of items */
+    struct item ** next_item;
+
+    /* The segment being added */
+    struct traffic_resolved_segment * rseg;
+
+    /* Coordinates of a segment not held in the graph cache */
+    struct coord ca[2048];
+
+    /* The last item added */
+    struct item * item;
+
+    int i;
+
+    if (!res->count)
+        return;
+
+    if (this_->priv->items) {
+        prev_items = this_->priv->items;
+        while (prev_items[prev_count])
+            prev_count++;
+        this_->priv->items = g_new0(struct item *, res->count + prev_count + 1);
+        memcpy(this_->priv->items, prev_items, sizeof(struct item *) * prev_count);
+        g_free(prev_items);
+    } else
+        this_->priv->items = g_new0(struct item *, res->count + 1);
+    next_item = this_->priv->items + prev_count;
+
+    for (i = 0; i < res->count; i++) {
+        rseg = &res->segments[i];
+        if (!rseg->c) {
+            rseg->ccnt = item_coord_get_within_range(&rseg->item, ca, 2047, &rseg->start, &rseg->end);
+            rseg->c = g_new0(struct coord, rseg->ccnt);
+            memcpy(rseg->c, ca, rseg->ccnt * sizeof(struct coord));
+        }
+
+        item = tm_add_item(map, type_traffic_distortion, rseg->item.id_hi, rseg->item.id_lo, rseg->flags, data->attrs,
+                           rseg->c, rseg->ccnt, this_->id);
+
+        tm_item_add_message_data(item, this_->id, rseg->speed, rseg->delay, data->attrs, route);
+
+        *next_item = tm_item_ref(item);
+        next_item++;
+    }
+}
+
+/**
+ * @brief Generates segments affected by a traffic message.
+ *
+ * This matches the location of the message to the map, stores each segment in the map, if not already
+ * present, and stores a link with the message.
+ *
+ * @param this_ The traffic message
+ * @param cache The traffic graph cache for the batch the message belongs to
+ * @param data Data for the segments added to the map
+ * @param map The traffic map
+ * @param route The route affected by the changes
+ *
+ * @return `true` if the locations were matched successfully, `false` if there was a failure.
+ */
+static int traffic_message_add_segments(struct traffic_message * this_, struct traffic_graph_cache * cache,
+                                        struct seg_data * data, struct map *map, struct route * route) {
+    struct traffic_resolution res;
+    int ret;
+
+    memset(&res, 0, sizeof(res));
+    ret = traffic_location_resolve(this_->location, cache, data, &res);
+    traffic_message_add_resolution(this_, &res, data, map, route);
+    traffic_resolution_free(&res);
+    return ret;
+}
+
 /**
  * @brief Restores segments associated with a traffic message from cached data.
  *
@@ -4133,6 +4679,241 @@ static void traffic_message_remove_item_data(struct traffic_message * old, struc
     }
 }
 
+/**
+ * @brief Main function of a resolver thread.
+ *
+ * @param data The thread
+ *
+ * @return Always 0
+ */
+static int traffic_resolver_main(void * data) {
+    struct traffic_resolver_thread * thread = data;
+    struct traffic_resolver * this_ = thread->resolver;
+    struct traffic_resolver_job * job;
+    int notify;
+
+    for (;;) {
+        thread_lock_acquire(this_->lock);
+        job = this_->jobs ? (struct traffic_resolver_job *) this_->jobs->data : NULL;
+        if (job)
+            this_->jobs = g_list_remove(this_->jobs, job);
+        else
+            thread->running = 0;
+        thread_lock_release(this_->lock);
+        if (!job)
+            break;
+        job->ret = traffic_location_resolve(job->message->location, job->cache, job->data, &job->res);
+        thread_lock_acquire(this_->lock);
+        this_->done = g_list_append(this_->done, job);
+        notify = !this_->notified;
+        this_->notified = 1;
+        thread_lock_release(this_->lock);
+        if (notify)
+            event_call_callback(this_->cbl);
+    }
+    return 0;
+}
+
+/**
+ * @brief Waits for all resolver threads to exit.
+ *
+ * Threads only exit when no jobs are left, thus all jobs queued so far have been matched when this returns.
+ *
+ * @param this_ The resolver
+ */
+static void traffic_resolver_join(struct traffic_resolver * this_) {
+    int i;
+
+    for (i = 0; i < this_->thread_count; i++)
+        if (this_->threads[i].thread) {
+            thread_join(this_->threads[i].thread);
+            this_->threads[i].thread = NULL;
+        }
+}
+
+/**
+ * @brief Applies finished resolver jobs to the traffic map.
+ *
+ * Segments are added to the traffic map and the route is updated. Messages which were removed while their job
+ * was running are destroyed. Unless `wait` is set, this stops after `TIME_SLICE` milliseconds and schedules
+ * itself on the main loop for the remaining jobs.
+ *
+ * @param shared The shared traffic data
+ * @param wait If true, wait for all queued jobs to be matched and apply all of them
+ */
+static void traffic_resolver_apply(struct traffic_shared_priv * shared, int wait) {
+    struct traffic_resolver * this_ = shared->resolver;
+    struct traffic_resolver_job * job;
+    struct timeval start;
+    int updated = 0, more = 0, notify;
+
+    if (wait)
+        traffic_resolver_join(this_);
+    gettimeofday(&start, NULL);
+    thread_lock_acquire(this_->lock);
+    this_->notified = 0;
+    thread_lock_release(this_->lock);
+    for (;;) {
+        if (!wait && (traffic_graph_cache_msec(&start) >= TIME_SLICE)) {
+            more = 1;
+            break;
+        }
+        thread_lock_acquire(this_->lock);
+        job = this_->done ? (struct traffic_resolver_job *) this_->done->data : NULL;
+        if (job)
+            this_->done = g_list_remove(this_->done, job);
+        thread_lock_release(this_->lock);
+        if (!job)
+            break;
+        if (job->discard)
+            traffic_message_destroy(job->message);
+        else {
+            job->message->priv->job = NULL;
+            if (!job->ret)
+                dbg(lvl_debug, "message %s could not be matched", job->message->id);
+            traffic_message_add_resolution(job->message, &job->res, job->data, shared->map, shared->rt);
+            updated |= job->res.count;
+        }
+        if (!--job->cache->jobs && job->cache->retired)
+            traffic_graph_cache_destroy(job->cache);
+        traffic_resolution_free(&job->res);
+        g_free(job->data);
+        g_free(job);
+        this_->pending--;
+        this_->matched++;
+    }
+
+    if (more) {
+        thread_lock_acquire(this_->lock);
+        notify = this_->done && !this_->notified;
+        if (notify)
+            this_->notified = 1;
+        thread_lock_release(this_->lock);
+        if (notify)
+            event_call_callback(this_->cbl);
+    }
+
+    if (updated) {
+        /* TODO see comment on route_recalculate_partial about thread-safety */
+        route_recalculate_partial(shared->rt);
+        if (navit_get_ready(this_->navit) == 3)
+            navit_draw_async(this_->navit, 1);
+    }
+
+    if (!this_->pending && this_->matched) {
+        traffic_resolver_join(this_);
+        dbg(lvl_info, "%d location(s) matched on up to %d thread(s) in %.0f ms", this_->matched, this_->thread_count,
+            traffic_graph_cache_msec(&this_->start));
+        this_->matched = 0;
+        traffic_dump_messages_to_xml(shared);
+    }
+}
+
+/**
+ * @brief Creates a resolver for traffic locations.
+ *
+ * @param shared The shared traffic data, which the resolver is used for
+ * @param navit The navit instance
+ * @param threads The maximum number of threads to use
+ *
+ * @return The resolver
+ */
+static struct traffic_resolver * traffic_resolver_new(struct traffic_shared_priv * shared, struct navit * navit,
+        int threads) {
+    struct traffic_resolver * ret = g_new0(struct traffic_resolver, 1);
+    int i;
+
+    ret->navit = navit;
+    ret->lock = thread_lock_new();
+    ret->thread_count = threads;
+    ret->threads = g_new0(struct traffic_resolver_thread, threads);
+    for (i = 0; i < threads; i++)
+        ret->threads[i].resolver = ret;
+    ret->cbl = callback_list_new();
+    callback_list_add(ret->cbl, callback_new_2(callback_cast(traffic_resolver_apply), shared, 0));
+    return ret;
+}
+
+/**
+ * @brief Queues a traffic message for matching its location on a resolver thread.
+ *
+ * The location is matched against the graph cache of the message queue, which is read on this thread if it does
+ * not yet cover the location. If jobs are still using the cache at that point, it is retired and a new one is
+ * started, as threads may be reading the old one.
+ *
+ * @param shared The shared traffic data
+ * @param message The message
+ * @param data Data for the segments, owned by the job from now on
+ * @param sel The selection of the route, locations of queued messages overlapping with it are registered with a
+ * new cache
+ */
+static void traffic_resolver_add(struct traffic_shared_priv * shared, struct traffic_message * message,
+                                 struct seg_data * data, struct map_selection * sel) {
+    struct traffic_resolver * this_ = shared->resolver;
+    struct traffic_resolver_job * job;
+    struct map_selection * loc_sel;
+    int i, running = 0;
+
+    traffic_location_set_enclosing_rect(message->location, NULL);
+    loc_sel = traffic_location_get_rect(message->location, traffic_map_meth.pro);
+    if (shared->graph_cache->jobs && !traffic_graph_cache_covers(shared->graph_cache->loaded, loc_sel)) {
+        traffic_graph_cache_retire(shared->graph_cache);
+        shared->graph_cache = traffic_graph_cache_new(shared->ms);
+        traffic_graph_cache_add_messages(shared->graph_cache, shared->message_queue, sel);
+    }
+    map_selection_destroy(loc_sel);
+    map_selection_destroy(traffic_graph_cache_get_location(shared->graph_cache, message->location));
+
+    job = g_new0(struct traffic_resolver_job, 1);
+    job->message = message;
+    job->data = data;
+    job->cache = shared->graph_cache;
+    job->cache->jobs++;
+    message->priv->job = job;
+    if (!this_->pending++)
+        gettimeofday(&this_->start, NULL);
+
+    thread_lock_acquire(this_->lock);
+    this_->jobs = g_list_append(this_->jobs, job);
+    for (i = 0; i < this_->thread_count; i++) {
+        if (!this_->threads[i].running) {
+            /* a thread which is no longer running may not have exited yet, but it does not need the lock */
+            if (this_->threads[i].thread)
+                thread_join(this_->threads[i].thread);
+            this_->threads[i].running = 1;
+            this_->threads[i].thread = thread_new(traffic_resolver_main, &this_->threads[i], "traffic_resolver");
+            this_->threads[i].running = (this_->threads[i].thread != NULL);
+            running |= this_->threads[i].running;
+            break;
+        }
+        running = 1;
+    }
+    thread_lock_release(this_->lock);
+
+    if (!running) {
+        /* no thread could be started, match on this thread and apply the result from the main loop */
+        this_->threads[0].running = 1;
+        traffic_resolver_main(&this_->threads[0]);
+    }
+}
+
+/**
+ * @brief Releases a message which is to be removed from the message store.
+ *
+ * @param message The message
+ *
+ * @return True if the message was destroyed, false if its resolver job is still running, in which case the message
+ * is destroyed once the job has been applied
+ */
+static int traffic_resolver_release(struct traffic_message * message) {
+    if (message->priv->job) {
+        message->priv->job->discard = 1;
+        return 0;
+    }
+    traffic_message_destroy(message);
+    return 1;
+}
+
 /**
  * @brief Ensures the traffic instance points to valid shared data.
  *
@@ -4403,7 +5184,8 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
                 /* check if any of the replaced messages has the same location and segment data */
                 for (msg_iter = msgs_to_remove; msg_iter && !swap_candidate; msg_iter = g_list_next(msg_iter)) {
                     stored_msg = (struct traffic_message *) msg_iter->data;
-                    if (seg_data_equals(data, traffic_message_parse_events(stored_msg))
+                    /* a message whose location is still being matched cannot give away its location */
+                    if (!stored_msg->priv->job && seg_data_equals(data, traffic_message_parse_events(stored_msg))
                             && traffic_location_equals(message->location, stored_msg->location))
                         swap_candidate = stored_msg;
                 }
@@ -4444,9 +5226,22 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
                                  * is deferred until a rectangle overlapping with the location is queried.
                                  */
                                 if (!message->priv->items) {
-                                    /* TODO do this in an idle loop, not here */
-                                    traffic_message_add_segments(message, this_->shared->ms, data,
-                                                                 this_->shared->map, this_->shared->rt);
+                                    /*
+                                     * The graph cache is kept until the queue has been processed. When it is
+                                     * created, register all queued locations which may need matching, so the
+                                     * map is read only once for all of them.
+                                     */
+                                    if (!this_->shared->graph_cache) {
+                                        this_->shared->graph_cache = traffic_graph_cache_new(this_->shared->ms);
+                                        traffic_graph_cache_add_messages(this_->shared->graph_cache,
+                                                                         this_->shared->message_queue, rt_ms);
+                                    }
+                                    if (this_->shared->resolver) {
+                                        traffic_resolver_add(this_->shared, message, data, rt_ms);
+                                        data = NULL;
+                                    } else
+                                        traffic_message_add_segments(message, this_->shared->graph_cache,
+                                                                     data, this_->shared->map, this_->shared->rt);
                                     break;
                                     map_selection_destroy(loc_ms);
                                     map_selection_destroy(rt_ms);
@@ -4472,7 +5267,7 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
                         ret |= MESSAGE_UPDATE_SEGMENTS;
                     this_->shared->messages = g_list_remove_all(this_->shared->messages, stored_msg);
                     traffic_message_remove_item_data(stored_msg, message, this_->shared->rt);
-                    traffic_message_destroy(stored_msg);
+                    traffic_resolver_release(stored_msg);
                 }
 
                 g_list_free(msgs_to_remove);
@@ -4500,7 +5295,12 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
             navit_draw_async(this_->navit, 1);
         return ret;
     } else {
-        /* last pass, remove our idle event and callback */
+        /* last pass, drop the graph cache for this batch (resolver jobs may still be using it) */
+        if (this_->shared->graph_cache) {
+            traffic_graph_cache_retire(this_->shared->graph_cache);
+            this_->shared->graph_cache = NULL;
+        }
+        /* remove our idle event and callback */
         if (this_->idle_ev)
             event_remove_idle(this_->idle_ev);
         if (this_->idle_cb)
@@ -4524,7 +5324,7 @@ static int traffic_process_messages_int(struct traffic * this_, int flags) {
                     ret |= MESSAGE_UPDATE_SEGMENTS;
                 this_->shared->messages = g_list_remove_all(this_->shared->messages, stored_msg);
                 traffic_message_remove_item_data(stored_msg, NULL, this_->shared->rt);
-                traffic_message_destroy(stored_msg);
+                traffic_resolver_release(stored_msg);
             }
 
             dbg(lvl_debug, "%d message(s) expired", g_list_length(msgs_to_remove));
@@ -4636,6 +5436,15 @@ static struct traffic * traffic_new(struct attr *parent, struct attr **attrs) {
     if (!this_->shared)
         traffic_set_shared(this_);
 
+    /* match locations on worker threads if requested by any traffic instance, results are applied on the main loop
+     * through event_call_callback(), without it locations are matched synchronously */
+    attr = attr_search(attrs, NULL, attr_match_threads);
+    if (attr && (attr->u.num > 0) && !this_->shared->resolver && thread_supported()
+            && event_call_callback_supported()) {
+        this_->shared->resolver = traffic_resolver_new(this_->shared, this_->navit, attr->u.num);
+        dbg(lvl_debug, "matching locations on up to %ld thread(s)", attr->u.num);
+    }
+
     return this_;
 }
 
@@ -5897,15 +6706,24 @@ struct traffic_message ** traffic_get_stored_messages(struct traffic *this_) {
     /* Attributes for traffic distortions generated from the current traffic message */
     struct seg_data * data;
 
+    /* Route graph data for all messages */
+    struct traffic_graph_cache * cache;
+
     /* Ensure all locations are fully resolved */
+    if (this_->shared->resolver)
+        traffic_resolver_apply(this_->shared, 1);
+    cache = traffic_graph_cache_new(this_->shared->ms);
+    traffic_graph_cache_add_messages(cache, this_->shared->messages, NULL);
     for (msgiter = this_->shared->messages; msgiter; msgiter = g_list_next(msgiter)) {
         message = (struct traffic_message *) msgiter->data;
         if (message->priv->items == NULL) {
             data = traffic_message_parse_events(message);
-            traffic_message_add_segments(message, this_->shared->ms, data, this_->shared->map, this_->shared->rt);
+            traffic_message_add_segments(message, cache, data, this_->shared->map,
+                                         this_->shared->rt);
             g_free(data);
         }
     }
+    traffic_graph_cache_destroy(cache);
     while (in) {
         *out = (struct traffic_message *) in->data;
         in = g_list_next(in);
@@ -5931,6 +6749,10 @@ void traffic_process_messages(struct traffic * this_, struct traffic_message **
 }
 
 void traffic_set_mapset(struct traffic *this_, struct mapset *ms) {
+    if (this_->shared->graph_cache && this_->shared->ms != ms) {
+        traffic_graph_cache_retire(this_->shared->graph_cache);
+        this_->shared->graph_cache = NULL;
+    }
     this_->shared->ms = ms;
 }
 
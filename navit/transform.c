@@ -321,16 +321,166 @@ void transform_from_geo(enum projection pro, const struct coord_geo *g, struct c
     }
 }
 
-void transform_from_to_count(struct coord *cfrom, enum projection from, struct coord *cto, enum projection to,
-                             int count) {
-    struct coord_geo g;
+/**
+ * @brief A Taylor series of a projection function around an anchor point
+ *
+ * Converting the latitude between Mercator and WGS84 needs a logarithm and a tangent or an exponential
+ * and an arc tangent. Coordinates that are converted together are mostly close to each other, so the
+ * batch functions expand the function around the first coordinate, and use that series as long as the
+ * following coordinates stay within `lo` and `hi`, where it is accurate to far below a coordinate unit.
+ * A coordinate outside this range becomes the new anchor.
+ */
+struct transform_series {
+    double x0;                          /**< The anchor */
+    double lo, hi;                      /**< The range in which the series is accurate enough */
+    double c[5];                        /**< The coefficients of the series in `x-x0` */
+};
+
+/** Radius of the series for the Mercator y coordinate, 0.01 radians or about 64 km at the equator */
+#define TRANSFORM_SERIES_MG 63710.0
+/** Radius of the series for the latitude in radians, divided by the secant of the latitude */
+#define TRANSFORM_SERIES_LAT 0.004
+
+/**
+ * @brief Expands the latitude in radians as a function of the Mercator y coordinate around `y`
+ *
+ * This is the Gudermannian function of `y/6371000`, its derivatives are expressed using its first
+ * derivative sech and tanh.
+ */
+static void transform_series_mg_to_lat(struct transform_series *s, double y) {
+    double r=6371000.0;
+    double e=exp(y/r), sum=e+1/e;
+    double sch=2/sum, th=(e-1/e)/sum;
+
+    s->x0=y;
+    s->lo=y-TRANSFORM_SERIES_MG;
+    s->hi=y+TRANSFORM_SERIES_MG;
+    s->c[0]=2*atan(e)-M_PI_2;
+    s->c[1]=sch*(1/r);
+    s->c[2]=-sch*th*(1/(2*r*r));
+    s->c[3]=sch*(th*th-sch*sch)*(1/(6*r*r*r));
+    s->c[4]=sch*th*(5*sch*sch-th*th)*(1/(24*r*r*r*r));
+}
+
+/**
+ * @brief Expands the Mercator y coordinate as a function of the latitude in radians around `lat`
+ *
+ * This is the inverse Gudermannian function, its derivatives are expressed using its first derivative
+ * sec and tan, which follow from the same tangent as the value. The derivatives grow towards the poles,
+ * so the range shrinks with the cosine of the latitude.
+ */
+static void transform_series_lat_to_mg(struct transform_series *s, double lat) {
+    double r=6371000.0;
+    double t=navit_tan(M_PI_4+lat/2);
+    double sc=(t+1/t)/2, tn=(t-1/t)/2;
+    double radius=TRANSFORM_SERIES_LAT/sc;
+
+    s->x0=lat;
+    s->lo=lat-radius;
+    s->hi=lat+radius;
+    s->c[0]=log(t)*r;
+    s->c[1]=sc*r;
+    s->c[2]=sc*tn*(r/2);
+    s->c[3]=sc*(tn*tn+sc*sc)*(r/6);
+    s->c[4]=sc*tn*(tn*tn+5*sc*sc)*(r/24);
+}
+
+static inline double transform_series_eval(struct transform_series *s, double x,
+        void (*expand)(struct transform_series *s, double x)) {
+    double d;
+    if (!(x >= s->lo && x <= s->hi))
+        expand(s, x);
+    d=x-s->x0;
+    return s->c[0]+d*(s->c[1]+d*(s->c[2]+d*(s->c[3]+d*s->c[4])));
+}
+
+/**
+ * @brief Transforms an array of coordinates to geographical (lat, long) coordinates
+ *
+ * This gives the same results as calling transform_to_geo() for every coordinate, apart from rounding
+ * errors far below a coordinate unit, but avoids the transcendental functions for most of the
+ * coordinates in the Mercator projection.
+ *
+ * @param pro The projection of `c`
+ * @param c The coordinates
+ * @param g Receives the geographical coordinates
+ * @param count Number of coordinates
+ */
+void transform_to_geo_count(enum projection pro, const struct coord *c, struct coord_geo *g, int count) {
+    struct transform_series s= {0, 1, 0};
+    int i;
+
+    if (pro != projection_mg) {
+        for (i = 0 ; i < count ; i++)
+            transform_to_geo(pro, c+i, g+i);
+        return;
+    }
+    for (i = 0 ; i < count ; i++) {
+        g[i].lng=c[i].x/6371000.0/M_PI*180;
+        g[i].lat=transform_series_eval(&s, c[i].y, transform_series_mg_to_lat)/M_PI*180;
+    }
+}
+
+/**
+ * @brief Transforms an array of geographical (lat, long) coordinates to coordinates in the given projection
+ *
+ * This is the batch version of transform_from_geo(), see transform_to_geo_count(). As the results are
+ * truncated to integers, a coordinate may differ by one unit from the one transform_from_geo() returns.
+ *
+ * @param pro The projection to transform to
+ * @param g The geographical coordinates
+ * @param c Receives the coordinates
+ * @param count Number of coordinates
+ */
+void transform_from_geo_count(enum projection pro, const struct coord_geo *g, struct coord *c, int count) {
+    struct transform_series s= {0, 1, 0};
     int i;
 
+    if (pro != projection_mg) {
+        for (i = 0 ; i < count ; i++)
+            transform_from_geo(pro, g+i, c+i);
+        return;
+    }
     for (i = 0 ; i < count ; i++) {
-        transform_to_geo(from, cfrom, &g);
-        transform_from_geo(to, &g, cto);
-        cfrom++;
-        cto++;
+        c[i].x=g[i].lng*6371000.0*M_PI/180;
+        c[i].y=transform_series_eval(&s, g[i].lat*M_PI/180, transform_series_lat_to_mg);
+    }
+}
+
+/** Number of coordinates transform_from_to_count() converts through geographical coordinates at a time */
+#define TRANSFORM_COUNT_CHUNK 256
+
+/**
+ * @brief Transforms an array of coordinates from one projection to another
+ *
+ * The coordinates are converted to geographical coordinates with transform_to_geo_count() and from
+ * there with transform_from_geo_count(), in chunks of `TRANSFORM_COUNT_CHUNK`, so conversions from
+ * and to the Mercator projection use the series of these functions. `cfrom` and `cto` may be the same
+ * array.
+ *
+ * @param cfrom The coordinates to transform
+ * @param from The projection of `cfrom`
+ * @param cto Receives the transformed coordinates
+ * @param to The projection to transform to
+ * @param count Number of coordinates
+ */
+void transform_from_to_count(struct coord *cfrom, enum projection from, struct coord *cto, enum projection to,
+                             int count) {
+    struct coord_geo g[TRANSFORM_COUNT_CHUNK];
+    int n;
+
+    if (from == to) {
+        if (cfrom != cto)
+            memmove(cto, cfrom, count*sizeof(*cto));
+        return;
+    }
+    while (count > 0) {
+        n=count < TRANSFORM_COUNT_CHUNK ? count : TRANSFORM_COUNT_CHUNK;
+        transform_to_geo_count(from, cfrom, g, n);
+        transform_from_geo_count(to, g, cto, n);
+        cfrom+=n;
+        cto+=n;
+        count-=n;
     }
 }
 
@@ -448,19 +598,6 @@ void transform_utm_to_geo(const double UTMEasting, const double UTMNorthing, int
     geo->lng=Long;
 }
 
-static struct coord transform_correct_projection(struct transformation *t, enum projection required_projection,
-        struct coord c) {
-    struct coord result;
-    struct coord_geo g;
-    if (required_projection == t->pro) {
-        result=c;
-    } else {
-        transform_to_geo(required_projection, &c, &g);
-        transform_from_geo(t->pro, &g, &result);
-    }
-    return result;
-}
-
 static struct coord transform_shift_by_center_and_scale(struct transformation *t, struct coord c) {
     struct coord result;
     result.x = c.x - t->map_center.x;
@@ -487,6 +624,123 @@ static struct coord_3d transform_rotate(struct transformation *t, struct coord c
     return result;
 }
 
+/** Number of coordinates which transform() passes through the batch kernel at once */
+#define TRANSFORM_BATCH 64
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+
+static inline __m128i transform_mullo_128(__m128i a, __m128i b) {
+#ifdef __SSE4_1__
+    return _mm_mullo_epi32(a, b);
+#else
+    __m128i even=_mm_mul_epu32(a, b);
+    __m128i odd=_mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+#endif
+}
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief Shifts, scales and rotates a batch of coordinates
+ *
+ * This does the same as calling `transform_shift_by_center_and_scale()` and `transform_rotate()` for every
+ * coordinate, and gives bit-identical results. The coordinates are kept interleaved as x/y pairs, so a
+ * vector holds two (SSE2, NEON) or four (AVX2) of them, and the x and y results are computed together by
+ * multiplying the pairs and their swapped copies with the matching matrix elements.
+ *
+ * In 2D mode (`z` is NULL) the screen coordinates are returned in `xy`. In 3D mode `xy` and `z` receive the
+ * rotated coordinates, which still have to be clipped and projected onto the view plane.
+ *
+ * @param t The transformation
+ * @param in The coordinates, already in the projection of the transformation
+ * @param xy Receives the x and y results
+ * @param z Receives the z results, or NULL in 2D mode
+ * @param count Number of coordinates
+ */
+static void transform_batch(struct transformation *t, struct coord *in, struct point *xy, int *z, int count) {
+    int shift=t->scale_shift;
+    int hx=HOG(*t)*t->m02, hy=HOG(*t)*t->m12, hz=HOG(*t)*t->m22+(t->offz << POST_SHIFT);
+    int ox=z ? 0 : t->offx, oy=z ? 0 : t->offy;
+    int i=0;
+#if defined(__AVX2__)
+    __m256i center=_mm256_setr_epi32(t->map_center.x, t->map_center.y, t->map_center.x, t->map_center.y,
+                                     t->map_center.x, t->map_center.y, t->map_center.x, t->map_center.y);
+    __m256i mdiag=_mm256_setr_epi32(t->m00, t->m11, t->m00, t->m11, t->m00, t->m11, t->m00, t->m11);
+    __m256i mcross=_mm256_setr_epi32(t->m01, t->m10, t->m01, t->m10, t->m01, t->m10, t->m01, t->m10);
+    __m256i mz=_mm256_setr_epi32(t->m20, t->m21, t->m20, t->m21, t->m20, t->m21, t->m20, t->m21);
+    __m256i add=_mm256_setr_epi32(hx, hy, hx, hy, hx, hy, hx, hy);
+    __m256i off=_mm256_setr_epi32(ox, oy, ox, oy, ox, oy, ox, oy);
+    __m128i sh=_mm_cvtsi32_si128(shift), post=_mm_cvtsi32_si128(z ? 0 : POST_SHIFT);
+    for (; i+4 <= count ; i+=4) {
+        __m256i c=_mm256_sra_epi32(_mm256_sub_epi32(_mm256_loadu_si256((__m256i *)(in+i)), center), sh);
+        __m256i swapped=_mm256_shuffle_epi32(c, _MM_SHUFFLE(2,3,0,1));
+        __m256i r=_mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(c, mdiag), _mm256_mullo_epi32(swapped, mcross)), add);
+        _mm256_storeu_si256((__m256i *)(xy+i), _mm256_add_epi32(_mm256_sra_epi32(r, post), off));
+        if (z) {
+            __m256i p=_mm256_mullo_epi32(c, mz);
+            p=_mm256_add_epi32(p, _mm256_shuffle_epi32(p, _MM_SHUFFLE(2,3,0,1)));
+            z[i]=_mm256_extract_epi32(p, 0)+hz;
+            z[i+1]=_mm256_extract_epi32(p, 2)+hz;
+            z[i+2]=_mm256_extract_epi32(p, 4)+hz;
+            z[i+3]=_mm256_extract_epi32(p, 6)+hz;
+        }
+    }
+#elif defined(__SSE2__)
+    __m128i center=_mm_setr_epi32(t->map_center.x, t->map_center.y, t->map_center.x, t->map_center.y);
+    __m128i mdiag=_mm_setr_epi32(t->m00, t->m11, t->m00, t->m11);
+    __m128i mcross=_mm_setr_epi32(t->m01, t->m10, t->m01, t->m10);
+    __m128i mz=_mm_setr_epi32(t->m20, t->m21, t->m20, t->m21);
+    __m128i add=_mm_setr_epi32(hx, hy, hx, hy);
+    __m128i off=_mm_setr_epi32(ox, oy, ox, oy);
+    __m128i sh=_mm_cvtsi32_si128(shift), post=_mm_cvtsi32_si128(z ? 0 : POST_SHIFT);
+    for (; i+2 <= count ; i+=2) {
+        __m128i c=_mm_sra_epi32(_mm_sub_epi32(_mm_loadu_si128((__m128i *)(in+i)), center), sh);
+        __m128i swapped=_mm_shuffle_epi32(c, _MM_SHUFFLE(2,3,0,1));
+        __m128i r=_mm_add_epi32(_mm_add_epi32(transform_mullo_128(c, mdiag), transform_mullo_128(swapped, mcross)), add);
+        _mm_storeu_si128((__m128i *)(xy+i), _mm_add_epi32(_mm_sra_epi32(r, post), off));
+        if (z) {
+            __m128i p=transform_mullo_128(c, mz);
+            p=_mm_add_epi32(p, _mm_shuffle_epi32(p, _MM_SHUFFLE(2,3,0,1)));
+            z[i]=_mm_cvtsi128_si32(p)+hz;
+            z[i+1]=_mm_cvtsi128_si32(_mm_srli_si128(p, 8))+hz;
+        }
+    }
+#elif defined(__ARM_NEON)
+    int32x4_t center=vcombine_s32(vld1_s32((int32_t *)&t->map_center), vld1_s32((int32_t *)&t->map_center));
+    int32x4_t mdiag={t->m00, t->m11, t->m00, t->m11};
+    int32x4_t mcross={t->m01, t->m10, t->m01, t->m10};
+    int32x4_t mz={t->m20, t->m21, t->m20, t->m21};
+    int32x4_t add={hx, hy, hx, hy};
+    int32x4_t off={ox, oy, ox, oy};
+    int32x4_t sh=vdupq_n_s32(-shift), post=vdupq_n_s32(z ? 0 : -POST_SHIFT);
+    for (; i+2 <= count ; i+=2) {
+        int32x4_t c=vshlq_s32(vsubq_s32(vld1q_s32((int32_t *)(in+i)), center), sh);
+        int32x4_t r=vaddq_s32(vmlaq_s32(vmulq_s32(c, mdiag), vrev64q_s32(c), mcross), add);
+        vst1q_s32((int32_t *)(xy+i), vaddq_s32(vshlq_s32(r, post), off));
+        if (z) {
+            int32x4_t p=vmulq_s32(c, mz);
+            p=vaddq_s32(p, vrev64q_s32(p));
+            z[i]=vgetq_lane_s32(p, 0)+hz;
+            z[i+1]=vgetq_lane_s32(p, 2)+hz;
+        }
+    }
+#endif
+    for (; i < count ; i++) {
+        struct coord_3d r=transform_rotate(t, transform_shift_by_center_and_scale(t, in[i]));
+        if (z) {
+            xy[i].x=r.x;
+            xy[i].y=r.y;
+            z[i]=r.z;
+        } else {
+            xy[i].x=(r.x >> POST_SHIFT)+ox;
+            xy[i].y=(r.y >> POST_SHIFT)+oy;
+        }
+    }
+}
+
 static struct coord_3d transform_z_clip(struct coord_3d c, struct coord_3d c_old, int zlimit) {
     struct coord_3d result;
     float clip_factor = ((float)zlimit-c.z)/(c_old.z-c.z);
@@ -545,15 +799,63 @@ static struct z_clip_result transform_z_clip_if_necessary(struct coord_3d coord,
     return clip_result;
 }
 
+/**
+ * @brief Transforms coordinates to screen coordinates in 2D mode
+ *
+ * The coordinates are written to `result` in batches, and the points which are too close to their
+ * predecessor are then dropped in place, which is possible because no point is ever moved forward.
+ *
+ * @see transform()
+ */
+static int transform_flat(struct transformation *t, enum projection required_projection, struct coord *input,
+                          struct point *result, int count, int mindist, int width, int *width_result) {
+    struct coord projected[TRANSFORM_BATCH];
+    int i,n,result_idx=count,result_idx_last=0;
+
+    for (i=0; i < count; i+=n) {
+        struct coord *in=input+i;
+        n=MIN(count-i, TRANSFORM_BATCH);
+        if (required_projection != t->pro) {
+            transform_from_to_count(in, required_projection, projected, t->pro, n);
+            in=projected;
+        }
+        transform_batch(t, in, result+i, NULL, n);
+    }
+    if (mindist) {
+        result_idx=0;
+        for (i=0; i < count; i++) {
+            if (i != 0 && i != count-1 &&
+                    (input[i+1].x != input[0].x || input[i+1].y != input[0].y)) {
+                if (transform_points_too_close(result[i], result[result_idx_last], mindist)) {
+                    continue;
+                }
+            }
+            result[result_idx]=result[i];
+            result_idx_last=result_idx;
+            result_idx++;
+        }
+    }
+    if (width_result) {
+        for (i=0; i < result_idx; i++)
+            width_result[i]=width;
+    }
+    return result_idx;
+}
+
 int transform(struct transformation *t, enum projection required_projection, struct coord *input,
               struct point *result, int count, int mindist, int width, int *width_result) {
-    struct coord projected_coord, shifted_coord;
+    struct coord projected[TRANSFORM_BATCH];
+    struct point batch_xy[TRANSFORM_BATCH];
+    int batch_z[TRANSFORM_BATCH];
+    int batch_start=0, batch_end=0;
     struct coord_3d rotated_coord;
     struct point screen_point;
     int zlimit=t->znear;
     struct z_clip_result clip_result, clip_result_old= {{0,0}, -1, 0, 0};
-    int i,result_idx = 0,result_idx_last=0;
+    int i,j,result_idx = 0,result_idx_last=0;
     dbg(lvl_debug,"count=%d", count);
+    if (!t->ddd)
+        return transform_flat(t, required_projection, input, result, count, mindist, width, width_result);
     for (i=0; i < count; i++) {
         dbg(lvl_debug, "input coord %d: (%d, %d)", i, input[i].x, input[i].y);
 #if 0 /* doesn't work as wanted */
@@ -562,26 +864,32 @@ int transform(struct transformation *t, enum projection required_projection, str
             continue;
         }
 #endif
-        projected_coord = transform_correct_projection(t, required_projection, input[i]);
-        shifted_coord = transform_shift_by_center_and_scale(t, projected_coord);
-        rotated_coord = transform_rotate(t, shifted_coord);
-
-        if (t->ddd) {
-            clip_result=transform_z_clip_if_necessary(rotated_coord, zlimit, clip_result_old);
-            clip_result_old=clip_result;
-            if(clip_result.process_coord_again) {
-                i--;
-            } else if (clip_result.skip_coord) {
-                continue;
+        if (i >= batch_end) {
+            struct coord *in=input+i;
+            batch_start=i;
+            batch_end=MIN(count, i+TRANSFORM_BATCH);
+            if (required_projection != t->pro) {
+                transform_from_to_count(in, required_projection, projected, t->pro, batch_end-batch_start);
+                in=projected;
             }
+            transform_batch(t, in, batch_xy, batch_z, batch_end-batch_start);
+        }
+        j=i-batch_start;
+        rotated_coord.x=batch_xy[j].x;
+        rotated_coord.y=batch_xy[j].y;
+        rotated_coord.z=batch_z[j];
+
+        clip_result=transform_z_clip_if_necessary(rotated_coord, zlimit, clip_result_old);
+        clip_result_old=clip_result;
+        if(clip_result.process_coord_again) {
+            i--;
+        } else if (clip_result.skip_coord) {
+            continue;
+        }
 #if 0
-            clip_result.clipped_coord.z=2000000;
+        clip_result.clipped_coord.z=2000000;
 #endif
-            screen_point = transform_project_onto_view_plane(t, clip_result.clipped_coord);
-        } else {
-            screen_point.x = rotated_coord.x>>POST_SHIFT;
-            screen_point.y = rotated_coord.y>>POST_SHIFT;
-        }
+        screen_point = transform_project_onto_view_plane(t, clip_result.clipped_coord);
         screen_point.x+=t->offx;
         screen_point.y+=t->offy;
         dbg(lvl_debug,"result: (%d, %d)", screen_point.x, screen_point.y);
@@ -594,11 +902,8 @@ int transform(struct transformation *t, enum projection required_projection, str
         }
         result[result_idx]=screen_point;
         if (width_result) {
-            if (t->ddd) {
-                dbg(lvl_debug,"width %d * %d / %d",width,t->wscale,clip_result.clipped_coord.z);
-                width_result[result_idx]=width*t->wscale/clip_result.clipped_coord.z;
-            } else
-                width_result[result_idx]=width;
+            dbg(lvl_debug,"width %d * %d / %d",width,t->wscale,clip_result.clipped_coord.z);
+            width_result[result_idx]=width*t->wscale/clip_result.clipped_coord.z;
         }
         result_idx_last=result_idx;
         result_idx++;
@@ -0,0 +1,122 @@
+/*
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2008 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Compares transform_to_geo_count(), transform_from_geo_count() and transform_from_to_count() with
+ * the scalar conversions they replace.
+ *
+ * The batch functions only expand their series again when a coordinate leaves the range of the last
+ * expansion, so the coordinates are generated as random walks, like the points of a polyline. The
+ * program prints the largest deviation of each conversion and exits with 1 if one of them exceeds
+ * its bound:
+ *  - mg to geo: 1e-9 degrees (about 0.1 mm), far below the resolution of a coordinate unit,
+ *  - geo to mg and mg to garmin: 1 unit, as the results are truncated to integers, which may
+ *    round a value the series misses by a tiny fraction to the neighbouring integer.
+ *
+ * It is not part of the build. Compile it together with transform.c against a configured build tree,
+ * letting the linker drop the functions of transform.c that need the rest of navit:
+ *   cc -O2 -ffunction-sections -Wl,--gc-sections -I navit -I navit/support -I navit/support/glib \
+ *      -I build -I build/navit -I build/navit/support/glib navit/transformtest.c navit/transform.c -lm
+ * transformtest.out holds the output of a run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <glib.h>
+#include "config.h"
+#include "coord.h"
+#include "projection.h"
+#include "transform.h"
+
+#define WALKS 200
+#define POINTS 2000
+
+/* Bounds of the checks, see above */
+#define BOUND_GEO 1e-9
+#define BOUND_UNITS 1
+
+static unsigned int seed=1;
+
+static int rnd(int min, int max) {
+    seed=seed*1103515245+12345;
+    return min+(int)((seed >> 8) % (unsigned int)(max-min+1));
+}
+
+/* Fills c with a random walk in the Mercator projection, up to 85 degrees north and south */
+static void walk(struct coord *c, int count, int step) {
+    int i;
+
+    c[0].x=rnd(-20000000, 20000000);
+    c[0].y=rnd(-19000000, 19000000);
+    for (i = 1 ; i < count ; i++) {
+        c[i].x=c[i-1].x+rnd(-step, step);
+        c[i].y=c[i-1].y+rnd(-step, step);
+        if (c[i].y > 19000000 || c[i].y < -19000000)
+            c[i].y=c[i-1].y;
+    }
+}
+
+int main(void) {
+    static struct coord c[POINTS], cb[POINTS], cs;
+    static struct coord_geo g[POINTS], gs;
+    double err_geo=0, err;
+    int err_mg=0, err_gar=0, d, i, j, step;
+
+    for (j = 0 ; j < WALKS ; j++) {
+        step=j % 2 ? 100 : 20000;
+        walk(c, POINTS, step);
+
+        transform_to_geo_count(projection_mg, c, g, POINTS);
+        for (i = 0 ; i < POINTS ; i++) {
+            transform_to_geo(projection_mg, &c[i], &gs);
+            err=fabs(g[i].lat-gs.lat);
+            if (fabs(g[i].lng-gs.lng) > err)
+                err=fabs(g[i].lng-gs.lng);
+            if (err > err_geo)
+                err_geo=err;
+        }
+
+        transform_from_geo_count(projection_mg, g, cb, POINTS);
+        for (i = 0 ; i < POINTS ; i++) {
+            transform_from_geo(projection_mg, &g[i], &cs);
+            d=abs(cb[i].x-cs.x) > abs(cb[i].y-cs.y) ? abs(cb[i].x-cs.x) : abs(cb[i].y-cs.y);
+            if (d > err_mg)
+                err_mg=d;
+        }
+
+        transform_from_to_count(c, projection_mg, cb, projection_garmin, POINTS);
+        for (i = 0 ; i < POINTS ; i++) {
+            transform_from_to(&c[i], projection_mg, &cs, projection_garmin);
+            d=abs(cb[i].x-cs.x) > abs(cb[i].y-cs.y) ? abs(cb[i].x-cs.x) : abs(cb[i].y-cs.y);
+            if (d > err_gar)
+                err_gar=d;
+        }
+    }
+
+    printf("mg to geo: max error %g degrees (bound %g)\n", err_geo, BOUND_GEO);
+    printf("geo to mg: max error %d units (bound %d)\n", err_mg, BOUND_UNITS);
+    printf("mg to garmin: max error %d units (bound %d)\n", err_gar, BOUND_UNITS);
+    if (err_geo > BOUND_GEO || err_mg > BOUND_UNITS || err_gar > BOUND_UNITS) {
+        printf("FAILED\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
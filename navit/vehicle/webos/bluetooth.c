@@ -21,6 +21,16 @@ static void vehicle_webos_spp_init_read(struct vehicle_priv *priv, unsigned int
 
 /********************************************************************/
 
+/* Runs the callbacks on the main loop, or right away if the event system cannot do that */
+static void mlPDL_call_callback(struct callback_list *cbl) {
+    if (event_call_callback_supported())
+        event_call_callback(cbl);
+    else
+        callback_list_call_0(cbl);
+}
+
+/********************************************************************/
+
 static void mlPDL_ServiceCall_callback(struct callback_list *cbl, char *service,
                                        char *parameters/*, struct callback *fail_cb*/) {
     PDL_Err err;
@@ -48,7 +58,7 @@ static void mlPDL_ServiceCall(const char *service, const char *parameters/*, str
     callback_list_add(cbl, cb);
 
     dbg(lvl_debug,"event_call_callback(%p)",cbl);
-    event_call_callback(cbl);
+    mlPDL_call_callback(cbl);
 }
 
 /********************************************************************/
@@ -90,7 +100,7 @@ static void mlPDL_ServiceCallWithCallback(const char *service,
     callback_list_add(cbl, cb);
 
     dbg(lvl_debug,"event_call_callback(%p)",cbl);
-    event_call_callback(cbl);
+    mlPDL_call_callback(cbl);
 }
 
 /********************************************************************/
@@ -122,7 +132,7 @@ static void vehicle_webos_init_pdl_locationtracking(struct vehicle_priv *priv, i
 
     callback_list_add(cbl, cb);
 
-    event_call_callback(cbl);
+    mlPDL_call_callback(cbl);
 }
 
 /********************************************************************/
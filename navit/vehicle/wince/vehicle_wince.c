@@ -288,7 +288,8 @@ static DWORD WINAPI wince_reader_thread (LPVOID lParam) {
             waitcounter++;
             if ( waitcounter % 8 == 0 ) {
                 dbg(lvl_debug, "Remind them of the data");
-                event_call_callback(priv->priv_cbl);
+                if (event_call_callback_supported())
+                    event_call_callback(priv->priv_cbl);
             }
             if(waitcounter % 200 == 0) {
                 dbg(lvl_error,"Will main thread ever be ready for the GPS data? Already %d intervals gone.",waitcounter);
@@ -305,7 +306,8 @@ static DWORD WINAPI wince_reader_thread (LPVOID lParam) {
         priv->read_buffer_pos += bytes_read;
 
         if ( !priv->has_data ) {
-            event_call_callback(priv->priv_cbl);
+            if (event_call_callback_supported())
+                event_call_callback(priv->priv_cbl);
             priv->has_data = 1;
         }
 